@@ -0,0 +1,312 @@
+/*
+ * lexbench.c --
+ *
+ *	A benchmark for the lexers that runs without a window. The corpus
+ *	files are loaded into a B-tree that belongs to no widget, then the
+ *	lexing and folding functions of every lexer module are run over the
+ *	whole of it. The throughput and the memory allocated by each pass are
+ *	reported, so that changes to the lexers can be judged by numbers.
+ *
+ *	Usage: lexbench ?-lexer name? ?-repeat count? ?-load plugin?
+ *		file ?file ...?
+ *
+ *	-load adds the lexer of a plugin built like plugin/LexSample.c, so
+ *	the plugin loading path is exercised too.
+ *
+ * RCS: @(#) $Id$
+ */
+
+#include "tkText.h"
+#include "tkTextHighlight.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * The results of lexing or folding the corpus once.
+ */
+
+typedef struct PassResult {
+    double seconds;		/* Fastest run. */
+    unsigned long bytesAllocated;
+				/* Memory allocated by the first run. */
+    unsigned long numAllocs;	/* Number of allocations by the first run. */
+} PassResult;
+
+static unsigned long bytesAllocated = 0;
+static unsigned long numAllocs = 0;
+
+#ifdef LEXBENCH_WRAP_ALLOC
+/*
+ * The benchmark is linked with --wrap for the Tcl allocator, so every
+ * ckalloc() made by the text widget and the lexers comes through here.
+ * Memory allocated inside Tcl itself, such as the growth of a Tcl_DString,
+ * isn't counted.
+ */
+
+char *__real_Tcl_Alloc(unsigned int size);
+char *__real_Tcl_Realloc(char *ptr, unsigned int size);
+char *__real_Tcl_AttemptAlloc(unsigned int size);
+char *__real_Tcl_AttemptRealloc(char *ptr, unsigned int size);
+
+char *
+__wrap_Tcl_Alloc(
+    unsigned int size)
+{
+    bytesAllocated += size;
+    numAllocs++;
+    return __real_Tcl_Alloc(size);
+}
+
+char *
+__wrap_Tcl_Realloc(
+    char *ptr,
+    unsigned int size)
+{
+    bytesAllocated += size;
+    numAllocs++;
+    return __real_Tcl_Realloc(ptr, size);
+}
+
+char *
+__wrap_Tcl_AttemptAlloc(
+    unsigned int size)
+{
+    bytesAllocated += size;
+    numAllocs++;
+    return __real_Tcl_AttemptAlloc(size);
+}
+
+char *
+__wrap_Tcl_AttemptRealloc(
+    char *ptr,
+    unsigned int size)
+{
+    bytesAllocated += size;
+    numAllocs++;
+    return __real_Tcl_AttemptRealloc(ptr, size);
+}
+#endif /* LEXBENCH_WRAP_ALLOC */
+
+/*
+ * Append the contents of a file to the corpus, making sure it ends with a
+ * newline so that files don't run into each other.
+ */
+
+static int
+LoadFile(
+    Tcl_Interp *interp,
+    const char *fileName,
+    Tcl_DString *corpusPtr)
+{
+    Tcl_Channel chan;
+    Tcl_Obj *objPtr;
+    const char *s;
+    int length;
+
+    chan = Tcl_OpenFileChannel(interp, fileName, "r", 0);
+    if (chan == NULL)
+	return TCL_ERROR;
+    objPtr = Tcl_NewObj();
+    Tcl_IncrRefCount(objPtr);
+    if (Tcl_ReadChars(chan, objPtr, -1, 0) < 0) {
+	Tcl_AppendResult(interp, "error reading \"", fileName, "\": ",
+		Tcl_PosixError(interp), NULL);
+	Tcl_DecrRefCount(objPtr);
+	Tcl_Close(interp, chan);
+	return TCL_ERROR;
+    }
+    Tcl_Close(interp, chan);
+    s = Tcl_GetStringFromObj(objPtr, &length);
+    Tcl_DStringAppend(corpusPtr, s, length);
+    if (length > 0 && s[length - 1] != '\n')
+	Tcl_DStringAppend(corpusPtr, "\n", 1);
+    Tcl_DecrRefCount(objPtr);
+    return TCL_OK;
+}
+
+/*
+ * Run the lexing or folding function of the current lexer over every line
+ * of the document "repeat" times. Returns true if the lexing function was
+ * asked to fold while lexing and did.
+ */
+
+static bool
+RunPass(
+    TkSharedText *sharedPtr,
+    LexerFunction fnPass,
+    bool folding,
+    bool foldWhileLexing,
+    int repeat,
+    PassResult *resultPtr)
+{
+    LexerArgs args;
+    LexVars vars;
+    Tcl_Time start, end;
+    double seconds;
+    int i;
+
+    resultPtr->seconds = -1;
+    for (i = 0; i < repeat; i++) {
+	memset(&args, '\0', sizeof(LexerArgs));
+	args.lexer = sharedPtr->lexer;
+	args.sharedPtr = sharedPtr;
+	args.linesInDocument = BTREE_NUMLINES(sharedPtr->peers);
+	args.firstLine = 0;
+	args.lastLine = args.linesInDocument - 1;
+	args.folding = folding;
+	args.foldWhileLexing = foldWhileLexing;
+	args.vars = &vars;
+	LexVars_Init(&vars);
+
+	bytesAllocated = numAllocs = 0;
+	Tcl_GetTime(&start);
+	(*fnPass)(&args);
+	Tcl_GetTime(&end);
+	if (i == 0) {
+	    resultPtr->bytesAllocated = bytesAllocated;
+	    resultPtr->numAllocs = numAllocs;
+	}
+
+	LexVars_Free(&vars);
+
+	seconds = (end.sec - start.sec) + (end.usec - start.usec) / 1e6;
+	if (resultPtr->seconds < 0 || seconds < resultPtr->seconds)
+	    resultPtr->seconds = seconds;
+    }
+    return args.folded;
+}
+
+static void
+Report(
+    const char *lexerName,
+    const char *passName,
+    PassResult *resultPtr,
+    int numBytes,
+    int numLines)
+{
+    double seconds = resultPtr->seconds;
+
+    if (seconds <= 0)
+	seconds = 1e-6;
+    printf("%-10s %-5s %9.4f %9.2f %12.0f %12lu %9lu\n", lexerName, passName,
+	    resultPtr->seconds, numBytes / seconds / (1024 * 1024),
+	    numLines / seconds, resultPtr->bytesAllocated,
+	    resultPtr->numAllocs);
+}
+
+int
+main(
+    int argc,
+    char **argv)
+{
+    Tcl_Interp *interp;
+    Tcl_DString corpus;
+    TkSharedText shared;
+    TkText text;
+    TkTextIndex index;
+    LexerModule *lm;
+    Lexer *lexer;
+    PassResult result;
+    Tcl_Obj *pathPtr;
+    const char *lexerName = NULL;
+    int i, repeat = 1, numFiles = 0, numBytes, numLines;
+
+    Tcl_FindExecutable(argv[0]);
+    interp = Tcl_CreateInterp();
+
+    /*
+     * Tk calls Tcl through the stubs table, which Tk_Init() sets up before
+     * it looks for a display. Without a display it fails after that, which
+     * is fine since only the option tables of Tk are used.
+     */
+
+    (void) Tk_Init(interp);
+    Tcl_ResetResult(interp);
+
+    Tcl_DStringInit(&corpus);
+    for (i = 1; i < argc; i++) {
+	if (!strcmp(argv[i], "-lexer") && i + 1 < argc) {
+	    lexerName = argv[++i];
+	} else if (!strcmp(argv[i], "-load") && i + 1 < argc) {
+	    pathPtr = Tcl_NewStringObj(argv[++i], -1);
+	    Tcl_IncrRefCount(pathPtr);
+	    if (LexerModule_Load(interp, pathPtr) != TCL_OK) {
+		fprintf(stderr, "%s\n", Tcl_GetStringResult(interp));
+		return 1;
+	    }
+	    Tcl_DecrRefCount(pathPtr);
+	} else if (!strcmp(argv[i], "-repeat") && i + 1 < argc) {
+	    if (Tcl_GetInt(interp, argv[++i], &repeat) != TCL_OK ||
+		    repeat < 1) {
+		fprintf(stderr, "bad repeat count \"%s\"\n", argv[i]);
+		return 1;
+	    }
+	} else {
+	    if (LoadFile(interp, argv[i], &corpus) != TCL_OK) {
+		fprintf(stderr, "%s\n", Tcl_GetStringResult(interp));
+		return 1;
+	    }
+	    numFiles++;
+	}
+    }
+    if (numFiles == 0) {
+	fprintf(stderr,
+		"usage: %s ?-lexer name? ?-repeat count? ?-load plugin? "
+		"file ?file ...?\n",
+		argv[0]);
+	return 1;
+    }
+
+    /*
+     * The B-tree has no peers while the text is inserted, so nothing tries
+     * to update a display. The lexers need one to get at the B-tree, which
+     * is all the fake peer below is used for.
+     */
+
+    memset(&shared, '\0', sizeof(TkSharedText));
+    memset(&text, '\0', sizeof(TkText));
+    shared.tree = TkBTreeCreate(&shared);
+    TkTextMakeByteIndex(shared.tree, NULL, 0, 0, &index);
+    TkBTreeInsertChars(shared.tree, &index, Tcl_DStringValue(&corpus));
+    text.sharedTextPtr = &shared;
+    shared.peers = &text;
+
+    numBytes = Tcl_DStringLength(&corpus);
+    numLines = TkBTreeNumLines(shared.tree, NULL);
+    Tcl_DStringFree(&corpus);
+
+    printf("%d files, %d bytes, %d lines, best of %d\n\n", numFiles,
+	    numBytes, numLines, repeat);
+    printf("%-10s %-5s %9s %9s %12s %12s %9s\n", "lexer", "pass", "seconds",
+	    "MB/s", "lines/s", "bytes alloc", "allocs");
+
+    for (lm = LexerModule_Head(interp); lm != NULL; lm = lm->next) {
+	if (lexerName != NULL && strcmp(lexerName, lm->name))
+	    continue;
+	lexer = Lexer_NewInstance(interp, NULL, lm);
+	if (lexer == NULL) {
+	    fprintf(stderr, "%s\n", Tcl_GetStringResult(interp));
+	    return 1;
+	}
+	shared.lexer = lexer;
+
+	RunPass(&shared, lm->fnLexer, false, false, repeat, &result);
+	Report(lm->name, "lex", &result, numBytes, numLines);
+	if (lm->fnFolder != NULL) {
+	    RunPass(&shared, lm->fnFolder, true, false, repeat, &result);
+	    Report(lm->name, "fold", &result, numBytes, numLines);
+
+	    /* Lexers that can fold while lexing do both in one pass. */
+	    if (RunPass(&shared, lm->fnLexer, false, true, repeat, &result))
+		Report(lm->name, "both", &result, numBytes, numLines);
+	}
+
+	shared.lexer = NULL;
+	Lexer_FreeInstance(NULL, lexer);
+    }
+
+    shared.peers = NULL;
+    TkBTreeDestroy(shared.tree);
+    Tcl_DeleteInterp(interp);
+    return 0;
+}
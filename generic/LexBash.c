@@ -117,7 +117,7 @@ static bool isBashOperator(char ch) {
     return false;
 }
 
-static int getBashNumberBase(void) {
+static int getBashNumberBase(LexVars *vars) {
     char s[11];
     int len = GetCurrent(s, sizeof(s)) - 1; /* only want to charIndex - 1 */
     int i, base = 0;
@@ -165,8 +165,25 @@ static void QuoteCls_Open(struct QuoteCls *q, char u) {
     q->Down  = opposite(q->Up);
 }
 
+/*
+ * Keep the delimiter of a here document with each line inside it, so that
+ * lexing a line in the middle of one needn't back up to the line with the
+ * "<<". The first byte is true for "<<-".
+ */
+
+static void SaveHereDoc(LexVars *vars, bool indent, const char *delimiter,
+    int length)
+{
+    char buf[HERE_DELIM_MAX + 1];
+
+    buf[0] = indent;
+    memcpy(buf + 1, delimiter, length);
+    SetStateExt(buf, length + 1);
+}
+
 static int ColouriseBashDoc(LexerArgs *args)
 {
+    LexVars *vars = args->vars;
     /* Lexer for bash often has to backtrack to start of current style to determine
      * which characters are being used as quotes, how deeply nested is the
      * start position and what the termination string is for here documents */
@@ -186,6 +203,8 @@ static int ColouriseBashDoc(LexerArgs *args)
 
     int numBase = 0;
     char chNext2;
+    const char *stateExt;
+    int stateExtSize;
 
     memset(&HereDoc, '\0', sizeof(HereDoc));
     QuoteCls_New(&Quote, 1);
@@ -195,20 +214,29 @@ static int ColouriseBashDoc(LexerArgs *args)
     /* If in a long distance lexical state, seek to the beginning to find quote characters
      * Bash strings can be multi-line with embedded newlines, so backtrack.
      * Bash numbers have additional state during lexing, so backtrack too. */
-    if (vars.style == SCE_SH_HERE_Q) {
-	while (!AtStartOfDoc() && (vars.style != SCE_SH_HERE_DELIM)) {
-	    Back();
+    if (vars->style == SCE_SH_HERE_Q) {
+	stateExt = PrevLineStateExt(&stateExtSize);
+	if (stateExt != NULL && stateExtSize <= HERE_DELIM_MAX) {
+	    HereDoc.State = 2;
+	    HereDoc.Indent = stateExt[0];
+	    HereDoc.DelimiterLength = stateExtSize - 1;
+	    memcpy(HereDoc.Delimiter, stateExt + 1, HereDoc.DelimiterLength);
+	    HereDoc.Delimiter[HereDoc.DelimiterLength] = '\0';
+	} else {
+	    while (!AtStartOfDoc() && (vars->style != SCE_SH_HERE_DELIM)) {
+		Back();
+	    }
+	    ToLineStart();
 	}
-	ToLineStart();
     }
-    if (vars.style == SCE_SH_STRING
-     || vars.style == SCE_SH_BACKTICKS
-     || vars.style == SCE_SH_CHARACTER
-     || vars.style == SCE_SH_NUMBER
-     || vars.style == SCE_SH_IDENTIFIER
-     || vars.style == SCE_SH_COMMENTLINE
+    if (vars->style == SCE_SH_STRING
+     || vars->style == SCE_SH_BACKTICKS
+     || vars->style == SCE_SH_CHARACTER
+     || vars->style == SCE_SH_NUMBER
+     || vars->style == SCE_SH_IDENTIFIER
+     || vars->style == SCE_SH_COMMENTLINE
     ) {
-	while (!AtStartOfDoc() && (vars.stylePrev == vars.style)) {
+	while (!AtStartOfDoc() && (vars->stylePrev == vars->style)) {
 	    Back();
 	}
 	ChangeState(SCE_SH_DEFAULT);
@@ -218,7 +246,7 @@ static int ColouriseBashDoc(LexerArgs *args)
 	/* if the current character is not consumed due to the completion of an
 	 * earlier style, lexing can be restarted via a simple goto */
     restartLexer:
-	chNext2 = SafeGetCharAt(vars.charIndex + 2);
+	chNext2 = SafeGetCharAt(vars->charIndex + 2);
 #if 0 /* always false for UTF-8 */
 	if (styler.IsLeadByte(ch)) {
 	    chNext = styler.SafeGetCharAt(i + 2);
@@ -227,19 +255,19 @@ static int ColouriseBashDoc(LexerArgs *args)
 	    continue;
 	}
 #endif
-	if ((vars.chPrev == '\r' && vars.chCur == '\n')) {	/* skip on DOS/Windows */
+	if ((vars->chPrev == '\r' && vars->chCur == '\n')) {	/* skip on DOS/Windows */
 	    /* styler.ColourTo(i, state); */
 	    continue;
 	}
 
-	if (vars.atLineEnd) {
+	if (vars->atLineEnd) {
 	    if (HereDoc.State == 1) {
 		/* Begin of here-doc (the line after the here-doc delimiter):
 		 * Lexically, the here-doc starts from the next line after the >>, but the
 		 * first line of here-doc seem to follow the style of the last EOL sequence */
 		HereDoc.State = 2;
 		if (HereDoc.Quoted) {
-		    if (vars.style == SCE_SH_HERE_DELIM) {
+		    if (vars->style == SCE_SH_HERE_DELIM) {
 			/* Missing quote at end of string! We are stricter than bash.
 			 * Colour here-doc anyway while marking this bit as an error. */
 			ChangeState(SCE_SH_ERROR);
@@ -250,25 +278,31 @@ static int ColouriseBashDoc(LexerArgs *args)
 		    /* always switch */
 		    SetStyle(SCE_SH_HERE_Q);
 		}
+		SaveHereDoc(vars, HereDoc.Indent, HereDoc.Delimiter,
+			HereDoc.DelimiterLength);
 		continue;
 	    }
+	    if (HereDoc.State == 2) {
+		SaveHereDoc(vars, HereDoc.Indent, HereDoc.Delimiter,
+			HereDoc.DelimiterLength);
+	    }
 	}
 
 	/* Determine if the current style should terminate. */
-	if (vars.style == SCE_SH_WHITESPACE) {
-	    if (!IsASpaceOrTab(vars.chCur)) {
+	if (vars->style == SCE_SH_WHITESPACE) {
+	    if (!IsASpaceOrTab(vars->chCur)) {
 		SetStyle(SCE_SH_DEFAULT);
 	   }
-	} else if (vars.style == SCE_SH_OPERATOR) {
+	} else if (vars->style == SCE_SH_OPERATOR) {
 	    SetStyle(SCE_SH_DEFAULT);
-	} else if (vars.style == SCE_SH_NUMBER) {
-	    int digit = translateBashDigit(vars.chCur);
+	} else if (vars->style == SCE_SH_NUMBER) {
+	    int digit = translateBashDigit(vars->chCur);
 	    if (numBase == BASH_BASE_DECIMAL) {
-		if (vars.chCur == '#') {
-		    numBase = getBashNumberBase();
+		if (vars->chCur == '#') {
+		    numBase = getBashNumberBase(vars);
 		    if (numBase == BASH_BASE_ERROR)	/* take the rest as comment */
 			goto numAtEnd;
-		} else if (!isdigit(vars.chCur))
+		} else if (!isdigit(vars->chCur))
 		    goto numAtEnd;
 	    } else if (numBase == BASH_BASE_HEX) {
 		if ((digit < 16) || (digit >= 36 && digit <= 41)) {
@@ -307,8 +341,8 @@ static int ColouriseBashDoc(LexerArgs *args)
 		    SetStyle(SCE_SH_DEFAULT);
 		}
 	    }
-	} else if (vars.style == SCE_SH_IDENTIFIER) {
-	    if (!iswordchar(vars.chCur) && vars.chCur != '+' && vars.chCur != '-') {
+	} else if (vars->style == SCE_SH_IDENTIFIER) {
+	    if (!iswordchar(vars->chCur) && vars->chCur != '+' && vars->chCur != '-') {
 		char s[100];
 		int len = GetCurrent(s, sizeof(s));
 		int kw;
@@ -318,35 +352,35 @@ static int ColouriseBashDoc(LexerArgs *args)
 		}
 		SetStyle(SCE_SH_DEFAULT);
 	    }
-	} else if (vars.style == SCE_SH_COMMENTLINE) {
-	    if (vars.chCur == '\\' && isEOLChar(vars.chNext)) {
+	} else if (vars->style == SCE_SH_COMMENTLINE) {
+	    if (vars->chCur == '\\' && isEOLChar(vars->chNext)) {
 		/* comment continuation */
-		if (vars.chNext == '\r' && chNext2 == '\n') {
+		if (vars->chNext == '\r' && chNext2 == '\n') {
 		    ForwardN(2);
 		} else {
 		    Forward();
 		}
-	    } else if (isEOLChar(vars.chCur)) {
+	    } else if (isEOLChar(vars->chCur)) {
 		SetStyle(SCE_SH_DEFAULT);
 	    }
-	} else if (vars.style == SCE_SH_SCALAR) {	/* variable names */
-	    if (isEndVar(vars.chCur)) {
-		if (vars.charIndex == (vars.startIndex + 1)) {
+	} else if (vars->style == SCE_SH_SCALAR) {	/* variable names */
+	    if (isEndVar(vars->chCur)) {
+		if (vars->charIndex == (vars->startIndex + 1)) {
 		    /* Special variable: $(, $_ etc. */
 		    ForwardSetStyle(SCE_SH_DEFAULT);
 		} else {
 		    SetStyle(SCE_SH_DEFAULT);
 		}
 	    }
-	} else if (vars.style == SCE_SH_STRING
-		|| vars.style == SCE_SH_CHARACTER
-		|| vars.style == SCE_SH_BACKTICKS
-		|| vars.style == SCE_SH_PARAM) {
-	    if (!Quote.Down && !isspacechar(vars.chCur)) {
-		QuoteCls_Open(&Quote, vars.chCur);
-	    } else if (vars.chCur == '\\' && Quote.Up != '\\') {
+	} else if (vars->style == SCE_SH_STRING
+		|| vars->style == SCE_SH_CHARACTER
+		|| vars->style == SCE_SH_BACKTICKS
+		|| vars->style == SCE_SH_PARAM) {
+	    if (!Quote.Down && !isspacechar(vars->chCur)) {
+		QuoteCls_Open(&Quote, vars->chCur);
+	    } else if (vars->chCur == '\\' && Quote.Up != '\\') {
 		Forward();
-	    } else if (vars.chCur == Quote.Down) {
+	    } else if (vars->chCur == Quote.Down) {
 		Quote.Count--;
 		if (Quote.Count == 0) {
 		    Quote.Rep--;
@@ -357,10 +391,10 @@ static int ColouriseBashDoc(LexerArgs *args)
 			Quote.Count++;
 		    }
 		}
-	    } else if (vars.chCur == Quote.Up) {
+	    } else if (vars->chCur == Quote.Up) {
 		Quote.Count++;
 	    }
-	} else if (vars.style == SCE_SH_HERE_DELIM) {
+	} else if (vars->style == SCE_SH_HERE_DELIM) {
 	    /*
 	     * From Bash info:
 	     * ---------------
@@ -370,28 +404,28 @@ static int ColouriseBashDoc(LexerArgs *args)
 	     * */
 	    if (HereDoc.State == 0) { /* '<<' encountered */
 		HereDoc.State = 1;
-		HereDoc.Quote = vars.chNext;
+		HereDoc.Quote = vars->chNext;
 		HereDoc.Quoted = false;
 		HereDoc.DelimiterLength = 0;
 		HereDoc.Delimiter[HereDoc.DelimiterLength] = '\0';
-		if (vars.chNext == '\'' || vars.chNext == '\"') {	/* a quoted here-doc delimiter (' or ") */
+		if (vars->chNext == '\'' || vars->chNext == '\"') {	/* a quoted here-doc delimiter (' or ") */
 		    Forward();
 		    HereDoc.Quoted = true;
-		} else if (!HereDoc.Indent && vars.chNext == '-') {	/* <<- indent case */
+		} else if (!HereDoc.Indent && vars->chNext == '-') {	/* <<- indent case */
 		    HereDoc.Indent = true;
 		    HereDoc.State = 0;
-		} else if (isalpha(vars.chNext) || vars.chNext == '_' || vars.chNext == '\\'
-		    || vars.chNext == '-' || vars.chNext == '+' || vars.chNext == '!') {
+		} else if (isalpha(vars->chNext) || vars->chNext == '_' || vars->chNext == '\\'
+		    || vars->chNext == '-' || vars->chNext == '+' || vars->chNext == '!') {
 		    /* an unquoted here-doc delimiter, no special handling */
 		    /* TODO check what exactly bash considers part of the delim */
-		} else if (vars.chNext == '<') {	/* HERE string <<< */
+		} else if (vars->chNext == '<') {	/* HERE string <<< */
 		    Forward();
 		    SetStyle(SCE_SH_DEFAULT);
 		    HereDoc.State = 0;
-		} else if (isspacechar(vars.chNext)) {
+		} else if (isspacechar(vars->chNext)) {
 		    /* eat whitespace */
 		    HereDoc.State = 0;
-		} else if (isdigit(vars.chNext) || vars.chNext == '=' || vars.chNext == '$') {
+		} else if (isdigit(vars->chNext) || vars->chNext == '=' || vars->chNext == '$') {
 		    /* left shift << or <<= operator cases */
 		    ChangeState(SCE_SH_OPERATOR);
 		    SetStyle(SCE_SH_DEFAULT);
@@ -401,20 +435,20 @@ static int ColouriseBashDoc(LexerArgs *args)
 		}
 	    } else if (HereDoc.State == 1) { /* collect the delimiter */
 		if (HereDoc.Quoted) { /* a quoted here-doc delimiter */
-		    if (vars.chCur == HereDoc.Quote) { /* closing quote => end of delimiter */
+		    if (vars->chCur == HereDoc.Quote) { /* closing quote => end of delimiter */
 			SetStyle(SCE_SH_DEFAULT);
 		    } else {
-			if (vars.chCur == '\\' && vars.chNext == HereDoc.Quote) { /* escaped quote */
+			if (vars->chCur == '\\' && vars->chNext == HereDoc.Quote) { /* escaped quote */
 			    Forward();
 			}
-			HereDoc.Delimiter[HereDoc.DelimiterLength++] = vars.chCur;
+			HereDoc.Delimiter[HereDoc.DelimiterLength++] = vars->chCur;
 			HereDoc.Delimiter[HereDoc.DelimiterLength] = '\0';
 		    }
 		} else { /* an unquoted here-doc delimiter */
-		    if (isalnum(vars.chCur) || vars.chCur == '_' || vars.chCur == '-' || vars.chCur == '+' || vars.chCur == '!') {
-			HereDoc.Delimiter[HereDoc.DelimiterLength++] = vars.chCur;
+		    if (isalnum(vars->chCur) || vars->chCur == '_' || vars->chCur == '-' || vars->chCur == '+' || vars->chCur == '!') {
+			HereDoc.Delimiter[HereDoc.DelimiterLength++] = vars->chCur;
 			HereDoc.Delimiter[HereDoc.DelimiterLength] = '\0';
-		    } else if (vars.chCur == '\\') {
+		    } else if (vars->chCur == '\\') {
 			/* skip escape prefix */
 		    } else {
 			SetStyle(SCE_SH_DEFAULT);
@@ -429,11 +463,11 @@ static int ColouriseBashDoc(LexerArgs *args)
 	} else if (HereDoc.State == 2) {
 	    /* state == SCE_SH_HERE_Q */
 	    if (MatchStr(HereDoc.Delimiter)) {
-		if (!HereDoc.Indent && isEOLChar(vars.chPrev) /* vars.atLineStart */) {
+		if (!HereDoc.Indent && isEOLChar(vars->chPrev) /* vars->atLineStart */) {
 		endHereDoc:
 		    /* standard HERE delimiter */
 		    ForwardN(HereDoc.DelimiterLength);
-		    if (isEOLChar(vars.chCur)) {
+		    if (isEOLChar(vars->chCur)) {
 			SetStyle(SCE_SH_DEFAULT);
 			HereDoc.State = 0;
 			goto restartLexer;
@@ -442,9 +476,9 @@ static int ColouriseBashDoc(LexerArgs *args)
 		    /* indented HERE delimiter */
 		    while (!AtStartOfDoc()) {
 			Back();
-			if (isEOLChar(vars.chCur)) {
+			if (isEOLChar(vars->chCur)) {
 			    goto endHereDoc;
-			} else if (!isspacechar(vars.chCur)) {
+			} else if (!isspacechar(vars->chCur)) {
 			    break;	/* got leading non-whitespace */
 			}
 		    }
@@ -453,87 +487,87 @@ static int ColouriseBashDoc(LexerArgs *args)
 	}
 
 	/* Determine if a new state should be entered. */
-	if (vars.style == SCE_SH_DEFAULT) {
-	    if (IsASpaceOrTab(vars.chCur)) {
+	if (vars->style == SCE_SH_DEFAULT) {
+	    if (IsASpaceOrTab(vars->chCur)) {
 		SetStyle(SCE_SH_WHITESPACE);
-	    } else if (vars.chCur == '\\') {	/* escaped character */
+	    } else if (vars->chCur == '\\') {	/* escaped character */
 		ChangeState(SCE_SH_IDENTIFIER); /* styler.ColourTo(i, SCE_SH_IDENTIFIER);*/
-	    } else if (isdigit(vars.chCur)) {
+	    } else if (isdigit(vars->chCur)) {
 		SetStyle(SCE_SH_NUMBER);
 		numBase = BASH_BASE_DECIMAL;
-		if (vars.chCur == '0') {	/* hex,octal */
-		    if (vars.chNext == 'x' || vars.chNext == 'X') {
+		if (vars->chCur == '0') {	/* hex,octal */
+		    if (vars->chNext == 'x' || vars->chNext == 'X') {
 			numBase = BASH_BASE_HEX;
 			Forward();
-		    } else if (isdigit(vars.chNext)) {
+		    } else if (isdigit(vars->chNext)) {
 			numBase = BASH_BASE_OCTAL;
 		    }
 		}
-	    } else if (iswordstart(vars.chCur)) {
+	    } else if (iswordstart(vars->chCur)) {
 		SetStyle(SCE_SH_IDENTIFIER);
-	    } else if (vars.chCur == '#') {
+	    } else if (vars->chCur == '#') {
 		SetStyle(SCE_SH_COMMENTLINE);
-	    } else if (vars.chCur == '\"') {
+	    } else if (vars->chCur == '\"') {
 		SetStyle(SCE_SH_STRING);
 		QuoteCls_New(&Quote, 1);
-		QuoteCls_Open(&Quote, vars.chCur);
-	    } else if (vars.chCur == '\'') {
+		QuoteCls_Open(&Quote, vars->chCur);
+	    } else if (vars->chCur == '\'') {
 		SetStyle(SCE_SH_CHARACTER);
 		QuoteCls_New(&Quote, 1);
-		QuoteCls_Open(&Quote, vars.chCur);
-	    } else if (vars.chCur == '`') {
+		QuoteCls_Open(&Quote, vars->chCur);
+	    } else if (vars->chCur == '`') {
 		SetStyle(SCE_SH_BACKTICKS);
 		QuoteCls_New(&Quote, 1);
-		QuoteCls_Open(&Quote, vars.chCur);
-	    } else if (vars.chCur == '$') {
-		if (vars.chNext == '{') {
+		QuoteCls_Open(&Quote, vars->chCur);
+	    } else if (vars->chCur == '$') {
+		if (vars->chNext == '{') {
 		    SetStyle(SCE_SH_PARAM);
 		    goto startQuote;
-		} else if (vars.chNext == '\'') {
+		} else if (vars->chNext == '\'') {
 		    SetStyle(SCE_SH_CHARACTER);
 		    goto startQuote;
-		} else if (vars.chNext == '"') {
+		} else if (vars->chNext == '"') {
 		    SetStyle(SCE_SH_STRING);
 		    goto startQuote;
-		} else if (vars.chNext == '(' && chNext2 == '(') {
+		} else if (vars->chNext == '(' && chNext2 == '(') {
 		    ChangeState(SCE_SH_OPERATOR);
 		    SetStyle(SCE_SH_DEFAULT);
 		    goto skipChar;
-		} else if (vars.chNext == '(' || vars.chNext == '`') {
+		} else if (vars->chNext == '(' || vars->chNext == '`') {
 		    SetStyle(SCE_SH_BACKTICKS);
 		startQuote:
 		    QuoteCls_New(&Quote, 1);
-		    QuoteCls_Open(&Quote, vars.chNext);
+		    QuoteCls_Open(&Quote, vars->chNext);
 		    goto skipChar;
 		} else {
 		    SetStyle(SCE_SH_SCALAR);
 		skipChar:
 		    Forward();
 		}
-	    } else if (vars.chCur == '*') {
-		if (vars.chNext == '*') {	/* exponentiation */
+	    } else if (vars->chCur == '*') {
+		if (vars->chNext == '*') {	/* exponentiation */
 		    Forward();
 		}
 		SetStyle(SCE_SH_OPERATOR); /*styler.ColourTo(i, SCE_SH_OPERATOR);*/
 /*				ForwardSetStyle(SCE_SH_DEFAULT); */
-	    } else if (vars.chCur == '<' && vars.chNext == '<') {
+	    } else if (vars->chCur == '<' && vars->chNext == '<') {
 		SetStyle(SCE_SH_HERE_DELIM);
 		HereDoc.State = 0;
 		HereDoc.Indent = false;
-	    } else if (vars.chCur == '-'	/* file test operators */
-	               && isSingleCharOp(vars.chNext)
-	               && !isalnum((chNext2 = SafeGetCharAt(vars.charIndex+2)))) {
+	    } else if (vars->chCur == '-'	/* file test operators */
+	               && isSingleCharOp(vars->chNext)
+	               && !isalnum((chNext2 = SafeGetCharAt(vars->charIndex+2)))) {
 		ChangeState(SCE_SH_WORD1);
 		ForwardN(2);
 		SetStyle(SCE_SH_DEFAULT);
-	    } else if (isBashOperator(vars.chCur)) {
+	    } else if (isBashOperator(vars->chCur)) {
 		SetStyle(SCE_SH_OPERATOR);
 	    } else {
 		/* keep colouring defaults to make restart easier */
 /*				Flush(); */
 	    }
 	}
-	if (vars.style == SCE_SH_ERROR) {
+	if (vars->style == SCE_SH_ERROR) {
 	    break;
 	}
     }
@@ -541,18 +575,19 @@ static int ColouriseBashDoc(LexerArgs *args)
     return 0;
 }
 
-#define LINEPTR(n) BTREE_FINDLINE(vars.sharedPtr->peers, n)
+#define LINEPTR(n) FindLineAt(vars->sharedPtr, n)
 
-static bool IsCommentLine(int line) {
+static bool IsCommentLine(LexVars *vars, int line) {
     char ch;
     if (line < 0) return false;
-    if (line >= vars.linesInDocument) return false;
+    if (line >= vars->linesInDocument) return false;
     ch = GetFirstNonWSChar(LINEPTR(line));
     return (ch == '#');
 }
 
 static int FoldBashDoc(LexerArgs *args) {
     struct Lexer2 *lexer = (struct Lexer2 *) args->lexer;
+    LexVars *vars = args->vars;
     bool foldComment = lexer->foldComment;
     bool foldCompact = lexer->foldCompact;
     int visibleChars = 0;
@@ -561,24 +596,24 @@ static int FoldBashDoc(LexerArgs *args) {
 
     BeginStyling(args, args->firstLine, args->lastLine);
 
-    levelPrev = vars.linePtr->level & SC_FOLDLEVELNUMBERMASK;
+    levelPrev = vars->linePtr->level & SC_FOLDLEVELNUMBERMASK;
     levelCurrent = levelPrev;
 
     for ( ; More(); Forward()) {
-	bool atEOL = vars.atLineEnd;
+	bool atEOL = vars->atLineEnd;
 	/* Comment folding */
-	if (foldComment && atEOL && IsCommentLine(vars.lineIndex)) {
-	    if (!IsCommentLine(vars.lineIndex - 1)
-		&& IsCommentLine(vars.lineIndex + 1))
+	if (foldComment && atEOL && IsCommentLine(vars, vars->lineIndex)) {
+	    if (!IsCommentLine(vars, vars->lineIndex - 1)
+		&& IsCommentLine(vars, vars->lineIndex + 1))
 		levelCurrent++;
-	    else if (IsCommentLine(vars.lineIndex - 1)
-		     && !IsCommentLine(vars.lineIndex+1))
+	    else if (IsCommentLine(vars, vars->lineIndex - 1)
+		     && !IsCommentLine(vars, vars->lineIndex+1))
 		levelCurrent--;
 	}
-	if (vars.style == SCE_SH_OPERATOR) {
-	    if (vars.chCur == '{') {
+	if (vars->style == SCE_SH_OPERATOR) {
+	    if (vars->chCur == '{') {
 		levelCurrent++;
-	    } else if (vars.chCur == '}') {
+	    } else if (vars->chCur == '}') {
 		levelCurrent--;
 	    }
 	}
@@ -589,17 +624,17 @@ static int FoldBashDoc(LexerArgs *args) {
 		flags |= SC_FOLDLEVELWHITEFLAG;
 	    if ((levelCurrent > levelPrev) && (visibleChars > 0))
 		flags |= SC_FOLDLEVELHEADERFLAG;
-	    SetLineFoldLevel(vars.sharedPtr, vars.linePtr, depth, flags);
+	    SetLineFoldLevel(vars->sharedPtr, vars->linePtr, depth, flags);
 	    levelPrev = levelCurrent;
 	    visibleChars = 0;
 	}
-	if (!isspacechar(vars.chCur))
+	if (!isspacechar(vars->chCur))
 	    visibleChars++;
     }
     /* Fill in the real level of the next line, keeping the current flags as they will be filled in later */
-    if (vars.linePtr != NULL) {
-	int flagsNext = vars.linePtr->level & ~SC_FOLDLEVELNUMBERMASK;
-	SetLineFoldLevel(vars.sharedPtr, vars.linePtr, levelPrev, flagsNext);
+    if (vars->linePtr != NULL) {
+	int flagsNext = vars->linePtr->level & ~SC_FOLDLEVELNUMBERMASK;
+	SetLineFoldLevel(vars->sharedPtr, vars->linePtr, levelPrev, flagsNext);
     }
     return 0;
 }
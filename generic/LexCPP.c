@@ -106,27 +106,34 @@ static bool IsADoxygenChar(const int ch) {
 	    ch == '}' || ch == '[' || ch == ']');
 }
 
+static void FoldLineCPP(LexVars *vars);
+
 static int ColorizeCPP(LexerArgs *args)
 {
     struct Lexer2 *lexer = (struct Lexer2 *) args->lexer;
+    LexVars *vars = args->vars;
     bool stylingWithinPreprocessor = lexer->stylingWithinPreprocessor;
     int chPrevNonWhite = ' ';
     int visibleChars = 0;
     bool lastWordWasUUID = false;
 
     BeginStyling(args, args->firstLine, args->lastLine);
+    if (args->foldWhileLexing) {
+	vars->foldLineProc = FoldLineCPP;
+	args->folded = true;
+    }
 
     /* Do not leak onto next line */
-    if (vars.style == SCE_C_STRINGEOL)
-	vars.style = SCE_C_DEFAULT;
+    if (vars->style == SCE_C_STRINGEOL)
+	vars->style = SCE_C_DEFAULT;
 
     for ( ; More(); Forward() ) {
 
-	if (vars.atLineStart) {
+	if (vars->atLineStart) {
 
 	    /* Do not leak onto next line */
-	    if (vars.style == SCE_C_STRINGEOL)
-		vars.style = SCE_C_DEFAULT;
+	    if (vars->style == SCE_C_STRINGEOL)
+		vars->style = SCE_C_DEFAULT;
 
 	    /* Reset states to begining of colourise so no surprises 
 	     * if different sets of lines lexed. */
@@ -136,7 +143,7 @@ static int ColorizeCPP(LexerArgs *args)
 	}
 
 	/* Handle line continuation generically. */
-	if (vars.chCur == '\\') {
+	if (vars->chCur == '\\') {
 	    if (MatchStr("\\\n")) {
 		ForwardN(1);
 		continue;
@@ -148,18 +155,22 @@ static int ColorizeCPP(LexerArgs *args)
 	}
 
 	/* Determine if the current style should terminate. */
-	if (vars.style == SCE_C_WHITESPACE) {
-	    if (!IsASpaceOrTab(vars.chCur)) {
+	if (vars->style == SCE_C_WHITESPACE) {
+	    if (!IsASpaceOrTab(vars->chCur)) {
 		SetStyle(SCE_C_DEFAULT);
+	    } else {
+		SkipClass(CC_BLANK);
 	    }
-	} else if (vars.style == SCE_C_OPERATOR) {
+	} else if (vars->style == SCE_C_OPERATOR) {
 	    SetStyle(SCE_C_DEFAULT);
-	} else if (vars.style == SCE_C_NUMBER) {
-	    if (!IsAWordChar(vars.chCur)) {
+	} else if (vars->style == SCE_C_NUMBER) {
+	    if (!IsWordChar(vars->chCur)) {
 		SetStyle(SCE_C_DEFAULT);
+	    } else {
+		SkipClass(CC_WORD);
 	    }
-	} else if (vars.style == SCE_C_IDENTIFIER) {
-	    if (!IsAWordChar(vars.chCur) || (vars.chCur == '.')) {
+	} else if (vars->style == SCE_C_IDENTIFIER) {
+	    if (!IsWordChar(vars->chCur) || (vars->chCur == '.')) {
 		char s[100];
 		int len = GetCurrent(s, sizeof(s));
 		int kw;
@@ -176,108 +187,120 @@ static int ColorizeCPP(LexerArgs *args)
 #endif
 		}
 		SetStyle(SCE_C_DEFAULT);
+	    } else {
+		SkipClass(CC_WORDSTART);
 	    }
-	} else if (vars.style == SCE_C_PREPROCESSOR) {
+	} else if (vars->style == SCE_C_PREPROCESSOR) {
 	    if (stylingWithinPreprocessor) {
-		if (IsASpace(vars.chCur)) {
+		if (IsASpace(vars->chCur)) {
 		    SetStyle(SCE_C_DEFAULT);
 		}
 	    } else {
-		if (vars.atLineEnd) {
+		if (vars->atLineEnd) {
 		    SetStyle(SCE_C_DEFAULT);
 		}
 	    }
-	} else if (vars.style == SCE_C_COMMENT) {
+	} else if (vars->style == SCE_C_COMMENT) {
 	    if (MatchChCh('*', '/')) {
 		Forward();
 		ForwardSetStyle(SCE_C_DEFAULT);
+	    } else {
+		SkipTo("*\\");
 	    }
-	} else if (vars.style == SCE_C_COMMENTDOC) {
+	} else if (vars->style == SCE_C_COMMENTDOC) {
 	    if (MatchChCh('*', '/')) {
 		Forward();
 		ForwardSetStyle(SCE_C_DEFAULT);
-	    } else if (vars.chCur == '@' || vars.chCur == '\\') {
+	    } else if (vars->chCur == '@' || vars->chCur == '\\') {
 		SetStyle(SCE_C_COMMENTDOCKEYWORD);
+	    } else {
+		SkipTo("*@\\");
 	    }
-	} else if (vars.style == SCE_C_COMMENTLINE ||
-		vars.style == SCE_C_COMMENTLINEDOC) {
-	    if (vars.atLineEnd) {
+	} else if (vars->style == SCE_C_COMMENTLINE ||
+		vars->style == SCE_C_COMMENTLINEDOC) {
+	    if (vars->atLineEnd) {
 		SetStyle(SCE_C_DEFAULT);
+	    } else {
+		SkipTo("\\");
 	    }
-	} else if (vars.style == SCE_C_COMMENTDOCKEYWORD) {
+	} else if (vars->style == SCE_C_COMMENTDOCKEYWORD) {
 	    if (MatchChCh('*', '/')) {
 		ChangeState(SCE_C_COMMENTDOCKEYWORDERROR);
 		Forward();
 		ForwardSetStyle(SCE_C_DEFAULT);
-	    } else if (!IsADoxygenChar(vars.chCur)) {
+	    } else if (!IsADoxygenChar(vars->chCur)) {
 		char s[100];
 		int len = GetCurrent(s, sizeof(s));
-		if (!isspace(vars.chCur) || !InList(vars.wordListPtrs[3-1], s+1, len)) {
+		if (!isspace(vars->chCur) || !InList(vars->wordListPtrs[3-1], s+1, len)) {
 		    ChangeState(SCE_C_COMMENTDOCKEYWORDERROR);
 		}
 		SetStyle(SCE_C_COMMENTDOC);
 	    }
-	} else if (vars.style == SCE_C_STRING) {
-	    if (vars.chCur == '\\') {
-		if (vars.chNext == '\"' || vars.chNext == '\'' || vars.chNext == '\\') {
+	} else if (vars->style == SCE_C_STRING) {
+	    if (vars->chCur == '\\') {
+		if (vars->chNext == '\"' || vars->chNext == '\'' || vars->chNext == '\\') {
 		    Forward();
 		}
-	    } else if (vars.chCur == '\"') {
+	    } else if (vars->chCur == '\"') {
 		ForwardSetStyle(SCE_C_DEFAULT);
-	    } else if (vars.atLineEnd) {
+	    } else if (vars->atLineEnd) {
 		ChangeState(SCE_C_STRINGEOL);
+	    } else {
+		SkipTo("\\\"");
 	    }
-	} else if (vars.style == SCE_C_CHARACTER) {
-	    if (vars.atLineEnd) {
+	} else if (vars->style == SCE_C_CHARACTER) {
+	    if (vars->atLineEnd) {
 		ChangeState(SCE_C_STRINGEOL);
-	    } else if (vars.chCur == '\\') {
-		if (vars.chNext == '\"' || vars.chNext == '\'' || vars.chNext == '\\') {
+	    } else if (vars->chCur == '\\') {
+		if (vars->chNext == '\"' || vars->chNext == '\'' || vars->chNext == '\\') {
 		    Forward();
 		}
-	    } else if (vars.chCur == '\'') {
+	    } else if (vars->chCur == '\'') {
 		ForwardSetStyle(SCE_C_DEFAULT);
+	    } else {
+		SkipTo("\\'");
 	    }
-	} else if (vars.style == SCE_C_REGEX) {
-	    if (vars.chCur == '\r' || vars.chCur == '\n' || vars.chCur == '/') {
+	} else if (vars->style == SCE_C_REGEX) {
+	    if (vars->chCur == '\r' || vars->chCur == '\n' || vars->chCur == '/') {
 		ForwardSetStyle(SCE_C_DEFAULT);
-	    } else if (vars.chCur == '\\') {
+	    } else if (vars->chCur == '\\') {
 		/* Gobble up the quoted character */
-		if (vars.chNext == '\\' || vars.chNext == '/') {
+		if (vars->chNext == '\\' || vars->chNext == '/') {
 		    Forward();
 		}
 	    }
-	} else if (vars.style == SCE_C_VERBATIM) {
-	    if (vars.chCur == '\"') {
-		if (vars.chNext == '\"') {
+	} else if (vars->style == SCE_C_VERBATIM) {
+	    if (vars->chCur == '\"') {
+		if (vars->chNext == '\"') {
 		    Forward();
 		} else {
 		    ForwardSetStyle(SCE_C_DEFAULT);
 		}
 	    }
-	} else if (vars.style == SCE_C_UUID) {
-	    if (vars.chCur == '\r' || vars.chCur == '\n' || vars.chCur == ')') {
+	} else if (vars->style == SCE_C_UUID) {
+	    if (vars->chCur == '\r' || vars->chCur == '\n' || vars->chCur == ')') {
 		SetStyle(SCE_C_DEFAULT);
 	    }
 	}
 
-	if (vars.atLineEnd)
+	if (vars->atLineEnd)
 	    continue;
 
 	/* Determine if a new style should begin. */
-	if (vars.style == SCE_C_DEFAULT) {
-	    if (IsASpaceOrTab(vars.chCur)) {
+	if (vars->style == SCE_C_DEFAULT) {
+	    if (IsASpaceOrTab(vars->chCur)) {
 		SetStyle(SCE_C_WHITESPACE);
 	    } else if (MatchChCh('@', '\"')) {
 		SetStyle(SCE_C_VERBATIM);
 		Forward();
-	    } else if (IsADigit(vars.chCur) || (vars.chCur == '.' && IsADigit(vars.chNext))) {
+	    } else if (IsADigit(vars->chCur) || (vars->chCur == '.' && IsADigit(vars->chNext))) {
 		if (lastWordWasUUID) {
 		    SetStyle(SCE_C_UUID);
 		    lastWordWasUUID = false;
 		} else {
 		    SetStyle(SCE_C_NUMBER);
 		}
-	    } else if (IsAWordStart(vars.chCur) || (vars.chCur == '@')) {
+	    } else if (IsWordStart(vars->chCur) || (vars->chCur == '@')) {
 		if (lastWordWasUUID) {
 		    SetStyle(SCE_C_UUID);
 		    lastWordWasUUID = false;
@@ -297,29 +320,29 @@ static int ColorizeCPP(LexerArgs *args)
 		} else {
 		    SetStyle(SCE_C_COMMENTLINE);
 		}
-	    } else if (vars.chCur == '/' && IsOKBeforeRE(chPrevNonWhite)) {
+	    } else if (vars->chCur == '/' && IsOKBeforeRE(chPrevNonWhite)) {
 		SetStyle(SCE_C_REGEX);
-	    } else if (vars.chCur == '\"') {
+	    } else if (vars->chCur == '\"') {
 		SetStyle(SCE_C_STRING);
-	    } else if (vars.chCur == '\'') {
+	    } else if (vars->chCur == '\'') {
 		SetStyle(SCE_C_CHARACTER);
-	    } else if (vars.chCur == '#' && visibleChars == 0) {
+	    } else if (vars->chCur == '#' && visibleChars == 0) {
 		/* Preprocessor commands are alone on their line */
 		SetStyle(SCE_C_PREPROCESSOR);
 		/* Skip whitespace between # and preprocessor word */
 		do {
 		    Forward();
-		} while (IsASpaceOrTab(vars.chCur) && More());
-		if (vars.atLineEnd) {
+		} while (IsASpaceOrTab(vars->chCur) && More());
+		if (vars->atLineEnd) {
 		    SetStyle(SCE_C_DEFAULT);
 		}
-	    } else if (isoperator(vars.chCur)) {
+	    } else if (isoperator(vars->chCur)) {
 		SetStyle(SCE_C_OPERATOR);
 	    }
 	}
 	
-	if (!IsASpace(vars.chCur)) {
-	    chPrevNonWhite = vars.chCur;
+	if (!IsASpace(vars->chCur)) {
+	    chPrevNonWhite = vars->chCur;
 	    visibleChars++;
 	}
     }
@@ -335,9 +358,15 @@ static bool IsStreamCommentStyle(int style) {
 	style == SCE_C_COMMENTDOCKEYWORDERROR;
 }
 
-static int FoldCPP(LexerArgs *args)
+/*
+ * Set the fold level of the current line from its text and styles. This is
+ * called for each line by the folding pass, or by the lexing pass right
+ * after styling the line when it folds too.
+ */
+
+static void FoldLineCPP(LexVars *vars)
 {
-    struct Lexer2 *lexer = (struct Lexer2 *) args->lexer;
+    struct Lexer2 *lexer = (struct Lexer2 *) GetLexer(vars->sharedPtr);
     bool foldComment = lexer->foldComment;
     bool foldPreprocessor = lexer->foldPreprocessor;
     bool foldCompact = lexer->foldCompact;
@@ -345,29 +374,41 @@ static int FoldCPP(LexerArgs *args)
 
     int levelCurrent, levelMinCurrent, levelNext;
     int visibleChars = 0;
-
-    BeginStyling(args, args->firstLine, args->lastLine);
+    int i, style, stylePrev, styleNext;
+    char ch;
 
     /* Store both the current line's fold level and the next line's in the
      * level store to make it easy to pick up with each increment
      * and to make it possible to fiddle the current level for "} else {". */
-    levelCurrent = vars.linePrevPtr ?
-	vars.linePrevPtr->level >> 16 : SC_FOLDLEVELBASE;
+    levelCurrent = vars->linePrevPtr ?
+	vars->linePrevPtr->level >> 16 : SC_FOLDLEVELBASE;
     levelMinCurrent = levelCurrent;
     levelNext = levelCurrent;
 
-    for ( ; More(); Forward() ) {
-	if (foldComment && IsStreamCommentStyle(vars.style)) {
-	    if (!IsStreamCommentStyle(vars.stylePrev)) {
+    style = (vars->lineLength > 0) ? vars->styleBuf[0] : SCE_C_DEFAULT;
+    stylePrev = vars->linePrevPtr ?
+	vars->linePrevPtr->styleEOL : SCE_C_DEFAULT;
+
+    for (i = 0; i < vars->lineLength; i++) {
+	bool atLineEnd;
+
+	ch = vars->charBuf[i];
+	styleNext = (i + 1 < vars->lineLength) ?
+	    vars->styleBuf[i + 1] : SCE_C_DEFAULT;
+	atLineEnd = (ch == '\r' && SafeGetCharAt(i + 1) != '\n') ||
+	    (ch == '\n') || (i + 1 >= vars->lineLength);
+
+	if (foldComment && IsStreamCommentStyle(style)) {
+	    if (!IsStreamCommentStyle(stylePrev)) {
 		levelNext++;
-	    } else if (!IsStreamCommentStyle(vars.styleNext) && !vars.atLineEnd) {
+	    } else if (!IsStreamCommentStyle(styleNext) && !atLineEnd) {
 		/* Comments don't end at end of line and the next character may be unstyled. */
 		levelNext--;
 	    }
 	}
-	if (foldComment && (vars.style == SCE_C_COMMENTLINE)) {
-	    if (MatchChCh('/', '/')) {
-		char chNext2 = SafeGetCharAt(vars.charIndex + 2);
+	if (foldComment && (style == SCE_C_COMMENTLINE)) {
+	    if (ch == '/' && SafeGetCharAt(i + 1) == '/') {
+		char chNext2 = SafeGetCharAt(i + 2);
 		if (chNext2 == '{') {
 		    levelNext++;
 		} else if (chNext2 == '}') {
@@ -375,10 +416,10 @@ static int FoldCPP(LexerArgs *args)
 		}
 	    }
 	}
-	if (foldPreprocessor && (vars.style == SCE_C_PREPROCESSOR)) {
-	    if (MatchCh('#')) {
-		unsigned int j = vars.charIndex + 1;
-		while ((j < vars.lineLength) && IsASpaceOrTab(SafeGetCharAt(j))) {
+	if (foldPreprocessor && (style == SCE_C_PREPROCESSOR)) {
+	    if (ch == '#') {
+		int j = i + 1;
+		while ((j < vars->lineLength) && IsASpaceOrTab(SafeGetCharAt(j))) {
 		    j++;
 		}
 		if (MatchStrAt(j, "region") || MatchStrAt(j, "if")) {
@@ -388,32 +429,47 @@ static int FoldCPP(LexerArgs *args)
 		}
 	    }
 	}
-	if (vars.style == SCE_C_OPERATOR) {
-	    if (MatchCh('{')) {
+	if (style == SCE_C_OPERATOR) {
+	    if (ch == '{') {
 		/* Measure the minimum before a '{' to allow
 		 * folding on "} else {" */
 		if (levelMinCurrent > levelNext) {
 		    levelMinCurrent = levelNext;
 		}
 		levelNext++;
-	    } else if (MatchCh('}')) {
+	    } else if (ch == '}') {
 		levelNext--;
 	    }
 	}
-	if (vars.atLineEnd) {
+	if (atLineEnd) {
 	    int levelUse = foldAtElse ? levelMinCurrent : levelCurrent;
 	    int lev = /* levelUse | */ (levelNext << 16);
 	    if (visibleChars == 0 && foldCompact)
 		lev |= SC_FOLDLEVELWHITEFLAG;
 	    if (levelUse < levelNext)
 		lev |= SC_FOLDLEVELHEADERFLAG;
-	    SetLineFoldLevel(vars.sharedPtr, vars.linePtr, levelUse, lev);
-	    levelCurrent = levelNext;
-	    levelMinCurrent = levelCurrent;
-	    visibleChars = 0;
+	    SetLineFoldLevel(vars->sharedPtr, vars->linePtr, levelUse, lev);
+	    break;
 	}
-	if (!IsASpace(vars.chCur))
+	if (!IsASpace(ch))
 	    visibleChars++;
+
+	stylePrev = style;
+	style = styleNext;
+    }
+}
+
+static int FoldCPP(LexerArgs *args)
+{
+    LexVars *vars = args->vars;
+
+    BeginStyling(args, args->firstLine, args->lastLine);
+
+    for ( ; More(); Forward() ) {
+	if (vars->atLineStart) {
+	    FoldLineCPP(vars);
+	    JumpToEOL();
+	}
     }
 
     return 0;
@@ -425,6 +481,8 @@ LexerModule lmCPP = {
     styleNames,
     ColorizeCPP,
     FoldCPP,
-    optionSpecs
+    optionSpecs,
+    IsAWordStart,
+    IsAWordChar
 };
 
@@ -0,0 +1,1123 @@
+/*
+ * LexGrammar.c --
+ *
+ * Lexer driven by a grammar given as the -grammar option, so that a
+ * language can be highlighted without writing C. The grammar is a list of
+ * states, each with a list of rules:
+ *
+ *	state {{regexp style ?push|goto state? ?pop?} ...} ?state rules ...?
+ *
+ * The first state is the initial one. At each position the rules of the
+ * current state are tried together, the longest match wins and ties go to
+ * the earlier rule. Characters no rule matches get the default style. The
+ * state stack is kept in each line's state, so lexing resumes at any line
+ * like the other lexers, and its depth is used as the fold level.
+ *
+ * When the grammar is configured the regular expressions of each state are
+ * compiled into one DFA over classes of bytes that no regular expression
+ * tells apart, so lexing costs one table lookup per byte.
+ *
+ * RCS: @(#) $Id$
+ */
+
+#include "tkText.h"
+#include "tkTextHighlight.h"
+
+#define SCE_GRAMMAR_DEFAULT 0
+#define SCE_GRAMMAR_COMMENT 1
+#define SCE_GRAMMAR_STRING 2
+#define SCE_GRAMMAR_CHARACTER 3
+#define SCE_GRAMMAR_NUMBER 4
+#define SCE_GRAMMAR_OPERATOR 5
+#define SCE_GRAMMAR_IDENTIFIER 6
+#define SCE_GRAMMAR_KEYWORD1 7
+#define SCE_GRAMMAR_KEYWORD2 8
+#define SCE_GRAMMAR_KEYWORD3 9
+#define SCE_GRAMMAR_KEYWORD4 10
+#define SCE_GRAMMAR_PREPROCESSOR 11
+#define SCE_GRAMMAR_VARIABLE 12
+#define SCE_GRAMMAR_TYPE 13
+#define SCE_GRAMMAR_REGEXP 14
+#define SCE_GRAMMAR_ERROR 15
+
+static CONST char *styleNames[] = {
+    "default", "comment", "string", "character", "number", "operator",
+    "identifier", "keyword1", "keyword2", "keyword3", "keyword4",
+    "preprocessor", "variable", "type", "regexp", "error", NULL
+};
+
+/*
+ * The state stack is packed into the line state: 4 bits for each entry,
+ * the bottom one first, and the number of entries above the bottom one in
+ * the top bits. A push onto a full stack replaces the top entry.
+ */
+
+#define MAX_STATES	16
+#define MAX_DEPTH	6
+#define STACK_DEPTH(s)	(((s) >> 28) & 0x7)
+#define STACK_TOP(s)	(((s) >> (4 * STACK_DEPTH(s))) & 0xF)
+
+#define MAX_DFA_STATES	4096	/* For one state of the grammar. */
+
+enum {
+    ACTION_NONE, ACTION_PUSH, ACTION_GOTO, ACTION_POP
+};
+
+typedef struct GrammarRule {
+    int style;			/* SCE_GRAMMAR_XXX. */
+    int action;			/* ACTION_XXX. */
+    int target;			/* State to push or go to. */
+    int atLineStart;		/* The regexp started with ^. */
+} GrammarRule;
+
+typedef struct GrammarDfa {
+    int numStates;		/* 0 if the DFA isn't used. */
+    int *next;			/* The next DFA state for each DFA state and
+				 * byte class, -1 if the match can't go on.
+				 * DFA state 0 is the start. */
+    int *accept;		/* The rule matched in each DFA state, -1 for
+				 * none. */
+} GrammarDfa;
+
+typedef struct GrammarState {
+    int numRules;
+    GrammarRule *rules;
+    GrammarDfa dfa;		/* Rules that may match anywhere. */
+    GrammarDfa startDfa;	/* All the rules, used at the start of a
+				 * line when some rule starts with ^. */
+} GrammarState;
+
+typedef struct Grammar {
+    unsigned char classOf[256];	/* Byte class of each byte. */
+    int numClasses;
+    int numStates;
+    GrammarState states[MAX_STATES];
+} Grammar;
+
+struct Lexer2
+{
+    struct Lexer lexer;		/* Required first field. */
+    Tcl_Obj *grammarObj;	/* -grammar */
+    Grammar *grammarPtr;	/* -grammar, compiled. NULL if empty. */
+};
+
+/* ======================================== */
+
+/*
+ * The NFA the regular expressions are parsed into. Only NFA_SET and
+ * NFA_MATCH nodes make up the states of the DFA, the others are followed
+ * when computing the closure of a set of nodes.
+ */
+
+enum {
+    NFA_SET, NFA_SPLIT, NFA_EMPTY, NFA_MATCH
+};
+
+typedef struct NfaNode {
+    int type;			/* NFA_XXX. */
+    int arg;			/* Byte set of NFA_SET, rule of NFA_MATCH. */
+    int out, out1;		/* Following nodes, -1 for none. */
+} NfaNode;
+
+typedef struct ByteSet {
+    unsigned char bits[32];
+} ByteSet;
+
+#define SET_HAS(s,b) ((s)->bits[(b) >> 3] & (1 << ((b) & 7)))
+#define SET_ADD(s,b) ((s)->bits[(b) >> 3] |= (1 << ((b) & 7)))
+
+typedef struct Frag {
+    int start;			/* First node. */
+    int end;			/* NFA_EMPTY node whose "out" is patched to
+				 * what follows. */
+} Frag;
+
+typedef struct Compiler {
+    Tcl_Interp *interp;
+    NfaNode *nodes;
+    int numNodes, nodeSpace;
+    ByteSet *sets;
+    int numSets, setSpace;
+    CONST char *re;		/* The regexp being parsed. */
+    CONST char *p;		/* Parse position in re. */
+} Compiler;
+
+static int
+NewNode(
+    Compiler *c,
+    int type,
+    int arg,
+    int out,
+    int out1)
+{
+    NfaNode *nodePtr;
+
+    if (c->numNodes == c->nodeSpace) {
+	c->nodeSpace = c->nodeSpace ? c->nodeSpace * 2 : 64;
+	c->nodes = (NfaNode *) ckrealloc((char *) c->nodes,
+		c->nodeSpace * sizeof(NfaNode));
+    }
+    nodePtr = &c->nodes[c->numNodes];
+    nodePtr->type = type;
+    nodePtr->arg = arg;
+    nodePtr->out = out;
+    nodePtr->out1 = out1;
+    return c->numNodes++;
+}
+
+static ByteSet *
+NewSet(
+    Compiler *c)
+{
+    if (c->numSets == c->setSpace) {
+	c->setSpace = c->setSpace ? c->setSpace * 2 : 32;
+	c->sets = (ByteSet *) ckrealloc((char *) c->sets,
+		c->setSpace * sizeof(ByteSet));
+    }
+    memset(&c->sets[c->numSets], '\0', sizeof(ByteSet));
+    return &c->sets[c->numSets++];
+}
+
+static Frag
+SetFrag(
+    Compiler *c)
+{
+    Frag f;
+
+    f.end = NewNode(c, NFA_EMPTY, 0, -1, -1);
+    f.start = NewNode(c, NFA_SET, c->numSets - 1, f.end, -1);
+    return f;
+}
+
+static int
+BadRegexp(
+    Compiler *c,
+    CONST char *why)
+{
+    Tcl_AppendResult(c->interp, "couldn't compile regular expression \"",
+	    c->re, "\": ", why, NULL);
+    return TCL_ERROR;
+}
+
+/*
+ * Add the bytes of a class escape such as \d to a set. Returns 0 if "ch"
+ * isn't one.
+ */
+
+static int
+AddClassEscape(
+    ByteSet *setPtr,
+    int ch)
+{
+    int b, negate = isupper(ch);
+
+    switch (tolower(ch)) {
+	case 'd': case 's': case 'w':
+	    break;
+	default:
+	    return 0;
+    }
+    for (b = 0; b < 256; b++) {
+	int in;
+
+	switch (tolower(ch)) {
+	    case 'd':
+		in = (b >= '0' && b <= '9');
+		break;
+	    case 's':
+		in = (b == ' ' || (b >= 0x09 && b <= 0x0d));
+		break;
+	    default:
+		in = (b < 128 && (isalnum(b) || b == '_'));
+		break;
+	}
+	if (in != negate)
+	    SET_ADD(setPtr, b);
+    }
+    return 1;
+}
+
+static int
+EscapedByte(
+    int ch)
+{
+    switch (ch) {
+	case 'n': return '\n';
+	case 't': return '\t';
+	case 'r': return '\r';
+	case 'f': return '\f';
+	case 'v': return '\v';
+    }
+    return ch;
+}
+
+/*
+ * Parse a bracket expression, c->p pointing just past the '['.
+ */
+
+static int
+ParseBracket(
+    Compiler *c,
+    Frag *fragPtr)
+{
+    ByteSet *setPtr = NewSet(c);
+    int negate = 0, first = 1, lo, hi, b;
+
+    if (*c->p == '^') {
+	negate = 1;
+	c->p++;
+    }
+    while (*c->p != ']' || first) {
+	first = 0;
+	if (*c->p == '\0')
+	    return BadRegexp(c, "unmatched []");
+	if (*c->p == '\\' && c->p[1] != '\0') {
+	    if (AddClassEscape(setPtr, UCHAR(c->p[1]))) {
+		c->p += 2;
+		continue;
+	    }
+	    lo = EscapedByte(UCHAR(c->p[1]));
+	    c->p += 2;
+	} else {
+	    lo = UCHAR(*c->p++);
+	}
+	hi = lo;
+	if (c->p[0] == '-' && c->p[1] != ']' && c->p[1] != '\0') {
+	    if (c->p[1] == '\\' && c->p[2] != '\0') {
+		hi = EscapedByte(UCHAR(c->p[2]));
+		c->p += 3;
+	    } else {
+		hi = UCHAR(c->p[1]);
+		c->p += 2;
+	    }
+	    if (hi < lo)
+		return BadRegexp(c, "invalid character range");
+	}
+	for (b = lo; b <= hi; b++)
+	    SET_ADD(setPtr, b);
+    }
+    c->p++;
+    if (negate) {
+	for (b = 0; b < 32; b++)
+	    setPtr->bits[b] = ~setPtr->bits[b];
+    }
+    *fragPtr = SetFrag(c);
+    return TCL_OK;
+}
+
+static int ParseAlternation(Compiler *c, Frag *fragPtr);
+
+static int
+ParseAtom(
+    Compiler *c,
+    Frag *fragPtr)
+{
+    ByteSet *setPtr;
+    int b;
+
+    switch (*c->p) {
+	case '(':
+	    c->p++;
+	    if (ParseAlternation(c, fragPtr) != TCL_OK)
+		return TCL_ERROR;
+	    if (*c->p != ')')
+		return BadRegexp(c, "unmatched ()");
+	    c->p++;
+	    return TCL_OK;
+	case '[':
+	    c->p++;
+	    return ParseBracket(c, fragPtr);
+	case '.':
+	    c->p++;
+	    setPtr = NewSet(c);
+	    for (b = 0; b < 256; b++) {
+		if (b != '\n')
+		    SET_ADD(setPtr, b);
+	    }
+	    *fragPtr = SetFrag(c);
+	    return TCL_OK;
+	case '*': case '+': case '?':
+	    return BadRegexp(c, "quantifier operand invalid");
+	case '\\':
+	    if (c->p[1] == '\0')
+		return BadRegexp(c, "trailing backslash");
+	    setPtr = NewSet(c);
+	    if (!AddClassEscape(setPtr, UCHAR(c->p[1])))
+		SET_ADD(setPtr, EscapedByte(UCHAR(c->p[1])));
+	    c->p += 2;
+	    *fragPtr = SetFrag(c);
+	    return TCL_OK;
+    }
+    setPtr = NewSet(c);
+    SET_ADD(setPtr, UCHAR(*c->p));
+    c->p++;
+    *fragPtr = SetFrag(c);
+    return TCL_OK;
+}
+
+static int
+ParseRepeat(
+    Compiler *c,
+    Frag *fragPtr)
+{
+    Frag f;
+    int split, end;
+
+    if (ParseAtom(c, &f) != TCL_OK)
+	return TCL_ERROR;
+    while (*c->p == '*' || *c->p == '+' || *c->p == '?') {
+	end = NewNode(c, NFA_EMPTY, 0, -1, -1);
+	split = NewNode(c, NFA_SPLIT, 0, f.start, end);
+	switch (*c->p++) {
+	    case '*':
+		c->nodes[f.end].out = split;
+		f.start = split;
+		break;
+	    case '+':
+		c->nodes[f.end].out = split;
+		break;
+	    case '?':
+		c->nodes[f.end].out = end;
+		f.start = split;
+		break;
+	}
+	f.end = end;
+    }
+    *fragPtr = f;
+    return TCL_OK;
+}
+
+static int
+ParseConcatenation(
+    Compiler *c,
+    Frag *fragPtr)
+{
+    Frag f, g;
+
+    f.start = f.end = NewNode(c, NFA_EMPTY, 0, -1, -1);
+    while (*c->p != '\0' && *c->p != '|' && *c->p != ')') {
+	if (ParseRepeat(c, &g) != TCL_OK)
+	    return TCL_ERROR;
+	c->nodes[f.end].out = g.start;
+	f.end = g.end;
+    }
+    *fragPtr = f;
+    return TCL_OK;
+}
+
+static int
+ParseAlternation(
+    Compiler *c,
+    Frag *fragPtr)
+{
+    Frag f, g;
+    int end;
+
+    if (ParseConcatenation(c, &f) != TCL_OK)
+	return TCL_ERROR;
+    while (*c->p == '|') {
+	c->p++;
+	if (ParseConcatenation(c, &g) != TCL_OK)
+	    return TCL_ERROR;
+	end = NewNode(c, NFA_EMPTY, 0, -1, -1);
+	c->nodes[f.end].out = end;
+	c->nodes[g.end].out = end;
+	f.start = NewNode(c, NFA_SPLIT, 0, f.start, g.start);
+	f.end = end;
+    }
+    *fragPtr = f;
+    return TCL_OK;
+}
+
+/*
+ * Parse one regexp into the NFA, ending in a match of "rule". Returns the
+ * first node in *startPtr.
+ */
+
+static int
+ParseRegexp(
+    Compiler *c,
+    CONST char *re,
+    int rule,
+    int *startPtr)
+{
+    Frag f;
+    int match;
+
+    c->re = c->p = re;
+    if (ParseAlternation(c, &f) != TCL_OK)
+	return TCL_ERROR;
+    if (*c->p != '\0')
+	return BadRegexp(c, "unmatched ()");
+    match = NewNode(c, NFA_MATCH, rule, -1, -1);
+    c->nodes[f.end].out = match;
+    *startPtr = f.start;
+    return TCL_OK;
+}
+
+/* ======================================== */
+
+/*
+ * Split the bytes into classes such that every byte set used by the NFA
+ * holds either all or none of the bytes of each class.
+ */
+
+static void
+ComputeClasses(
+    Compiler *c,
+    Grammar *g)
+{
+    int i, b, n;
+    int remap[512];
+
+    memset(g->classOf, '\0', sizeof(g->classOf));
+    g->numClasses = 1;
+    for (i = 0; i < c->numSets; i++) {
+	for (b = 0; b < 512; b++)
+	    remap[b] = -1;
+	n = 0;
+	for (b = 0; b < 256; b++) {
+	    int key = g->classOf[b] * 2 + (SET_HAS(&c->sets[i], b) ? 1 : 0);
+
+	    if (remap[key] < 0)
+		remap[key] = n++;
+	    g->classOf[b] = remap[key];
+	}
+	g->numClasses = n;
+    }
+}
+
+typedef struct Closure {
+    int *nodes;			/* NFA_SET and NFA_MATCH nodes, sorted. */
+    int numNodes;
+} Closure;
+
+/*
+ * Add the nodes reachable from "node" without reading a byte.
+ */
+
+static void
+AddClosure(
+    Compiler *c,
+    int node,
+    int *mark,
+    int gen,
+    Closure *clPtr)
+{
+    while (node >= 0 && mark[node] != gen) {
+	NfaNode *nodePtr = &c->nodes[node];
+
+	mark[node] = gen;
+	switch (nodePtr->type) {
+	    case NFA_SET:
+	    case NFA_MATCH:
+		clPtr->nodes[clPtr->numNodes++] = node;
+		return;
+	    case NFA_SPLIT:
+		AddClosure(c, nodePtr->out1, mark, gen, clPtr);
+		node = nodePtr->out;
+		break;
+	    default:
+		node = nodePtr->out;
+		break;
+	}
+    }
+}
+
+static int
+CompareInts(
+    const void *a,
+    const void *b)
+{
+    return *(const int *) a - *(const int *) b;
+}
+
+/*
+ * Find or add the DFA state for a closure. Returns its index or -1 if
+ * there are too many.
+ */
+
+static int
+DfaStateFor(
+    Closure *clPtr,
+    Tcl_HashTable *tablePtr,
+    Tcl_DString *keyPtr,
+    Closure **queuePtr,
+    int *numStatesPtr)
+{
+    Tcl_HashEntry *hPtr;
+    char buf[TCL_INTEGER_SPACE + 1];
+    int i, isNew;
+
+    qsort(clPtr->nodes, clPtr->numNodes, sizeof(int), CompareInts);
+    Tcl_DStringSetLength(keyPtr, 0);
+    for (i = 0; i < clPtr->numNodes; i++) {
+	sprintf(buf, "%d ", clPtr->nodes[i]);
+	Tcl_DStringAppend(keyPtr, buf, -1);
+    }
+    hPtr = Tcl_CreateHashEntry(tablePtr, Tcl_DStringValue(keyPtr), &isNew);
+    if (!isNew)
+	return (int) (long) Tcl_GetHashValue(hPtr);
+    if (*numStatesPtr == MAX_DFA_STATES)
+	return -1;
+    if ((*numStatesPtr & 63) == 0) {
+	*queuePtr = (Closure *) ckrealloc((char *) *queuePtr,
+		(*numStatesPtr + 64) * sizeof(Closure));
+    }
+    (*queuePtr)[*numStatesPtr].nodes = (int *) ckalloc(
+	    clPtr->numNodes * sizeof(int) + 1);
+    memcpy((*queuePtr)[*numStatesPtr].nodes, clPtr->nodes,
+	    clPtr->numNodes * sizeof(int));
+    (*queuePtr)[*numStatesPtr].numNodes = clPtr->numNodes;
+    Tcl_SetHashValue(hPtr, (ClientData) (long) *numStatesPtr);
+    return (*numStatesPtr)++;
+}
+
+/*
+ * Build the DFA for the rules starting at the given NFA nodes, by the
+ * usual subset construction.
+ */
+
+static int
+BuildDfa(
+    Compiler *c,
+    Grammar *g,
+    int *starts,
+    int numStarts,
+    GrammarDfa *dfaPtr)
+{
+    Tcl_HashTable table;
+    Tcl_DString key;
+    Closure *queue = NULL, cl;
+    int *mark, *rep, gen = 0, numStates = 0, space = 0;
+    int d, i, k, b, result = TCL_OK;
+
+    mark = (int *) ckalloc(c->numNodes * sizeof(int));
+    for (i = 0; i < c->numNodes; i++)
+	mark[i] = -1;
+    cl.nodes = (int *) ckalloc(c->numNodes * sizeof(int));
+    rep = (int *) ckalloc(g->numClasses * sizeof(int));
+    for (b = 255; b >= 0; b--)
+	rep[g->classOf[b]] = b;
+    Tcl_InitHashTable(&table, TCL_STRING_KEYS);
+    Tcl_DStringInit(&key);
+    dfaPtr->next = NULL;
+    dfaPtr->accept = NULL;
+
+    cl.numNodes = 0;
+    for (i = 0; i < numStarts; i++)
+	AddClosure(c, starts[i], mark, gen, &cl);
+    gen++;
+    (void) DfaStateFor(&cl, &table, &key, &queue, &numStates);
+
+    for (d = 0; d < numStates; d++) {
+	if (numStates > space) {
+	    space = numStates + 64;
+	    dfaPtr->next = (int *) ckrealloc((char *) dfaPtr->next,
+		    space * g->numClasses * sizeof(int));
+	    dfaPtr->accept = (int *) ckrealloc((char *) dfaPtr->accept,
+		    space * sizeof(int));
+	}
+	dfaPtr->accept[d] = -1;
+	for (i = 0; i < queue[d].numNodes; i++) {
+	    NfaNode *nodePtr = &c->nodes[queue[d].nodes[i]];
+
+	    if (nodePtr->type == NFA_MATCH && (dfaPtr->accept[d] < 0 ||
+		    nodePtr->arg < dfaPtr->accept[d]))
+		dfaPtr->accept[d] = nodePtr->arg;
+	}
+	for (k = 0; k < g->numClasses; k++) {
+	    cl.numNodes = 0;
+	    for (i = 0; i < queue[d].numNodes; i++) {
+		NfaNode *nodePtr = &c->nodes[queue[d].nodes[i]];
+
+		if (nodePtr->type == NFA_SET &&
+			SET_HAS(&c->sets[nodePtr->arg], rep[k]))
+		    AddClosure(c, nodePtr->out, mark, gen, &cl);
+	    }
+	    gen++;
+	    if (cl.numNodes == 0) {
+		dfaPtr->next[d * g->numClasses + k] = -1;
+		continue;
+	    }
+	    dfaPtr->next[d * g->numClasses + k] =
+		    DfaStateFor(&cl, &table, &key, &queue, &numStates);
+	    if (dfaPtr->next[d * g->numClasses + k] < 0) {
+		Tcl_AppendResult(c->interp, "regular expressions are too ",
+			"complex", NULL);
+		result = TCL_ERROR;
+		goto done;
+	    }
+	}
+    }
+    dfaPtr->numStates = numStates;
+
+done:
+    for (d = 0; d < numStates; d++)
+	ckfree((char *) queue[d].nodes);
+    if (queue != NULL)
+	ckfree((char *) queue);
+    Tcl_DeleteHashTable(&table);
+    Tcl_DStringFree(&key);
+    ckfree((char *) mark);
+    ckfree((char *) cl.nodes);
+    ckfree((char *) rep);
+    if (result != TCL_OK) {
+	if (dfaPtr->next != NULL)
+	    ckfree((char *) dfaPtr->next);
+	if (dfaPtr->accept != NULL)
+	    ckfree((char *) dfaPtr->accept);
+	dfaPtr->numStates = 0;
+	dfaPtr->next = dfaPtr->accept = NULL;
+    }
+    return result;
+}
+
+static void
+FreeGrammar(
+    Grammar *g)
+{
+    int i;
+
+    for (i = 0; i < g->numStates; i++) {
+	GrammarState *statePtr = &g->states[i];
+
+	if (statePtr->rules != NULL)
+	    ckfree((char *) statePtr->rules);
+	if (statePtr->dfa.numStates > 0) {
+	    ckfree((char *) statePtr->dfa.next);
+	    ckfree((char *) statePtr->dfa.accept);
+	}
+	if (statePtr->startDfa.numStates > 0) {
+	    ckfree((char *) statePtr->startDfa.next);
+	    ckfree((char *) statePtr->startDfa.accept);
+	}
+    }
+    ckfree((char *) g);
+}
+
+static int
+FindState(
+    Tcl_Interp *interp,
+    Tcl_Obj **stateObjs,
+    int numStates,
+    Tcl_Obj *nameObj,
+    int *indexPtr)
+{
+    int i;
+
+    for (i = 0; i < numStates; i++) {
+	if (!strcmp(Tcl_GetString(stateObjs[2 * i]),
+		Tcl_GetString(nameObj))) {
+	    *indexPtr = i;
+	    return TCL_OK;
+	}
+    }
+    Tcl_AppendResult(interp, "unknown state \"", Tcl_GetString(nameObj),
+	    "\"", NULL);
+    return TCL_ERROR;
+}
+
+/*
+ * Parse a rule: {regexp style ?push|goto state? ?pop?}
+ */
+
+static int
+ParseRule(
+    Compiler *c,
+    Tcl_Obj **stateObjs,
+    int numStates,
+    Tcl_Obj *ruleObj,
+    int rule,
+    GrammarRule *rulePtr,
+    int *startPtr)
+{
+    static CONST char *actionNames[] = { "push", "goto", "pop", NULL };
+    Tcl_Obj **objv;
+    CONST char *re;
+    int objc, index;
+
+    if (Tcl_ListObjGetElements(c->interp, ruleObj, &objc, &objv) != TCL_OK)
+	return TCL_ERROR;
+    if (objc < 2 || objc > 4) {
+	Tcl_AppendResult(c->interp, "bad rule \"", Tcl_GetString(ruleObj),
+		"\": must be {regexp style ?push|goto state? ?pop?}", NULL);
+	return TCL_ERROR;
+    }
+    if (Tcl_GetIndexFromObj(c->interp, objv[1], styleNames, "style", 0,
+	    &rulePtr->style) != TCL_OK)
+	return TCL_ERROR;
+    rulePtr->action = ACTION_NONE;
+    rulePtr->target = 0;
+    if (objc > 2) {
+	if (Tcl_GetIndexFromObj(c->interp, objv[2], actionNames, "action",
+		0, &index) != TCL_OK)
+	    return TCL_ERROR;
+	rulePtr->action = ACTION_PUSH + index;
+	if ((rulePtr->action == ACTION_POP) != (objc == 3)) {
+	    Tcl_AppendResult(c->interp, "bad rule \"",
+		    Tcl_GetString(ruleObj), "\": must be {regexp style ",
+		    "?push|goto state? ?pop?}", NULL);
+	    return TCL_ERROR;
+	}
+	if (rulePtr->action != ACTION_POP && FindState(c->interp, stateObjs,
+		numStates, objv[3], &rulePtr->target) != TCL_OK)
+	    return TCL_ERROR;
+    }
+
+    re = Tcl_GetString(objv[0]);
+    rulePtr->atLineStart = (re[0] == '^');
+    if (rulePtr->atLineStart)
+	re++;
+    return ParseRegexp(c, re, rule, startPtr);
+}
+
+/*
+ * Compile the value of -grammar. Returns NULL with an error message in the
+ * interpreter if it is bad.
+ */
+
+static Grammar *
+CompileGrammar(
+    Tcl_Interp *interp,
+    Tcl_Obj *grammarObj)
+{
+    Compiler c;
+    Grammar *g;
+    Tcl_Obj **stateObjs, **ruleObjs;
+    int **starts, objc, numRules, i, j, n;
+    int result = TCL_OK, failedState = 0;
+
+    if (Tcl_ListObjGetElements(interp, grammarObj, &objc, &stateObjs)
+	    != TCL_OK)
+	return NULL;
+    if (objc & 1) {
+	Tcl_AppendResult(interp, "grammar must be a list of states and ",
+		"their rules", NULL);
+	return NULL;
+    }
+    if (objc / 2 > MAX_STATES) {
+	Tcl_AppendResult(interp, "too many states in grammar", NULL);
+	return NULL;
+    }
+
+    memset(&c, '\0', sizeof(c));
+    c.interp = interp;
+    g = (Grammar *) ckalloc(sizeof(Grammar));
+    memset(g, '\0', sizeof(Grammar));
+    g->numStates = objc / 2;
+    starts = (int **) ckalloc((g->numStates + 1) * sizeof(int *));
+    memset(starts, '\0', (g->numStates + 1) * sizeof(int *));
+
+    for (i = 0; i < g->numStates && result == TCL_OK; i++) {
+	GrammarState *statePtr = &g->states[i];
+
+	if (Tcl_ListObjGetElements(interp, stateObjs[2 * i + 1], &numRules,
+		&ruleObjs) != TCL_OK) {
+	    result = TCL_ERROR;
+	    failedState = i;
+	    break;
+	}
+	statePtr->numRules = numRules;
+	statePtr->rules = (GrammarRule *) ckalloc(
+		numRules * sizeof(GrammarRule) + 1);
+	starts[i] = (int *) ckalloc(numRules * sizeof(int) + 1);
+	for (j = 0; j < numRules; j++) {
+	    if (ParseRule(&c, stateObjs, g->numStates, ruleObjs[j], j,
+		    &statePtr->rules[j], &starts[i][j]) != TCL_OK) {
+		result = TCL_ERROR;
+		failedState = i;
+		break;
+	    }
+	}
+    }
+
+    if (result == TCL_OK) {
+	int *anywhere = (int *) ckalloc(c.numNodes * sizeof(int) + 1);
+
+	ComputeClasses(&c, g);
+	for (i = 0; i < g->numStates && result == TCL_OK; i++) {
+	    GrammarState *statePtr = &g->states[i];
+
+	    for (j = n = 0; j < statePtr->numRules; j++) {
+		if (!statePtr->rules[j].atLineStart)
+		    anywhere[n++] = starts[i][j];
+	    }
+	    result = BuildDfa(&c, g, anywhere, n, &statePtr->dfa);
+	    if (result == TCL_OK && n < statePtr->numRules) {
+		result = BuildDfa(&c, g, starts[i], statePtr->numRules,
+			&statePtr->startDfa);
+	    }
+	    if (result != TCL_OK)
+		failedState = i;
+	}
+	ckfree((char *) anywhere);
+    }
+    if (result != TCL_OK) {
+	Tcl_AddObjErrorInfo(interp, "\n    (compiling grammar state \"", -1);
+	Tcl_AddObjErrorInfo(interp,
+		Tcl_GetString(stateObjs[2 * failedState]), -1);
+	Tcl_AddObjErrorInfo(interp, "\")", -1);
+    }
+
+    for (i = 0; i < g->numStates; i++) {
+	if (starts[i] != NULL)
+	    ckfree((char *) starts[i]);
+    }
+    ckfree((char *) starts);
+    if (c.nodes != NULL)
+	ckfree((char *) c.nodes);
+    if (c.sets != NULL)
+	ckfree((char *) c.sets);
+    if (result != TCL_OK) {
+	FreeGrammar(g);
+	return NULL;
+    }
+    return g;
+}
+
+/* ======================================== */
+
+static int
+GrammarSetProc(
+    ClientData clientData,
+    Tcl_Interp *interp,
+    Tk_Window tkwin,
+    Tcl_Obj **value,
+    char *recordPtr,
+    int internalOffset,
+    char *saveInternalPtr,
+    int flags)
+{
+    Grammar **internalPtr = (Grammar **) (recordPtr + internalOffset);
+    Grammar *new = NULL;
+    int length;
+
+    (void) Tcl_GetStringFromObj(*value, &length);
+    if (length > 0) {
+	new = CompileGrammar(interp, *value);
+	if (new == NULL)
+	    return TCL_ERROR;
+    }
+    *((Grammar **) saveInternalPtr) = *internalPtr;
+    *internalPtr = new;
+    return TCL_OK;
+}
+
+static Tcl_Obj *
+GrammarGetProc(
+    ClientData clientData,
+    Tk_Window tkwin,
+    char *recordPtr,
+    int internalOffset)
+{
+    return ((struct Lexer2 *) recordPtr)->grammarObj;
+}
+
+static void
+GrammarRestoreProc(
+    ClientData clientData,
+    Tk_Window tkwin,
+    char *internalPtr,
+    char *saveInternalPtr)
+{
+    *((Grammar **) internalPtr) = *((Grammar **) saveInternalPtr);
+}
+
+static void
+GrammarFreeProc(
+    ClientData clientData,
+    Tk_Window tkwin,
+    char *internalPtr)
+{
+    if (*((Grammar **) internalPtr) != NULL) {
+	FreeGrammar(*((Grammar **) internalPtr));
+	*((Grammar **) internalPtr) = NULL;
+    }
+}
+
+static Tk_ObjCustomOption grammarOption = {
+    "grammar",
+    GrammarSetProc,
+    GrammarGetProc,
+    GrammarRestoreProc,
+    GrammarFreeProc,
+    (ClientData) NULL
+};
+
+static Tk_OptionSpec optionSpecs[] = {
+    {TK_OPTION_CUSTOM, "-grammar", (char *) NULL, (char *) NULL,
+	"", Tk_Offset(struct Lexer2, grammarObj),
+	Tk_Offset(struct Lexer2, grammarPtr), 0, (ClientData) &grammarOption,
+	0},
+    {TK_OPTION_END, (char *) NULL, (char *) NULL, (char *) NULL,
+	(char *) NULL, 0, 0, 0, 0}
+};
+
+/* ======================================== */
+
+static int
+ApplyAction(
+    GrammarRule *rulePtr,
+    int stack)
+{
+    int depth = STACK_DEPTH(stack);
+
+    switch (rulePtr->action) {
+	case ACTION_PUSH:
+	    if (depth < MAX_DEPTH) {
+		depth++;
+		stack = (stack & ~(0x7 << 28)) | (depth << 28);
+	    }
+	    /* FALLTHRU */
+	case ACTION_GOTO:
+	    stack &= ~(0xF << (4 * depth));
+	    stack |= rulePtr->target << (4 * depth);
+	    break;
+	case ACTION_POP:
+	    if (depth > 0) {
+		stack &= ~(0xF << (4 * depth));
+		depth--;
+		stack = (stack & ~(0x7 << 28)) | (depth << 28);
+	    }
+	    break;
+    }
+    return stack;
+}
+
+/*
+ * Style the current line, starting with the given state stack. Returns the
+ * state stack at the end of the line.
+ */
+
+static int
+StyleLine(
+    LexVars *vars,
+    Grammar *g,
+    int stack)
+{
+    const unsigned char *buf = (const unsigned char *) vars->charBuf;
+    int length = vars->lineLength;
+    int pos = 0, i, d, style, matchEnd, matchRule;
+    GrammarState *statePtr;
+    GrammarDfa *dfaPtr;
+    GrammarRule *rulePtr;
+
+    while (pos < length) {
+	if (g == NULL || STACK_TOP(stack) >= g->numStates) {
+	    memset(vars->styleBuf + pos, SCE_GRAMMAR_DEFAULT, length - pos);
+	    break;
+	}
+	statePtr = &g->states[STACK_TOP(stack)];
+	dfaPtr = (pos == 0 && statePtr->startDfa.numStates > 0) ?
+		&statePtr->startDfa : &statePtr->dfa;
+
+	/* Find the longest match. */
+	matchEnd = pos;
+	matchRule = -1;
+	for (i = pos, d = 0; i < length; i++) {
+	    d = dfaPtr->next[d * g->numClasses + g->classOf[buf[i]]];
+	    if (d < 0)
+		break;
+	    if (dfaPtr->accept[d] >= 0) {
+		matchEnd = i + 1;
+		matchRule = dfaPtr->accept[d];
+	    }
+	}
+
+	if (matchEnd == pos) {
+	    vars->styleBuf[pos++] = SCE_GRAMMAR_DEFAULT;
+	    continue;
+	}
+
+	rulePtr = &statePtr->rules[matchRule];
+	style = rulePtr->style;
+	if (style == SCE_GRAMMAR_IDENTIFIER) {
+	    for (i = 0; i < 4; i++) {
+		if (InList(vars->wordListPtrs[i], (const char *) buf + pos,
+			matchEnd - pos)) {
+		    style = SCE_GRAMMAR_KEYWORD1 + i;
+		    break;
+		}
+	    }
+	}
+	memset(vars->styleBuf + pos, style, matchEnd - pos);
+	pos = matchEnd;
+	stack = ApplyAction(rulePtr, stack);
+    }
+    return stack;
+}
+
+/*
+ * A line that pushes a state starts a fold. This is called for each line by
+ * the folding pass, or by the lexing pass once it has styled the line.
+ */
+
+static void
+FoldLineGrammar(
+    LexVars *vars)
+{
+    int depthPrev = STACK_DEPTH(PrevLineState());
+    int depth = STACK_DEPTH(vars->linePtr->state);
+
+    SetLineFoldLevel(vars->sharedPtr, vars->linePtr,
+	    SC_FOLDLEVELBASE + depthPrev,
+	    (depth > depthPrev) ? SC_FOLDLEVELHEADERFLAG : 0);
+}
+
+static int
+ColouriseGrammarDoc(
+    LexerArgs *args)
+{
+    struct Lexer2 *lexer = (struct Lexer2 *) args->lexer;
+    LexVars *vars = args->vars;
+    int stack;
+
+    BeginStyling(args, args->firstLine, args->lastLine);
+    if (args->foldWhileLexing) {
+	vars->foldLineProc = FoldLineGrammar;
+	args->folded = true;
+    }
+
+    for (; More(); Forward()) {
+	if (!vars->atLineStart)
+	    continue;
+
+	/* The whole line is styled at once, then skipped. */
+	stack = StyleLine(vars, lexer->grammarPtr, PrevLineState());
+	SetLineState(NULL, vars->linePtr, stack);
+	vars->startIndex = vars->lineLength;
+	if (vars->lineLength > 0)
+	    vars->style = vars->styleBuf[vars->lineLength - 1];
+	JumpToEOL();
+    }
+
+    Complete();
+    return 0;
+}
+
+static int
+FoldGrammarDoc(
+    LexerArgs *args)
+{
+    LexVars *vars = args->vars;
+
+    BeginStyling(args, args->firstLine, args->lastLine);
+
+    for (; More(); Forward()) {
+	if (vars->atLineStart) {
+	    FoldLineGrammar(vars);
+	    JumpToEOL();
+	}
+    }
+    return 0;
+}
+
+LexerModule lmGrammar = {
+    "grammar",
+    sizeof(struct Lexer2),
+    styleNames,
+    ColouriseGrammarDoc,
+    FoldGrammarDoc,
+    optionSpecs
+};
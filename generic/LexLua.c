@@ -108,17 +108,18 @@ static bool isLuaOperator(const int ch)
 /* Test for [=[ ... ]=] delimiters, returns 0 if it's only a [ or ],
  * return 1 for [[ or ]], returns >=2 for [=[ or ]=] and so on.
  * The maximum number of '=' characters allowed is 254. */
-static int LongDelimCheck(void) {
+static int LongDelimCheck(LexVars *vars) {
     int sep = 1;
     while (GetRelative(sep) == '=' && sep < 0xFF)
 	sep++;
-    if (GetRelative(sep) == vars.chCur)
+    if (GetRelative(sep) == vars->chCur)
 	return sep;
     return 0;
 }
 
 static int ColouriseLuaDoc(LexerArgs *args)
 {
+    LexVars *vars = args->vars;
     /* Initialize long string [[ ... ]] or block comment --[[ ... ]] nesting level,
      * if we are inside such a string. Block comment was introduced in Lua 5.0,
      * blocks with separators [=[ ... ]=] in Lua 5.1. */
@@ -128,47 +129,49 @@ static int ColouriseLuaDoc(LexerArgs *args)
     BeginStyling(args, args->firstLine, args->lastLine);
 
     /* Must initialize the literal string nesting level, if we are inside such a string. */
-    if (vars.style == SCE_LUA_LITERALSTRING || vars.style == SCE_LUA_COMMENT)
+    if (vars->style == SCE_LUA_LITERALSTRING || vars->style == SCE_LUA_COMMENT)
     {
-	int lineState = GetLineState(NULL, vars.linePrevPtr);
+	int lineState = PrevLineState();
 	nestLevel = lineState >> 8;
 	sepCount = lineState & 0xFF;
     }
 
     /* Do not leak onto next line */
-    if (vars.style == SCE_LUA_STRINGEOL ||
-	    vars.style == SCE_LUA_COMMENTLINE ||
-	    vars.style == SCE_LUA_PREPROCESSOR) {
-	vars.style = SCE_LUA_DEFAULT;
+    if (vars->style == SCE_LUA_STRINGEOL ||
+	    vars->style == SCE_LUA_COMMENTLINE ||
+	    vars->style == SCE_LUA_PREPROCESSOR) {
+	vars->style = SCE_LUA_DEFAULT;
     }
 
-    if (vars.charIndex == 0 && vars.chCur == '#') {
+    if (vars->charIndex == 0 && vars->chCur == '#') {
 	/* shbang line: # is a comment only if first char of the script */
 	SetStyle(SCE_LUA_COMMENTLINE);
     }
 
     for (; More(); Forward())
     {
-	if (vars.atLineStart) {
-	    if (vars.style == SCE_LUA_STRINGEOL) {
+	if (vars->atLineStart) {
+	    if (vars->style == SCE_LUA_STRINGEOL) {
 		SetStyle(SCE_LUA_DEFAULT);
 	    }
 	}
 
 	/* Determine if the current style should terminate. */
-	if (vars.style == SCE_LUA_WHITESPACE) {
-	    if (!IsASpaceOrTab(vars.chCur)) {
+	if (vars->style == SCE_LUA_WHITESPACE) {
+	    if (!IsASpaceOrTab(vars->chCur)) {
 		SetStyle(SCE_LUA_DEFAULT);
+	    } else {
+		SkipClass(CC_BLANK);
 	    }
-	} else if (vars.style == SCE_LUA_OPERATOR) {
+	} else if (vars->style == SCE_LUA_OPERATOR) {
 	    SetStyle(SCE_LUA_DEFAULT);
-	} else if (vars.style == SCE_LUA_NUMBER) {
+	} else if (vars->style == SCE_LUA_NUMBER) {
 	    /* We stop the number definition on non-numerical non-dot non-eE non-sign non-hexdigit char */
-	    if (!IsANumberChar(vars.chCur)) {
+	    if (!IsANumberChar(vars->chCur)) {
 		SetStyle(SCE_LUA_DEFAULT);
 	    }
-	} else if (vars.style == SCE_LUA_IDENTIFIER) {
-	    if (!IsAWordChar(vars.chCur) || (vars.chCur == '.')) {
+	} else if (vars->style == SCE_LUA_IDENTIFIER) {
+	    if (!IsWordChar(vars->chCur) || (vars->chCur == '.')) {
 		char s[100];
 		int len = GetCurrent(s, sizeof(s));
 		int kw;
@@ -183,48 +186,56 @@ static int ColouriseLuaDoc(LexerArgs *args)
 		}
 #endif
 		SetStyle(SCE_LUA_DEFAULT);
+	    } else {
+		SkipClass(CC_WORDSTART);
 	    }
-	} else if (vars.style == SCE_LUA_COMMENTLINE ||
-		vars.style == SCE_LUA_PREPROCESSOR) {
-	    if (vars.atLineEnd) {
+	} else if (vars->style == SCE_LUA_COMMENTLINE ||
+		vars->style == SCE_LUA_PREPROCESSOR) {
+	    if (vars->atLineEnd) {
 		SetStyle(SCE_LUA_DEFAULT);
+	    } else {
+		SkipTo("");
 	    }
-	} else if (vars.style == SCE_LUA_STRING) {
-	    if (vars.chCur == '\\') {
-		if (vars.chNext == '\"' || vars.chNext == '\'' ||
-		    vars.chNext == '\\') {
+	} else if (vars->style == SCE_LUA_STRING) {
+	    if (vars->chCur == '\\') {
+		if (vars->chNext == '\"' || vars->chNext == '\'' ||
+		    vars->chNext == '\\') {
 		    Forward();
 		}
-	    } else if (vars.chCur == '\"') {
+	    } else if (vars->chCur == '\"') {
 		ForwardSetStyle(SCE_LUA_DEFAULT);
-	    } else if (vars.atLineEnd) {
-		if (vars.chPrev != '\\' || IsEscaped(-1)) {
+	    } else if (vars->atLineEnd) {
+		if (vars->chPrev != '\\' || IsEscaped(-1)) {
 		    ChangeState(SCE_LUA_STRINGEOL);
 		}
+	    } else {
+		SkipTo("\\\"");
 	    }
-	} else if (vars.style == SCE_LUA_CHARACTER) {
-	    if (vars.chCur == '\\') {
-		if (vars.chNext == '\"' || vars.chNext == '\'' ||
-		    vars.chNext == '\\') {
+	} else if (vars->style == SCE_LUA_CHARACTER) {
+	    if (vars->chCur == '\\') {
+		if (vars->chNext == '\"' || vars->chNext == '\'' ||
+		    vars->chNext == '\\') {
 		    Forward();
 		}
-	    } else if (vars.chCur == '\'') {
+	    } else if (vars->chCur == '\'') {
 		ForwardSetStyle(SCE_LUA_DEFAULT);
-	    } else if (vars.atLineEnd) {
-		if (vars.chPrev != '\\' || IsEscaped(-1)) {
+	    } else if (vars->atLineEnd) {
+		if (vars->chPrev != '\\' || IsEscaped(-1)) {
 		    ChangeState(SCE_LUA_STRINGEOL);
 		}
+	    } else {
+		SkipTo("\\'");
 	    }
-	} else if (vars.style == SCE_LUA_LITERALSTRING ||
-		vars.style == SCE_LUA_COMMENT) {
+	} else if (vars->style == SCE_LUA_LITERALSTRING ||
+		vars->style == SCE_LUA_COMMENT) {
 	    if (MatchCh('[')) {
-		int sep = LongDelimCheck();
+		int sep = LongDelimCheck(vars);
 		if (sep == 1 && sepCount == 1) {     /* [[-only allowed to nest */
 		    nestLevel++;
 		    Forward();
 		}
 	    } else if (MatchCh(']')) {
-		int sep = LongDelimCheck();
+		int sep = LongDelimCheck(vars);
 		if (sep == 1 && sepCount == 1) {     /* un-nest with ]]-only */
 		    nestLevel--;
 		    Forward();
@@ -235,35 +246,37 @@ static int ColouriseLuaDoc(LexerArgs *args)
 		    ForwardN(sep);
 		    ForwardSetStyle(SCE_LUA_DEFAULT);
 		}
+	    } else {
+		SkipTo("[]");
 	    }
 	}
 
-	if (vars.atLineEnd) {
+	if (vars->atLineEnd) {
 	    /* Update the line state, so it can be seen by next line */
-	    switch (vars.style) {
+	    switch (vars->style) {
 		case SCE_LUA_LITERALSTRING:
 		case SCE_LUA_COMMENT:
 		    /* Inside a literal string or block comment, we set the line state */
-		    SetLineState(NULL, vars.linePtr, (nestLevel << 8) | sepCount);
+		    SetLineState(NULL, vars->linePtr, (nestLevel << 8) | sepCount);
 		    break;
 		default:
 		    /* Reset the line state */
-		    SetLineState(NULL, vars.linePtr, 0);
+		    SetLineState(NULL, vars->linePtr, 0);
 		    break;
 	    }
 	    continue;
 	}
 
 	/* Determine if a new style should begin. */
-	if (vars.style == SCE_LUA_DEFAULT) {
-	    if (IsASpaceOrTab(vars.chCur)) {
+	if (vars->style == SCE_LUA_DEFAULT) {
+	    if (IsASpaceOrTab(vars->chCur)) {
 		SetStyle(SCE_LUA_WHITESPACE);
-	    } else if (IsADigit(vars.chCur) || (vars.chCur == '.' && IsADigit(vars.chNext))) {
+	    } else if (IsADigit(vars->chCur) || (vars->chCur == '.' && IsADigit(vars->chNext))) {
 		SetStyle(SCE_LUA_NUMBER);
-		if (MatchCh('0') && toupper(vars.chNext) == 'X') {
+		if (MatchCh('0') && toupper(vars->chNext) == 'X') {
 		    ForwardN(1);
 		}
-	    } else if (IsAWordStart(vars.chCur)) {
+	    } else if (IsWordStart(vars->chCur)) {
 		SetStyle(SCE_LUA_IDENTIFIER);
 	    } else if (MatchCh('\"')) {
 		SetStyle(SCE_LUA_STRING);
@@ -271,7 +284,7 @@ static int ColouriseLuaDoc(LexerArgs *args)
 		SetStyle(SCE_LUA_CHARACTER);
 	    } else if (MatchCh('['))
 	    {
-		sepCount = LongDelimCheck();
+		sepCount = LongDelimCheck(vars);
 		if (sepCount == 0) {
 		    SetStyle(SCE_LUA_OPERATOR);
 		} else {
@@ -283,7 +296,7 @@ static int ColouriseLuaDoc(LexerArgs *args)
 		SetStyle(SCE_LUA_COMMENTLINE);
 		if (MatchStr("--[")) {
 		    ForwardN(2);
-		    sepCount = LongDelimCheck();
+		    sepCount = LongDelimCheck(vars);
 		    if (sepCount > 0) {
 			nestLevel = 1;
 			ChangeState(SCE_LUA_COMMENT);
@@ -292,9 +305,9 @@ static int ColouriseLuaDoc(LexerArgs *args)
 		} else {
 		    Forward();
 		}
-	    } else if (vars.atLineStart && MatchCh('$')) {
+	    } else if (vars->atLineStart && MatchCh('$')) {
 		SetStyle(SCE_LUA_PREPROCESSOR);		/* Obsolete since Lua 4.0, but still in old code */
-	    } else if (isLuaOperator(vars.chCur)) {
+	    } else if (isLuaOperator(vars->chCur)) {
 		SetStyle(SCE_LUA_OPERATOR);
 	    }
 	}
@@ -306,6 +319,7 @@ static int ColouriseLuaDoc(LexerArgs *args)
 static int FoldLuaDoc(LexerArgs *args)
 {
     struct Lexer2 *lexer = (struct Lexer2 *) args->lexer;
+    LexVars *vars = args->vars;
     bool foldCompact = lexer->foldCompact;
     int visibleChars = 0;
     int levelPrev, levelCurrent;
@@ -313,14 +327,14 @@ static int FoldLuaDoc(LexerArgs *args)
 
     BeginStyling(args, args->firstLine, args->lastLine);
 
-    levelPrev = vars.linePtr->level & SC_FOLDLEVELNUMBERMASK;
+    levelPrev = vars->linePtr->level & SC_FOLDLEVELNUMBERMASK;
     levelCurrent = levelPrev;
 
     for ( ; More(); Forward() ) {
 
-	if (vars.style == SCE_LUA_WORD1) {
+	if (vars->style == SCE_LUA_WORD1) {
 	    if (MatchCh('i') || MatchCh('d') || MatchCh('f') || MatchCh('e') || MatchCh('r') || MatchCh('u')) {
-		unsigned int j;
+		int j;
 		for (j = 0; j < 8; j++) {
 		    if (!iswordchar(GetRelative(j))) {
 			break;
@@ -336,13 +350,13 @@ static int FoldLuaDoc(LexerArgs *args)
 		    levelCurrent--;
 		}
 	    }
-	} else if (vars.style == SCE_LUA_OPERATOR) {
+	} else if (vars->style == SCE_LUA_OPERATOR) {
 	    if (MatchCh('{') || MatchCh('(')) {
 		levelCurrent++;
 	    } else if (MatchCh('}') || MatchCh(')')) {
 		levelCurrent--;
 	    }
-	} else if (vars.style == SCE_LUA_LITERALSTRING || vars.style == SCE_LUA_COMMENT) {
+	} else if (vars->style == SCE_LUA_LITERALSTRING || vars->style == SCE_LUA_COMMENT) {
 	    if (MatchCh('[')) {
 		levelCurrent++;
 	    } else if (MatchCh(']')) {
@@ -350,7 +364,7 @@ static int FoldLuaDoc(LexerArgs *args)
 	    }
 	}
 
-	if (vars.atLineEnd) {
+	if (vars->atLineEnd) {
 	    int lev = 0 /* levelPrev */;
 	    if (visibleChars == 0 && foldCompact) {
 		lev |= SC_FOLDLEVELWHITEFLAG;
@@ -358,18 +372,18 @@ static int FoldLuaDoc(LexerArgs *args)
 	    if ((levelCurrent > levelPrev) && (visibleChars > 0)) {
 		lev |= SC_FOLDLEVELHEADERFLAG;
 	    }
-	    SetLineFoldLevel(vars.sharedPtr, vars.linePtr, levelPrev, lev);
+	    SetLineFoldLevel(vars->sharedPtr, vars->linePtr, levelPrev, lev);
 	    levelPrev = levelCurrent;
 	    visibleChars = 0;
 	}
-	if (!isspacechar(vars.chCur)) {
+	if (!isspacechar(vars->chCur)) {
 	    visibleChars++;
 	}
     }
     /* Fill in the real level of the next line, keeping the current flags as they will be filled in later */
-    if (vars.lineNextPtr != NULL) {
-	int flagsNext = vars.lineNextPtr->level & ~SC_FOLDLEVELNUMBERMASK;
-	SetLineFoldLevel(vars.sharedPtr, vars.lineNextPtr, levelPrev, flagsNext);
+    if (vars->lineNextPtr != NULL) {
+	int flagsNext = vars->lineNextPtr->level & ~SC_FOLDLEVELNUMBERMASK;
+	SetLineFoldLevel(vars->sharedPtr, vars->lineNextPtr, levelPrev, flagsNext);
     }
 
     return 0;
@@ -381,6 +395,8 @@ LexerModule lmLua = {
     styleNames,
     ColouriseLuaDoc,
     FoldLuaDoc,
-    optionSpecs
+    optionSpecs,
+    IsAWordStart,
+    IsAWordChar
 };
 
@@ -75,14 +75,15 @@ LS_TARGET = 0x10,
 LS_VARIABLE = 0x20
 };
 
-void ColourRange(int start, int end, int style)
+static void ColourRange(LexVars *vars, int start, int end, int style)
 {
     while (start <= end)
-	vars.styleBuf[start++] = style;
+	vars->styleBuf[start++] = style;
 }
 
 static int ColouriseMakeDoc(LexerArgs *args)
 {
+    LexVars *vars = args->vars;
     bool targetOrVar = false;
     int leadingWS = 0;
 
@@ -90,28 +91,27 @@ static int ColouriseMakeDoc(LexerArgs *args)
 
     for (; More(); Forward()) {
 
-	if (vars.atLineStart) {
-	    bool continuation = (vars.linePrevPtr != NULL) &&
-		(vars.linePrevPtr->state & LS_CONTINUATION);
+	if (vars->atLineStart) {
+	    bool continuation = (PrevLineState() & LS_CONTINUATION) != 0;
 
-	    if (vars.style == SCE_MAKE_STRINGEOL)
-		vars.style = SCE_MAKE_DEFAULT;
+	    if (vars->style == SCE_MAKE_STRINGEOL)
+		vars->style = SCE_MAKE_DEFAULT;
 
 	    /* Skip leading whitespace */
-	    if (IsASpaceOrTab(vars.chCur)) {
-		if (vars.style == SCE_MAKE_DEFAULT) {
+	    if (IsASpaceOrTab(vars->chCur)) {
+		if (vars->style == SCE_MAKE_DEFAULT) {
 		    SetStyle(SCE_MAKE_WHITESPACE);
 		}
-		while (!vars.atLineEnd && IsASpaceOrTab(vars.chCur)) {
+		while (!vars->atLineEnd && IsASpaceOrTab(vars->chCur)) {
 		    Forward();
 		}
-		if (vars.style == SCE_MAKE_WHITESPACE) {
+		if (vars->style == SCE_MAKE_WHITESPACE) {
 		    SetStyle(SCE_MAKE_DEFAULT);
 		}
 	    }
-	    leadingWS = vars.charIndex;
+	    leadingWS = vars->charIndex;
 
-	    targetOrVar = vars.atLineStart;
+	    targetOrVar = vars->atLineStart;
 	    if (continuation) {
 		targetOrVar = false;
 	    } else if (MatchCh('#')) {
@@ -124,9 +124,9 @@ static int ColouriseMakeDoc(LexerArgs *args)
 	}
 
 	/* Determine if the current style should end. */
-	switch (vars.style) {
+	switch (vars->style) {
 	    case SCE_MAKE_WHITESPACE:
-		if (!IsASpaceOrTab(vars.chCur)) {
+		if (!IsASpaceOrTab(vars->chCur)) {
 		    SetStyle(SCE_MAKE_DEFAULT);
 		}
 		break;
@@ -134,14 +134,14 @@ static int ColouriseMakeDoc(LexerArgs *args)
 		SetStyle(SCE_MAKE_DEFAULT);
 		break;
 	    case SCE_MAKE_COMMENT:
-		if (vars.atLineEnd) {
-		    if (vars.chPrev != '\\' || IsEscaped(-1)) {
+		if (vars->atLineEnd) {
+		    if (vars->chPrev != '\\' || IsEscaped(-1)) {
 			SetStyle(SCE_MAKE_DEFAULT);
 		    }
 		}
 		break;
 	    case SCE_MAKE_SUBSTITUTION:
-		if (vars.atLineEnd) {
+		if (vars->atLineEnd) {
 		    /* Error: unterminated variable dereference. */
 		    ChangeState(SCE_MAKE_IDEOL);
 		} else if (MatchCh(')') || MatchCh('}')) {
@@ -149,8 +149,8 @@ static int ColouriseMakeDoc(LexerArgs *args)
 		}
 		break;
 	    case SCE_MAKE_CHARACTER:
-		if (vars.atLineEnd) {
-		    if (vars.chPrev != '\\' || IsEscaped(-1)) {
+		if (vars->atLineEnd) {
+		    if (vars->chPrev != '\\' || IsEscaped(-1)) {
 			SetStyle(SCE_MAKE_STRINGEOL);
 		    }
 		} else if (MatchCh('\'') && !IsEscaped(0)) {
@@ -158,8 +158,8 @@ static int ColouriseMakeDoc(LexerArgs *args)
 		}
 		break;
 	    case SCE_MAKE_STRING:
-		if (vars.atLineEnd) {
-		    if (vars.chPrev != '\\' || IsEscaped(-1)) {
+		if (vars->atLineEnd) {
+		    if (vars->chPrev != '\\' || IsEscaped(-1)) {
 			SetStyle(SCE_MAKE_STRINGEOL);
 		    }
 		} else if (MatchCh('\"') && !IsEscaped(0)) {
@@ -168,75 +168,75 @@ static int ColouriseMakeDoc(LexerArgs *args)
 		break;
 	}
 
-	if (vars.atLineEnd) {
+	if (vars->atLineEnd) {
 	    int state = 0;
 
-	    if (vars.stylePrev == SCE_MAKE_COMMENT)
+	    if (vars->stylePrev == SCE_MAKE_COMMENT)
 		state |= LS_COMMENT;
 
-	    if (leadingWS == vars.charIndex)
+	    if (leadingWS == vars->charIndex)
 		state |= LS_BLANK;
 
-	    if (vars.charBuf[0] == '\t')
+	    if (vars->charBuf[0] == '\t')
 		state |= LS_TAB;
 
-	    if (vars.styleBuf[0] == SCE_MAKE_TARGET)
+	    if (vars->styleBuf[0] == SCE_MAKE_TARGET)
 		state |= LS_TARGET;
 
-	    if (vars.styleBuf[0] == SCE_MAKE_VARIABLE)
+	    if (vars->styleBuf[0] == SCE_MAKE_VARIABLE)
 		state |= LS_VARIABLE;
 
-	    if (vars.chPrev == '\\' && !IsEscaped(-1)) {
+	    if (vars->chPrev == '\\' && !IsEscaped(-1)) {
 		state |= LS_CONTINUATION;
 #if 0
 		/* Comments and strings may extend to the next line. */
-		if (vars.style != SCE_MAKE_COMMENT &&
-			vars.style != SCE_MAKE_STRING) {
+		if (vars->style != SCE_MAKE_COMMENT &&
+			vars->style != SCE_MAKE_STRING) {
 		    SetStyle(SCE_MAKE_DEFAULT);
 		}
 	    } else {
 		SetStyle(SCE_MAKE_DEFAULT);
 #endif
 	    }
-	    SetLineState(NULL, vars.linePtr, state);
+	    SetLineState(NULL, vars->linePtr, state);
 	    continue;
 	}
 
 	/* NAME = VALUE, NAME := VALUE, NAME ?= VALUE */
 	if (targetOrVar && (MatchCh('=') || MatchChCh(':', '=') ||
 		MatchChCh('?', '='))) {
-	    int i = vars.charIndex - 1;
-	    while (i > 0 && IsASpaceOrTab(vars.charBuf[i]))
+	    int i = vars->charIndex - 1;
+	    while (i > 0 && IsASpaceOrTab(vars->charBuf[i]))
 		i--;
 	    SetStyle(SCE_MAKE_OPERATOR);
-	    if (vars.chCur != '=') {
+	    if (vars->chCur != '=') {
 		Forward();
 	    }
-	    ColourRange(0, i, SCE_MAKE_VARIABLE);
+	    ColourRange(vars, 0, i, SCE_MAKE_VARIABLE);
 	    targetOrVar = false;
 	    continue;
 	}
 
 	/* TARGET : */
 	if (targetOrVar && MatchCh(':')) {
-	    int i = vars.charIndex - 1;
-	    while (i > 0 && IsASpaceOrTab(vars.charBuf[i]))
+	    int i = vars->charIndex - 1;
+	    while (i > 0 && IsASpaceOrTab(vars->charBuf[i]))
 		i--;
 	    SetStyle(SCE_MAKE_OPERATOR);
-	    ColourRange(0, i, SCE_MAKE_TARGET);
+	    ColourRange(vars, 0, i, SCE_MAKE_TARGET);
 	    targetOrVar = false;
 	    continue;
 	}
 
 	/* Determine if a new style should start. */
-	if (vars.style == SCE_MAKE_DEFAULT) {
-	    switch (vars.chCur) {
+	if (vars->style == SCE_MAKE_DEFAULT) {
+	    switch (vars->chCur) {
 		case ' ':
 		case '\t': {
 		    SetStyle(SCE_MAKE_WHITESPACE);
 		    break;
 		case '$':
-		    if (vars.chNext == '(' || vars.chNext == '{') {
+		    if (vars->chNext == '(' || vars->chNext == '{') {
 			SetStyle(SCE_MAKE_SUBSTITUTION);
 		    }
 		    break;
@@ -247,7 +247,7 @@ static int ColouriseMakeDoc(LexerArgs *args)
 		    SetStyle(SCE_MAKE_STRING);
 		    break;
 		case '\\':
-		    if (!IsEscaped(0) && vars.chNext == '\"') {
+		    if (!IsEscaped(0) && vars->chNext == '\"') {
 			StyleAhead(2, SCE_MAKE_STRING);
 			SetStyle(SCE_MAKE_DEFAULT);
 		    }
@@ -264,6 +264,7 @@ static int ColouriseMakeDoc(LexerArgs *args)
 static int FoldMakeDoc(LexerArgs *args)
 {
     struct Lexer2 *lexer = (struct Lexer2 *) args->lexer;
+    LexVars *vars = args->vars;
     bool foldComment = lexer->foldComment;
     bool foldRule = true;
     bool foldVariable = true;
@@ -280,43 +281,43 @@ static int FoldMakeDoc(LexerArgs *args)
     else
 	BeginStyling(args, args->firstLine, args->lastLine);
 
-    if (vars.linePrevPtr != NULL) {
-	currentLevel = vars.linePrevPtr->level >> 18;
-	insideRule = (vars.linePrevPtr->level & (1 << 16)) != 0;
-	insideVariable = (vars.linePrevPtr->level & (1 << 17)) != 0;
-	insideComment = (vars.linePrevPtr->state & LS_COMMENT) != 0;
+    if (vars->linePrevPtr != NULL) {
+	currentLevel = vars->linePrevPtr->level >> 18;
+	insideRule = (vars->linePrevPtr->level & (1 << 16)) != 0;
+	insideVariable = (vars->linePrevPtr->level & (1 << 17)) != 0;
+	insideComment = (vars->linePrevPtr->state & LS_COMMENT) != 0;
     }
 
     previousLevel = currentLevel;
 
     for (; More(); Forward()) {
 
-	if (vars.atLineStart) {
-	    if (vars.linePtr->state & LS_COMMENT) {
+	if (vars->atLineStart) {
+	    if (vars->linePtr->state & LS_COMMENT) {
 		JumpToEOL();
-	    } else if (vars.linePtr->state & LS_TARGET) {
+	    } else if (vars->linePtr->state & LS_TARGET) {
 		JumpToEOL();
 	    }
 	}
 
-	if (vars.atLineEnd) {
+	if (vars->atLineEnd) {
 	    int flag = 0;
 	    if (foldComment) {
-		if (vars.linePtr->state & LS_COMMENT) {
+		if (vars->linePtr->state & LS_COMMENT) {
 		    if (!insideComment &&
-			    (vars.lineNextPtr != NULL) &&
-			    (vars.lineNextPtr->state & LS_COMMENT)) {
+			    (vars->lineNextPtr != NULL) &&
+			    (vars->lineNextPtr->state & LS_COMMENT)) {
 			++currentLevel;
-dbwin("line %d comment START", vars.lineIndex+1);
+dbwin("line %d comment START", vars->lineIndex+1);
 			insideComment = true;
 		    }
-else dbwin("line %d comment CONTINUE LS_COMMENT %s", vars.lineIndex+1, (vars.linePtr->state & LS_COMMENT) ? "yes" : "no");
+else dbwin("line %d comment CONTINUE LS_COMMENT %s", vars->lineIndex+1, (vars->linePtr->state & LS_COMMENT) ? "yes" : "no");
 		} else {
 		    if (insideComment) {
 			--currentLevel;
 			--previousLevel;
 			insideComment = false;
-dbwin("line %d comment END LS_COMMENT %s", vars.lineIndex+1, (vars.linePtr->state & LS_COMMENT) ? "yes" : "no");
+dbwin("line %d comment END LS_COMMENT %s", vars->lineIndex+1, (vars->linePtr->state & LS_COMMENT) ? "yes" : "no");
 		    }
 		}
 	    }
@@ -324,15 +325,15 @@ dbwin("line %d comment END LS_COMMENT %s", vars.lineIndex+1, (vars.linePtr->stat
 	     * a fold. */
 	    if (foldVariable) {
 		if (insideVariable) {
-		    if ((vars.linePrevPtr != NULL) &&
-			    !(vars.linePrevPtr->state & LS_CONTINUATION)) {
+		    if ((vars->linePrevPtr != NULL) &&
+			    !(vars->linePrevPtr->state & LS_CONTINUATION)) {
 			--currentLevel;
 			--previousLevel;
 			insideVariable = false;
 		    }
 		}
-		if ((vars.linePtr->state & LS_VARIABLE) &&
-			(vars.linePtr->state & LS_CONTINUATION)) {
+		if ((vars->linePtr->state & LS_VARIABLE) &&
+			(vars->linePtr->state & LS_CONTINUATION)) {
 		    ++currentLevel;
 		    insideVariable = true;
 		}
@@ -340,7 +341,7 @@ dbwin("line %d comment END LS_COMMENT %s", vars.lineIndex+1, (vars.linePtr->stat
 	    if (foldRule) {
 		if (insideRule) {
 
-		    if (!(vars.linePtr->state & (LS_COMMENT | LS_TAB | LS_BLANK))) {
+		    if (!(vars->linePtr->state & (LS_COMMENT | LS_TAB | LS_BLANK))) {
 			TkTextLine *linePtr;
 			int depth;
 
@@ -351,37 +352,37 @@ dbwin("line %d comment END LS_COMMENT %s", vars.lineIndex+1, (vars.linePtr->stat
 			/* The current line terminates a rule. Now walk back
 			 * through all comments and blank lines, removing
 			 * them from the rule. */
-			for (linePtr = vars.linePrevPtr;
+			for (linePtr = vars->linePrevPtr;
 				linePtr != NULL;
-				linePtr = BTREE_PREVLINE(vars.sharedPtr->peers, linePtr)) {
+				linePtr = BTREE_PREVLINE(NULL, linePtr)) {
 			    /* If we get all the way back to the start of a
 			     * rule, then mark it as unfoldable since it is
 			     * only a single line. */
 			    if (linePtr->state & LS_TARGET) {
 				/* Clear the depth<<18 as well. */
 				int flags = linePtr->level & ~SC_FOLDLEVELNUMBERMASK;
-				SetLineFoldLevel(vars.sharedPtr, linePtr,
+				SetLineFoldLevel(vars->sharedPtr, linePtr,
 					0, flags & ~SC_FOLDLEVELHEADERFLAG);
 				break;
 			    }
 			    if (!(linePtr->state & (LS_COMMENT | LS_BLANK)))
 				break;
 			    depth = (linePtr->level >> 18) - 1;
-			    SetLineFoldLevel(vars.sharedPtr, linePtr,
+			    SetLineFoldLevel(vars->sharedPtr, linePtr,
 				    (linePtr->level & SC_FOLDLEVELNUMBERMASK) - 1,
 				    (depth << 18) |
 				    (linePtr->level & 0xFFFF));
 			}
 		    }
 		}
-		if (vars.linePtr->state & LS_TARGET) {
+		if (vars->linePtr->state & LS_TARGET) {
 		    ++currentLevel;
 		    insideRule = true;
 		}
 	    }
 	    if (currentLevel > previousLevel)
 		flag |= SC_FOLDLEVELHEADERFLAG;
-	    SetLineFoldLevel(vars.sharedPtr, vars.linePtr,
+	    SetLineFoldLevel(vars->sharedPtr, vars->linePtr,
 		    SC_FOLDLEVELBASE + previousLevel,
 		    flag |
 		    (currentLevel << 18) |
@@ -98,7 +98,7 @@ static bool IsPyStringStart(int ch, int chNext, int chNext2) {
 }
 
 /* Return the state to use for the string starting at i; *nextIndex will be set to the first index following the quote(s) */
-static int GetPyStringState(int i, unsigned int *nextIndex) {
+static int GetPyStringState(LexVars *vars, int i, int *nextIndex) {
     char ch = SafeGetCharAt(i);
     char chNext = SafeGetCharAt(i + 1);
 
@@ -149,6 +149,7 @@ static bool IsAWordStart(int ch) {
 static int ColourisePyDoc(LexerArgs *args)
 {
     struct Lexer2 *lexer = (struct Lexer2 *) args->lexer;
+    LexVars *vars = args->vars;
     const int whingeLevel = lexer->whingeLevel;
     int initStyle;
     int spaceFlags = 0;
@@ -160,15 +161,15 @@ static int ColourisePyDoc(LexerArgs *args)
 	BeginStyling(args, args->firstLine - 1, args->lastLine);
     else
 	BeginStyling(args, args->firstLine, args->lastLine);
-    initStyle = vars.style;
+    initStyle = vars->style;
 
     initStyle = initStyle & 31;
     if (initStyle == SCE_P_STRINGEOL) {
 	initStyle = SCE_P_DEFAULT;
     }
 
-    if (!vars.atLineStart)
-	IndentAmount(vars.linePtr, vars.linePrevPtr, &spaceFlags, IsPyComment);
+    if (!vars->atLineStart)
+	IndentAmount(vars->linePtr, vars->linePrevPtr, &spaceFlags, IsPyComment);
 
 #if 0
     /* Python uses a different mask because bad indentation is marked by oring with 32 */
@@ -177,8 +178,8 @@ static int ColourisePyDoc(LexerArgs *args)
 
     for (; More(); Forward()) {
 
-	if (vars.atLineStart) {
-	    if (vars.style == SCE_P_STRINGEOL) {
+	if (vars->atLineStart) {
+	    if (vars->style == SCE_P_STRINGEOL) {
 		SetStyle(SCE_P_DEFAULT);
 	    }
 	}
@@ -188,7 +189,7 @@ static int ColourisePyDoc(LexerArgs *args)
 	    const char chGood = static_cast<char>(0);
 	    char chFlags = chGood;
 
-	    IndentAmount(vars.linePtr, vars.linePrevPtr, &spaceFlags, IsPyComment);
+	    IndentAmount(vars->linePtr, vars->linePrevPtr, &spaceFlags, IsPyComment);
 	    if (whingeLevel == 1) {
 		chFlags = (spaceFlags & wsInconsistent) ? chBad : chGood;
 	    } else if (whingeLevel == 2) {
@@ -204,20 +205,22 @@ static int ColourisePyDoc(LexerArgs *args)
 #endif
 
 	/* Determine if the current style should terminate. */
-	if (vars.style == SCE_P_WHITESPACE) {
-	    if (!IsASpaceOrTab(vars.chCur)) {
+	if (vars->style == SCE_P_WHITESPACE) {
+	    if (!IsASpaceOrTab(vars->chCur)) {
 		SetStyle(SCE_P_DEFAULT);
+	    } else {
+		SkipClass(CC_BLANK);
 	    }
-	} else if (vars.style == SCE_P_OPERATOR) {
+	} else if (vars->style == SCE_P_OPERATOR) {
 	    kwLast = kwOther;
 	    SetStyle(SCE_P_DEFAULT);
-	} else if (vars.style == SCE_P_NUMBER) {
-	    if (!IsAWordChar(vars.chCur) &&
-	            !(!hexadecimal && ((vars.chCur == '+' || vars.chCur == '-') && (vars.chPrev == 'e' || vars.chPrev == 'E')))) {
+	} else if (vars->style == SCE_P_NUMBER) {
+	    if (!IsWordChar(vars->chCur) &&
+	            !(!hexadecimal && ((vars->chCur == '+' || vars->chCur == '-') && (vars->chPrev == 'e' || vars->chPrev == 'E')))) {
 		SetStyle(SCE_P_DEFAULT);
 	    }
-	} else if (vars.style == SCE_P_IDENTIFIER) {
-	    if ((vars.chCur == '.') || (!IsAWordChar(vars.chCur))) {
+	} else if (vars->style == SCE_P_IDENTIFIER) {
+	    if ((vars->chCur == '.') || (!IsWordChar(vars->chCur))) {
 		char s[100];
 		int len = GetCurrent(s, sizeof(s));
 		int kw, style = SCE_P_IDENTIFIER;
@@ -244,85 +247,95 @@ static int ColourisePyDoc(LexerArgs *args)
 		} else {
 		    kwLast = kwOther;
 		}
+	    } else {
+		SkipClass(CC_WORDSTART);
 	    }
-	} else if ((vars.style == SCE_P_COMMENTLINE) || (vars.style == SCE_P_COMMENTBLOCK)) {
-	    if (vars.chCur == '\r' || vars.chCur == '\n') {
+	} else if ((vars->style == SCE_P_COMMENTLINE) || (vars->style == SCE_P_COMMENTBLOCK)) {
+	    if (vars->chCur == '\r' || vars->chCur == '\n') {
 		SetStyle(SCE_P_DEFAULT);
+	    } else {
+		SkipTo("");
 	    }
-	} else if (vars.style == SCE_P_DECORATOR) {
-	    if (vars.chCur == '\r' || vars.chCur == '\n') {
+	} else if (vars->style == SCE_P_DECORATOR) {
+	    if (vars->chCur == '\r' || vars->chCur == '\n') {
 		SetStyle(SCE_P_DEFAULT);
-	    } else if (vars.chCur == '#') {
-		SetStyle((vars.chNext == '#') ? SCE_P_COMMENTBLOCK  :  SCE_P_COMMENTLINE);
+	    } else if (vars->chCur == '#') {
+		SetStyle((vars->chNext == '#') ? SCE_P_COMMENTBLOCK  :  SCE_P_COMMENTLINE);
 	    }
-	} else if ((vars.style == SCE_P_STRING) || (vars.style == SCE_P_CHARACTER)) {
-	    if (vars.chCur == '\\') {
-		if ((vars.chNext == '\r') && (GetRelative(2) == '\n')) {
+	} else if ((vars->style == SCE_P_STRING) || (vars->style == SCE_P_CHARACTER)) {
+	    if (vars->chCur == '\\') {
+		if ((vars->chNext == '\r') && (GetRelative(2) == '\n')) {
 		    Forward();
 		}
 		Forward();
-	    } else if ((vars.style == SCE_P_STRING) && (vars.chCur == '\"')) {
+	    } else if ((vars->style == SCE_P_STRING) && (vars->chCur == '\"')) {
 		ForwardSetStyle(SCE_P_DEFAULT);
-	    } else if ((vars.style == SCE_P_CHARACTER) && (vars.chCur == '\'')) {
+	    } else if ((vars->style == SCE_P_CHARACTER) && (vars->chCur == '\'')) {
 		ForwardSetStyle(SCE_P_DEFAULT);
+	    } else {
+		SkipTo("\\\"'");
 	    }
-	} else if (vars.style == SCE_P_TRIPLE) {
-	    if (vars.chCur == '\\') {
+	} else if (vars->style == SCE_P_TRIPLE) {
+	    if (vars->chCur == '\\') {
 		Forward();
 	    } else if (MatchStr("\'\'\'")) {
 		Forward();
 		Forward();
 		ForwardSetStyle(SCE_P_DEFAULT);
+	    } else {
+		SkipTo("\\'");
 	    }
-	} else if (vars.style == SCE_P_TRIPLEDOUBLE) {
-	    if (vars.chCur == '\\') {
+	} else if (vars->style == SCE_P_TRIPLEDOUBLE) {
+	    if (vars->chCur == '\\') {
 		Forward();
 	    } else if (MatchStr("\"\"\"")) {
 		Forward();
 		Forward();
 		ForwardSetStyle(SCE_P_DEFAULT);
+	    } else {
+		SkipTo("\\\"");
 	    }
 	}
 
-	if (vars.atLineEnd) {
-	    if ((vars.style == SCE_P_DEFAULT) ||
-	            (vars.style == SCE_P_TRIPLE) ||
-	            (vars.style == SCE_P_TRIPLEDOUBLE)) {
+	if (vars->atLineEnd) {
+	    if ((vars->style == SCE_P_DEFAULT) ||
+	            (vars->style == SCE_P_TRIPLE) ||
+	            (vars->style == SCE_P_TRIPLEDOUBLE)) {
 		/* Perform colourisation of white space and triple quoted strings at end of each line to allow
 		 * tab marking to work inside white space and triple quoted strings */
-		SetStyle(vars.style);
+		SetStyle(vars->style);
 	    }
 
-	    if ((vars.style == SCE_P_STRING) || (vars.style == SCE_P_CHARACTER)) {
+	    if ((vars->style == SCE_P_STRING) || (vars->style == SCE_P_CHARACTER)) {
 		ChangeState(SCE_P_STRINGEOL);
 	    }
 	    continue;
 	}
 
 	/* Determine if a new style should be begin. */
-	if (vars.style == SCE_P_DEFAULT) {
-	    if (IsASpaceOrTab(vars.chCur)) {
+	if (vars->style == SCE_P_DEFAULT) {
+	    if (IsASpaceOrTab(vars->chCur)) {
 		SetStyle(SCE_P_WHITESPACE);
-	    } else if (IsADigit(vars.chCur) || (vars.chCur == '.' && IsADigit(vars.chNext))) {
-		if (vars.chCur == '0' && (vars.chNext == 'x' || vars.chNext == 'X')) {
+	    } else if (IsADigit(vars->chCur) || (vars->chCur == '.' && IsADigit(vars->chNext))) {
+		if (vars->chCur == '0' && (vars->chNext == 'x' || vars->chNext == 'X')) {
 		    hexadecimal = true;
 		} else {
 		    hexadecimal = false;
 		}
 		SetStyle(SCE_P_NUMBER);
-	    } else if (isascii(vars.chCur) && isoperator(vars.chCur) || vars.chCur == '`') {
+	    } else if (isascii(vars->chCur) && isoperator(vars->chCur) || vars->chCur == '`') {
 		SetStyle(SCE_P_OPERATOR);
-	    } else if (vars.chCur == '#') {
-		SetStyle(vars.chNext == '#' ? SCE_P_COMMENTBLOCK : SCE_P_COMMENTLINE);
-	    } else if (vars.chCur == '@') {
+	    } else if (vars->chCur == '#') {
+		SetStyle(vars->chNext == '#' ? SCE_P_COMMENTBLOCK : SCE_P_COMMENTLINE);
+	    } else if (vars->chCur == '@') {
 		SetStyle(SCE_P_DECORATOR);
-	    } else if (IsPyStringStart(vars.chCur, vars.chNext, GetRelative(2))) {
-		unsigned int nextIndex = 0;
-		SetStyle(GetPyStringState(vars.charIndex, &nextIndex));
-		while (nextIndex > (vars.charIndex + 1) && More()) {
+	    } else if (IsPyStringStart(vars->chCur, vars->chNext, GetRelative(2))) {
+		int nextIndex = 0;
+		SetStyle(GetPyStringState(vars, vars->charIndex, &nextIndex));
+		while (nextIndex > (vars->charIndex + 1) && More()) {
 		    Forward();
 		}
-	    } else if (IsAWordStart(vars.chCur)) {
+	    } else if (IsWordStart(vars->chCur)) {
 		SetStyle(SCE_P_IDENTIFIER);
 	    }
 	}
@@ -331,7 +344,7 @@ static int ColourisePyDoc(LexerArgs *args)
     return 0;
 }
 
-#define LINEPTR(n) BTREE_FINDLINE(args->sharedPtr->peers, n)
+#define LINEPTR(n) FindLineAt(args->sharedPtr, n)
 
 static bool IsCommentLine(LexerArgs *args, int line) {
     return (GetFirstNonWSChar(LINEPTR(line)) == '#');
@@ -348,6 +361,7 @@ static bool IsQuoteLine(LexerArgs *args, int line) {
 static int FoldPyDoc(LexerArgs *args)
 {
     struct Lexer2 *lexer = (struct Lexer2 *) args->lexer;
+    LexVars *vars = args->vars;
     const bool foldComment = lexer->foldComment;
     const bool foldQuotes = lexer->foldQuote;
     const int maxLines = args->lastLine;             /* Requested last line */
@@ -510,7 +524,7 @@ static int FoldPyDoc(LexerArgs *args)
 		aLineChanged = true;
 	}
 	/* Report back the last line we actually examined. */
-	vars.lineIndex = lineNext - 1;
+	vars->lineIndex = lineNext - 1;
 #endif
 	indentCurrent = indentNext;
 	lineCurrent = lineNext;
@@ -528,6 +542,8 @@ LexerModule lmPython = {
     styleNames,
     ColourisePyDoc,
     FoldPyDoc,
-    optionSpecs
+    optionSpecs,
+    IsAWordStart,
+    IsAWordChar
 };
 
@@ -109,6 +109,7 @@ static bool IsADoxygenChar(const int ch) {
 static int ColorizeTOL(LexerArgs *args)
 {
     struct Lexer2 *lexer = (struct Lexer2 *) args->lexer;
+    LexVars *vars = args->vars;
     bool stylingWithinPreprocessor = lexer->stylingWithinPreprocessor;
     int chPrevNonWhite = ' ';
     int visibleChars = 0;
@@ -118,17 +119,17 @@ static int ColorizeTOL(LexerArgs *args)
 
     /* Do not leak onto next line */
     /*
-    if (vars.style == SCE_C_STRINGEOL)
-	vars.style = SCE_C_DEFAULT;
+    if (vars->style == SCE_C_STRINGEOL)
+	vars->style = SCE_C_DEFAULT;
     */
     for ( ; More(); Forward() ) {
 
-	if (vars.atLineStart) {
+	if (vars->atLineStart) {
 
 	    /* Do not leak onto next line */
             /*
-	    if (vars.style == SCE_C_STRINGEOL)
-		vars.style = SCE_C_DEFAULT;
+	    if (vars->style == SCE_C_STRINGEOL)
+		vars->style = SCE_C_DEFAULT;
             */
 	    /* Reset states to begining of colourise so no surprises 
 	     * if different sets of lines lexed. */
@@ -138,7 +139,7 @@ static int ColorizeTOL(LexerArgs *args)
 	}
 
 	/* Handle line continuation generically. */
-	if (vars.chCur == '\\') {
+	if (vars->chCur == '\\') {
 	    if (MatchStr("\\\n")) {
 		ForwardN(1);
 		continue;
@@ -150,18 +151,22 @@ static int ColorizeTOL(LexerArgs *args)
 	}
 
 	/* Determine if the current style should terminate. */
-	if (vars.style == SCE_C_WHITESPACE) {
-	    if (!IsASpaceOrTab(vars.chCur)) {
+	if (vars->style == SCE_C_WHITESPACE) {
+	    if (!IsASpaceOrTab(vars->chCur)) {
 		SetStyle(SCE_C_DEFAULT);
+	    } else {
+		SkipClass(CC_BLANK);
 	    }
-	} else if (vars.style == SCE_C_OPERATOR) {
+	} else if (vars->style == SCE_C_OPERATOR) {
 	    SetStyle(SCE_C_DEFAULT);
-	} else if (vars.style == SCE_C_NUMBER) {
-	    if (!IsAWordChar(vars.chCur)) {
+	} else if (vars->style == SCE_C_NUMBER) {
+	    if (!IsWordChar(vars->chCur)) {
 		SetStyle(SCE_C_DEFAULT);
+	    } else {
+		SkipClass(CC_WORD);
 	    }
-	} else if (vars.style == SCE_C_IDENTIFIER) {
-	    if (!IsAWordChar(vars.chCur) || (vars.chCur == '.')) {
+	} else if (vars->style == SCE_C_IDENTIFIER) {
+	    if (!IsWordChar(vars->chCur) || (vars->chCur == '.')) {
 		char s[100];
 		int len = GetCurrent(s, sizeof(s));
 		int kw;
@@ -178,108 +183,120 @@ static int ColorizeTOL(LexerArgs *args)
 #endif
 		}
 		SetStyle(SCE_C_DEFAULT);
+	    } else {
+		SkipClass(CC_WORDSTART);
 	    }
-	} else if (vars.style == SCE_C_PREPROCESSOR) {
+	} else if (vars->style == SCE_C_PREPROCESSOR) {
 	    if (stylingWithinPreprocessor) {
-		if (IsASpace(vars.chCur)) {
+		if (IsASpace(vars->chCur)) {
 		    SetStyle(SCE_C_DEFAULT);
 		}
 	    } else {
-		if (vars.atLineEnd) {
+		if (vars->atLineEnd) {
 		    SetStyle(SCE_C_DEFAULT);
 		}
 	    }
-	} else if (vars.style == SCE_C_COMMENT) {
+	} else if (vars->style == SCE_C_COMMENT) {
 	    if (MatchChCh('*', '/')) {
 		Forward();
 		ForwardSetStyle(SCE_C_DEFAULT);
+	    } else {
+		SkipTo("*\\");
 	    }
-	} else if (vars.style == SCE_C_COMMENTDOC) {
+	} else if (vars->style == SCE_C_COMMENTDOC) {
 	    if (MatchChCh('*', '/')) {
 		Forward();
 		ForwardSetStyle(SCE_C_DEFAULT);
-	    } else if (vars.chCur == '@' || vars.chCur == '\\') {
+	    } else if (vars->chCur == '@' || vars->chCur == '\\') {
 		SetStyle(SCE_C_COMMENTDOCKEYWORD);
+	    } else {
+		SkipTo("*@\\");
 	    }
-	} else if (vars.style == SCE_C_COMMENTLINE ||
-		vars.style == SCE_C_COMMENTLINEDOC) {
-	    if (vars.atLineEnd) {
+	} else if (vars->style == SCE_C_COMMENTLINE ||
+		vars->style == SCE_C_COMMENTLINEDOC) {
+	    if (vars->atLineEnd) {
 		SetStyle(SCE_C_DEFAULT);
+	    } else {
+		SkipTo("\\");
 	    }
-	} else if (vars.style == SCE_C_COMMENTDOCKEYWORD) {
+	} else if (vars->style == SCE_C_COMMENTDOCKEYWORD) {
 	    if (MatchChCh('*', '/')) {
 		ChangeState(SCE_C_COMMENTDOCKEYWORDERROR);
 		Forward();
 		ForwardSetStyle(SCE_C_DEFAULT);
-	    } else if (!IsADoxygenChar(vars.chCur)) {
+	    } else if (!IsADoxygenChar(vars->chCur)) {
 		char s[100];
 		int len = GetCurrent(s, sizeof(s));
-		if (!isspace(vars.chCur) || !InList(vars.wordListPtrs[3-1], s+1, len)) {
+		if (!isspace(vars->chCur) || !InList(vars->wordListPtrs[3-1], s+1, len)) {
 		    ChangeState(SCE_C_COMMENTDOCKEYWORDERROR);
 		}
 		SetStyle(SCE_C_COMMENTDOC);
 	    }
-	} else if (vars.style == SCE_C_STRING) {
-	    if (vars.chCur == '\\') {
-		if (vars.chNext == '\"' || vars.chNext == '\'' || vars.chNext == '\\') {
+	} else if (vars->style == SCE_C_STRING) {
+	    if (vars->chCur == '\\') {
+		if (vars->chNext == '\"' || vars->chNext == '\'' || vars->chNext == '\\') {
 		    Forward();
 		}
-	    } else if (vars.chCur == '\"') {
+	    } else if (vars->chCur == '\"') {
 		ForwardSetStyle(SCE_C_DEFAULT);
-	    }/* else if (vars.atLineEnd) {
+	    } else {
+		SkipTo("\\\"");
+	    }/* else if (vars->atLineEnd) {
 		ChangeState(SCE_C_STRINGEOL);
                 }*/
-	} else if (vars.style == SCE_C_CHARACTER) {
-          /*if (vars.atLineEnd) {
+	} else if (vars->style == SCE_C_CHARACTER) {
+          /*if (vars->atLineEnd) {
 		ChangeState(SCE_C_STRINGEOL);
-                } else*/ if (vars.chCur == '\\') {
-		if (vars.chNext == '\"' || vars.chNext == '\'' || vars.chNext == '\\') {
+                } else*/ if (vars->chCur == '\\') {
+		if (vars->chNext == '\"' || vars->chNext == '\'' || vars->chNext == '\\') {
 		    Forward();
 		}
-	    } else if (vars.chCur == '\'') {
+	    } else if (vars->chCur == '\'') {
 		ForwardSetStyle(SCE_C_DEFAULT);
+	    } else {
+		SkipTo("\\'");
 	    }
-	} else if (vars.style == SCE_C_REGEX) {
-	    if (vars.chCur == '\r' || vars.chCur == '\n' || vars.chCur == '/') {
+	} else if (vars->style == SCE_C_REGEX) {
+	    if (vars->chCur == '\r' || vars->chCur == '\n' || vars->chCur == '/') {
 		ForwardSetStyle(SCE_C_DEFAULT);
-	    } else if (vars.chCur == '\\') {
+	    } else if (vars->chCur == '\\') {
 		/* Gobble up the quoted character */
-		if (vars.chNext == '\\' || vars.chNext == '/') {
+		if (vars->chNext == '\\' || vars->chNext == '/') {
 		    Forward();
 		}
 	    }
-	} else if (vars.style == SCE_C_VERBATIM) {
-	    if (vars.chCur == '\"') {
-		if (vars.chNext == '\"') {
+	} else if (vars->style == SCE_C_VERBATIM) {
+	    if (vars->chCur == '\"') {
+		if (vars->chNext == '\"') {
 		    Forward();
 		} else {
 		    ForwardSetStyle(SCE_C_DEFAULT);
 		}
 	    }
-	} else if (vars.style == SCE_C_UUID) {
-	    if (vars.chCur == '\r' || vars.chCur == '\n' || vars.chCur == ')') {
+	} else if (vars->style == SCE_C_UUID) {
+	    if (vars->chCur == '\r' || vars->chCur == '\n' || vars->chCur == ')') {
 		SetStyle(SCE_C_DEFAULT);
 	    }
 	}
 
-	if (vars.atLineEnd)
+	if (vars->atLineEnd)
 	    continue;
 
 	/* Determine if a new style should begin. */
-	if (vars.style == SCE_C_DEFAULT) {
-	    if (IsASpaceOrTab(vars.chCur)) {
+	if (vars->style == SCE_C_DEFAULT) {
+	    if (IsASpaceOrTab(vars->chCur)) {
 		SetStyle(SCE_C_WHITESPACE);
 	    } else if (MatchChCh('@', '\"')) {
 		SetStyle(SCE_C_VERBATIM);
 		Forward();
-	    } else if (IsADigit(vars.chCur) || (vars.chCur == '.' && IsADigit(vars.chNext))) {
+	    } else if (IsADigit(vars->chCur) || (vars->chCur == '.' && IsADigit(vars->chNext))) {
 		if (lastWordWasUUID) {
 		    SetStyle(SCE_C_UUID);
 		    lastWordWasUUID = false;
 		} else {
 		    SetStyle(SCE_C_NUMBER);
 		}
-	    } else if (IsAWordStart(vars.chCur) || (vars.chCur == '@')) {
+	    } else if (IsWordStart(vars->chCur) || (vars->chCur == '@')) {
 		if (lastWordWasUUID) {
 		    SetStyle(SCE_C_UUID);
 		    lastWordWasUUID = false;
@@ -299,29 +316,29 @@ static int ColorizeTOL(LexerArgs *args)
 		} else {
 		    SetStyle(SCE_C_COMMENTLINE);
 		}
-	    } else if (vars.chCur == '/' && IsOKBeforeRE(chPrevNonWhite)) {
+	    } else if (vars->chCur == '/' && IsOKBeforeRE(chPrevNonWhite)) {
 		SetStyle(SCE_C_REGEX);
-	    } else if (vars.chCur == '\"') {
+	    } else if (vars->chCur == '\"') {
 		SetStyle(SCE_C_STRING);
-	    } else if (vars.chCur == '\'') {
+	    } else if (vars->chCur == '\'') {
 		SetStyle(SCE_C_CHARACTER);
-	    } else if (vars.chCur == '#' && visibleChars == 0) {
+	    } else if (vars->chCur == '#' && visibleChars == 0) {
 		/* Preprocessor commands are alone on their line */
 		SetStyle(SCE_C_PREPROCESSOR);
 		/* Skip whitespace between # and preprocessor word */
 		do {
 		    Forward();
-		} while (IsASpaceOrTab(vars.chCur) && More());
-		if (vars.atLineEnd) {
+		} while (IsASpaceOrTab(vars->chCur) && More());
+		if (vars->atLineEnd) {
 		    SetStyle(SCE_C_DEFAULT);
 		}
-	    } else if (isoperator(vars.chCur)) {
+	    } else if (isoperator(vars->chCur)) {
 		SetStyle(SCE_C_OPERATOR);
 	    }
 	}
 	
-	if (!IsASpace(vars.chCur)) {
-	    chPrevNonWhite = vars.chCur;
+	if (!IsASpace(vars->chCur)) {
+	    chPrevNonWhite = vars->chCur;
 	    visibleChars++;
 	}
     }
@@ -340,6 +357,7 @@ static bool IsStreamCommentStyle(int style) {
 static int FoldTOL(LexerArgs *args)
 {
     struct Lexer2 *lexer = (struct Lexer2 *) args->lexer;
+    LexVars *vars = args->vars;
     bool foldComment = lexer->foldComment;
     bool foldPreprocessor = lexer->foldPreprocessor;
     bool foldCompact = lexer->foldCompact;
@@ -353,23 +371,23 @@ static int FoldTOL(LexerArgs *args)
     /* Store both the current line's fold level and the next line's in the
      * level store to make it easy to pick up with each increment
      * and to make it possible to fiddle the current level for "} else {". */
-    levelCurrent = vars.linePrevPtr ?
-	vars.linePrevPtr->level >> 16 : SC_FOLDLEVELBASE;
+    levelCurrent = vars->linePrevPtr ?
+	vars->linePrevPtr->level >> 16 : SC_FOLDLEVELBASE;
     levelMinCurrent = levelCurrent;
     levelNext = levelCurrent;
 
     for ( ; More(); Forward() ) {
-	if (foldComment && IsStreamCommentStyle(vars.style)) {
-	    if (!IsStreamCommentStyle(vars.stylePrev)) {
+	if (foldComment && IsStreamCommentStyle(vars->style)) {
+	    if (!IsStreamCommentStyle(vars->stylePrev)) {
 		levelNext++;
-	    } else if (!IsStreamCommentStyle(vars.styleNext) && !vars.atLineEnd) {
+	    } else if (!IsStreamCommentStyle(vars->styleNext) && !vars->atLineEnd) {
 		/* Comments don't end at end of line and the next character may be unstyled. */
 		levelNext--;
 	    }
 	}
-	if (foldComment && (vars.style == SCE_C_COMMENTLINE)) {
+	if (foldComment && (vars->style == SCE_C_COMMENTLINE)) {
 	    if (MatchChCh('/', '/')) {
-		char chNext2 = SafeGetCharAt(vars.charIndex + 2);
+		char chNext2 = SafeGetCharAt(vars->charIndex + 2);
 		if (chNext2 == '{') {
 		    levelNext++;
 		} else if (chNext2 == '}') {
@@ -377,10 +395,10 @@ static int FoldTOL(LexerArgs *args)
 		}
 	    }
 	}
-	if (foldPreprocessor && (vars.style == SCE_C_PREPROCESSOR)) {
+	if (foldPreprocessor && (vars->style == SCE_C_PREPROCESSOR)) {
 	    if (MatchCh('#')) {
-		unsigned int j = vars.charIndex + 1;
-		while ((j < vars.lineLength) && IsASpaceOrTab(SafeGetCharAt(j))) {
+		int j = vars->charIndex + 1;
+		while ((j < vars->lineLength) && IsASpaceOrTab(SafeGetCharAt(j))) {
 		    j++;
 		}
 		if (MatchStrAt(j, "region") || MatchStrAt(j, "if")) {
@@ -390,7 +408,7 @@ static int FoldTOL(LexerArgs *args)
 		}
 	    }
 	}
-	if (vars.style == SCE_C_OPERATOR) {
+	if (vars->style == SCE_C_OPERATOR) {
 	    if (MatchCh('{')) {
 		/* Measure the minimum before a '{' to allow
 		 * folding on "} else {" */
@@ -402,19 +420,19 @@ static int FoldTOL(LexerArgs *args)
 		levelNext--;
 	    }
 	}
-	if (vars.atLineEnd) {
+	if (vars->atLineEnd) {
 	    int levelUse = foldAtElse ? levelMinCurrent : levelCurrent;
 	    int lev = /* levelUse | */ (levelNext << 16);
 	    if (visibleChars == 0 && foldCompact)
 		lev |= SC_FOLDLEVELWHITEFLAG;
 	    if (levelUse < levelNext)
 		lev |= SC_FOLDLEVELHEADERFLAG;
-	    SetLineFoldLevel(vars.sharedPtr, vars.linePtr, levelUse, lev);
+	    SetLineFoldLevel(vars->sharedPtr, vars->linePtr, levelUse, lev);
 	    levelCurrent = levelNext;
 	    levelMinCurrent = levelCurrent;
 	    visibleChars = 0;
 	}
-	if (!IsASpace(vars.chCur))
+	if (!IsASpace(vars->chCur))
 	    visibleChars++;
     }
 
@@ -427,6 +445,8 @@ LexerModule lmTOL = {
     styleNames,
     ColorizeTOL,
     FoldTOL,
-    optionSpecs
+    optionSpecs,
+    IsAWordStart,
+    IsAWordChar
 };
 
@@ -99,7 +99,7 @@ static bool IsANumberChar(int ch) {
 #define isComment(s) (s==SCE_TCL_COMMENT || s==SCE_TCL_COMMENTLINE || s==SCE_TCL_COMMENT_BOX || s==SCE_TCL_BLOCK_COMMENT)
 
 #define StyleIs(s) \
-    (vars.style == (s))
+    (vars->style == (s))
 
 enum tLineState {
     LS_DEFAULT = 0,
@@ -115,6 +115,7 @@ enum tLineState {
 
 static int ColorizeTcl(LexerArgs *args)
 {
+    LexVars *vars = args->vars;
     int lineState = LS_DEFAULT;
     int currentLine;
     bool cmdExpected = false;
@@ -129,14 +130,12 @@ static int ColorizeTcl(LexerArgs *args)
 	currentLine--;
     BeginStyling(args, currentLine, args->lastLine);
 
-    if (vars.linePrevPtr != NULL) {
-	lineState = GetLineState(NULL, vars.linePrevPtr) & LS_MASK_STATE;
-	continuation = (lineState & LS_CONTINUATION) != 0;
-    }
+    lineState = PrevLineState() & LS_MASK_STATE;
+    continuation = (lineState & LS_CONTINUATION) != 0;
 
     for ( ; More() ; Forward() ) {
 
-	if (vars.atLineStart) {
+	if (vars->atLineStart) {
 	    /* We can expect the first word on this line to be a command
 	     * if the previous line did not end in an unclosed string,
 	     * continuation line, or variable name in braces. */
@@ -152,28 +151,28 @@ static int ColorizeTcl(LexerArgs *args)
 		    (MatchCh('#') || MatchChCh(' ', '#'))) {
 		SetStyle(SCE_TCL_COMMENT_BOX);
 	    } else {
-		if (IsASpaceOrTab(vars.chCur)) {
+		if (IsASpaceOrTab(vars->chCur)) {
 		    SetStyle(SCE_TCL_WHITESPACE);
 		} else {
 		    SetStyle(SCE_TCL_DEFAULT);
 		}
 		cmdExpected = !continuation &&
-		    (IsAWordStart(vars.chCur) ||
-		    IsASpaceOrTab(vars.chCur));
+		    (IsWordStart(vars->chCur) ||
+		    IsASpaceOrTab(vars->chCur));
 	    }
 
 	    /* Skip past any the leading whitespace. */
-	    while (!vars.atLineEnd && IsASpaceOrTab(vars.chCur)) {
+	    while (!vars->atLineEnd && IsASpaceOrTab(vars->chCur)) {
 		Forward();
 	    }
-	    leadingWS = vars.charIndex;
+	    leadingWS = vars->charIndex;
 
 	    braceDepthInComment = 0;
 	}
 
 	/* Determine if the current style should terminate. */
 	if (StyleIs(SCE_TCL_WHITESPACE)) {
-	    if (!IsASpaceOrTab(vars.chCur)) {
+	    if (!IsASpaceOrTab(vars->chCur)) {
 		SetStyle(SCE_TCL_DEFAULT);
 	    }
 	} else if (StyleIs(SCE_TCL_SUB_BRACE)) {
@@ -184,10 +183,10 @@ static int ColorizeTcl(LexerArgs *args)
 	    } else {
 		SetStyle(SCE_TCL_SUB_BRACE);
 	    }
-	    if (!vars.atLineEnd)
+	    if (!vars->atLineEnd)
 		continue;
 	} else if (StyleIs(SCE_TCL_NUMBER)) {
-	    if (!IsANumberChar(vars.chCur)) {
+	    if (!IsANumberChar(vars->chCur)) {
 		SetStyle(SCE_TCL_DEFAULT);
 	    }
 	} else if (StyleIs(SCE_TCL_IN_QUOTE)) {
@@ -206,13 +205,13 @@ static int ColorizeTcl(LexerArgs *args)
 #if 0
 	} else if (StyleIs(SCE_TCL_DEFAULT) || StyleIs(SCE_TCL_OPERATOR)) {
 	    if (cmdExpected) {
-		cmdExpected = isspacechar(vars.chCur) ||
-		    IsAWordStart(vars.chCur) ||
+		cmdExpected = isspacechar(vars->chCur) ||
+		    IsWordStart(vars->chCur) ||
 		    MatchCh('#');
 	    }
 #endif
 	} else if (StyleIs(SCE_TCL_SUBSTITUTION)) {
-	    switch (vars.chCur) {
+	    switch (vars->chCur) {
 		case '(':
 		    subParen = true;
 		    StyleAhead(1, SCE_TCL_OPERATOR);
@@ -234,13 +233,13 @@ static int ColorizeTcl(LexerArgs *args)
 		    continue;
 		default :
 		    /* maybe spaces should be allowed ??? */
-		    if (!IsAWordChar(vars.chCur)) { /* probably the code is wrong */
+		    if (!IsWordChar(vars->chCur)) { /* probably the code is wrong */
 			SetStyle(SCE_TCL_DEFAULT);
 			subParen = false;
 		    }
 		    break;
 	    }
-	} else if (isComment(vars.style)) {
+	} else if (isComment(vars->style)) {
 	    /* To be done right we would need to keep a running brace-depth
 	     * counter from the start of the file. For now we just try
 	     * to match braces within a single line. */
@@ -248,11 +247,11 @@ static int ColorizeTcl(LexerArgs *args)
 		++braceDepthInComment;
 	    else if (MatchCh('}') && !IsEscaped(0))
 		--braceDepthInComment;
-	    if (vars.chCur == '}' && braceDepthInComment < 0) {
+	    if (vars->chCur == '}' && braceDepthInComment < 0) {
 		SetStyle(SCE_TCL_OPERATOR);
 		ForwardSetStyle(SCE_TCL_DEFAULT);
 	    }
-	} else if (!IsAWordChar(vars.chCur)) {
+	} else if (!IsWordChar(vars->chCur)) {
 	    if ((StyleIs(SCE_TCL_IDENTIFIER) && cmdExpected) || StyleIs(SCE_TCL_MODIFIER)) {
 		char w[100];
 		char *s = w;
@@ -276,12 +275,12 @@ static int ColorizeTcl(LexerArgs *args)
 	    }
 	}
 
-	if (vars.atLineEnd) {
+	if (vars->atLineEnd) {
 	    int flags = 0;
 
 	    lineState = LS_DEFAULT;
 
-	    continuation = (!vars.atLineStart && vars.chPrev == '\\' &&
+	    continuation = (!vars->atLineStart && vars->chPrev == '\\' &&
 		!IsEscaped(-1));
 	    if (continuation)
 		flags |= LS_CONTINUATION;
@@ -293,7 +292,7 @@ static int ColorizeTcl(LexerArgs *args)
 		lineState = LS_VARNAME_IN_BRACES;
 	    } else {
 		if (continuation) {
-		    if (isComment(vars.style))
+		    if (isComment(vars->style))
 			lineState = LS_OPEN_COMMENT;
 		} else if (StyleIs(SCE_TCL_COMMENT_BOX))
 		    lineState = LS_COMMENT_BOX;
@@ -301,13 +300,13 @@ static int ColorizeTcl(LexerArgs *args)
 
 	    /* Remember whether this line is nothing but a comment. This
 	     * information is used by the folding function. */
-	    if (!StyleIs(SCE_TCL_COMMENT) && isComment(vars.style))
+	    if (!StyleIs(SCE_TCL_COMMENT) && isComment(vars->style))
 		flags |= LS_ONLY_COMMENT;
 
-	    if (leadingWS == vars.charIndex)
+	    if (leadingWS == vars->charIndex)
 		flags |= LS_BLANK;
 
-	    SetLineState(NULL, vars.linePtr, flags | lineState);
+	    SetLineState(NULL, vars->linePtr, flags | lineState);
 
 	    if ((lineState != LS_COMMENT_BOX) &&
 		    (lineState != LS_OPEN_DOUBLE_QUOTE) &&
@@ -319,11 +318,11 @@ static int ColorizeTcl(LexerArgs *args)
 
 	/* Determine if a new style should be begin. */
 	if (StyleIs(SCE_TCL_DEFAULT)) {
-	    if (IsAWordStart(vars.chCur)) {
+	    if (IsWordStart(vars->chCur)) {
 		SetStyle(SCE_TCL_IDENTIFIER);
 		continue;
 	    }
-	    if (IsADigit(vars.chCur) && !IsAWordChar(vars.chPrev)) {
+	    if (IsADigit(vars->chCur) && !IsWordChar(vars->chPrev)) {
 		SetStyle(SCE_TCL_NUMBER);
 		if (MatchChCh('0', 'x') && IsADigitBase(GetRelative(2),
 			0x10)) {
@@ -332,7 +331,7 @@ static int ColorizeTcl(LexerArgs *args)
 		continue;
 	    }
 
-	    switch (vars.chCur) {
+	    switch (vars->chCur) {
 		case ' ':
 		case '\t':
 		    SetStyle(SCE_TCL_WHITESPACE);
@@ -384,7 +383,7 @@ static int ColorizeTcl(LexerArgs *args)
 		    break;
 		case '$':
 		    subParen = false;
-		    if (vars.chNext != '{') {
+		    if (vars->chNext != '{') {
 			SetStyle(SCE_TCL_SUBSTITUTION);
 		    } else {
 			StyleAhead(2, SCE_TCL_OPERATOR);  /* ${ */
@@ -392,28 +391,28 @@ static int ColorizeTcl(LexerArgs *args)
 		    }
 		    break;
 		case '#':
-		    if ((leadingWS < vars.charIndex) && cmdExpected) {
+		    if ((leadingWS < vars->charIndex) && cmdExpected) {
 			/* A comment following other text. */
 			SetStyle(SCE_TCL_COMMENT);
 			break;
 		    }
-		    if (leadingWS == vars.charIndex) {
+		    if (leadingWS == vars->charIndex) {
 			/* I don't like these special comment types. */
-			if (vars.chNext == '~') {
+			if (vars->chNext == '~') {
 			    SetStyle(SCE_TCL_BLOCK_COMMENT);
-			} else if (vars.atLineStart &&
-				(vars.chNext == '#' ||
-				vars.chNext == '-')) {
+			} else if (vars->atLineStart &&
+				(vars->chNext == '#' ||
+				vars->chNext == '-')) {
 			    SetStyle(SCE_TCL_COMMENT_BOX);
 			} else {
 			    SetStyle(SCE_TCL_COMMENTLINE);
 			}
 			break;
 		    }
-		    if ((IsASpaceOrTab(vars.chPrev) ||
-			    (vars.chPrev == '\\') ||
-			    isoperator(vars.chPrev)) &&
-			    IsADigitBase(vars.chNext, 0x10)) {
+		    if ((IsASpaceOrTab(vars->chPrev) ||
+			    (vars->chPrev == '\\') ||
+			    isoperator(vars->chPrev)) &&
+			    IsADigitBase(vars->chNext, 0x10)) {
 			SetStyle(SCE_TCL_NUMBER);
 			break;
 		    }
@@ -422,11 +421,11 @@ static int ColorizeTcl(LexerArgs *args)
 		    break;
 		case '-':
 		    /* "test text-20.59 {..." */
-		    if (vars.stylePrev != SCE_TCL_DEFAULT) {
+		    if (vars->stylePrev != SCE_TCL_DEFAULT) {
 			SetStyle(SCE_TCL_IDENTIFIER);
 			break;
 		    }
-		    if (IsADigit(vars.chNext)) {
+		    if (IsADigit(vars->chNext)) {
 			SetStyle(SCE_TCL_NUMBER);
 		    } else {
 			/* These modifiers are -switches ??? */
@@ -434,7 +433,7 @@ static int ColorizeTcl(LexerArgs *args)
 		    }
 		    break;
 		default:
-		    if (isoperator(vars.chCur)) {
+		    if (isoperator(vars->chCur)) {
 			SetStyle(SCE_TCL_OPERATOR);
 		    }
 		    break;
@@ -448,6 +447,7 @@ static int ColorizeTcl(LexerArgs *args)
 static int FoldTcl(LexerArgs *args)
 {
     struct Lexer2 *lexer = (struct Lexer2 *) args->lexer;
+    LexVars *vars = args->vars;
     bool foldComment = lexer->foldComment;
     int foldCommentMinLevel = 100;
     int blankLineEndsComment = true;
@@ -462,29 +462,29 @@ static int FoldTcl(LexerArgs *args)
 	currentLine--;
     BeginStyling(args, currentLine, args->lastLine);
 
-    if (vars.linePrevPtr != NULL) {
-	currentLevel = vars.linePrevPtr->level >> 17;
-	insideComment = (vars.linePrevPtr->level & (1 << 16)) != 0;
+    if (vars->linePrevPtr != NULL) {
+	currentLevel = vars->linePrevPtr->level >> 17;
+	insideComment = (vars->linePrevPtr->level & (1 << 16)) != 0;
     }
 
     previousLevel = currentLevel;
 
     for ( ; More(); Forward() ) {
 
-	visibleChars = !(vars.linePtr->state & LS_BLANK);
+	visibleChars = !(vars->linePtr->state & LS_BLANK);
 	if (!visibleChars) {
 	    JumpToEOL();
 	}
 
-	if (vars.atLineEnd) {
+	if (vars->atLineEnd) {
 	    int flag = 0;
 
 	    if (foldComment) {
-		if (vars.linePtr->state & LS_ONLY_COMMENT) {
+		if (vars->linePtr->state & LS_ONLY_COMMENT) {
 		    if (!insideComment &&
 			    (currentLevel <= foldCommentMinLevel) &&
-			    (vars.lineNextPtr != NULL) &&
-			    (vars.lineNextPtr->state & LS_ONLY_COMMENT)) {
+			    (vars->lineNextPtr != NULL) &&
+			    (vars->lineNextPtr->state & LS_ONLY_COMMENT)) {
 			++currentLevel;
 			insideComment = true;
 		    }
@@ -502,7 +502,7 @@ static int FoldTcl(LexerArgs *args)
 	    if (currentLevel > previousLevel)
 		flag = SC_FOLDLEVELHEADERFLAG;
 
-	    SetLineFoldLevel(vars.sharedPtr, vars.linePtr,
+	    SetLineFoldLevel(vars->sharedPtr, vars->linePtr,
 		SC_FOLDLEVELBASE + previousLevel,
 		flag |
 		(currentLevel << 17) |
@@ -512,8 +512,8 @@ static int FoldTcl(LexerArgs *args)
 	    continue;
 	}
 
-	if (vars.style == SCE_TCL_OPERATOR) {
-	    switch (vars.chCur) {
+	if (vars->style == SCE_TCL_OPERATOR) {
+	    switch (vars->chCur) {
 		case '{':
 		    ++currentLevel;
 		    break;
@@ -533,6 +533,8 @@ LexerModule lmTcl = {
     styleNames,
     ColorizeTcl,
     FoldTcl,
-    optionSpecs
+    optionSpecs,
+    IsAWordStart,
+    IsAWordChar
 };
 
@@ -20,6 +20,10 @@
 #include "tkInt.h"
 #include "tkUndo.h"
 
+#if !defined(__WIN32__)
+#include <sys/mman.h>
+#endif
+
 #if defined(MAC_OSX_TK)
 #define Style TkStyle
 #define DInfo TkDInfo
@@ -423,6 +427,10 @@ static int		TextInsertCmd(TkSharedText *sharedTextPtr,
 			    TkText *textPtr, Tcl_Interp *interp,
 			    int objc, Tcl_Obj *CONST objv[],
 			    CONST TkTextIndex *indexPtr, int viewUpdate);
+#ifdef STEXT_DIFF
+static int		TextLoadCmd(TkText *textPtr, Tcl_Interp *interp,
+			    int objc, Tcl_Obj *CONST objv[]);
+#endif
 static int		TextReplaceCmd(TkText *textPtr, Tcl_Interp *interp,
 			    CONST TkTextIndex *indexFromPtr,
 			    CONST TkTextIndex *indexToPtr,
@@ -771,20 +779,21 @@ TextWidgetObjCmd(
     TkText *peer;
     static CONST char *optionStrings[] = {
 	"bbox", "cget", "compare", "configure", "count", "debug",
-	"delete", "dlineinfo", "dump", "edit", "get", "identify",
+	"delete", "dlineinfo", "dump", "edit", "fold", "get", "identify",
 	"image", "index", "insert", "lexer", "linefoldable", "linefolded",
 	"linefoldhighlight", "linefoldlevel", "linemarker", "linevisible",
-	"margin", "mark", "peer", "replace", "scan", "search", "see", "tag",
-	"togglecontraction", "window", "xview", "yview", NULL
+	"load", "margin", "mark", "peer", "replace", "scan", "search", "see",
+	"tag", "togglecontraction", "window", "xview", "yview", NULL
     };
     enum options {
 	TEXT_BBOX, TEXT_CGET, TEXT_COMPARE, TEXT_CONFIGURE, TEXT_COUNT,
 	TEXT_DEBUG, TEXT_DELETE, TEXT_DLINEINFO, TEXT_DUMP, TEXT_EDIT,
-	TEXT_GET, TEXT_IDENTIFY, TEXT_IMAGE, TEXT_INDEX, TEXT_INSERT,
+	TEXT_FOLD, TEXT_GET, TEXT_IDENTIFY, TEXT_IMAGE, TEXT_INDEX, TEXT_INSERT,
 	TEXT_LEXER, TEXT_LINEFOLDABLE, TEXT_LINEFOLDED, TEXT_LINEFOLDHIGHLIGHT,
-	TEXT_LINEFOLDLEVEL, TEXT_LINEMARKER, TEXT_LINEVISIBLE, TEXT_MARGIN,
-	TEXT_MARK, TEXT_PEER, TEXT_REPLACE, TEXT_SCAN, TEXT_SEARCH, TEXT_SEE,
-	TEXT_TAG, TEXT_TOGGLECONTRACTION, TEXT_WINDOW, TEXT_XVIEW, TEXT_YVIEW
+	TEXT_LINEFOLDLEVEL, TEXT_LINEMARKER, TEXT_LINEVISIBLE, TEXT_LOAD,
+	TEXT_MARGIN, TEXT_MARK, TEXT_PEER, TEXT_REPLACE, TEXT_SCAN,
+	TEXT_SEARCH, TEXT_SEE, TEXT_TAG, TEXT_TOGGLECONTRACTION, TEXT_WINDOW,
+	TEXT_XVIEW, TEXT_YVIEW
     };
 #else
     static CONST char *optionStrings[] = {
@@ -1498,6 +1507,92 @@ TextWidgetObjCmd(
 	break;
     }
 #ifdef STEXT_FOLDING
+    case TEXT_FOLD: {
+	static CONST char *foldOptionStrings[] = {
+	    "all", "level", "none", NULL
+	};
+	enum foldOptions {
+	    FOLD_ALL, FOLD_LEVEL, FOLD_NONE
+	};
+	CONST TkTextIndex *indexPtr;
+	TkTextLine *firstPtr, *lastPtr;
+	int foldIndex, depth, i = 3;
+
+	if (objc < 3) {
+	    goto foldUsage;
+	}
+	if (Tcl_GetIndexFromObj(interp, objv[2], foldOptionStrings,
+		"option", 0, &foldIndex) != TCL_OK) {
+	    result = TCL_ERROR;
+	    goto done;
+	}
+	switch ((enum foldOptions) foldIndex) {
+	case FOLD_ALL:
+	    depth = 0;
+	    break;
+	case FOLD_LEVEL:
+	    if (objc < 4) {
+		goto foldUsage;
+	    }
+	    if (Tcl_GetIntFromObj(interp, objv[3], &depth) != TCL_OK) {
+		result = TCL_ERROR;
+		goto done;
+	    }
+	    if (depth < 0) {
+		Tcl_AppendResult(interp, "bad fold level \"",
+			Tcl_GetString(objv[3]), "\"", NULL);
+		result = TCL_ERROR;
+		goto done;
+	    }
+	    i++;
+	    break;
+	case FOLD_NONE:
+	    depth = SC_FOLDLEVELNUMBERMASK + 1;
+	    break;
+	}
+	if (objc == i) {
+	    firstPtr = PEER_FINDLINE(textPtr, 0);
+	    lastPtr = PEER_FINDLINE(textPtr, PEER_NUMLINES(textPtr) - 1);
+	} else if (objc == i + 2) {
+	    indexPtr = TkTextGetIndexFromObj(interp, textPtr, objv[i]);
+	    if (indexPtr == NULL) {
+		result = TCL_ERROR;
+		goto done;
+	    }
+	    firstPtr = indexPtr->linePtr;
+	    indexPtr = TkTextGetIndexFromObj(interp, textPtr, objv[i+1]);
+	    if (indexPtr == NULL) {
+		result = TCL_ERROR;
+		goto done;
+	    }
+	    lastPtr = indexPtr->linePtr;
+	    if (PEER_LINESTO(textPtr, firstPtr) >
+		    PEER_LINESTO(textPtr, lastPtr)) {
+		Tcl_AppendResult(interp, "Index \"", Tcl_GetString(objv[i+1]),
+			"\" before \"", Tcl_GetString(objv[i]),
+			"\" in the text", NULL);
+		result = TCL_ERROR;
+		goto done;
+	    }
+	} else {
+	    goto foldUsage;
+	}
+
+	/* The fold levels must be known as far as any fold could reach. */
+	if (textPtr->sharedTextPtr->lexer != NULL) {
+	    LexerFoldsWanted(textPtr->sharedTextPtr,
+		    PEER_LINESTO(textPtr, firstPtr));
+	    LexerLexThrough(textPtr->sharedTextPtr, BTREE_LINESTO(textPtr,
+		    PEER_FINDLINE(textPtr, PEER_NUMLINES(textPtr))));
+	}
+	FoldLines(textPtr, firstPtr, lastPtr, depth);
+	break;
+
+    foldUsage:
+	Tcl_WrongNumArgs(interp, 2, objv, "all|none|level N ?index1 index2?");
+	result = TCL_ERROR;
+	goto done;
+    }
     case TEXT_LINEFOLDABLE: {
 	CONST TkTextIndex *indexPtr;
 	TkTextLine *linePtr;
@@ -1514,7 +1609,8 @@ TextWidgetObjCmd(
 	}
 	linePtr = indexPtr->linePtr;
 	/* FIXME: if no lexer or not enabled ... */
-	/* FIXME: if LEX_NEEDED ... */
+	LexerFoldsWanted(textPtr->sharedTextPtr,
+		PEER_LINESTO(textPtr, linePtr));
 	Tcl_SetObjResult(interp, Tcl_NewBooleanObj(
 		GetLineFoldable(textPtr->sharedTextPtr, linePtr)));
 	break;
@@ -1543,6 +1639,8 @@ TextWidgetObjCmd(
 		result = TCL_ERROR;
 		goto done;
 	    }
+	    LexerFoldsWanted(textPtr->sharedTextPtr,
+		    PEER_LINESTO(textPtr, linePtr));
 	    folded = SetLineFolded(textPtr, linePtr, folded);
 	    Tcl_SetObjResult(interp, Tcl_NewBooleanObj(folded));
 	}
@@ -1592,6 +1690,8 @@ TextWidgetObjCmd(
 	    goto done;
 	}
 	linePtr = indexPtr->linePtr;
+	LexerFoldsWanted(textPtr->sharedTextPtr,
+		PEER_LINESTO(textPtr, linePtr));
 	Tcl_SetObjResult(interp, Tcl_NewIntObj(
 		GetLineFoldDepth(textPtr->sharedTextPtr, linePtr)));
 	break;
@@ -1610,7 +1710,8 @@ TextWidgetObjCmd(
 	    goto done;
 	}
 	/* FIXME: if no lexer or not enabled ... */
-	/* FIXME: if LEX_NEEDED ... */
+	LexerFoldsWanted(textPtr->sharedTextPtr,
+		PEER_LINESTO(textPtr, indexPtr->linePtr));
 	ToggleContraction(textPtr, indexPtr->linePtr);
 	break;
     }
@@ -1660,6 +1761,11 @@ TextWidgetObjCmd(
 	break;
     }
 #endif /* STEXT_LINE_VISIBLE */
+#ifdef STEXT_DIFF
+    case TEXT_LOAD:
+	result = TextLoadCmd(textPtr, interp, objc, objv);
+	break;
+#endif
 #ifdef STEXT_MARGINS
     case TEXT_MARGIN:
 	result = TkTextMarginCmd(textPtr, interp, objc, objv);
@@ -2198,10 +2304,12 @@ DestroyText(
     TkTextDeleteTag(textPtr, textPtr->selTagPtr);
     TkBTreeUnlinkSegment(textPtr->insertMarkPtr,
 	    textPtr->insertMarkPtr->body.mark.linePtr);
-    ckfree((char *) textPtr->insertMarkPtr);
+    TkBTreeFreeSegment(sharedTextPtr->tree, textPtr->insertMarkPtr,
+	    MSEG_SIZE);
     TkBTreeUnlinkSegment(textPtr->currentMarkPtr,
 	    textPtr->currentMarkPtr->body.mark.linePtr);
-    ckfree((char *) textPtr->currentMarkPtr);
+    TkBTreeFreeSegment(sharedTextPtr->tree, textPtr->currentMarkPtr,
+	    MSEG_SIZE);
 
     /*
      * Now we've cleaned up everything of relevance to us in the B-tree, so we
@@ -2270,10 +2378,11 @@ DestroyText(
 	    TkTextFreeTag(textPtr, tagPtr);
 	}
 	Tcl_DeleteHashTable(&sharedTextPtr->tagTable);
-	for (hPtr = Tcl_FirstHashEntry(&sharedTextPtr->markTable, &search);
-	     hPtr != NULL; hPtr = Tcl_NextHashEntry(&search)) {
-	    ckfree((char *) Tcl_GetHashValue(hPtr));
-	}
+
+	/*
+	 * The mark segments were freed with the pool of the B-tree.
+	 */
+
 	Tcl_DeleteHashTable(&sharedTextPtr->markTable);
 	TkUndoFreeStack(sharedTextPtr->undoStack);
 
@@ -3991,6 +4100,551 @@ TextInsertCmd(
     }
     return TCL_OK;
 }
+
+#ifdef STEXT_DIFF
+/*
+ * Text of the file loaded by the "load" widget command that can't be used
+ * in place is converted to UTF-8 this many bytes at a time, each piece
+ * being inserted into the text before the next is converted.
+ */
+
+#define LOAD_CHUNK_SIZE (1024 * 1024)
+
+#ifdef __WIN32__
+/*
+ * Set errno from the last Windows error, close enough for the message of
+ * the "load" widget command.
+ */
+
+static void
+SetLoadErrno(void)
+{
+    switch (GetLastError()) {
+    case ERROR_FILE_NOT_FOUND:
+    case ERROR_PATH_NOT_FOUND:
+	Tcl_SetErrno(ENOENT);
+	break;
+    case ERROR_NOT_ENOUGH_MEMORY:
+	Tcl_SetErrno(ENOMEM);
+	break;
+    default:
+	Tcl_SetErrno(EACCES);
+	break;
+    }
+}
+#endif
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * MapFile --
+ *
+ *	Map a file into memory for the "load" widget command, with mmap or
+ *	MapViewOfFile.
+ *
+ * Results:
+ *	The mapping, with a reference count of one, or NULL with errno set
+ *	if the file can't be mapped. An empty file has a mapping with no
+ *	data.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static TkTextMapping *
+MapFile(
+    Tcl_Obj *pathPtr)		/* Name of the file. */
+{
+    CONST char *nativePath = (CONST char *) Tcl_FSGetNativePath(pathPtr);
+    TkTextMapping *mapPtr;
+    char *data = NULL;
+    Tcl_WideInt size;
+#ifdef __WIN32__
+    HANDLE fileHandle, mapHandle = NULL;
+    LARGE_INTEGER fileSize;
+#else
+    int fd;
+    struct stat statBuf;
+#endif
+
+    if (nativePath == NULL) {
+	Tcl_SetErrno(ENOENT);
+	return NULL;
+    }
+#ifdef __WIN32__
+    fileHandle = CreateFile((LPCTSTR) nativePath, GENERIC_READ,
+	    FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+	    FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE) {
+	SetLoadErrno();
+	return NULL;
+    }
+    if (!GetFileSizeEx(fileHandle, &fileSize)) {
+	SetLoadErrno();
+	CloseHandle(fileHandle);
+	return NULL;
+    }
+    size = fileSize.QuadPart;
+    if (size > INT_MAX) {
+	CloseHandle(fileHandle);
+	Tcl_SetErrno(EFBIG);
+	return NULL;
+    }
+    if (size > 0) {
+	mapHandle = CreateFileMapping(fileHandle, NULL, PAGE_READONLY, 0, 0,
+		NULL);
+	if (mapHandle != NULL) {
+	    data = MapViewOfFile(mapHandle, FILE_MAP_READ, 0, 0, 0);
+	}
+	if (data == NULL) {
+	    SetLoadErrno();
+	    if (mapHandle != NULL) {
+		CloseHandle(mapHandle);
+	    }
+	    CloseHandle(fileHandle);
+	    return NULL;
+	}
+    }
+    CloseHandle(fileHandle);
+#else
+    fd = open(nativePath, O_RDONLY, 0);
+    if (fd < 0) {
+	return NULL;
+    }
+    if (fstat(fd, &statBuf) != 0) {
+	close(fd);
+	return NULL;
+    }
+    size = statBuf.st_size;
+    if (size > INT_MAX) {
+	close(fd);
+	Tcl_SetErrno(EFBIG);
+	return NULL;
+    }
+    if (size > 0) {
+	data = mmap(NULL, (size_t) size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == (char *) MAP_FAILED) {
+	    close(fd);
+	    return NULL;
+	}
+    }
+    close(fd);
+#endif
+
+    mapPtr = (TkTextMapping *) ckalloc(sizeof(TkTextMapping));
+    mapPtr->data = data;
+    mapPtr->size = (size_t) size;
+    mapPtr->refCount = 1;
+#ifdef __WIN32__
+    mapPtr->handle = (ClientData) mapHandle;
+#else
+    mapPtr->handle = NULL;
+#endif
+    return mapPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkTextReleaseMapping --
+ *
+ *	Release a reference to a file mapped by the "load" widget command.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The file is unmapped when the last reference is released.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TkTextReleaseMapping(
+    TkTextMapping *mapPtr)	/* Mapping to release. */
+{
+    if (--mapPtr->refCount > 0) {
+	return;
+    }
+    if (mapPtr->data != NULL) {
+#ifdef __WIN32__
+	UnmapViewOfFile(mapPtr->data);
+	CloseHandle((HANDLE) mapPtr->handle);
+#else
+	munmap(mapPtr->data, mapPtr->size);
+#endif
+    }
+    ckfree((char *) mapPtr);
+}
+
+#ifdef STEXT_MAPPED_CHARS
+/*
+ *----------------------------------------------------------------------
+ *
+ * MappableLine --
+ *
+ *	Decide whether a line of a UTF-8 file can be used in place. It can
+ *	if it is what reading it through a channel would give: it ends with
+ *	"\n" or "\r\n", has no other "\r", and has no null and no bytes that
+ *	Tcl would convert, i.e. nothing but well-formed UTF-8 sequences of
+ *	up to three bytes that aren't surrogates.
+ *
+ * Results:
+ *	Non-zero if the line can be mapped.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+MappableLine(
+    CONST char *start,		/* First byte of the line. */
+    CONST char *end)		/* Just after the "\n" that ends the line. */
+{
+    CONST unsigned char *p = (CONST unsigned char *) start;
+    CONST unsigned char *q = (CONST unsigned char *) end - 1;
+
+    if (q > p && q[-1] == '\r') {
+	q--;
+    }
+    while (p < q) {
+	if (*p < 0x80) {
+	    if (*p == 0 || *p == '\r') {
+		return 0;
+	    }
+	    p++;
+	} else if (*p >= 0xC2 && *p <= 0xDF) {
+	    if (q - p < 2 || (p[1] & 0xC0) != 0x80) {
+		return 0;
+	    }
+	    p += 2;
+	} else if (*p >= 0xE0 && *p <= 0xEF) {
+	    if (q - p < 3 || (p[1] & 0xC0) != 0x80 || (p[2] & 0xC0) != 0x80
+		    || (*p == 0xE0 && p[1] < 0xA0)
+		    || (*p == 0xED && p[1] >= 0xA0)) {
+		return 0;
+	    }
+	    p += 3;
+	} else {
+	    return 0;
+	}
+    }
+    return 1;
+}
+#endif /* STEXT_MAPPED_CHARS */
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * LoadConverted --
+ *
+ *	Convert part of a file loaded by the "load" widget command to UTF-8
+ *	and append it to the text, a piece at a time through a fixed-size
+ *	buffer. Line endings are translated as by the "auto" translation of
+ *	a channel. The part must not end between the "\r" and "\n" of a
+ *	line ending.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Text is inserted at the end.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+LoadConverted(
+    TkText *textPtr,		/* Information about text widget. */
+    Tcl_Encoding encoding,	/* Encoding of the file. */
+    CONST char *src,		/* First byte of the part to convert. */
+    int size)			/* Number of bytes in the part. */
+{
+    TkSharedText *sharedTextPtr = textPtr->sharedTextPtr;
+    CONST char *srcEnd = src + size;
+    char *buffer, *dst;
+    Tcl_EncodingState state;
+    TkTextIndex index;
+    Tcl_Obj *chunkPtr;
+    int i, flags, srcLen, srcRead, dstWrote, bufSize, pendingCR = 0;
+
+    /*
+     * A short part, such as a single line between mapped runs, converts in
+     * one go into a buffer of its own size.
+     */
+
+    bufSize = LOAD_CHUNK_SIZE;
+    if (size < LOAD_CHUNK_SIZE / TCL_UTF_MAX) {
+	bufSize = size * TCL_UTF_MAX;
+    }
+    buffer = ckalloc(bufSize + 1);
+
+    flags = TCL_ENCODING_START;
+    do {
+	srcLen = LOAD_CHUNK_SIZE;
+	if (srcEnd - src <= srcLen) {
+	    srcLen = srcEnd - src;
+	    flags |= TCL_ENCODING_END;
+	}
+	Tcl_ExternalToUtf(NULL, encoding, src, srcLen, flags, &state, buffer,
+		bufSize + 1, &srcRead, &dstWrote, NULL);
+	flags &= ~TCL_ENCODING_START;
+	src += srcRead;
+
+	/*
+	 * Translate CR and CRLF to LF. A CR at the end of one piece is
+	 * remembered, so that a LF at the start of the next is dropped.
+	 */
+
+	for (dst = buffer, i = 0; i < dstWrote; i++) {
+	    if (buffer[i] == '\n' && pendingCR) {
+		pendingCR = 0;
+		continue;
+	    }
+	    pendingCR = (buffer[i] == '\r');
+	    *dst++ = pendingCR ? '\n' : buffer[i];
+	}
+	if (dst > buffer) {
+	    /*
+	     * Insert before the final newline. Leaving that to InsertChars
+	     * doesn't do, as it stops a million bytes into a long line.
+	     */
+
+	    chunkPtr = Tcl_NewStringObj(buffer, dst - buffer);
+	    Tcl_IncrRefCount(chunkPtr);
+	    TkTextMakeByteIndex(sharedTextPtr->tree, textPtr,
+		    TkBTreeNumLines(sharedTextPtr->tree, textPtr), 0, &index);
+	    TkTextIndexBackBytes(textPtr, &index, 1, &index);
+	    InsertChars(sharedTextPtr, textPtr, &index, chunkPtr, 1);
+	    Tcl_DecrRefCount(chunkPtr);
+	}
+    } while (srcRead > 0 && src < srcEnd);
+    ckfree(buffer);
+}
+
+#ifdef STEXT_MAPPED_CHARS
+/*
+ *----------------------------------------------------------------------
+ *
+ * LoadMapped --
+ *
+ *	Append whole lines of a file loaded by the "load" widget command to
+ *	the text, as segments that point into the mapping of the file. See
+ *	TkBTreeInsertMapped for what the lines must be like.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Lines are inserted at the end.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+LoadMapped(
+    TkText *textPtr,		/* Information about text widget. */
+    TkTextMapping *mapPtr,	/* Mapping of the file. */
+    CONST char *start,		/* First byte of the lines. */
+    int numBytes)		/* Number of bytes in the lines. */
+{
+    TkSharedText *sharedTextPtr = textPtr->sharedTextPtr;
+    TkTextIndex index;
+    TkText *tPtr;
+
+    /*
+     * Everything loaded so far ends with a newline, so the text ends with
+     * an empty line and the new lines go at its start.
+     */
+
+    TkTextMakeByteIndex(sharedTextPtr->tree, textPtr,
+	    TkBTreeNumLines(sharedTextPtr->tree, textPtr) - 1, 0, &index);
+    TkTextChanged(sharedTextPtr, NULL, &index, &index);
+    sharedTextPtr->stateEpoch++;
+    TkBTreeInsertMapped(sharedTextPtr->tree, &index, mapPtr, start,
+	    numBytes);
+    for (tPtr = sharedTextPtr->peers; tPtr != NULL ; tPtr = tPtr->next) {
+	tPtr->abortSelections = 1;
+    }
+}
+#endif /* STEXT_MAPPED_CHARS */
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TextLoadCmd --
+ *
+ *	This function is invoked to process the "load" widget command for
+ *	text widgets. The whole text is replaced by the contents of a file,
+ *	which is mapped into memory. For a UTF-8 file, each line that reads
+ *	the same as it would through a channel gets a character segment that
+ *	points into the mapping, so the file isn't copied; a segment is
+ *	copied only when the text around it is first modified. The rest of
+ *	the file, and all of it for another encoding, is converted a piece
+ *	at a time and inserted. Line endings are translated as by the "auto"
+ *	translation of a channel.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	The text is replaced, the undo stack is cleared and the widget is
+ *	marked unmodified, as for a newly opened file. The file stays mapped
+ *	as long as some of the text points into it.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+TextLoadCmd(
+    TkText *textPtr,		/* Information about text widget. */
+    Tcl_Interp *interp,		/* Current interpreter. */
+    int objc,			/* Number of arguments. */
+    Tcl_Obj *CONST objv[])	/* Argument objects. */
+{
+    static CONST char *loadOptionStrings[] = {
+	"-encoding", "-file", NULL
+    };
+    enum loadOptions {
+	LOAD_ENCODING, LOAD_FILE
+    };
+    TkSharedText *sharedTextPtr = textPtr->sharedTextPtr;
+    Tcl_Obj *pathPtr = NULL;
+    CONST char *encodingName = NULL;
+    Tcl_Encoding encoding;
+    TkTextMapping *mapPtr;
+    TkTextIndex index1, index2;
+    TkText *peer;
+    CONST char *data, *dataEnd;
+    int i, undo, oldDirty;
+#ifdef STEXT_MAPPED_CHARS
+    CONST char *p, *eol, *mapStart = NULL, *convStart = NULL;
+#endif
+
+    for (i = 2; i < objc; i += 2) {
+	int optionIndex;
+
+	if (Tcl_GetIndexFromObj(interp, objv[i], loadOptionStrings,
+		"option", 0, &optionIndex) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	if (i + 1 == objc) {
+	    Tcl_AppendResult(interp, "value for \"", Tcl_GetString(objv[i]),
+		    "\" missing", NULL);
+	    return TCL_ERROR;
+	}
+	switch ((enum loadOptions) optionIndex) {
+	case LOAD_ENCODING:
+	    encodingName = Tcl_GetString(objv[i+1]);
+	    break;
+	case LOAD_FILE:
+	    pathPtr = objv[i+1];
+	    break;
+	}
+    }
+    if (pathPtr == NULL) {
+	Tcl_WrongNumArgs(interp, 2, objv, "-file fileName ?-encoding name?");
+	return TCL_ERROR;
+    }
+    if (textPtr->state != TK_TEXT_STATE_NORMAL) {
+	return TCL_OK;
+    }
+
+    /*
+     * Like a channel, default to the system encoding.
+     */
+
+    encoding = Tcl_GetEncoding(interp, encodingName);
+    if (encoding == NULL) {
+	return TCL_ERROR;
+    }
+    mapPtr = MapFile(pathPtr);
+    if (mapPtr == NULL) {
+	Tcl_FreeEncoding(encoding);
+	Tcl_AppendResult(interp, "couldn't load \"", Tcl_GetString(pathPtr),
+		"\": ", Tcl_PosixError(interp), NULL);
+	return TCL_ERROR;
+    }
+    data = mapPtr->data;
+    dataEnd = data + mapPtr->size;
+
+    /*
+     * Replace the text without recording undo actions or letting the
+     * insertions mark the widget modified.
+     */
+
+    undo = sharedTextPtr->undo;
+    sharedTextPtr->undo = 0;
+    oldDirty = sharedTextPtr->isDirty;
+    sharedTextPtr->dirtyMode = TK_TEXT_DIRTY_FIXED;
+
+    for (peer = sharedTextPtr->peers; peer != NULL; peer = peer->next) {
+	SetFoldHighlightLine(peer, NULL);
+    }
+    TkTextMakeByteIndex(sharedTextPtr->tree, textPtr, 0, 0, &index1);
+    TkTextMakeByteIndex(sharedTextPtr->tree, textPtr,
+	    TkBTreeNumLines(sharedTextPtr->tree, textPtr), 0, &index2);
+    DeleteIndexRange(NULL, textPtr, &index1, &index2, 1);
+
+#ifdef STEXT_MAPPED_CHARS
+    if (strcmp(Tcl_GetEncodingName(encoding), "utf-8") == 0) {
+	/*
+	 * Gather runs of lines that can be mapped, and runs that must be
+	 * converted. The last line of the file is always converted, so that
+	 * every mapped line is followed by another byte of the mapping.
+	 */
+
+	for (p = data; p < dataEnd; p = eol) {
+	    eol = memchr(p, '\n', (size_t) (dataEnd - p));
+	    eol = (eol == NULL) ? dataEnd : eol + 1;
+	    if (eol < dataEnd && MappableLine(p, eol)) {
+		if (convStart != NULL) {
+		    LoadConverted(textPtr, encoding, convStart, p - convStart);
+		    convStart = NULL;
+		}
+		if (mapStart == NULL) {
+		    mapStart = p;
+		}
+		continue;
+	    }
+	    if (mapStart != NULL) {
+		LoadMapped(textPtr, mapPtr, mapStart, p - mapStart);
+		mapStart = NULL;
+	    }
+	    if (convStart == NULL) {
+		convStart = p;
+	    } else if (p - convStart >= LOAD_CHUNK_SIZE) {
+		LoadConverted(textPtr, encoding, convStart, p - convStart);
+		convStart = p;
+	    }
+	}
+	if (convStart != NULL) {
+	    LoadConverted(textPtr, encoding, convStart, dataEnd - convStart);
+	}
+    } else
+#endif /* STEXT_MAPPED_CHARS */
+    if (data != NULL) {
+	LoadConverted(textPtr, encoding, data, dataEnd - data);
+    }
+    TkTextReleaseMapping(mapPtr);
+    Tcl_FreeEncoding(encoding);
+
+    sharedTextPtr->undo = undo;
+    TkUndoClearStacks(sharedTextPtr->undoStack);
+    sharedTextPtr->isDirty = 0;
+    sharedTextPtr->dirtyMode = TK_TEXT_DIRTY_NORMAL;
+    if (oldDirty) {
+	for (peer = sharedTextPtr->peers; peer != NULL; peer = peer->next) {
+	    GenerateModifiedEvent(peer);
+	}
+    }
+    return TCL_OK;
+}
+#endif /* STEXT_DIFF */
 
 /*
  *----------------------------------------------------------------------
@@ -4323,7 +4977,7 @@ TextSearchIndexInLine(
 	    } else if (searchSpecPtr->exact) {
 		index += segPtr->size;
 	    } else {
-		index += Tcl_NumUtfChars(segPtr->body.chars, -1);
+		index += Tcl_NumUtfChars(segPtr->body.chars, segPtr->size);
 	    }
 	}
 	leftToScan -= segPtr->size;
@@ -4586,7 +5240,8 @@ TextSearchFoundMatch(
 		if (searchSpecPtr->exact) {
 		    matchOffset += segPtr->size;
 		} else {
-		    matchOffset += Tcl_NumUtfChars(segPtr->body.chars, -1);
+		    matchOffset += Tcl_NumUtfChars(segPtr->body.chars,
+			    segPtr->size);
 		}
 	    } else {
 		leftToScan -= segPtr->size;
@@ -4678,13 +5333,13 @@ TextSearchFoundMatch(
 #else
 		&& TkTextIsElided(textPtr, &curIndex, NULL)) {
 #endif
-	    numChars += Tcl_NumUtfChars(segPtr->body.chars, -1);
+	    numChars += Tcl_NumUtfChars(segPtr->body.chars, segPtr->size);
 	    continue;
 	}
 	if (searchSpecPtr->exact) {
 	    leftToScan -= segPtr->size;
 	} else {
-	    leftToScan -= Tcl_NumUtfChars(segPtr->body.chars, -1);
+	    leftToScan -= Tcl_NumUtfChars(segPtr->body.chars, segPtr->size);
 	}
     }
 
@@ -36,6 +36,7 @@
 #define STEXT_LINE_MARKERS
 #define STEXT_MARGINS
 #define STEXT_STYLE_HACK
+#define STEXT_STYLE_RUNS
 #define STEXT_LINE_NUMBER
 #define STEXT_LINE_VISIBLE
 #define STEXT_EDGE_LINE
@@ -44,6 +45,7 @@
 #define STEXT_FOLDING
 #define STEXT_DLINE_CACHE
 #define STEXT_LINE_FLAGS
+#define STEXT_MAPPED_CHARS
 
 #ifndef MODULE_SCOPE /* for < 8.4.13 */
 #   ifdef __cplusplus
@@ -70,6 +72,8 @@
  */
 
 typedef struct TkTextBTree_ *TkTextBTree;
+typedef struct TkTextPool TkTextPool;
+typedef struct TkTextMapping TkTextMapping;
 
 #ifdef STEXT_LINE_FLAGS
 typedef struct TkTextLinePeerData {
@@ -83,6 +87,7 @@ typedef struct TkTextLinePeerData {
 #define LINE_FLAG_HIDDEN	0x0002
 #define LINE_FLAG_HIGHLIGHT	0x0004
 #define LINE_FLAG_STARTEND	0x0008
+#define LINE_FLAG_RESTYLE	0x0010
 #define LINE_FLAG_MARKER1	0x00010000
 #define LINE_FLAG_MARKER2	0x00020000
 #define LINE_FLAG_MARKER3	0x00030000
@@ -92,6 +97,51 @@ typedef struct TkTextLinePeerData {
 } TkTextLinePeerData;
 #endif
 
+#ifdef STEXT_STYLE_RUNS
+/*
+ * Lexer styles for a line are stored as runs of bytes with the same style,
+ * indexed by byte index within the line. Embedded windows and images are
+ * covered by unstyled runs. Bytes past the last run are unstyled.
+ */
+
+typedef struct TkTextStyleRun {
+    unsigned char style;	/* Lexer style, 0xFF for no style. */
+    unsigned char count;	/* Number of bytes, 1-255. Longer runs are
+				 * split. */
+} TkTextStyleRun;
+
+/*
+ * Every STYLE_RUNS_PER_MARK runs the byte index where the runs so far end is
+ * kept in "marks", so a byte can be found by binary search over the marks
+ * and a short walk over the runs after one, instead of adding up the counts
+ * of all the runs before it.
+ */
+
+#define STYLE_RUNS_PER_MARK 16
+
+typedef struct TkTextStyleRuns {
+    int numRuns;		/* Number of runs below. */
+    int *marks;			/* marks[i] is the byte index past run
+				 * (i + 1) * STYLE_RUNS_PER_MARK - 1. There
+				 * are numRuns / STYLE_RUNS_PER_MARK of
+				 * them, stored after the runs. */
+    TkTextStyleRun runs[1];	/* Actual size varies. */
+} TkTextStyleRuns;
+#endif
+
+#ifdef STEXT_DIFF
+/*
+ * Lexer state of a line that doesn't fit in an int, such as the delimiter
+ * of a here document. Compared byte for byte to tell whether the state the
+ * next line starts from changed.
+ */
+
+typedef struct TkTextLineState {
+    int size;			/* Number of bytes in data. */
+    char data[1];		/* Actual size varies. */
+} TkTextLineState;
+#endif
+
 /*
  * The data structure below defines a single logical line of text (from
  * newline to newline, not necessarily what appears on one display line of the
@@ -122,20 +172,51 @@ typedef struct TkTextLine {
     int flags;			/* LINE_FLAG_STARTEND, LINE_FLAG_MARKER1-4
 				 * This is a quick way to determine if a
 				 * line is a -startline or -endline or if
-				 * it has any linemarkers. */
+				 * it has any linemarkers.
+				 * LINE_FLAG_RESTYLE: the line used a
+				 * keyword that changed, and is waiting for
+				 * the lexer. */
     int state; /* This is used by a lexer to keep track of a style that
 		* should continue to the next line, such as within a
 		* comment or string. */
+    short styleEOL;		/* Lexer style of the newline, -1 if
+				 * unstyled. Together with state and level
+				 * this is the checkpoint lexing of the next
+				 * line starts from. */
+    TkTextLineState *stateExt;	/* State the lexer keeps beyond "state",
+				 * or NULL. Part of the checkpoint too. */
+    unsigned int keywordBits;	/* One bit for the hash of each word the
+				 * lexer looked up in its keyword lists, so
+				 * a change to the lists needn't restyle
+				 * lines that can't have used the words. */
 #endif
 #ifdef STEXT_FOLDING
     int level;
 #endif
+#ifdef STEXT_STYLE_RUNS
+    TkTextStyleRuns *styles;	/* Lexer styles for this line, or NULL if
+				 * the line is unstyled. */
+#endif
 } TkTextLine;
 
+#ifdef STEXT_STYLE_RUNS
+#define STEXT_INIT_LINE(L) \
+    (L)->flags = 0; \
+    (L)->state = 0; \
+    (L)->styleEOL = -1; \
+    (L)->stateExt = NULL; \
+    (L)->keywordBits = 0; \
+    (L)->level = 0; \
+    (L)->styles = NULL;
+#else
 #define STEXT_INIT_LINE(L) \
     (L)->flags = 0; \
     (L)->state = 0; \
+    (L)->styleEOL = -1; \
+    (L)->stateExt = NULL; \
+    (L)->keywordBits = 0; \
     (L)->level = 0;
+#endif
 
 /*
  * -----------------------------------------------------------------------
@@ -246,7 +327,7 @@ typedef struct TkTextEmbImage {
 				 * specifications. */
 } TkTextEmbImage;
 
-#ifdef STEXT_STYLE_HACK
+#if defined(STEXT_STYLE_HACK) && !defined(STEXT_STYLE_RUNS)
 typedef struct TkTextChSt
 {
     char *chars; /* Points into data */
@@ -255,6 +336,42 @@ typedef struct TkTextChSt
 } TkTextChSt;
 #endif /* STEXT_STYLE_HACK */
 
+#if defined(STEXT_MAPPED_CHARS) && !defined(STEXT_STYLE_RUNS)
+#undef STEXT_MAPPED_CHARS	/* The style hack keeps the styles of a
+				 * segment after its characters. */
+#endif
+
+/*
+ * A file mapped into memory by the "load" widget command. Character
+ * segments may point into the mapping instead of holding characters of
+ * their own. Such a segment is copied into an ordinary one when the text
+ * around it is modified, and the file is unmapped once no segment points
+ * into it.
+ */
+
+struct TkTextMapping {
+    char *data;			/* The mapped file. */
+    size_t size;		/* Size of the file in bytes. */
+    int refCount;		/* Number of segments pointing into the
+				 * mapping, plus one while it is loaded. */
+    ClientData handle;		/* Platform handle of the mapping, if it
+				 * needs one to be unmapped. */
+};
+
+#ifdef STEXT_MAPPED_CHARS
+typedef struct TkTextChars {
+    char *chars;		/* Points into data, or into the mapping of
+				 * a mapped segment. Only the characters of
+				 * an ordinary segment are followed by a
+				 * null. */
+    union {
+	char data[4];		/* Characters of an ordinary segment. Actual
+				 * size varies. */
+	TkTextMapping *mapPtr;	/* Mapping that chars points into. */
+    } u;
+} TkTextChars;
+#endif /* STEXT_MAPPED_CHARS */
+
 /*
  * The data structure below defines line segments.
  */
@@ -269,9 +386,12 @@ typedef struct TkTextSegment {
     int size;			/* Size of this segment (# of bytes of index
 				 * space it occupies). */
     union {
-#ifdef STEXT_STYLE_HACK
+#if defined(STEXT_STYLE_HACK) && !defined(STEXT_STYLE_RUNS)
 	char *chars;		/* Overlaps TkTextChSt.chars */
 	TkTextChSt chst;
+#elif defined(STEXT_MAPPED_CHARS)
+	char *chars;		/* Overlaps TkTextChars.chars */
+	TkTextChars ch;
 #else /* STEXT_STYLE_HACK */
 	char chars[4];		/* Characters that make up character info.
 				 * Actual length varies to hold as many
@@ -284,6 +404,13 @@ typedef struct TkTextSegment {
     } body;
 } TkTextSegment;
 
+/*
+ * Macro that determines the size of a mark segment:
+ */
+
+#define MSEG_SIZE ((unsigned) (Tk_Offset(TkTextSegment, body) \
+	+ sizeof(TkTextMark)))
+
 /*
  * Data structures of the type defined below are used during the execution of
  * Tcl commands to keep track of various interesting places in a text. An
@@ -629,6 +756,8 @@ typedef struct TkSharedText {
     int refCount;		/* Reference count this shared object. */
     TkTextBTree tree;		/* B-tree representation of text and tags for
 				 * widget. */
+    TkTextPool *poolPtr;	/* Memory pool from which the B-tree allocates
+				 * its lines and segments. */
     Tcl_HashTable tagTable;	/* Hash table that maps from tag names to
 				 * pointers to TkTextTag structures. The "sel"
 				 * tag does not feature in this table, since
@@ -684,6 +813,12 @@ typedef struct TkSharedText {
 #ifdef STEXT_DIFF
      struct Lexer *lexer;
 #endif /* STEXT_DIFF */
+#ifdef STEXT_STYLE_HACK
+    int tagEpoch;		/* This is incremented each time a tag is
+				 * configured, added, removed or deleted, and
+				 * means that styles cached by the display
+				 * for lexer styles are no longer valid. */
+#endif /* STEXT_STYLE_HACK */
  
     /*
      * Keep track of all the peers
@@ -971,7 +1106,7 @@ typedef struct TkText {
  */
 
 typedef TkTextSegment *	Tk_SegSplitProc(struct TkTextSegment *segPtr,
-			    int index);
+			    int index, TkTextLine *linePtr);
 typedef int		Tk_SegDeleteProc(struct TkTextSegment *segPtr,
 			    TkTextLine *linePtr, int treeGone);
 typedef TkTextSegment *	Tk_SegCleanupProc(struct TkTextSegment *segPtr,
@@ -1156,6 +1291,9 @@ MODULE_SCOPE const Tk_SegType tkTextToggleOffType;
 #ifdef STEXT_DIFF
 #define Tk_TextObjCmd STextObjCmd
 #define TkBTreeAdjustPixelHeight SBTreeAdjustPixelHeight
+#define TkBTreeAllocSegment SBTreeAllocSegment
+#define TkBTreeBytesTo SBTreeBytesTo
+#define TkBTreeCharsTo SBTreeCharsTo
 #define TkBTreeCharTagged SBTreeCharTagged
 #define TkBTreeCheck SBTreeCheck
 #define TkBTreeCreate SBTreeCreate
@@ -1165,10 +1303,18 @@ MODULE_SCOPE const Tk_SegType tkTextToggleOffType;
 #define TkBTreeDestroy SBTreeDestroy
 #define TkBTreeDeleteIndexRange SBTreeDeleteIndexRange
 #define TkBTreeEpoch SBTreeEpoch
+#define TkBTreeFindByteLine SBTreeFindByteLine
+#define TkBTreeFindCharLine SBTreeFindCharLine
 #define TkBTreeFindLine SBTreeFindLine
 #define TkBTreeFindPixelLine SBTreeFindPixelLine
+#define TkBTreeFreeLineState SBTreeFreeLineState
+#define TkBTreeFreeSegment SBTreeFreeSegment
+#define TkBTreeFreeStyles SBTreeFreeStyles
+#define TkBTreeGetStyle SBTreeGetStyle
+#define TkBTreeGetStyles SBTreeGetStyles
 #define TkBTreeGetTags SBTreeGetTags
 #define TkBTreeInsertChars SBTreeInsertChars
+#define TkBTreeInsertMapped SBTreeInsertMapped
 #define TkBTreeLinesTo SBTreeLinesTo
 #define TkBTreePixelsTo SBTreePixelsTo
 #define TkBTreeLinkSegment SBTreeLinkSegment
@@ -1178,6 +1324,7 @@ MODULE_SCOPE const Tk_SegType tkTextToggleOffType;
 #define TkBTreeNumPixels SBTreeNumPixels
 #define TkBTreePreviousLine SBTreePreviousLine
 #define TkBTreePrevTag SBTreePrevTag
+#define TkBTreeSetStyles SBTreeSetStyles
 #define TkBTreeStartSearch SBTreeStartSearch
 #define TkBTreeStartSearchBack SBTreeStartSearchBack
 #define TkBTreeTag SBTreeTag
@@ -1249,6 +1396,12 @@ MODULE_SCOPE const Tk_SegType tkTextToggleOffType;
 MODULE_SCOPE int	TkBTreeAdjustPixelHeight(const TkText *textPtr,
 			    TkTextLine *linePtr, int newPixelHeight,
 			    int mergedLogicalLines);
+MODULE_SCOPE TkTextSegment *TkBTreeAllocSegment(TkTextBTree tree,
+			    unsigned size);
+MODULE_SCOPE int	TkBTreeBytesTo(const TkText *textPtr,
+			    TkTextLine *linePtr);
+MODULE_SCOPE int	TkBTreeCharsTo(const TkText *textPtr,
+			    TkTextLine *linePtr, TkTextCountType type);
 MODULE_SCOPE int	TkBTreeCharTagged(const TkTextIndex *indexPtr,
 			    TkTextTag *tagPtr);
 MODULE_SCOPE void	TkBTreeCheck(TkTextBTree tree);
@@ -1263,12 +1416,30 @@ MODULE_SCOPE void	TkBTreeDestroy(TkTextBTree tree);
 MODULE_SCOPE void	TkBTreeDeleteIndexRange(TkTextBTree tree,
 			    TkTextIndex *index1Ptr, TkTextIndex *index2Ptr);
 MODULE_SCOPE int	TkBTreeEpoch(TkTextBTree tree);
+MODULE_SCOPE TkTextLine *TkBTreeFindByteLine(TkTextBTree tree,
+			    const TkText *textPtr, int offset,
+			    int *offsetPtr);
+MODULE_SCOPE TkTextLine *TkBTreeFindCharLine(TkTextBTree tree,
+			    const TkText *textPtr, int offset,
+			    TkTextCountType type, int *offsetPtr);
 MODULE_SCOPE TkTextLine *TkBTreeFindLine(TkTextBTree tree,
 			    const TkText *textPtr, int line);
 MODULE_SCOPE TkTextLine *TkBTreeFindPixelLine(TkTextBTree tree,
 			    const TkText *textPtr, int pixels,
 			    int *pixelOffset);
+MODULE_SCOPE void	TkBTreeFreeSegment(TkTextBTree tree,
+			    TkTextSegment *segPtr, unsigned size);
+#ifdef STEXT_STYLE_RUNS
+MODULE_SCOPE void	TkBTreeFreeStyles(TkTextLine *linePtr);
+MODULE_SCOPE int	TkBTreeGetStyle(TkTextLine *linePtr, int byteIndex,
+			    int *endPtr);
+MODULE_SCOPE void	TkBTreeGetStyles(TkTextLine *linePtr, int byteIndex,
+			    int count, char *styles);
+MODULE_SCOPE void	TkBTreeSetStyles(TkTextLine *linePtr,
+			    const char *styles, int count);
+#endif
 #ifdef STEXT_DIFF
+MODULE_SCOPE void	TkBTreeFreeLineState(TkTextLine *linePtr);
 MODULE_SCOPE TkTextTag **TkBTreeGetTags(const TkTextIndex *indexPtr,
 			    const TkText *textPtr, TkTextTagInfo *tagInfo);
 MODULE_SCOPE void	TkTextFreeTagInfo(TkTextTagInfo *tagInfo);
@@ -1278,6 +1449,11 @@ MODULE_SCOPE TkTextTag **TkBTreeGetTags(const TkTextIndex *indexPtr,
 #endif
 MODULE_SCOPE void	TkBTreeInsertChars(TkTextBTree tree,
 			    TkTextIndex *indexPtr, const char *string);
+#ifdef STEXT_MAPPED_CHARS
+MODULE_SCOPE void	TkBTreeInsertMapped(TkTextBTree tree,
+			    TkTextIndex *indexPtr, TkTextMapping *mapPtr,
+			    const char *start, int numBytes);
+#endif
 MODULE_SCOPE int	TkBTreeLinesTo(const TkText *textPtr,
 			    TkTextLine *linePtr);
 MODULE_SCOPE int	TkBTreePixelsTo(const TkText *textPtr,
@@ -1331,6 +1507,7 @@ MODULE_SCOPE TkTextTag *TkTextCreateTag(TkText *textPtr,
 MODULE_SCOPE void	TkTextFreeDInfo(TkText *textPtr);
 MODULE_SCOPE void	TkTextDeleteTag(TkText *textPtr, TkTextTag *tagPtr);
 MODULE_SCOPE void	TkTextFreeTag(TkText *textPtr, TkTextTag *tagPtr);
+MODULE_SCOPE void	TkTextReleaseMapping(TkTextMapping *mapPtr);
 MODULE_SCOPE int	TkTextGetIndex(Tcl_Interp *interp, TkText *textPtr,
 			    const char *string, TkTextIndex *indexPtr);
 MODULE_SCOPE int	TkTextGetObjIndex(Tcl_Interp *interp, TkText *textPtr,
@@ -1477,15 +1654,28 @@ MODULE_SCOPE int	TkTextLexerCmd(TkText *textPtr, Tcl_Interp *interp,
 MODULE_SCOPE bool	Lexer_OwnsTag(struct Lexer *lexer, TkTextTag *tagPtr);
 MODULE_SCOPE TkTextTag *Lexer_TagAtIndex(struct Lexer *lexer,
 			    CONST TkTextIndex *indexPtr);
+MODULE_SCOPE int	Lexer_StyleAtIndex(struct Lexer *lexer,
+			    CONST TkTextIndex *indexPtr);
+struct LexerModule;
+MODULE_SCOPE struct Lexer *Lexer_NewInstance(Tcl_Interp *interp,
+			    TkText *textPtr, struct LexerModule *lm);
 MODULE_SCOPE void	Lexer_FreeInstance(TkText *textPtr,
 			    struct Lexer *lexer);
+MODULE_SCOPE struct LexerModule *LexerModule_Head(Tcl_Interp *interp);
+MODULE_SCOPE int	LexerModule_Load(Tcl_Interp *interp, Tcl_Obj *pathPtr);
 MODULE_SCOPE void	LexerInsertion(TkSharedText *sharedPtr, int startLine,
 			    int numLines);
 MODULE_SCOPE void	LexerDeletion(TkSharedText *sharedPtr, int startLine,
 			    int numLines);
-MODULE_SCOPE void	LexerLexNeeded(TkSharedText *sharedPtr);
+MODULE_SCOPE void	LexerLexNeeded(TkText *textPtr);
+MODULE_SCOPE void	LexerLexThrough(TkSharedText *sharedPtr,
+			    int lineIndex);
+MODULE_SCOPE void	LexerFoldsWanted(TkSharedText *sharedPtr,
+			    int lineIndex);
 MODULE_SCOPE void	ToggleContraction(TkText *textPtr,
 			    TkTextLine *linePtr);
+MODULE_SCOPE void	FoldLines(TkText *textPtr, TkTextLine *firstPtr,
+			    TkTextLine *lastPtr, int depth);
 MODULE_SCOPE TkTextLine *GetLastChild(TkSharedText *sharedPtr,
 			    TkTextLine *linePtr);
 MODULE_SCOPE TkTextLine *GetFoldParent(TkSharedText *sharedPtr,
@@ -1511,6 +1701,8 @@ MODULE_SCOPE void	SetLineFoldLevel(TkSharedText *sharedPtr,
 			    TkTextLine *linePtr, int depth, int level);
 MODULE_SCOPE int	GetLineFoldDepth(TkSharedText *sharedPtr,
 			    TkTextLine *linePtr);
+MODULE_SCOPE int	GetLineFoldLevel(TkSharedText *sharedPtr,
+			    TkTextLine *linePtr);
 
 MODULE_SCOPE void	TkTextEventuallyUpdateDInfo(TkText *textPtr);
 MODULE_SCOPE void	TkTextEventuallyRelayoutWindow(TkText *textPtr);
@@ -1531,6 +1723,15 @@ MODULE_SCOPE TkTextLine *TkBTreePreviousLineVisible(CONST TkText *textPtr,
 			    TkTextLine *linePtr);
 MODULE_SCOPE void	TkBTreeToggleLineVisible(CONST TkText *textPtr,
 			    TkTextLine *linePtr);
+MODULE_SCOPE void	TkBTreeRecountLinesVisible(CONST TkText *textPtr,
+			    TkTextLine *firstPtr, TkTextLine *lastPtr);
+#ifdef STEXT_FOLDING
+MODULE_SCOPE void	TkBTreeLineFoldChanged(TkTextLine *linePtr);
+MODULE_SCOPE TkTextLine *TkBTreeNextLineFoldDepth(TkTextLine *linePtr,
+			    int depth);
+MODULE_SCOPE TkTextLine *TkBTreePreviousFoldHeader(TkTextLine *linePtr,
+			    int depth);
+#endif
 
 MODULE_SCOPE void	TkTextInitLineMarkers(TkText *textPtr);
 MODULE_SCOPE void	TkTextFreeLineMarkers(TkText *textPtr);
@@ -41,7 +41,10 @@
 
 /*
  * The data structure below keeps summary information about one tag as part of
- * the tag information in a node.
+ * the tag information in a node. The summaries of a node are kept in an
+ * array sorted by the address of the tag, so that the one for a given tag
+ * can be found with a binary search. With syntax highlighting every style
+ * of the lexer is a tag, and a node easily has a few dozen of them.
  */
 
 typedef struct Summary {
@@ -49,8 +52,6 @@ typedef struct Summary {
     int toggleCount;		/* Number of transitions into or out of this
 				 * tag that occur in the subtree rooted at
 				 * this node. */
-    struct Summary *nextPtr;	/* Next in list of all tags for same node, or
-				 * NULL if at end of list. */
 } Summary;
 
 /*
@@ -62,9 +63,12 @@ typedef struct Node {
 				 * the root. */
     struct Node *nextPtr;	/* Next in list of siblings with the same
 				 * parent node, or NULL for end of list. */
-    Summary *summaryPtr;	/* First in malloc-ed list of info about tags
-				 * in this subtree (NULL if no tag info in the
-				 * subtree). */
+    Summary *summaries;		/* Malloc-ed array of info about tags in this
+				 * subtree, sorted by tag address (NULL if no
+				 * tag info was ever in the subtree). */
+    int numSummaries;		/* Number of entries used in summaries. */
+    int summarySpace;		/* Number of entries allocated for
+				 * summaries. */
     int level;			/* Level of this node in the B-tree. 0 refers
 				 * to the bottom of the tree (children are
 				 * lines, not nodes). */
@@ -75,6 +79,13 @@ typedef struct Node {
     int numChildren;		/* Number of children of this node. */
     int numLines;		/* Total number of lines (leaves) in the
 				 * subtree rooted here. */
+    int numBytes;		/* Total number of bytes in the lines of the
+				 * subtree rooted here. */
+    int numChars;		/* Total number of characters in the char
+				 * segments of the subtree rooted here. */
+    int numEmbedded;		/* Total size of the other segments (embedded
+				 * windows and images) in the subtree rooted
+				 * here; each of them is one index. */
 #ifdef STEXT_LINE_VISIBLE
     int *numLinesVisible;	/* Total number of non-hidden lines in
 				 * the subtree rooted here, one entry for
@@ -83,8 +94,30 @@ typedef struct Node {
     int *numPixels;		/* Array containing total number of vertical
 				 * display pixels in the subtree rooted here,
 				 * one entry for each peer widget. */
+    TkTextPool *poolPtr;	/* Pool of the shared text, from which the
+				 * lines below this node and their segments
+				 * are allocated. */
+#ifdef STEXT_FOLDING
+    int minFoldDepth;		/* Smallest fold depth of a line in the
+				 * subtree rooted here. */
+    int minHeaderDepth;		/* Smallest fold depth of a fold header in the
+				 * subtree rooted here, FOLD_DEPTH_NONE if
+				 * there is none. */
+    bool foldStale;		/* The two fields above must be recomputed.
+				 * If a node is stale, so are all of its
+				 * ancestors. */
+#endif
 } Node;
 
+/*
+ * Macro that tells whether the subtree of a node has toggles for the tag of
+ * a search, or for any tag at all if the search is for all tags:
+ */
+
+#define SEARCH_IN_NODE(searchPtr, nodePtr) \
+	((searchPtr)->allTags ? (nodePtr)->numSummaries > 0 \
+	: FindSummary((nodePtr), (searchPtr)->tagPtr) != NULL)
+
 /*
  * Used to avoid having to allocate and deallocate arrays on the fly for
  * commonly used functions. Must be > 0.
@@ -101,6 +134,23 @@ typedef struct Node {
 #define MAX_CHILDREN 12
 #define MIN_CHILDREN 6
 
+/*
+ * An insert that adds more than this many lines to a node is rebalanced by
+ * RebalanceBulk, which packs the new lines into nearly full nodes, instead of
+ * by Rebalance.
+ */
+
+#define BULK_INSERT_LINES (MAX_CHILDREN * MAX_CHILDREN)
+
+/*
+ * The kinds of offsets that OffsetTo and FindOffsetLine work with. Indices
+ * are the characters plus the embedded windows and images.
+ */
+
+#define OFFSET_BYTES	0
+#define OFFSET_CHARS	1
+#define OFFSET_INDICES	2
+
 /*
  * The data structure below defines an entire B-tree. Since text widgets are
  * the only current B-tree clients, 'clients' and 'pixelReferences' are
@@ -147,16 +197,92 @@ int tkBTreeDebug = 0;
  * Macros that determine how much space to allocate for new segments:
  */
 
-#ifdef STEXT_STYLE_HACK
+#if defined(STEXT_STYLE_HACK) && !defined(STEXT_STYLE_RUNS)
 #define CSEG_SIZE(chars) ((unsigned) (Tk_Offset(TkTextSegment, body.chst.data) \
 	+ (1 + (chars)) * 2))
+#elif defined(STEXT_MAPPED_CHARS)
+#define CSEG_SIZE(chars) ((unsigned) (Tk_Offset(TkTextSegment, body.ch.u.data) \
+	+ 1 + (chars)))
 #else /* STEXT_STYLE_HACK */
 #define CSEG_SIZE(chars) ((unsigned) (Tk_Offset(TkTextSegment, body) \
 	+ 1 + (chars)))
 #endif /* STEXT_STYLE_HACK */
+
+/*
+ * A mapped character segment holds a pointer to its mapping where an
+ * ordinary one holds its characters.
+ */
+
+#ifdef STEXT_MAPPED_CHARS
+#define CSEG_MAPPED(segPtr) \
+	((segPtr)->body.ch.chars != (segPtr)->body.ch.u.data)
+#define CSEG_MAPPED_SIZE ((unsigned) (Tk_Offset(TkTextSegment, body.ch.u) \
+	+ sizeof(TkTextMapping *)))
+#endif
 #define TSEG_SIZE ((unsigned) (Tk_Offset(TkTextSegment, body) \
 	+ sizeof(TkTextToggle)))
 
+/*
+ * Segments, lines and the per-peer data of lines are allocated from a pool
+ * that belongs to the shared text, rather than one by one with ckalloc.
+ * Blocks are handed out in size classes POOL_GRAIN bytes apart, carved from
+ * chunks of POOL_CHUNK_SIZE bytes, and a freed block goes on the free list
+ * of its class to be reused. Requests larger than POOL_MAX_SIZE go to
+ * ckalloc. The chunks are only released, all at once, when the B-tree is
+ * destroyed.
+ */
+
+#define POOL_GRAIN 8
+#define POOL_MAX_SIZE 256
+#define POOL_CHUNK_SIZE 65536
+#define POOL_CLASS(size) (((size) + POOL_GRAIN - 1) / POOL_GRAIN)
+#define LINE_POOL(linePtr) ((linePtr)->parentPtr->poolPtr)
+
+typedef union PoolChunk {
+    union PoolChunk *nextPtr;	/* Next older chunk of the pool. */
+    double align;		/* Keeps the blocks that follow the header
+				 * aligned. */
+} PoolChunk;
+
+typedef struct PoolBlock {
+    struct PoolBlock *nextPtr;	/* Next block on the same free list. */
+} PoolBlock;
+
+struct TkTextPool {
+    PoolBlock *freePtr[POOL_CLASS(POOL_MAX_SIZE) + 1];
+				/* Free list of each size class. */
+    PoolChunk *chunkPtr;	/* Newest chunk, first in the list of all
+				 * chunks allocated by the pool. */
+    char *nextPtr;		/* First unused byte of the newest chunk. */
+    char *endPtr;		/* End of the newest chunk. */
+};
+
+#ifdef STEXT_STYLE_RUNS
+/*
+ * The structure below is used to build up the style runs of a line.
+ */
+
+typedef struct StyleBuilder {
+    TkTextStyleRun *runs;	/* Runs so far. */
+    int numRuns;		/* Number of runs in use. */
+    int spaceRuns;		/* Number of runs allocated. */
+    TkTextStyleRun staticSpace[64];
+				/* Initial storage, to avoid allocating for
+				 * most lines. */
+} StyleBuilder;
+
+#ifndef MIN
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+#endif
+
+#define StyleBuilderInit(builderPtr) \
+    ((builderPtr)->runs = (builderPtr)->staticSpace, \
+    (builderPtr)->numRuns = 0, (builderPtr)->spaceRuns = 64)
+#endif /* STEXT_STYLE_RUNS */
+
 /*
  * Forward declarations for functions defined in this file:
  */
@@ -165,6 +291,8 @@ static int		AdjustPixelClient(BTree *treePtr, int defaultHeight,
 			    Node *nodePtr, TkTextLine *start, TkTextLine *end,
 			    int useReference, int newPixelReferences,
 			    int *counting);
+static void		ChangeNodeSizes(Node *nodePtr,
+			    const TkTextSegment *segPtr, int sign);
 static void		ChangeNodeToggleCount(Node *nodePtr,
 			    TkTextTag *tagPtr, int delta);
 static void		CharCheckProc(TkTextSegment *segPtr,
@@ -173,11 +301,21 @@ static int		CharDeleteProc(TkTextSegment *segPtr,
 			    TkTextLine *linePtr, int treeGone);
 static TkTextSegment *	CharCleanupProc(TkTextSegment *segPtr,
 			    TkTextLine *linePtr);
-static TkTextSegment *	CharSplitProc(TkTextSegment *segPtr, int index);
+static TkTextSegment *	CharSplitProc(TkTextSegment *segPtr, int index,
+			    TkTextLine *linePtr);
 static void		CheckNodeConsistency(Node *nodePtr, int references);
+static void		FreeChars(TkTextSegment *segPtr,
+			    TkTextLine *linePtr);
 static void		CleanupLine(TkTextLine *linePtr);
-static void		DeleteSummaries(Summary *tagPtr);
-static void		DestroyNode(Node *nodePtr);
+static int		CountChars(const char *string, int numBytes);
+static Summary *	AddSummary(Node *nodePtr, TkTextTag *tagPtr,
+			    int toggleCount);
+static void		DeleteSummaries(Node *nodePtr);
+static void		DestroyNode(BTree *treePtr, Node *nodePtr);
+static Summary *	FindSummary(const Node *nodePtr,
+			    const TkTextTag *tagPtr);
+static TkTextLine *	FindOffsetLine(BTree *treePtr, const TkText *textPtr,
+			    int offset, int kind, int *offsetPtr);
 static TkTextSegment *	FindTagEnd(TkTextBTree tree, TkTextTag *tagPtr,
 			    TkTextIndex *indexPtr);
 #ifdef STEXT_DIFF
@@ -187,11 +325,54 @@ static void		IncCount(TkTextTag *tagPtr, int inc,
 static void		IncCount(TkTextTag *tagPtr, int inc,
 			    TagInfo *tagInfoPtr);
 #endif
+static void		GrowRoot(BTree *treePtr);
+static void		InsertText(TkTextBTree tree, TkTextIndex *indexPtr,
+			    const char *string, int numBytes,
+			    TkTextMapping *mapPtr);
+static int		LineOffsetSize(const TkTextLine *linePtr, int kind);
+#ifdef STEXT_MAPPED_CHARS
+static TkTextSegment *	MappedChars(TkTextLine *linePtr,
+			    TkTextMapping *mapPtr, const char *start,
+			    int numBytes, TkTextSegment **lastPtrPtr);
+#endif
+static int		NodeOffsetSize(const Node *nodePtr, int kind);
+static int		OffsetTo(const TkText *textPtr, TkTextLine *linePtr,
+			    int kind);
+static char *		PoolAlloc(TkTextPool *poolPtr, unsigned size);
+static TkTextPool *	PoolCreate(void);
+static void		PoolDestroy(TkTextPool *poolPtr);
+static void		PoolFree(TkTextPool *poolPtr, char *ptr,
+			    unsigned size);
+static char *		PoolRealloc(TkTextPool *poolPtr, char *ptr,
+			    unsigned oldSize, unsigned newSize);
 static void		Rebalance(BTree *treePtr, Node *nodePtr);
+static void		RebalanceBulk(BTree *treePtr, Node *nodePtr);
 static void		RecomputeNodeCounts(BTree *treePtr, Node *nodePtr);
+#ifdef STEXT_FOLDING
+static void		FoldIndexStale(Node *nodePtr);
+#endif
+static void		RemoveSummary(Node *nodePtr, Summary *summaryPtr);
 static void		RemovePixelClient(BTree *treePtr, Node *nodePtr,
 			    int overwriteWithLast);
 static TkTextSegment *	SplitSeg(TkTextIndex *indexPtr);
+#ifdef STEXT_STYLE_RUNS
+static void		StyleAppend(StyleBuilder *builderPtr, int style,
+			    int count);
+static void		StyleCopy(StyleBuilder *builderPtr,
+			    TkTextStyleRuns *stylesPtr, int first, int last);
+static void		StyleDelete(TkTextLine *linePtr, int byteIndex,
+			    int count);
+static int		StyleFindRun(TkTextStyleRuns *stylesPtr,
+			    int byteIndex, int *startPtr);
+static void		StyleFinish(StyleBuilder *builderPtr,
+			    TkTextLine *linePtr);
+static void		StyleInsert(TkTextLine *linePtr, int byteIndex,
+			    int count);
+static void		StyleJoin(TkTextLine *linePtr, int byteIndex,
+			    TkTextLine *line2Ptr, int byteIndex2);
+static void		StyleSplit(TkTextLine *linePtr, int byteIndex,
+			    TkTextLine *newLinePtr);
+#endif
 static void		ToggleCheckProc(TkTextSegment *segPtr,
 			    TkTextLine *linePtr);
 static TkTextSegment *	ToggleCleanupProc(TkTextSegment *segPtr,
@@ -290,22 +471,34 @@ TkBTreeCreate(
      * of the tree.
      */
 
+    sharedTextPtr->poolPtr = PoolCreate();
     rootPtr = (Node *) ckalloc(sizeof(Node));
-    linePtr = (TkTextLine *) ckalloc(sizeof(TkTextLine));
-    linePtr2 = (TkTextLine *) ckalloc(sizeof(TkTextLine));
+    linePtr = (TkTextLine *)
+	    PoolAlloc(sharedTextPtr->poolPtr, sizeof(TkTextLine));
+    linePtr2 = (TkTextLine *)
+	    PoolAlloc(sharedTextPtr->poolPtr, sizeof(TkTextLine));
     STEXT_INIT_LINE(linePtr)
     STEXT_INIT_LINE(linePtr2)
 
     rootPtr->parentPtr = NULL;
     rootPtr->nextPtr = NULL;
-    rootPtr->summaryPtr = NULL;
+    rootPtr->summaries = NULL;
+    rootPtr->numSummaries = 0;
+    rootPtr->summarySpace = 0;
     rootPtr->level = 0;
     rootPtr->children.linePtr = linePtr;
     rootPtr->numChildren = 2;
     rootPtr->numLines = 2;
+    rootPtr->numBytes = 2;
+    rootPtr->numChars = 2;
+    rootPtr->numEmbedded = 0;
+    rootPtr->poolPtr = sharedTextPtr->poolPtr;
 #ifdef STEXT_LINE_VISIBLE
     rootPtr->numLinesVisible = NULL;
 #endif
+#ifdef STEXT_FOLDING
+    rootPtr->foldStale = true;
+#endif
 
     /*
      * The tree currently has no registered clients, so all pixel count
@@ -323,32 +516,40 @@ TkBTreeCreate(
 
     linePtr->parentPtr = rootPtr;
     linePtr->nextPtr = linePtr2;
-    segPtr = (TkTextSegment *) ckalloc(CSEG_SIZE(1));
+    segPtr = (TkTextSegment *)
+	    PoolAlloc(sharedTextPtr->poolPtr, CSEG_SIZE(1));
     linePtr->segPtr = segPtr;
     segPtr->typePtr = &tkTextCharType;
     segPtr->nextPtr = NULL;
     segPtr->size = 1;
-#ifdef STEXT_STYLE_HACK
+#if defined(STEXT_STYLE_HACK) && !defined(STEXT_STYLE_RUNS)
     segPtr->body.chst.chars = segPtr->body.chst.data;
     segPtr->body.chst.style = segPtr->body.chst.data + segPtr->size + 1;
     segPtr->body.chst.style[0] = -1;
     segPtr->body.chst.style[1] = -1;
+#endif
+#ifdef STEXT_MAPPED_CHARS
+    segPtr->body.ch.chars = segPtr->body.ch.u.data;
 #endif
     segPtr->body.chars[0] = '\n';
     segPtr->body.chars[1] = 0;
 
     linePtr2->parentPtr = rootPtr;
     linePtr2->nextPtr = NULL;
-    segPtr = (TkTextSegment *) ckalloc(CSEG_SIZE(1));
+    segPtr = (TkTextSegment *)
+	    PoolAlloc(sharedTextPtr->poolPtr, CSEG_SIZE(1));
     linePtr2->segPtr = segPtr;
     segPtr->typePtr = &tkTextCharType;
     segPtr->nextPtr = NULL;
     segPtr->size = 1;
-#ifdef STEXT_STYLE_HACK
+#if defined(STEXT_STYLE_HACK) && !defined(STEXT_STYLE_RUNS)
     segPtr->body.chst.chars = segPtr->body.chst.data;
     segPtr->body.chst.style = segPtr->body.chst.data + segPtr->size + 1;
     segPtr->body.chst.style[0] = -1;
     segPtr->body.chst.style[1] = -1;
+#endif
+#ifdef STEXT_MAPPED_CHARS
+    segPtr->body.ch.chars = segPtr->body.ch.u.data;
 #endif
     segPtr->body.chars[0] = '\n';
     segPtr->body.chars[1] = 0;
@@ -515,13 +716,199 @@ TkBTreeDestroy(
      * itself.
      */
 
-    DestroyNode(treePtr->rootPtr);
+    DestroyNode(treePtr, treePtr->rootPtr);
+    PoolDestroy(treePtr->sharedTextPtr->poolPtr);
+    treePtr->sharedTextPtr->poolPtr = NULL;
     if (treePtr->startEnd != NULL) {
 	ckfree((char *) treePtr->startEnd);
 	ckfree((char *) treePtr->startEndRef);
     }
     ckfree((char *) treePtr);
 }
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PoolCreate, PoolDestroy --
+ *
+ *	Create an empty pool for the segments and lines of a B-tree, or
+ *	release all the memory of one at once.
+ *
+ * Results:
+ *	PoolCreate returns the new pool.
+ *
+ * Side effects:
+ *	Memory is allocated or freed. Every block handed out by the pool is
+ *	invalid after PoolDestroy, except those larger than POOL_MAX_SIZE,
+ *	which must have been freed already.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static TkTextPool *
+PoolCreate(void)
+{
+    TkTextPool *poolPtr = (TkTextPool *) ckalloc(sizeof(TkTextPool));
+
+    memset(poolPtr, 0, sizeof(TkTextPool));
+    return poolPtr;
+}
+
+static void
+PoolDestroy(
+    TkTextPool *poolPtr)	/* Pool to destroy. */
+{
+    PoolChunk *chunkPtr;
+
+    while (poolPtr->chunkPtr != NULL) {
+	chunkPtr = poolPtr->chunkPtr;
+	poolPtr->chunkPtr = chunkPtr->nextPtr;
+	ckfree((char *) chunkPtr);
+    }
+    ckfree((char *) poolPtr);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PoolAlloc, PoolFree, PoolRealloc --
+ *
+ *	Allocate, free or resize a block of a pool. The caller must pass the
+ *	size of a block when freeing or resizing it, as the pool doesn't
+ *	record it.
+ *
+ * Results:
+ *	PoolAlloc and PoolRealloc return the block, or NULL if the size is
+ *	zero.
+ *
+ * Side effects:
+ *	A new chunk may be allocated for the pool.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static char *
+PoolAlloc(
+    TkTextPool *poolPtr,	/* Pool to allocate from. */
+    unsigned size)		/* Number of bytes wanted. */
+{
+    PoolBlock *blockPtr;
+    unsigned sizeClass;
+
+    if (size == 0) {
+	return NULL;
+    }
+    if (size > POOL_MAX_SIZE) {
+	return ckalloc(size);
+    }
+    sizeClass = POOL_CLASS(size);
+    blockPtr = poolPtr->freePtr[sizeClass];
+    if (blockPtr != NULL) {
+	poolPtr->freePtr[sizeClass] = blockPtr->nextPtr;
+	return (char *) blockPtr;
+    }
+
+    /*
+     * Carve a new block from the newest chunk. Whatever is left at the end
+     * of a chunk when it gets too small is not used.
+     */
+
+    size = sizeClass * POOL_GRAIN;
+    if (poolPtr->endPtr - poolPtr->nextPtr < (int) size) {
+	PoolChunk *chunkPtr = (PoolChunk *) ckalloc(POOL_CHUNK_SIZE);
+
+	chunkPtr->nextPtr = poolPtr->chunkPtr;
+	poolPtr->chunkPtr = chunkPtr;
+	poolPtr->nextPtr = (char *) (chunkPtr + 1);
+	poolPtr->endPtr = (char *) chunkPtr + POOL_CHUNK_SIZE;
+    }
+    blockPtr = (PoolBlock *) poolPtr->nextPtr;
+    poolPtr->nextPtr += size;
+    return (char *) blockPtr;
+}
+
+static void
+PoolFree(
+    TkTextPool *poolPtr,	/* Pool the block came from. */
+    char *ptr,			/* Block to free, may be NULL. */
+    unsigned size)		/* Size the block was allocated with. */
+{
+    PoolBlock *blockPtr = (PoolBlock *) ptr;
+    unsigned sizeClass;
+
+    if (ptr == NULL) {
+	return;
+    }
+    if (size > POOL_MAX_SIZE) {
+	ckfree(ptr);
+	return;
+    }
+    sizeClass = POOL_CLASS(size);
+    blockPtr->nextPtr = poolPtr->freePtr[sizeClass];
+    poolPtr->freePtr[sizeClass] = blockPtr;
+}
+
+static char *
+PoolRealloc(
+    TkTextPool *poolPtr,	/* Pool the block came from. */
+    char *ptr,			/* Block to resize, may be NULL. */
+    unsigned oldSize,		/* Size the block was allocated with. */
+    unsigned newSize)		/* Size wanted. */
+{
+    char *newPtr;
+
+    if (oldSize > POOL_MAX_SIZE && newSize > POOL_MAX_SIZE) {
+	return ckrealloc(ptr, newSize);
+    }
+    if (ptr != NULL && newSize <= POOL_MAX_SIZE
+	    && POOL_CLASS(oldSize) == POOL_CLASS(newSize)) {
+	return ptr;
+    }
+    newPtr = PoolAlloc(poolPtr, newSize);
+    if (ptr != NULL && newPtr != NULL) {
+	memcpy(newPtr, ptr, oldSize < newSize ? oldSize : newSize);
+    }
+    PoolFree(poolPtr, ptr, oldSize);
+    return newPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkBTreeAllocSegment, TkBTreeFreeSegment --
+ *
+ *	Allocate or free a segment of a B-tree from the pool of its shared
+ *	text. This is used by the segment types implemented outside this
+ *	file, such as marks. The size passed when a segment is freed must be
+ *	the one it was allocated with.
+ *
+ * Results:
+ *	TkBTreeAllocSegment returns the uninitialized segment.
+ *
+ * Side effects:
+ *	Memory is allocated or freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+TkTextSegment *
+TkBTreeAllocSegment(
+    TkTextBTree tree,		/* Tree the segment will be linked into. */
+    unsigned size)		/* Size of the segment in bytes. */
+{
+    return (TkTextSegment *)
+	    PoolAlloc(((BTree *) tree)->sharedTextPtr->poolPtr, size);
+}
+
+void
+TkBTreeFreeSegment(
+    TkTextBTree tree,		/* Tree the segment belonged to. */
+    TkTextSegment *segPtr,	/* Segment, no longer linked into the tree. */
+    unsigned size)		/* Size the segment was allocated with. */
+{
+    PoolFree(((BTree *) tree)->sharedTextPtr->poolPtr, (char *) segPtr,
+	    size);
+}
 
 /*
  *----------------------------------------------------------------------
@@ -581,7 +968,9 @@ TkBTreeRemoveClient(
 	 * The last reference to the tree.
 	 */
 
-	DestroyNode(treePtr->rootPtr);
+	DestroyNode(treePtr, treePtr->rootPtr);
+	PoolDestroy(treePtr->sharedTextPtr->poolPtr);
+	treePtr->sharedTextPtr->poolPtr = NULL;
 	ckfree((char *) treePtr);
 	return;
     } else if (pixelReference == -1) {
@@ -787,11 +1176,14 @@ AdjustPixelClient(
 	    }
 	    if (newPixelReferences != treePtr->pixelReferences) {
 #ifdef STEXT_LINE_FLAGS
-		linePtr->peerData = (TkTextLinePeerData *) ckrealloc(
-			(char *) linePtr->peerData,
+		linePtr->peerData = (TkTextLinePeerData *) PoolRealloc(
+			nodePtr->poolPtr, (char *) linePtr->peerData,
+			sizeof(TkTextLinePeerData) * treePtr->pixelReferences,
 			sizeof(TkTextLinePeerData) * newPixelReferences);
 #else
-		linePtr->pixels = (int *) ckrealloc((char *) linePtr->pixels,
+		linePtr->pixels = (int *) PoolRealloc(nodePtr->poolPtr,
+			(char *) linePtr->pixels,
+			sizeof(int) * 2 * treePtr->pixelReferences,
 			sizeof(int) * 2 * newPixelReferences);
 #endif
 	    }
@@ -911,23 +1303,17 @@ RemovePixelClient(
 			linePtr->pixels[1+2*(treePtr->pixelReferences-1)];
 #endif
 	    }
-	    if (treePtr->pixelReferences == 1) {
-#ifdef STEXT_LINE_FLAGS
-		linePtr->peerData = NULL;
-#else
-		linePtr->pixels = NULL;
-#endif
-	    } else {
 #ifdef STEXT_LINE_FLAGS
-		linePtr->peerData = (TkTextLinePeerData *) ckrealloc(
-			(char *) linePtr->peerData,
-			sizeof(TkTextLinePeerData)
-			* (treePtr->pixelReferences-1));
+	    linePtr->peerData = (TkTextLinePeerData *) PoolRealloc(
+		    nodePtr->poolPtr, (char *) linePtr->peerData,
+		    sizeof(TkTextLinePeerData) * treePtr->pixelReferences,
+		    sizeof(TkTextLinePeerData) * (treePtr->pixelReferences-1));
 #else
-		linePtr->pixels = (int *) ckrealloc((char *) linePtr->pixels,
-			sizeof(int) * 2 * (treePtr->pixelReferences-1));
+	    linePtr->pixels = (int *) PoolRealloc(nodePtr->poolPtr,
+		    (char *) linePtr->pixels,
+		    sizeof(int) * 2 * treePtr->pixelReferences,
+		    sizeof(int) * 2 * (treePtr->pixelReferences-1));
 #endif
-	    }
 	    linePtr = linePtr->nextPtr;
 	}
     }
@@ -952,6 +1338,7 @@ RemovePixelClient(
 
 static void
 DestroyNode(
+    BTree *treePtr,		/* Tree the node belongs to. */
     register Node *nodePtr)	/* Destroy from this node downwards. */
 {
     if (nodePtr->level == 0) {
@@ -966,12 +1353,25 @@ DestroyNode(
 		linePtr->segPtr = segPtr->nextPtr;
 		(*segPtr->typePtr->deleteProc)(segPtr, linePtr, 1);
 	    }
+#ifdef STEXT_DIFF
+	    TkBTreeFreeLineState(linePtr);
+#endif
+#ifdef STEXT_STYLE_RUNS
+	    TkBTreeFreeStyles(linePtr);
+#endif
+
+	    /*
+	     * The line goes with the pool. So does its per-peer data, unless
+	     * there are so many peers that it was too large for the pool.
+	     */
+
 #ifdef STEXT_LINE_FLAGS
-	    ckfree((char *) linePtr->peerData);
+	    PoolFree(nodePtr->poolPtr, (char *) linePtr->peerData,
+		    sizeof(TkTextLinePeerData) * treePtr->pixelReferences);
 #else
-	    ckfree((char *) linePtr->pixels);
+	    PoolFree(nodePtr->poolPtr, (char *) linePtr->pixels,
+		    sizeof(int) * 2 * treePtr->pixelReferences);
 #endif
-	    ckfree((char *) linePtr);
 	}
     } else {
 	register Node *childPtr;
@@ -979,10 +1379,10 @@ DestroyNode(
 	while (nodePtr->children.nodePtr != NULL) {
 	    childPtr = nodePtr->children.nodePtr;
 	    nodePtr->children.nodePtr = childPtr->nextPtr;
-	    DestroyNode(childPtr);
+	    DestroyNode(treePtr, childPtr);
 	}
     }
-    DeleteSummaries(nodePtr->summaryPtr);
+    DeleteSummaries(nodePtr);
     ckfree((char *) nodePtr->numPixels);
 #ifdef STEXT_LINE_FLAGS
     ckfree((char *) nodePtr->numLinesVisible);
@@ -995,8 +1395,8 @@ DestroyNode(
  *
  * DeleteSummaries --
  *
- *	Free up all of the memory in a list of tag summaries associated with a
- *	node.
+ *	Free up all of the memory in the array of tag summaries associated
+ *	with a node.
  *
  * Results:
  *	None.
@@ -1009,16 +1409,113 @@ DestroyNode(
 
 static void
 DeleteSummaries(
-    register Summary *summaryPtr)
-				/* First in list of node's tag summaries. */
+    Node *nodePtr)		/* Node whose tag summaries are freed. */
+{
+    if (nodePtr->summaries != NULL) {
+	ckfree((char *) nodePtr->summaries);
+	nodePtr->summaries = NULL;
+    }
+    nodePtr->numSummaries = 0;
+    nodePtr->summarySpace = 0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FindSummary --
+ *
+ *	Look up the summary information about a tag in a node.
+ *
+ * Results:
+ *	The summary for the tag, or NULL if the node has none, that is if
+ *	there are no toggles for the tag in its subtree or the node is the
+ *	root of the tag.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Summary *
+FindSummary(
+    const Node *nodePtr,	/* Node to look in. */
+    const TkTextTag *tagPtr)	/* Tag to look for. */
 {
-    register Summary *nextPtr;
+    int low = 0, high = nodePtr->numSummaries - 1, middle;
+    Summary *summaryPtr;
+
+    while (low <= high) {
+	middle = (low + high) / 2;
+	summaryPtr = &nodePtr->summaries[middle];
+	if (summaryPtr->tagPtr == tagPtr) {
+	    return summaryPtr;
+	}
+	if (summaryPtr->tagPtr < tagPtr) {
+	    low = middle + 1;
+	} else {
+	    high = middle - 1;
+	}
+    }
+    return NULL;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AddSummary, RemoveSummary --
+ *
+ *	Add the summary information about a tag to a node, which mustn't
+ *	have any for the tag yet, or remove a summary from its node.
+ *
+ * Results:
+ *	AddSummary returns the new summary. It is only valid until the
+ *	summaries of the node are next changed.
+ *
+ * Side effects:
+ *	The array of summaries of the node may be reallocated.
+ *
+ *----------------------------------------------------------------------
+ */
 
-    while (summaryPtr != NULL) {
-	nextPtr = summaryPtr->nextPtr;
-	ckfree((char *) summaryPtr);
-	summaryPtr = nextPtr;
+static Summary *
+AddSummary(
+    Node *nodePtr,		/* Node to add the summary to. */
+    TkTextTag *tagPtr,		/* Tag the summary is about. */
+    int toggleCount)		/* Toggles for the tag below the node. */
+{
+    Summary *summaryPtr;
+    int i;
+
+    if (nodePtr->numSummaries == nodePtr->summarySpace) {
+	nodePtr->summarySpace = nodePtr->summarySpace ?
+		2 * nodePtr->summarySpace : 4;
+	nodePtr->summaries = (Summary *) ckrealloc(
+		(char *) nodePtr->summaries,
+		sizeof(Summary) * nodePtr->summarySpace);
+    }
+    for (i = nodePtr->numSummaries; i > 0; i--) {
+	if (nodePtr->summaries[i - 1].tagPtr < tagPtr) {
+	    break;
+	}
     }
+    summaryPtr = &nodePtr->summaries[i];
+    memmove(summaryPtr + 1, summaryPtr,
+	    sizeof(Summary) * (nodePtr->numSummaries - i));
+    nodePtr->numSummaries++;
+    summaryPtr->tagPtr = tagPtr;
+    summaryPtr->toggleCount = toggleCount;
+    return summaryPtr;
+}
+
+static void
+RemoveSummary(
+    Node *nodePtr,		/* Node the summary belongs to. */
+    Summary *summaryPtr)	/* Summary to remove. */
+{
+    nodePtr->numSummaries--;
+    memmove(summaryPtr, summaryPtr + 1, sizeof(Summary)
+	    * (nodePtr->numSummaries - (summaryPtr - nodePtr->summaries)));
 }
 
 /*
@@ -1125,6 +1622,81 @@ TkBTreeInsertChars(
 				 * structure. */
     const char *string)		/* Pointer to bytes to insert (may contain
 				 * newlines, must be null-terminated). */
+{
+    InsertText(tree, indexPtr, string, (int) strlen(string), NULL);
+}
+
+#ifdef STEXT_MAPPED_CHARS
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkBTreeInsertMapped --
+ *
+ *	Insert whole lines of a mapped file at the start of a line of a
+ *	B-tree, without copying them. Each line gets a character segment
+ *	that points into the mapping. A line that ends with "\r\n" gets one
+ *	that stops short of the "\r", followed by an ordinary segment for
+ *	the "\n".
+ *
+ *	The lines must end with "\n" or "\r\n", and contain no other "\r"
+ *	and no null. They must be valid UTF-8, without the sequences that Tcl
+ *	stores differently, and must not end the mapping: something has to
+ *	follow them, for lexers that look one byte past the end of a line.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Lines are added to the B-tree, as by TkBTreeInsertChars. Each of the
+ *	new segments holds a reference to the mapping.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TkBTreeInsertMapped(
+    TkTextBTree tree,		/* Tree to insert into. */
+    TkTextIndex *indexPtr,	/* Start of the line to insert the new lines
+				 * before. No longer valid when the function
+				 * returns. */
+    TkTextMapping *mapPtr,	/* Mapping that the lines are in. */
+    const char *start,		/* First byte of the lines. */
+    int numBytes)		/* Number of bytes in the lines. */
+{
+    InsertText(tree, indexPtr, start, numBytes, mapPtr);
+}
+#endif /* STEXT_MAPPED_CHARS */
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * InsertText --
+ *
+ *	Does the work of TkBTreeInsertChars and TkBTreeInsertMapped. With a
+ *	mapping, the new segments point into it and the lines they make up
+ *	are not cleaned up, since they are already as clean as CleanupLine
+ *	would leave them and it would merge the "\n" of a "\r\n" line into
+ *	a copy of the line.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	See TkBTreeInsertChars.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+InsertText(
+    TkTextBTree tree,		/* Tree to insert into. */
+    register TkTextIndex *indexPtr,
+				/* Indicates where to insert text. */
+    const char *string,		/* Pointer to bytes to insert (may contain
+				 * newlines). */
+    int numBytes,		/* Number of bytes to insert. */
+    TkTextMapping *mapPtr)	/* Mapping that string is in, or NULL to
+				 * copy it into ordinary segments. */
 {
     register Node *nodePtr;
     register TkTextSegment *prevPtr;
@@ -1137,16 +1709,29 @@ TkBTreeInsertChars(
     TkTextLine *linePtr;	/* Current line (new segments are added to
 				 * this line). */
     register TkTextSegment *segPtr;
+    TkTextSegment *lastPtr;	/* Last of the new segments of the current
+				 * chunk. */
     TkTextLine *newLinePtr;
     int chunkSize;		/* # characters in current chunk. */
+    int textSize;		/* # bytes the chunk takes in the text. */
+    const char *end = string + numBytes;
     register const char *eol;	/* Pointer to character just after last one in
 				 * current chunk. */
     int changeToLineCount;	/* Counts change to total number of lines in
 				 * file. */
+    int changeToByteCount;	/* Counts change to total number of bytes in
+				 * file. */
+    int changeToCharCount;	/* Counts change to total number of characters
+				 * in file. */
     int *changeToPixelCount;	/* Counts change to total number of pixels in
 				 * file. */
     int ref;
     int pixels[PIXEL_CLIENTS];
+#ifdef STEXT_STYLE_RUNS
+    int styleIndex = indexPtr->byteIndex;
+				/* Where the current chunk goes in the
+				 * styles of linePtr. */
+#endif
 
     BTree *treePtr = (BTree *) tree;
     treePtr->stateEpoch++;
@@ -1160,6 +1745,8 @@ TkBTreeInsertChars(
      */
 
     changeToLineCount = 0;
+    changeToByteCount = 0;
+    changeToCharCount = 0;
     if (treePtr->pixelReferences > PIXEL_CLIENTS) {
 	changeToPixelCount = (int *)
 		ckalloc(sizeof(int) * treePtr->pixelReferences);
@@ -1170,31 +1757,53 @@ TkBTreeInsertChars(
 	changeToPixelCount[ref] = 0;
     }
 
-    while (*string != 0) {
-	for (eol = string; *eol != 0; eol++) {
+    while (string < end) {
+	for (eol = string; eol < end; eol++) {
 	    if (*eol == '\n') {
 		eol++;
 		break;
 	    }
 	}
 	chunkSize = eol-string;
-	segPtr = (TkTextSegment *) ckalloc(CSEG_SIZE(chunkSize));
-	segPtr->typePtr = &tkTextCharType;
+	textSize = chunkSize;
+#ifdef STEXT_MAPPED_CHARS
+	if (mapPtr != NULL) {
+	    segPtr = MappedChars(linePtr, mapPtr, string, chunkSize,
+		    &lastPtr);
+	    if (chunkSize > 1 && eol[-2] == '\r') {
+		textSize--;
+	    }
+	} else
+#endif
+	{
+	    segPtr = (TkTextSegment *)
+		    PoolAlloc(LINE_POOL(linePtr), CSEG_SIZE(chunkSize));
+	    segPtr->typePtr = &tkTextCharType;
+	    segPtr->size = chunkSize;
+#if defined(STEXT_STYLE_HACK) && !defined(STEXT_STYLE_RUNS)
+	    segPtr->body.chst.chars = segPtr->body.chst.data;
+	    segPtr->body.chst.style = segPtr->body.chst.data + segPtr->size + 1;
+	    memset(segPtr->body.chst.style, -1, segPtr->size + 1);
+#endif
+#ifdef STEXT_MAPPED_CHARS
+	    segPtr->body.ch.chars = segPtr->body.ch.u.data;
+#endif
+	    memcpy(segPtr->body.chars, string, (size_t) chunkSize);
+	    segPtr->body.chars[chunkSize] = 0;
+	    lastPtr = segPtr;
+	}
 	if (curPtr == NULL) {
-	    segPtr->nextPtr = linePtr->segPtr;
+	    lastPtr->nextPtr = linePtr->segPtr;
 	    linePtr->segPtr = segPtr;
 	} else {
-	    segPtr->nextPtr = curPtr->nextPtr;
+	    lastPtr->nextPtr = curPtr->nextPtr;
 	    curPtr->nextPtr = segPtr;
 	}
-	segPtr->size = chunkSize;
-#ifdef STEXT_STYLE_HACK
-	segPtr->body.chst.chars = segPtr->body.chst.data;
-	segPtr->body.chst.style = segPtr->body.chst.data + segPtr->size + 1;
-	memset(segPtr->body.chst.style, -1, segPtr->size + 1);
+	changeToByteCount += textSize;
+	changeToCharCount += CountChars(string, textSize);
+#ifdef STEXT_STYLE_RUNS
+	StyleInsert(linePtr, styleIndex, textSize);
 #endif
-	strncpy(segPtr->body.chars, string, (size_t) chunkSize);
-	segPtr->body.chars[chunkSize] = 0;
 
 	if (eol[-1] != '\n') {
 	    break;
@@ -1205,20 +1814,26 @@ TkBTreeInsertChars(
 	 * the remainder of the old line to it.
 	 */
 
-	newLinePtr = (TkTextLine *) ckalloc(sizeof(TkTextLine));
+	newLinePtr = (TkTextLine *)
+		PoolAlloc(LINE_POOL(linePtr), sizeof(TkTextLine));
 #ifdef STEXT_LINE_FLAGS
-	newLinePtr->peerData = (TkTextLinePeerData *)
-		ckalloc(sizeof(TkTextLinePeerData)*treePtr->pixelReferences);
+	newLinePtr->peerData = (TkTextLinePeerData *) PoolAlloc(
+		LINE_POOL(linePtr),
+		sizeof(TkTextLinePeerData) * treePtr->pixelReferences);
 #else
-	newLinePtr->pixels = (int *)
-		ckalloc(sizeof(int) * 2 * treePtr->pixelReferences);
+	newLinePtr->pixels = (int *) PoolAlloc(LINE_POOL(linePtr),
+		sizeof(int) * 2 * treePtr->pixelReferences);
 #endif
 
 	newLinePtr->parentPtr = linePtr->parentPtr;
 	newLinePtr->nextPtr = linePtr->nextPtr;
 	STEXT_INIT_LINE(newLinePtr)
 	linePtr->nextPtr = newLinePtr;
-	newLinePtr->segPtr = segPtr->nextPtr;
+	newLinePtr->segPtr = lastPtr->nextPtr;
+#ifdef STEXT_STYLE_RUNS
+	StyleSplit(linePtr, styleIndex + textSize, newLinePtr);
+	styleIndex = 0;
+#endif
 
 	/*
 	 * Set up a starting default height, which will be re-adjusted later.
@@ -1238,7 +1853,7 @@ TkBTreeInsertChars(
 #endif
 	}
 
-	segPtr->nextPtr = NULL;
+	lastPtr->nextPtr = NULL;
 	linePtr = newLinePtr;
 	curPtr = NULL;
 	changeToLineCount++;
@@ -1267,19 +1882,23 @@ TkBTreeInsertChars(
      * it's different.
      */
 
-    CleanupLine(indexPtr->linePtr);
-    if (linePtr != indexPtr->linePtr) {
-	CleanupLine(linePtr);
+    if (mapPtr == NULL) {
+	CleanupLine(indexPtr->linePtr);
+	if (linePtr != indexPtr->linePtr) {
+	    CleanupLine(linePtr);
+	}
     }
 
     /*
-     * Increment the line and pixel counts in all the parent nodes of the
-     * insertion point, then rebalance the tree if necessary.
+     * Increment the line, byte, character and pixel counts in all the parent
+     * nodes of the insertion point, then rebalance the tree if necessary.
      */
 
     for (nodePtr = linePtr->parentPtr ; nodePtr != NULL;
 	    nodePtr = nodePtr->parentPtr) {
 	nodePtr->numLines += changeToLineCount;
+	nodePtr->numBytes += changeToByteCount;
+	nodePtr->numChars += changeToCharCount;
 	for (ref = 0; ref < treePtr->pixelReferences; ref++) {
 	    nodePtr->numPixels[ref] += changeToPixelCount[ref];
 #if defined(STEXT_LINE_VISIBLE) && defined(STEXT_LINE_FLAGS)
@@ -1288,13 +1907,20 @@ TkBTreeInsertChars(
 #endif
 	}
     }
+#ifdef STEXT_FOLDING
+    if (changeToLineCount != 0) {
+	FoldIndexStale(linePtr->parentPtr);
+    }
+#endif
     if (treePtr->pixelReferences > PIXEL_CLIENTS) {
 	ckfree((char *) changeToPixelCount);
     }
 
     nodePtr = linePtr->parentPtr;
     nodePtr->numChildren += changeToLineCount;
-    if (nodePtr->numChildren > MAX_CHILDREN) {
+    if (changeToLineCount > BULK_INSERT_LINES) {
+	RebalanceBulk(treePtr, nodePtr);
+    } else if (nodePtr->numChildren > MAX_CHILDREN) {
 	Rebalance(treePtr, nodePtr);
     }
 
@@ -1359,7 +1985,7 @@ SplitSeg(
 	    if (count == 0) {
 		return prevPtr;
 	    }
-	    segPtr = (*segPtr->typePtr->splitProc)(segPtr, count);
+	    segPtr = (*segPtr->typePtr->splitProc)(segPtr, count, linePtr);
 	    if (prevPtr == NULL) {
 		indexPtr->linePtr->segPtr = segPtr;
 	    } else {
@@ -1489,6 +2115,20 @@ TkBTreeDeleteIndexRange(
 
     treePtr->stateEpoch++;
 
+#ifdef STEXT_STYLE_RUNS
+    /*
+     * Adjust the styles while the byte indices are still valid.
+     */
+
+    if (index1Ptr->linePtr == index2Ptr->linePtr) {
+	StyleDelete(index1Ptr->linePtr, index1Ptr->byteIndex,
+		index2Ptr->byteIndex - index1Ptr->byteIndex);
+    } else {
+	StyleJoin(index1Ptr->linePtr, index1Ptr->byteIndex,
+		index2Ptr->linePtr, index2Ptr->byteIndex);
+    }
+#endif
+
     /*
      * Tricky point: split at index2Ptr first; otherwise the split at
      * index2Ptr may invalidate segPtr and/or prevPtr.
@@ -1550,6 +2190,9 @@ TkBTreeDeleteIndexRange(
 		}
 		changeToLineCount++;
 		curNodePtr->numChildren--;
+#ifdef STEXT_FOLDING
+		FoldIndexStale(curNodePtr);
+#endif
 
 		/*
 		 * Check if we need to adjust any partial clients.
@@ -1586,11 +2229,22 @@ TkBTreeDeleteIndexRange(
 		}
 #endif
 #ifdef STEXT_LINE_FLAGS
-		ckfree((char *) curLinePtr->peerData);
+		PoolFree(treePtr->sharedTextPtr->poolPtr,
+			(char *) curLinePtr->peerData,
+			sizeof(TkTextLinePeerData) * treePtr->pixelReferences);
 #else
-		ckfree((char *) curLinePtr->pixels);
+		PoolFree(treePtr->sharedTextPtr->poolPtr,
+			(char *) curLinePtr->pixels,
+			sizeof(int) * 2 * treePtr->pixelReferences);
+#endif
+#ifdef STEXT_DIFF
+		TkBTreeFreeLineState(curLinePtr);
+#endif
+#ifdef STEXT_STYLE_RUNS
+		TkBTreeFreeStyles(curLinePtr);
 #endif
-		ckfree((char *) curLinePtr);
+		PoolFree(treePtr->sharedTextPtr->poolPtr,
+			(char *) curLinePtr, sizeof(TkTextLine));
 	    }
 	    curLinePtr = nextLinePtr;
 	    segPtr = curLinePtr->segPtr;
@@ -1622,12 +2276,14 @@ TkBTreeDeleteIndexRange(
 	}
 
 	nextPtr = segPtr->nextPtr;
+	ChangeNodeSizes(curNodePtr, segPtr, -1);
 	if ((*segPtr->typePtr->deleteProc)(segPtr, curLinePtr, 0) != 0) {
 	    /*
 	     * This segment refuses to die. Move it to prevPtr and advance
 	     * prevPtr if the segment has left gravity.
 	     */
 
+	    ChangeNodeSizes(index1Ptr->linePtr->parentPtr, segPtr, 1);
 	    if (prevPtr == NULL) {
 		segPtr->nextPtr = index1Ptr->linePtr->segPtr;
 		index1Ptr->linePtr->segPtr = segPtr;
@@ -1650,13 +2306,17 @@ TkBTreeDeleteIndexRange(
     if (index1Ptr->linePtr != index2Ptr->linePtr) {
 	TkTextLine *prevLinePtr;
 
+	curNodePtr = index2Ptr->linePtr->parentPtr;
 	for (segPtr = lastPtr; segPtr != NULL;
 		segPtr = segPtr->nextPtr) {
 	    if (segPtr->typePtr->lineChangeProc != NULL) {
 		(*segPtr->typePtr->lineChangeProc)(segPtr, index2Ptr->linePtr);
 	    }
+	    if (curNodePtr != index1Ptr->linePtr->parentPtr) {
+		ChangeNodeSizes(curNodePtr, segPtr, -1);
+		ChangeNodeSizes(index1Ptr->linePtr->parentPtr, segPtr, 1);
+	    }
 	}
-	curNodePtr = index2Ptr->linePtr->parentPtr;
 	for (nodePtr = curNodePtr; nodePtr != NULL;
 		nodePtr = nodePtr->parentPtr) {
 	    nodePtr->numLines--;
@@ -1674,6 +2334,9 @@ TkBTreeDeleteIndexRange(
 	}
 	changeToLineCount++;
 	curNodePtr->numChildren--;
+#ifdef STEXT_FOLDING
+	FoldIndexStale(curNodePtr);
+#endif
 	prevLinePtr = curNodePtr->children.linePtr;
 	if (prevLinePtr == index2Ptr->linePtr) {
 	    curNodePtr->children.linePtr = index2Ptr->linePtr->nextPtr;
@@ -1724,11 +2387,22 @@ TkBTreeDeleteIndexRange(
 	}
 #endif
 #ifdef STEXT_LINE_FLAGS
-	ckfree((char *) index2Ptr->linePtr->peerData);
+	PoolFree(treePtr->sharedTextPtr->poolPtr,
+		(char *) index2Ptr->linePtr->peerData,
+		sizeof(TkTextLinePeerData) * treePtr->pixelReferences);
 #else
-	ckfree((char *) index2Ptr->linePtr->pixels);
+	PoolFree(treePtr->sharedTextPtr->poolPtr,
+		(char *) index2Ptr->linePtr->pixels,
+		sizeof(int) * 2 * treePtr->pixelReferences);
 #endif
-	ckfree((char *) index2Ptr->linePtr);
+#ifdef STEXT_DIFF
+	TkBTreeFreeLineState(index2Ptr->linePtr);
+#endif
+#ifdef STEXT_STYLE_RUNS
+	TkBTreeFreeStyles(index2Ptr->linePtr);
+#endif
+	PoolFree(treePtr->sharedTextPtr->poolPtr,
+		(char *) index2Ptr->linePtr, sizeof(TkTextLine));
 
 	Rebalance((BTree *) index2Ptr->tree, curNodePtr);
     }
@@ -2216,7 +2890,296 @@ TkBTreeLinesTo(
     return index;
 }
 
-#ifdef STEXT_LINE_VISIBLE
+/*
+ *----------------------------------------------------------------------
+ *
+ * NodeOffsetSize, LineOffsetSize --
+ *
+ *	Return the number of bytes, characters or indices (depending on
+ *	"kind") in the lines below a node, or in a single line.
+ *
+ * Results:
+ *	See above.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+NodeOffsetSize(
+    const Node *nodePtr,	/* Node whose subtree is measured. */
+    int kind)			/* OFFSET_BYTES, OFFSET_CHARS or
+				 * OFFSET_INDICES. */
+{
+    switch (kind) {
+    case OFFSET_BYTES:
+	return nodePtr->numBytes;
+    case OFFSET_CHARS:
+	return nodePtr->numChars;
+    default:
+	return nodePtr->numChars + nodePtr->numEmbedded;
+    }
+}
+
+static int
+LineOffsetSize(
+    const TkTextLine *linePtr,	/* Line to measure. */
+    int kind)			/* OFFSET_BYTES, OFFSET_CHARS or
+				 * OFFSET_INDICES. */
+{
+    register TkTextSegment *segPtr;
+    int size = 0;
+
+    for (segPtr = linePtr->segPtr; segPtr != NULL; segPtr = segPtr->nextPtr) {
+	if (kind == OFFSET_BYTES) {
+	    size += segPtr->size;
+	} else if (segPtr->typePtr == &tkTextCharType) {
+	    size += CountChars(segPtr->body.chars, segPtr->size);
+	} else if (kind == OFFSET_INDICES) {
+	    size += segPtr->size;
+	}
+    }
+    return size;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * OffsetTo --
+ *
+ *	Given a pointer to a line in a B-tree, return the number of bytes,
+ *	characters or indices (depending on "kind") in the lines before it.
+ *	This is the same walk as TkBTreeLinesTo, using the byte and character
+ *	counts of the nodes.
+ *
+ * Results:
+ *	The offset of the start of linePtr, where 0 corresponds to the start
+ *	of the first line in the tree (or of the first line of the client).
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+OffsetTo(
+    const TkText *textPtr,	/* Relative to this client of the B-tree. */
+    TkTextLine *linePtr,	/* Pointer to existing line in B-tree. */
+    int kind)			/* OFFSET_BYTES, OFFSET_CHARS or
+				 * OFFSET_INDICES. */
+{
+    register TkTextLine *linePtr2;
+    register Node *nodePtr, *parentPtr, *nodePtr2;
+    int offset;
+
+    nodePtr = linePtr->parentPtr;
+    offset = 0;
+    for (linePtr2 = nodePtr->children.linePtr; linePtr2 != linePtr;
+	    linePtr2 = linePtr2->nextPtr) {
+	if (linePtr2 == NULL) {
+	    Tcl_Panic("OffsetTo couldn't find line");
+	}
+	offset += LineOffsetSize(linePtr2, kind);
+    }
+    for (parentPtr = nodePtr->parentPtr ; parentPtr != NULL;
+	    nodePtr = parentPtr, parentPtr = parentPtr->parentPtr) {
+	for (nodePtr2 = parentPtr->children.nodePtr; nodePtr2 != nodePtr;
+		nodePtr2 = nodePtr2->nextPtr) {
+	    if (nodePtr2 == NULL) {
+		Tcl_Panic("OffsetTo couldn't find node");
+	    }
+	    offset += NodeOffsetSize(nodePtr2, kind);
+	}
+    }
+    if (textPtr != NULL && textPtr->start != NULL) {
+	offset -= OffsetTo(NULL, textPtr->start, kind);
+    }
+    return offset;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FindOffsetLine --
+ *
+ *	Find the line of a B-tree that contains the byte, character or index
+ *	(depending on "kind") at a given offset from the start of the text.
+ *	This is the same walk as TkBTreeFindLine, using the byte and character
+ *	counts of the nodes.
+ *
+ * Results:
+ *	The return value is a pointer to the line that contains "offset", or
+ *	NULL if no such line exists. The offset within that line is stored in
+ *	*offsetPtr.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static TkTextLine *
+FindOffsetLine(
+    BTree *treePtr,		/* B-tree in which to find line. */
+    const TkText *textPtr,	/* Relative to this client of the B-tree. */
+    int offset,			/* Offset of the desired position. */
+    int kind,			/* OFFSET_BYTES, OFFSET_CHARS or
+				 * OFFSET_INDICES. */
+    int *offsetPtr)		/* Store the offset within the line here. */
+{
+    register Node *nodePtr;
+    register TkTextLine *linePtr;
+    int size;
+
+    if (treePtr == NULL) {
+	treePtr = (BTree *) textPtr->sharedTextPtr->tree;
+    }
+
+    nodePtr = treePtr->rootPtr;
+    size = NodeOffsetSize(nodePtr, kind);
+    if ((offset < 0) || (offset >= size)) {
+	return NULL;
+    }
+
+    /*
+     * Check for the any start offset for this text widget; the end is
+     * checked once the line is known.
+     */
+
+    if (textPtr != NULL && textPtr->start != NULL) {
+	int start = OffsetTo(NULL, textPtr->start, kind);
+
+	if (offset >= size - start) {
+	    return NULL;
+	}
+	offset += start;
+    }
+
+    /*
+     * Work down through levels of the tree until a node is found at level 0.
+     */
+
+    while (nodePtr->level != 0) {
+	for (nodePtr = nodePtr->children.nodePtr;
+		(size = NodeOffsetSize(nodePtr, kind)) <= offset;
+		nodePtr = nodePtr->nextPtr) {
+	    if (nodePtr == NULL) {
+		Tcl_Panic("FindOffsetLine ran out of nodes");
+	    }
+	    offset -= size;
+	}
+    }
+
+    /*
+     * Work through the lines attached to the level-0 node.
+     */
+
+    for (linePtr = nodePtr->children.linePtr;
+	    (size = LineOffsetSize(linePtr, kind)) <= offset;
+	    linePtr = linePtr->nextPtr) {
+	if (linePtr == NULL) {
+	    Tcl_Panic("FindOffsetLine ran out of lines");
+	}
+	offset -= size;
+    }
+    if (textPtr != NULL && textPtr->end != NULL) {
+	if (TkBTreeLinesTo(NULL, linePtr)
+		> TkBTreeLinesTo(NULL, textPtr->end)) {
+	    return NULL;
+	}
+    }
+    *offsetPtr = offset;
+    return linePtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkBTreeBytesTo, TkBTreeCharsTo --
+ *
+ *	Given a pointer to a line in a B-tree, return the number of bytes, or
+ *	of characters, in the lines before it. The byte and character counts
+ *	in the nodes make this O(log n), like TkBTreeLinesTo.
+ *
+ * Results:
+ *	The offset of the start of linePtr, where 0 corresponds to the start
+ *	of the first line in the tree. If "type" includes COUNT_INDICES then
+ *	the embedded windows and images are counted as well.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TkBTreeBytesTo(
+    const TkText *textPtr,	/* Relative to this client of the B-tree. */
+    TkTextLine *linePtr)	/* Pointer to existing line in B-tree. */
+{
+    return OffsetTo(textPtr, linePtr, OFFSET_BYTES);
+}
+
+int
+TkBTreeCharsTo(
+    const TkText *textPtr,	/* Relative to this client of the B-tree. */
+    TkTextLine *linePtr,	/* Pointer to existing line in B-tree. */
+    TkTextCountType type)	/* COUNT_CHARS or COUNT_INDICES. */
+{
+    return OffsetTo(textPtr, linePtr,
+	    (type & COUNT_INDICES) ? OFFSET_INDICES : OFFSET_CHARS);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkBTreeFindByteLine, TkBTreeFindCharLine --
+ *
+ *	Find the line of a B-tree that contains the byte, or the character,
+ *	at a given offset from the start of the text.
+ *
+ * Results:
+ *	The return value is a pointer to the line that contains "offset", or
+ *	NULL if no such line exists. The offset within that line is stored in
+ *	*offsetPtr. If "type" includes COUNT_INDICES then the embedded windows
+ *	and images are counted as well.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+TkTextLine *
+TkBTreeFindByteLine(
+    TkTextBTree tree,		/* B-tree in which to find line. */
+    const TkText *textPtr,	/* Relative to this client of the B-tree. */
+    int offset,			/* Byte offset of the desired position. */
+    int *offsetPtr)		/* Store the byte offset within the line
+				 * here. */
+{
+    return FindOffsetLine((BTree *) tree, textPtr, offset, OFFSET_BYTES,
+	    offsetPtr);
+}
+
+TkTextLine *
+TkBTreeFindCharLine(
+    TkTextBTree tree,		/* B-tree in which to find line. */
+    const TkText *textPtr,	/* Relative to this client of the B-tree. */
+    int offset,			/* Character offset of the desired
+				 * position. */
+    TkTextCountType type,	/* COUNT_CHARS or COUNT_INDICES. */
+    int *offsetPtr)		/* Store the character offset within the line
+				 * here. */
+{
+    return FindOffsetLine((BTree *) tree, textPtr, offset,
+	    (type & COUNT_INDICES) ? OFFSET_INDICES : OFFSET_CHARS, offsetPtr);
+}
+
+#ifdef STEXT_LINE_VISIBLE
 
 TkTextLine *
 TkBTreeFindLineVisible(tree, textPtr, line)
@@ -2384,182 +3347,1021 @@ dbwin("TkBTreePreviousLineVisible: no visible nodes before line %d\n", BTREE_LIN
 	    if (nodePrevPtr->level == 0) {
 		break;
 	    }
-	    node2Ptr = nodePrevPtr;
-	    nodePrevPtr = NULL;
+	    node2Ptr = nodePrevPtr;
+	    nodePrevPtr = NULL;
+	}
+    }
+    ASSERT(nodePrevPtr != NULL && nodePrevPtr->level == 0);
+    node2Ptr = nodePrevPtr;
+
+    /* Finally, search the level 0 node for its last visible line. */
+    prevVisPtr = NULL;
+    for (prevPtr = node2Ptr->children.linePtr; ; prevPtr = prevPtr->nextPtr) {
+	if (GetLineVisible(textPtr, prevPtr))
+	    prevVisPtr = prevPtr;
+	if (prevPtr->nextPtr == (TkTextLine *) NULL) {
+	    break;
+	}
+    }
+    ASSERT(prevVisPtr != NULL);
+    return prevVisPtr;
+}
+
+int
+TkBTreeLinesToVisible(textPtr, linePtr)
+    CONST TkText *textPtr;	/* Relative to this client of the B-tree */
+    TkTextLine *linePtr;	/* Pointer to existing line in B-tree. */
+{
+    int ref = textPtr->pixelReference;
+    register TkTextLine *linePtr2;
+    register Node *nodePtr, *parentPtr, *nodePtr2;
+    int index;
+
+    /*
+     * First count how many visible lines precede this one in its level-0
+     * node.
+     */
+
+    nodePtr = linePtr->parentPtr;
+    index = 0;
+    for (linePtr2 = nodePtr->children.linePtr; linePtr2 != linePtr;
+	    linePtr2 = linePtr2->nextPtr) {
+	ASSERTM(linePtr2 != NULL, "couldn't find line");
+	if (GetLineVisible(textPtr, linePtr2))
+	    index += 1;
+    }
+
+    /*
+     * Now work up through the levels of the tree one at a time,
+     * counting how many visible lines are in nodes preceding the current
+     * node.
+     */
+
+    for (parentPtr = nodePtr->parentPtr ; parentPtr != NULL;
+	    nodePtr = parentPtr, parentPtr = parentPtr->parentPtr) {
+	for (nodePtr2 = parentPtr->children.nodePtr; nodePtr2 != nodePtr;
+		nodePtr2 = nodePtr2->nextPtr) {
+	    ASSERTM(nodePtr2 != NULL, "couldn't find node");
+	    index += nodePtr2->numLinesVisible[ref];
+	}
+    }
+
+    if (textPtr->start != NULL && linePtr != textPtr->start) {
+	index -= TkBTreeLinesToVisible(textPtr, textPtr->start);
+    }
+
+    return index;
+}
+
+void
+TkBTreeToggleLineVisible(textPtr, linePtr)
+    CONST TkText *textPtr;	/* In the context of this client. */
+    TkTextLine *linePtr;		/* Pointer to existing line in
+					 * B-tree. */
+{
+    int ref = textPtr->pixelReference;
+    bool visible = GetLineVisible(textPtr, linePtr);
+    register Node *nodePtr, *parentPtr;
+
+    nodePtr = linePtr->parentPtr;
+    nodePtr->numLinesVisible[ref] += visible ? 1 : -1;
+
+    for (parentPtr = nodePtr->parentPtr; parentPtr != NULL;
+	    parentPtr = parentPtr->parentPtr) {
+	parentPtr->numLinesVisible[ref] += visible ? 1 : -1;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkBTreeRecountLinesVisible --
+ *
+ *	Recomputes the visible line count and pixel height of each level-0
+ *	node holding a line between firstPtr and lastPtr, and adjusts the
+ *	ancestors of those nodes to match. Used after the hidden flag and
+ *	pixel height of many lines have been changed directly, instead of
+ *	calling TkBTreeToggleLineVisible and TkBTreeAdjustPixelHeight for
+ *	each line.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Node counts for this client are updated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TkBTreeRecountLinesVisible(
+    CONST TkText *textPtr,	/* In the context of this client. */
+    TkTextLine *firstPtr,	/* First line that changed. */
+    TkTextLine *lastPtr)	/* Last line that changed. */
+{
+    int ref = textPtr->pixelReference;
+    register Node *nodePtr, *leafPtr;
+    register TkTextLine *linePtr;
+    int numVisible, numPixels, changeToVisible, changeToPixels;
+    bool done = false;
+
+    linePtr = firstPtr;
+    while (!done) {
+	leafPtr = linePtr->parentPtr;
+	numVisible = numPixels = 0;
+	for (linePtr = leafPtr->children.linePtr; ;
+		linePtr = linePtr->nextPtr) {
+	    if (GetLineVisible(textPtr, linePtr))
+		numVisible++;
+	    numPixels += TkBTreeLinePixelCount(textPtr, linePtr);
+	    if (linePtr == lastPtr)
+		done = true;
+	    if (linePtr->nextPtr == NULL)
+		break;
+	}
+	changeToVisible = numVisible - leafPtr->numLinesVisible[ref];
+	changeToPixels = numPixels - leafPtr->numPixels[ref];
+	for (nodePtr = leafPtr; nodePtr != NULL; nodePtr = nodePtr->parentPtr) {
+	    nodePtr->numLinesVisible[ref] += changeToVisible;
+	    nodePtr->numPixels[ref] += changeToPixels;
+	}
+	if (!done) {
+	    linePtr = TkBTreeNextLine(NULL, linePtr);
+	}
+    }
+}
+#endif /* STEXT_LINE_VISIBLE */
+
+#ifdef STEXT_FOLDING
+
+/*
+ * Each node keeps the smallest fold depth of the lines below it, so that the
+ * fold hierarchy can be searched without visiting every line. The minimums
+ * are recomputed lazily: any change marks the node and its ancestors stale,
+ * and a search brings a stale node up to date before it looks at it.
+ */
+
+#define FOLD_DEPTH_NONE (SC_FOLDLEVELNUMBERMASK + 1)
+#define LINE_FOLD_DEPTH(linePtr) ((linePtr)->level & SC_FOLDLEVELNUMBERMASK)
+#define LINE_FOLD_HEADER(linePtr) \
+	(((linePtr)->level & SC_FOLDLEVELHEADERFLAG) != 0)
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FoldIndexStale --
+ *
+ *	Marks a node and its ancestors as needing their fold minimums
+ *	recomputed.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The climb stops at the first node that is already stale, since all
+ *	of its ancestors must be stale too.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FoldIndexStale(
+    Node *nodePtr)
+{
+    while (nodePtr != NULL && !nodePtr->foldStale) {
+	nodePtr->foldStale = true;
+	nodePtr = nodePtr->parentPtr;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * UpdateFoldIndex --
+ *
+ *	Recomputes the fold minimums of a stale node and of any stale nodes
+ *	below it.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The node and all of its descendants are no longer stale.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+UpdateFoldIndex(
+    Node *nodePtr)
+{
+    int minDepth = FOLD_DEPTH_NONE, minHeader = FOLD_DEPTH_NONE, depth;
+
+    if (!nodePtr->foldStale) {
+	return;
+    }
+    if (nodePtr->level == 0) {
+	TkTextLine *linePtr;
+
+	for (linePtr = nodePtr->children.linePtr; linePtr != NULL;
+		linePtr = linePtr->nextPtr) {
+	    depth = LINE_FOLD_DEPTH(linePtr);
+	    if (depth < minDepth) {
+		minDepth = depth;
+	    }
+	    if (LINE_FOLD_HEADER(linePtr) && depth < minHeader) {
+		minHeader = depth;
+	    }
+	}
+    } else {
+	Node *childPtr;
+
+	for (childPtr = nodePtr->children.nodePtr; childPtr != NULL;
+		childPtr = childPtr->nextPtr) {
+	    UpdateFoldIndex(childPtr);
+	    if (childPtr->minFoldDepth < minDepth) {
+		minDepth = childPtr->minFoldDepth;
+	    }
+	    if (childPtr->minHeaderDepth < minHeader) {
+		minHeader = childPtr->minHeaderDepth;
+	    }
+	}
+    }
+    nodePtr->minFoldDepth = minDepth;
+    nodePtr->minHeaderDepth = minHeader;
+    nodePtr->foldStale = false;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkBTreeLineFoldChanged --
+ *
+ *	Called when the fold depth or header flag of a line changes.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The fold minimums of the nodes above the line will be recomputed
+ *	the next time they are needed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TkBTreeLineFoldChanged(
+    TkTextLine *linePtr)	/* Line whose fold level changed. */
+{
+    FoldIndexStale(linePtr->parentPtr);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkBTreeNextLineFoldDepth --
+ *
+ *	Finds the first line after a given one whose fold depth is no
+ *	greater than "depth". Used to find the end of a fold.
+ *
+ * Results:
+ *	The line found, or NULL if every following line is deeper.
+ *
+ * Side effects:
+ *	Stale fold minimums may be recomputed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+TkTextLine *
+TkBTreeNextLineFoldDepth(
+    TkTextLine *linePtr,	/* Search starts after this line. */
+    int depth)			/* Largest fold depth to accept. */
+{
+    register Node *nodePtr, *parentPtr;
+    register TkTextLine *nextPtr;
+
+    /* Look for a following line in the same node. */
+    for (nextPtr = linePtr->nextPtr; nextPtr != NULL;
+	    nextPtr = nextPtr->nextPtr) {
+	if (LINE_FOLD_DEPTH(nextPtr) <= depth) {
+	    return nextPtr;
+	}
+    }
+
+    /* Look at the nodes following each ancestor of the line. */
+    for (parentPtr = linePtr->parentPtr; ; parentPtr = parentPtr->parentPtr) {
+	for (nodePtr = parentPtr->nextPtr; nodePtr != NULL;
+		nodePtr = nodePtr->nextPtr) {
+	    UpdateFoldIndex(nodePtr);
+	    if (nodePtr->minFoldDepth <= depth) {
+		break;
+	    }
+	}
+	if (nodePtr != NULL) {
+	    break;
+	}
+	if (parentPtr->parentPtr == NULL) {
+	    return NULL;
+	}
+    }
+
+    /* Walk down to level 0. The descendants of a fresh node are fresh. */
+    while (nodePtr->level > 0) {
+	for (nodePtr = nodePtr->children.nodePtr;
+		nodePtr->minFoldDepth > depth;
+		nodePtr = nodePtr->nextPtr) {
+	    ASSERTM(nodePtr->nextPtr != NULL, "ran out of nodes");
+	}
+    }
+    for (nextPtr = nodePtr->children.linePtr;
+	    LINE_FOLD_DEPTH(nextPtr) > depth;
+	    nextPtr = nextPtr->nextPtr) {
+	ASSERTM(nextPtr->nextPtr != NULL, "ran out of lines");
+    }
+    return nextPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkBTreePreviousFoldHeader --
+ *
+ *	Finds the last fold header before a given line whose fold depth is
+ *	less than "depth". Used to find the parent of a fold.
+ *
+ * Results:
+ *	The line found, or NULL if there is none.
+ *
+ * Side effects:
+ *	Stale fold minimums may be recomputed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+TkTextLine *
+TkBTreePreviousFoldHeader(
+    TkTextLine *linePtr,	/* Search starts before this line. */
+    int depth)			/* Fold depth the header must be above. */
+{
+    register Node *nodePtr, *node2Ptr;
+    Node *nodePrevPtr;
+    register TkTextLine *prevPtr;
+    TkTextLine *headerPtr;
+
+    /* Check for a header under the same parent. */
+    headerPtr = NULL;
+    for (prevPtr = linePtr->parentPtr->children.linePtr; prevPtr != linePtr;
+	    prevPtr = prevPtr->nextPtr) {
+	if (LINE_FOLD_HEADER(prevPtr) && LINE_FOLD_DEPTH(prevPtr) < depth) {
+	    headerPtr = prevPtr;
+	}
+    }
+    if (headerPtr != NULL) {
+	return headerPtr;
+    }
+
+    /*
+     * Find the nearest ancestor with a previous sibling node that holds a
+     * header. The last such sibling holds the line we want.
+     */
+
+    nodePrevPtr = NULL;
+    for (nodePtr = linePtr->parentPtr; nodePtr->parentPtr != NULL;
+	    nodePtr = nodePtr->parentPtr) {
+	for (node2Ptr = nodePtr->parentPtr->children.nodePtr;
+		node2Ptr != nodePtr; node2Ptr = node2Ptr->nextPtr) {
+	    UpdateFoldIndex(node2Ptr);
+	    if (node2Ptr->minHeaderDepth < depth) {
+		nodePrevPtr = node2Ptr;
+	    }
+	}
+	if (nodePrevPtr != NULL) {
+	    break;
+	}
+    }
+    if (nodePrevPtr == NULL) {
+	return NULL;
+    }
+
+    /* Search down to level 0, keeping to the last matching child. */
+    while (nodePrevPtr->level > 0) {
+	nodePtr = nodePrevPtr;
+	nodePrevPtr = NULL;
+	for (node2Ptr = nodePtr->children.nodePtr; node2Ptr != NULL;
+		node2Ptr = node2Ptr->nextPtr) {
+	    if (node2Ptr->minHeaderDepth < depth) {
+		nodePrevPtr = node2Ptr;
+	    }
+	}
+	ASSERT(nodePrevPtr != NULL);
+    }
+
+    /* Finally, search the level 0 node for its last matching header. */
+    for (prevPtr = nodePrevPtr->children.linePtr; prevPtr != NULL;
+	    prevPtr = prevPtr->nextPtr) {
+	if (LINE_FOLD_HEADER(prevPtr) && LINE_FOLD_DEPTH(prevPtr) < depth) {
+	    headerPtr = prevPtr;
+	}
+    }
+    ASSERT(headerPtr != NULL);
+    return headerPtr;
+}
+
+#endif /* STEXT_FOLDING */
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkBTreeLinkSegment --
+ *
+ *	This function adds a new segment to a B-tree at a given location.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	SegPtr will be linked into its tree.
+ *
+ *----------------------------------------------------------------------
+ */
+
+	/* ARGSUSED */
+void
+TkBTreeLinkSegment(
+    TkTextSegment *segPtr,	/* Pointer to new segment to be added to
+				 * B-tree. Should be completely initialized by
+				 * caller except for nextPtr field. */
+    TkTextIndex *indexPtr)	/* Where to add segment: it gets linked in
+				 * just before the segment indicated here. */
+{
+    register TkTextSegment *prevPtr;
+
+#ifdef STEXT_STYLE_RUNS
+    if (segPtr->size > 0) {
+	StyleInsert(indexPtr->linePtr, indexPtr->byteIndex, segPtr->size);
+    }
+#endif
+    prevPtr = SplitSeg(indexPtr);
+    if (prevPtr == NULL) {
+	segPtr->nextPtr = indexPtr->linePtr->segPtr;
+	indexPtr->linePtr->segPtr = segPtr;
+    } else {
+	segPtr->nextPtr = prevPtr->nextPtr;
+	prevPtr->nextPtr = segPtr;
+    }
+    ChangeNodeSizes(indexPtr->linePtr->parentPtr, segPtr, 1);
+    CleanupLine(indexPtr->linePtr);
+    if (tkBTreeDebug) {
+	TkBTreeCheck(indexPtr->tree);
+    }
+    ((BTree *)indexPtr->tree)->stateEpoch++;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkBTreeUnlinkSegment --
+ *
+ *	This function unlinks a segment from its line in a B-tree.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	SegPtr will be unlinked from linePtr. The segment itself isn't
+ *	modified by this function.
+ *
+ *----------------------------------------------------------------------
+ */
+
+	/* ARGSUSED */
+void
+TkBTreeUnlinkSegment(
+    TkTextSegment *segPtr,	/* Segment to be unlinked. */
+    TkTextLine *linePtr)	/* Line that currently contains segment. */
+{
+    register TkTextSegment *prevPtr;
+
+    if (linePtr->segPtr == segPtr) {
+	linePtr->segPtr = segPtr->nextPtr;
+    } else {
+	prevPtr = linePtr->segPtr;
+	while (prevPtr->nextPtr != segPtr) {
+	    prevPtr = prevPtr->nextPtr;
+
+	    if (prevPtr == NULL) {
+		/*
+		 * Two logical lines merged into one display line through
+		 * eliding of a newline.
+		 */
+
+		linePtr = TkBTreeNextLine(NULL, linePtr);
+		prevPtr = linePtr->segPtr;
+	    }
+	}
+	prevPtr->nextPtr = segPtr->nextPtr;
+    }
+    ChangeNodeSizes(linePtr->parentPtr, segPtr, -1);
+    CleanupLine(linePtr);
+}
+
+#ifdef STEXT_STYLE_RUNS
+/*
+ *----------------------------------------------------------------------
+ *
+ * StyleAppend --
+ *
+ *	Add "count" bytes with the given style to the end of a StyleBuilder,
+ *	merging with the last run when the style is the same.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Storage for the runs may be allocated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+StyleAppend(
+    StyleBuilder *builderPtr,	/* Runs being built. */
+    int style,			/* Style of the bytes, 0xFF for none. */
+    int count)			/* Number of bytes. */
+{
+    TkTextStyleRun *runPtr;
+    int n;
+
+    while (count > 0) {
+	if (builderPtr->numRuns > 0) {
+	    runPtr = &builderPtr->runs[builderPtr->numRuns - 1];
+	    if ((runPtr->style == style) && (runPtr->count < 255)) {
+		n = MIN(count, 255 - runPtr->count);
+		runPtr->count += n;
+		count -= n;
+		continue;
+	    }
+	}
+	if (builderPtr->numRuns == builderPtr->spaceRuns) {
+	    TkTextStyleRun *newPtr;
+
+	    builderPtr->spaceRuns *= 2;
+	    newPtr = (TkTextStyleRun *) ckalloc((unsigned)
+		    (builderPtr->spaceRuns * sizeof(TkTextStyleRun)));
+	    memcpy(newPtr, builderPtr->runs,
+		    builderPtr->numRuns * sizeof(TkTextStyleRun));
+	    if (builderPtr->runs != builderPtr->staticSpace) {
+		ckfree((char *) builderPtr->runs);
+	    }
+	    builderPtr->runs = newPtr;
+	}
+	runPtr = &builderPtr->runs[builderPtr->numRuns++];
+	n = MIN(count, 255);
+	runPtr->style = (unsigned char) style;
+	runPtr->count = (unsigned char) n;
+	count -= n;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * StyleCopy --
+ *
+ *	Append the styles of bytes first up to last of a line to a
+ *	StyleBuilder. If last is -1 the rest of the line's runs are copied,
+ *	otherwise the copy is padded to last with unstyled bytes.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Storage for the runs may be allocated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+StyleCopy(
+    StyleBuilder *builderPtr,	/* Runs being built. */
+    TkTextStyleRuns *stylesPtr,	/* Runs to copy from, may be NULL. */
+    int first,			/* Byte index of first byte to copy. */
+    int last)			/* Byte index after last byte to copy, or -1
+				 * to copy to the end. */
+{
+    int i, start, end = 0;
+
+    if (stylesPtr != NULL) {
+	for (i = 0; i < stylesPtr->numRuns; i++) {
+	    start = end;
+	    end = start + stylesPtr->runs[i].count;
+	    if ((last >= 0) && (start >= last)) {
+		break;
+	    }
+	    if (end <= first) {
+		continue;
+	    }
+	    StyleAppend(builderPtr, stylesPtr->runs[i].style,
+		    ((last >= 0) ? MIN(end, last) : end) - MAX(start, first));
+	}
+    }
+    if (last > MAX(end, first)) {
+	StyleAppend(builderPtr, 0xFF, last - MAX(end, first));
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * StyleFinish --
+ *
+ *	Replace the styles of a line with the runs in a StyleBuilder.
+ *	Trailing unstyled runs are dropped, since bytes past the last run are
+ *	unstyled anyway.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The old styles of the line are freed and the builder is reset.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+StyleFinish(
+    StyleBuilder *builderPtr,	/* Runs to store. */
+    TkTextLine *linePtr)	/* Line to store them in. */
+{
+    TkTextStyleRuns *stylesPtr = NULL;
+    int numRuns = builderPtr->numRuns;
+    int i, end, marksOffset;
+
+    while ((numRuns > 0) && (builderPtr->runs[numRuns - 1].style == 0xFF)) {
+	numRuns--;
+    }
+    if (numRuns > 0) {
+	marksOffset = Tk_Offset(TkTextStyleRuns, runs)
+		+ numRuns * sizeof(TkTextStyleRun);
+	marksOffset = (marksOffset + sizeof(int) - 1) & ~(sizeof(int) - 1);
+	stylesPtr = (TkTextStyleRuns *) ckalloc((unsigned) (marksOffset
+		+ (numRuns / STYLE_RUNS_PER_MARK) * sizeof(int)));
+	stylesPtr->numRuns = numRuns;
+	stylesPtr->marks = (int *) ((char *) stylesPtr + marksOffset);
+	memcpy(stylesPtr->runs, builderPtr->runs,
+		numRuns * sizeof(TkTextStyleRun));
+	for (i = 0, end = 0; i < numRuns; i++) {
+	    end += stylesPtr->runs[i].count;
+	    if ((i + 1) % STYLE_RUNS_PER_MARK == 0) {
+		stylesPtr->marks[i / STYLE_RUNS_PER_MARK] = end;
+	    }
 	}
     }
-    ASSERT(nodePrevPtr != NULL && nodePrevPtr->level == 0);
-    node2Ptr = nodePrevPtr;
-
-    /* Finally, search the level 0 node for its last visible line. */
-    prevVisPtr = NULL;
-    for (prevPtr = node2Ptr->children.linePtr; ; prevPtr = prevPtr->nextPtr) {
-	if (GetLineVisible(textPtr, prevPtr))
-	    prevVisPtr = prevPtr;
-	if (prevPtr->nextPtr == (TkTextLine *) NULL) {
-	    break;
-	}
+    TkBTreeFreeStyles(linePtr);
+    linePtr->styles = stylesPtr;
+    if (builderPtr->runs != builderPtr->staticSpace) {
+	ckfree((char *) builderPtr->runs);
     }
-    ASSERT(prevVisPtr != NULL);
-    return prevVisPtr;
+    StyleBuilderInit(builderPtr);
 }
 
-int
-TkBTreeLinesToVisible(textPtr, linePtr)
-    CONST TkText *textPtr;	/* Relative to this client of the B-tree */
-    TkTextLine *linePtr;	/* Pointer to existing line in B-tree. */
-{
-    int ref = textPtr->pixelReference;
-    register TkTextLine *linePtr2;
-    register Node *nodePtr, *parentPtr, *nodePtr2;
-    int index;
+/*
+ *----------------------------------------------------------------------
+ *
+ * StyleInsert, StyleDelete, StyleSplit, StyleJoin --
+ *
+ *	Keep the styles of lines in step with edits to their text, so that
+ *	existing styles stay attached to the same characters until the lexer
+ *	gets to restyle the line. Inserted bytes are unstyled.
+ *
+ *	StyleSplit moves the styles from byteIndex onwards to the (new,
+ *	unstyled) line newLinePtr. StyleJoin replaces the styles of linePtr
+ *	from byteIndex onwards with those of line2Ptr from byteIndex2
+ *	onwards.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Storage for the styles may be allocated and freed.
+ *
+ *----------------------------------------------------------------------
+ */
 
-    /*
-     * First count how many visible lines precede this one in its level-0
-     * node.
-     */
+static void
+StyleInsert(
+    TkTextLine *linePtr,
+    int byteIndex,
+    int count)
+{
+    StyleBuilder builder;
 
-    nodePtr = linePtr->parentPtr;
-    index = 0;
-    for (linePtr2 = nodePtr->children.linePtr; linePtr2 != linePtr;
-	    linePtr2 = linePtr2->nextPtr) {
-	ASSERTM(linePtr2 != NULL, "couldn't find line");
-	if (GetLineVisible(textPtr, linePtr2))
-	    index += 1;
+    if (linePtr->styles == NULL) {
+	return;
     }
+    StyleBuilderInit(&builder);
+    StyleCopy(&builder, linePtr->styles, 0, byteIndex);
+    StyleAppend(&builder, 0xFF, count);
+    StyleCopy(&builder, linePtr->styles, byteIndex, -1);
+    StyleFinish(&builder, linePtr);
+}
 
-    /*
-     * Now work up through the levels of the tree one at a time,
-     * counting how many visible lines are in nodes preceding the current
-     * node.
-     */
+static void
+StyleDelete(
+    TkTextLine *linePtr,
+    int byteIndex,
+    int count)
+{
+    StyleBuilder builder;
 
-    for (parentPtr = nodePtr->parentPtr ; parentPtr != NULL;
-	    nodePtr = parentPtr, parentPtr = parentPtr->parentPtr) {
-	for (nodePtr2 = parentPtr->children.nodePtr; nodePtr2 != nodePtr;
-		nodePtr2 = nodePtr2->nextPtr) {
-	    ASSERTM(nodePtr2 != NULL, "couldn't find node");
-	    index += nodePtr2->numLinesVisible[ref];
-	}
+    if (linePtr->styles == NULL) {
+	return;
     }
+    StyleBuilderInit(&builder);
+    StyleCopy(&builder, linePtr->styles, 0, byteIndex);
+    StyleCopy(&builder, linePtr->styles, byteIndex + count, -1);
+    StyleFinish(&builder, linePtr);
+}
 
-    if (textPtr->start != NULL && linePtr != textPtr->start) {
-	index -= TkBTreeLinesToVisible(textPtr, textPtr->start);
-    }
+static void
+StyleSplit(
+    TkTextLine *linePtr,
+    int byteIndex,
+    TkTextLine *newLinePtr)
+{
+    StyleBuilder builder;
 
-    return index;
+    if (linePtr->styles == NULL) {
+	return;
+    }
+    StyleBuilderInit(&builder);
+    StyleCopy(&builder, linePtr->styles, byteIndex, -1);
+    StyleFinish(&builder, newLinePtr);
+    StyleCopy(&builder, linePtr->styles, 0, byteIndex);
+    StyleFinish(&builder, linePtr);
 }
 
-void
-TkBTreeToggleLineVisible(textPtr, linePtr)
-    CONST TkText *textPtr;	/* In the context of this client. */
-    TkTextLine *linePtr;		/* Pointer to existing line in
-					 * B-tree. */
+static void
+StyleJoin(
+    TkTextLine *linePtr,
+    int byteIndex,
+    TkTextLine *line2Ptr,
+    int byteIndex2)
 {
-    int ref = textPtr->pixelReference;
-    bool visible = GetLineVisible(textPtr, linePtr);
-    register Node *nodePtr, *parentPtr;
+    StyleBuilder builder;
 
-    nodePtr = linePtr->parentPtr;
-    nodePtr->numLinesVisible[ref] += visible ? 1 : -1;
-
-    for (parentPtr = nodePtr->parentPtr; parentPtr != NULL;
-	    parentPtr = parentPtr->parentPtr) {
-	parentPtr->numLinesVisible[ref] += visible ? 1 : -1;
+    if ((linePtr->styles == NULL) && (line2Ptr->styles == NULL)) {
+	return;
     }
+    StyleBuilderInit(&builder);
+    StyleCopy(&builder, linePtr->styles, 0, byteIndex);
+    StyleCopy(&builder, line2Ptr->styles, byteIndex2, -1);
+    StyleFinish(&builder, linePtr);
+    TkBTreeFreeStyles(line2Ptr);
 }
-#endif /* STEXT_LINE_VISIBLE */
 
-
 /*
  *----------------------------------------------------------------------
  *
- * TkBTreeLinkSegment --
+ * TkBTreeFreeStyles --
  *
- *	This function adds a new segment to a B-tree at a given location.
+ *	Discard the lexer styles of a line.
  *
  * Results:
  *	None.
  *
  * Side effects:
- *	SegPtr will be linked into its tree.
+ *	The line becomes unstyled.
  *
  *----------------------------------------------------------------------
  */
 
-	/* ARGSUSED */
 void
-TkBTreeLinkSegment(
-    TkTextSegment *segPtr,	/* Pointer to new segment to be added to
-				 * B-tree. Should be completely initialized by
-				 * caller except for nextPtr field. */
-    TkTextIndex *indexPtr)	/* Where to add segment: it gets linked in
-				 * just before the segment indicated here. */
+TkBTreeFreeStyles(
+    TkTextLine *linePtr)	/* Line to unstyle. */
 {
-    register TkTextSegment *prevPtr;
+    if (linePtr->styles != NULL) {
+	ckfree((char *) linePtr->styles);
+	linePtr->styles = NULL;
+    }
+}
 
-    prevPtr = SplitSeg(indexPtr);
-    if (prevPtr == NULL) {
-	segPtr->nextPtr = indexPtr->linePtr->segPtr;
-	indexPtr->linePtr->segPtr = segPtr;
-    } else {
-	segPtr->nextPtr = prevPtr->nextPtr;
-	prevPtr->nextPtr = segPtr;
+/*
+ *----------------------------------------------------------------------
+ *
+ * StyleFindRun --
+ *
+ *	Binary search the marks of a line's runs for the last one at or
+ *	before a byte, so that the run containing the byte is at most
+ *	STYLE_RUNS_PER_MARK runs further on.
+ *
+ * Results:
+ *	The index of the run to start walking from. *startPtr is set to the
+ *	byte index where that run starts.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+StyleFindRun(
+    TkTextStyleRuns *stylesPtr,	/* Runs of the line. */
+    int byteIndex,		/* Byte index within the line. */
+    int *startPtr)		/* Returns start of the run. */
+{
+    int lo = 0, hi = stylesPtr->numRuns / STYLE_RUNS_PER_MARK, mid;
+
+    /*
+     * Find the number of marks at or before byteIndex.
+     */
+
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	if (stylesPtr->marks[mid] <= byteIndex) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
+	}
     }
-    CleanupLine(indexPtr->linePtr);
-    if (tkBTreeDebug) {
-	TkBTreeCheck(indexPtr->tree);
+    *startPtr = (lo > 0) ? stylesPtr->marks[lo - 1] : 0;
+    return lo * STYLE_RUNS_PER_MARK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkBTreeGetStyle --
+ *
+ *	Find the lexer style of one byte of a line.
+ *
+ * Results:
+ *	The style of the byte, or -1 if it is unstyled. If endPtr isn't NULL,
+ *	*endPtr is set to the byte index just past the run containing the
+ *	byte, so callers stepping through a line need only look up the next
+ *	style when they reach it.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+TkBTreeGetStyle(
+    TkTextLine *linePtr,	/* Line containing the byte. */
+    int byteIndex,		/* Byte index within the line. */
+    int *endPtr)		/* Returns end of the run, may be NULL. */
+{
+    TkTextStyleRuns *stylesPtr = linePtr->styles;
+    int i, end = 0;
+
+    if (stylesPtr != NULL) {
+	for (i = StyleFindRun(stylesPtr, byteIndex, &end);
+		i < stylesPtr->numRuns; i++) {
+	    end += stylesPtr->runs[i].count;
+	    if (byteIndex < end) {
+		if (endPtr != NULL) {
+		    *endPtr = end;
+		}
+		return (stylesPtr->runs[i].style == 0xFF) ? -1
+			: stylesPtr->runs[i].style;
+	    }
+	}
     }
-    ((BTree *)indexPtr->tree)->stateEpoch++;
+    if (endPtr != NULL) {
+	*endPtr = INT_MAX;
+    }
+    return -1;
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
- * TkBTreeUnlinkSegment --
+ * TkBTreeGetStyles --
  *
- *	This function unlinks a segment from its line in a B-tree.
+ *	Expand the lexer styles of a range of bytes of a line into one style
+ *	byte per text byte.
  *
  * Results:
  *	None.
  *
  * Side effects:
- *	SegPtr will be unlinked from linePtr. The segment itself isn't
- *	modified by this function.
+ *	"count" bytes are stored in "styles", -1 for unstyled bytes.
  *
  *----------------------------------------------------------------------
  */
 
-	/* ARGSUSED */
 void
-TkBTreeUnlinkSegment(
-    TkTextSegment *segPtr,	/* Segment to be unlinked. */
-    TkTextLine *linePtr)	/* Line that currently contains segment. */
+TkBTreeGetStyles(
+    TkTextLine *linePtr,	/* Line containing the bytes. */
+    int byteIndex,		/* Byte index of the first byte. */
+    int count,			/* Number of bytes. */
+    char *styles)		/* Returns the styles. */
 {
-    register TkTextSegment *prevPtr;
+    TkTextStyleRuns *stylesPtr = linePtr->styles;
+    int i, start, end = 0, last = byteIndex + count;
 
-    if (linePtr->segPtr == segPtr) {
-	linePtr->segPtr = segPtr->nextPtr;
-    } else {
-	prevPtr = linePtr->segPtr;
-	while (prevPtr->nextPtr != segPtr) {
-	    prevPtr = prevPtr->nextPtr;
+    memset(styles, -1, (size_t) count);
+    if (stylesPtr == NULL) {
+	return;
+    }
+    for (i = StyleFindRun(stylesPtr, byteIndex, &end);
+	    i < stylesPtr->numRuns; i++) {
+	start = end;
+	end = start + stylesPtr->runs[i].count;
+	if (start >= last) {
+	    break;
+	}
+	if ((end > byteIndex) && (stylesPtr->runs[i].style != 0xFF)) {
+	    memset(styles + MAX(start, byteIndex) - byteIndex,
+		    stylesPtr->runs[i].style,
+		    (size_t) (MIN(end, last) - MAX(start, byteIndex)));
+	}
+    }
+}
 
-	    if (prevPtr == NULL) {
-		/*
-		 * Two logical lines merged into one display line through
-		 * eliding of a newline.
-		 */
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkBTreeSetStyles --
+ *
+ *	Set the lexer styles of a line from one style byte per character
+ *	byte, as produced by a lexer. Only character segments are counted in
+ *	"styles"; embedded windows and images are left unstyled.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The old styles of the line are replaced.
+ *
+ *----------------------------------------------------------------------
+ */
 
-		linePtr = TkBTreeNextLine(NULL, linePtr);
-		prevPtr = linePtr->segPtr;
+void
+TkBTreeSetStyles(
+    TkTextLine *linePtr,	/* Line to style. */
+    const char *styles,		/* One style per character byte. */
+    int count)			/* Number of bytes in styles. */
+{
+    StyleBuilder builder;
+    TkTextSegment *segPtr;
+    int i, j, n, copied = 0;
+
+    StyleBuilderInit(&builder);
+    for (segPtr = linePtr->segPtr;
+	    (segPtr != NULL) && (copied < count);
+	    segPtr = segPtr->nextPtr) {
+	if (segPtr->typePtr != &tkTextCharType) {
+	    StyleAppend(&builder, 0xFF, segPtr->size);
+	    continue;
+	}
+	n = MIN(segPtr->size, count - copied);
+	for (i = 0; i < n; i = j) {
+	    for (j = i + 1; (j < n) && (styles[copied+j] == styles[copied+i]);
+		    j++) {
+		/* Empty loop body. */
 	    }
+	    StyleAppend(&builder, (unsigned char) styles[copied+i], j - i);
 	}
-	prevPtr->nextPtr = segPtr->nextPtr;
+	copied += n;
     }
-    CleanupLine(linePtr);
+    StyleFinish(&builder, linePtr);
 }
-
+#endif /* STEXT_STYLE_RUNS */
+
+#ifdef STEXT_DIFF
+/*
+ *----------------------------------------------------------------------
+ *
+ * TkBTreeFreeLineState --
+ *
+ *	Discard the extended lexer state of a line.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The line's stateExt becomes NULL.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+TkBTreeFreeLineState(
+    TkTextLine *linePtr)	/* Line whose state is discarded. */
+{
+    if (linePtr->stateExt != NULL) {
+	ckfree((char *) linePtr->stateExt);
+	linePtr->stateExt = NULL;
+    }
+}
+#endif /* STEXT_DIFF */
+
 /*
  *----------------------------------------------------------------------
  *
@@ -2607,7 +4409,8 @@ TkBTreeTag(
 
     oldState = TkBTreeCharTagged(index1Ptr, tagPtr);
     if ((add != 0) ^ oldState) {
-	segPtr = (TkTextSegment *) ckalloc(TSEG_SIZE);
+	segPtr = (TkTextSegment *)
+		PoolAlloc(LINE_POOL(index1Ptr->linePtr), TSEG_SIZE);
 	segPtr->typePtr = (add) ? &tkTextToggleOnType : &tkTextToggleOffType;
 	prevPtr = SplitSeg(index1Ptr);
 	if (prevPtr == NULL) {
@@ -2652,7 +4455,8 @@ TkBTreeTag(
 	} else {
 	    changed = 0;
 	}
-	ckfree((char *) segPtr);
+	PoolFree(LINE_POOL(search.curIndex.linePtr), (char *) segPtr,
+		TSEG_SIZE);
 
 	/*
 	 * The code below is a bit tricky. After deleting a toggle we
@@ -2678,7 +4482,8 @@ TkBTreeTag(
 	}
     }
     if ((add != 0) ^ oldState) {
-	segPtr = (TkTextSegment *) ckalloc(TSEG_SIZE);
+	segPtr = (TkTextSegment *)
+		PoolAlloc(LINE_POOL(index2Ptr->linePtr), TSEG_SIZE);
 	segPtr->typePtr = (add) ? &tkTextToggleOffType : &tkTextToggleOnType;
 	prevPtr = SplitSeg(index2Ptr);
 	if (prevPtr == NULL) {
@@ -2741,7 +4546,7 @@ ChangeNodeToggleCount(
     int delta)			/* Amount to add to current toggle count for
 				 * tag (may be negative). */
 {
-    register Summary *summaryPtr, *prevPtr;
+    register Summary *summaryPtr;
     register Node *node2Ptr;
     int rootLevel;		/* Level of original tag root. */
 
@@ -2770,13 +4575,7 @@ ChangeNodeToggleCount(
 	 * perhaps all we have to do is adjust its count.
 	 */
 
-	for (prevPtr = NULL, summaryPtr = nodePtr->summaryPtr;
-		summaryPtr != NULL;
-		prevPtr = summaryPtr, summaryPtr = summaryPtr->nextPtr) {
-	    if (summaryPtr->tagPtr == tagPtr) {
-		break;
-	    }
-	}
+	summaryPtr = FindSummary(nodePtr, tagPtr);
 	if (summaryPtr != NULL) {
 	    summaryPtr->toggleCount += delta;
 	    if (summaryPtr->toggleCount > 0 &&
@@ -2798,12 +4597,7 @@ ChangeNodeToggleCount(
 	     * Zero toggle count; must remove this tag from the list.
 	     */
 
-	    if (prevPtr == NULL) {
-		nodePtr->summaryPtr = summaryPtr->nextPtr;
-	    } else {
-		prevPtr->nextPtr = summaryPtr->nextPtr;
-	    }
-	    ckfree((char *) summaryPtr);
+	    RemoveSummary(nodePtr, summaryPtr);
 	} else {
 	    /*
 	     * This tag isn't currently in the summary information list.
@@ -2822,20 +4616,12 @@ ChangeNodeToggleCount(
 
 		Node *rootNodePtr = tagPtr->tagRootPtr;
 
-		summaryPtr = (Summary *) ckalloc(sizeof(Summary));
-		summaryPtr->tagPtr = tagPtr;
-		summaryPtr->toggleCount = tagPtr->toggleCount - delta;
-		summaryPtr->nextPtr = rootNodePtr->summaryPtr;
-		rootNodePtr->summaryPtr = summaryPtr;
+		AddSummary(rootNodePtr, tagPtr, tagPtr->toggleCount - delta);
 		rootNodePtr = rootNodePtr->parentPtr;
 		rootLevel = rootNodePtr->level;
 		tagPtr->tagRootPtr = rootNodePtr;
 	    }
-	    summaryPtr = (Summary *) ckalloc(sizeof(Summary));
-	    summaryPtr->tagPtr = tagPtr;
-	    summaryPtr->toggleCount = delta;
-	    summaryPtr->nextPtr = nodePtr->summaryPtr;
-	    nodePtr->summaryPtr = summaryPtr;
+	    AddSummary(nodePtr, tagPtr, delta);
 	}
     }
 
@@ -2861,13 +4647,7 @@ ChangeNodeToggleCount(
 	for (node2Ptr = nodePtr->children.nodePtr;
 		node2Ptr != NULL ;
 		node2Ptr = node2Ptr->nextPtr) {
-	    for (prevPtr = NULL, summaryPtr = node2Ptr->summaryPtr;
-		    summaryPtr != NULL;
-		    prevPtr = summaryPtr, summaryPtr = summaryPtr->nextPtr) {
-		if (summaryPtr->tagPtr == tagPtr) {
-		    break;
-		}
-	    }
+	    summaryPtr = FindSummary(node2Ptr, tagPtr);
 	    if (summaryPtr == NULL) {
 		continue;
 	    }
@@ -2883,12 +4663,7 @@ ChangeNodeToggleCount(
 	     * This node has all the toggles, so push down the root.
 	     */
 
-	    if (prevPtr == NULL) {
-		node2Ptr->summaryPtr = summaryPtr->nextPtr;
-	    } else {
-		prevPtr->nextPtr = summaryPtr->nextPtr;
-	    }
-	    ckfree((char *) summaryPtr);
+	    RemoveSummary(node2Ptr, summaryPtr);
 	    tagPtr->tagRootPtr = node2Ptr;
 	    break;
 	}
@@ -2924,7 +4699,6 @@ FindTagStart(
     register Node *nodePtr;
     register TkTextLine *linePtr;
     register TkTextSegment *segPtr;
-    register Summary *summaryPtr;
     int offset;
 
     nodePtr = tagPtr->tagRootPtr;
@@ -2940,15 +4714,10 @@ FindTagStart(
     while (nodePtr->level > 0) {
 	for (nodePtr = nodePtr->children.nodePtr ; nodePtr != NULL;
 		nodePtr = nodePtr->nextPtr) {
-	    for (summaryPtr = nodePtr->summaryPtr ; summaryPtr != NULL;
-		    summaryPtr = summaryPtr->nextPtr) {
-		if (summaryPtr->tagPtr == tagPtr) {
-		    goto gotNodeWithTag;
-		}
+	    if (FindSummary(nodePtr, tagPtr) != NULL) {
+		break;
 	    }
 	}
-    gotNodeWithTag:
-	continue;
     }
 
     /*
@@ -3005,7 +4774,6 @@ FindTagEnd(
     register Node *nodePtr, *lastNodePtr;
     register TkTextLine *linePtr ,*lastLinePtr;
     register TkTextSegment *segPtr, *lastSegPtr, *last2SegPtr;
-    register Summary *summaryPtr;
     int lastoffset, lastoffset2, offset;
 
     nodePtr = tagPtr->tagRootPtr;
@@ -3021,12 +4789,8 @@ FindTagEnd(
     while (nodePtr->level > 0) {
 	for (lastNodePtr = NULL, nodePtr = nodePtr->children.nodePtr ;
 		nodePtr != NULL; nodePtr = nodePtr->nextPtr) {
-	    for (summaryPtr = nodePtr->summaryPtr ; summaryPtr != NULL;
-		    summaryPtr = summaryPtr->nextPtr) {
-		if (summaryPtr->tagPtr == tagPtr) {
-		    lastNodePtr = nodePtr;
-		    break;
-		}
+	    if (FindSummary(nodePtr, tagPtr) != NULL) {
+		lastNodePtr = nodePtr;
 	    }
 	}
 	nodePtr = lastNodePtr;
@@ -3298,7 +5062,6 @@ TkBTreeNextTag(
 {
     register TkTextSegment *segPtr;
     register Node *nodePtr;
-    register Summary *summaryPtr;
 
     if (searchPtr->linesLeft <= 0) {
 	goto searchOver;
@@ -3368,12 +5131,8 @@ TkBTreeNextTag(
 		nodePtr = nodePtr->parentPtr;
 	    }
 	    nodePtr = nodePtr->nextPtr;
-	    for (summaryPtr = nodePtr->summaryPtr; summaryPtr != NULL;
-		    summaryPtr = summaryPtr->nextPtr) {
-		if ((searchPtr->allTags) ||
-			(summaryPtr->tagPtr == searchPtr->tagPtr)) {
-		    goto gotNodeWithTag;
-		}
+	    if (SEARCH_IN_NODE(searchPtr, nodePtr)) {
+		goto gotNodeWithTag;
 	    }
 	    searchPtr->linesLeft -= nodePtr->numLines;
 	}
@@ -3388,24 +5147,14 @@ TkBTreeNextTag(
 	while (nodePtr->level > 0) {
 	    for (nodePtr = nodePtr->children.nodePtr; ;
 		    nodePtr = nodePtr->nextPtr) {
-		for (summaryPtr = nodePtr->summaryPtr; summaryPtr != NULL;
-			summaryPtr = summaryPtr->nextPtr) {
-		    if ((searchPtr->allTags)
-			    || (summaryPtr->tagPtr == searchPtr->tagPtr)) {
-			/*
-			 * Would really like a multi-level continue here...
-			 */
-
-			goto nextChild;
-		    }
+		if (SEARCH_IN_NODE(searchPtr, nodePtr)) {
+		    break;
 		}
 		searchPtr->linesLeft -= nodePtr->numLines;
 		if (nodePtr->nextPtr == NULL) {
 		    Tcl_Panic("TkBTreeNextTag found incorrect tag summary info.");
 		}
 	    }
-	nextChild:
-	    continue;
 	}
 
 	/*
@@ -3464,7 +5213,6 @@ TkBTreePrevTag(
     register TkTextSegment *segPtr, *prevPtr;
     register TkTextLine *linePtr, *prevLinePtr;
     register Node *nodePtr, *node2Ptr, *prevNodePtr;
-    register Summary *summaryPtr;
     int byteIndex, linesSkipped;
     int pastLast;		/* Saw last marker during scan. */
 
@@ -3567,19 +5315,12 @@ TkBTreePrevTag(
 	    for (prevNodePtr = NULL, linesSkipped = 0,
 		    node2Ptr = nodePtr->parentPtr->children.nodePtr ;
 		    node2Ptr != nodePtr;  node2Ptr = node2Ptr->nextPtr) {
-		for (summaryPtr = node2Ptr->summaryPtr; summaryPtr != NULL;
-			summaryPtr = summaryPtr->nextPtr) {
-		    if ((searchPtr->allTags) ||
-			    (summaryPtr->tagPtr == searchPtr->tagPtr)) {
-			prevNodePtr = node2Ptr;
-			linesSkipped = 0;
-			goto keepLooking;
-		    }
+		if (SEARCH_IN_NODE(searchPtr, node2Ptr)) {
+		    prevNodePtr = node2Ptr;
+		    linesSkipped = 0;
+		} else {
+		    linesSkipped += node2Ptr->numLines;
 		}
-		linesSkipped += node2Ptr->numLines;
-
-	    keepLooking:
-		continue;
 	    }
 	    if (prevNodePtr != NULL) {
 		nodePtr = prevNodePtr;
@@ -3604,19 +5345,12 @@ TkBTreePrevTag(
 	    for (linesSkipped = 0, prevNodePtr = NULL,
 		    nodePtr = nodePtr->children.nodePtr; nodePtr != NULL ;
 		    nodePtr = nodePtr->nextPtr) {
-		for (summaryPtr = nodePtr->summaryPtr; summaryPtr != NULL;
-			summaryPtr = summaryPtr->nextPtr) {
-		    if ((searchPtr->allTags)
-			    || (summaryPtr->tagPtr == searchPtr->tagPtr)) {
-			prevNodePtr = nodePtr;
-			linesSkipped = 0;
-			goto keepLooking2;
-		    }
+		if (SEARCH_IN_NODE(searchPtr, nodePtr)) {
+		    prevNodePtr = nodePtr;
+		    linesSkipped = 0;
+		} else {
+		    linesSkipped += nodePtr->numLines;
 		}
-		linesSkipped += nodePtr->numLines;
-
-	    keepLooking2:
-		continue;
 	    }
 	    if (prevNodePtr == NULL) {
 		Tcl_Panic("TkBTreePrevTag found incorrect tag summary info.");
@@ -3735,11 +5469,9 @@ TkBTreeCharTagged(
 
 	for (siblingPtr = nodePtr->parentPtr->children.nodePtr;
 		siblingPtr != nodePtr; siblingPtr = siblingPtr->nextPtr) {
-	    for (summaryPtr = siblingPtr->summaryPtr; summaryPtr != NULL;
-		    summaryPtr = summaryPtr->nextPtr) {
-		if (summaryPtr->tagPtr == tagPtr) {
-		    toggles += summaryPtr->toggleCount;
-		}
+	    summaryPtr = FindSummary(siblingPtr, tagPtr);
+	    if (summaryPtr != NULL) {
+		toggles += summaryPtr->toggleCount;
 	    }
 	}
 	if (nodePtr == tagPtr->tagRootPtr) {
@@ -3888,11 +5620,12 @@ TkBTreeGetTags(
 	    nodePtr = nodePtr->parentPtr) {
 	register Node *siblingPtr;
 	register Summary *summaryPtr;
+	int i;
 
 	for (siblingPtr = nodePtr->parentPtr->children.nodePtr;
 		siblingPtr != nodePtr; siblingPtr = siblingPtr->nextPtr) {
-	    for (summaryPtr = siblingPtr->summaryPtr; summaryPtr != NULL;
-		    summaryPtr = summaryPtr->nextPtr) {
+	    for (i = 0; i < siblingPtr->numSummaries; i++) {
+		summaryPtr = &siblingPtr->summaries[i];
 		if (summaryPtr->toggleCount & 1) {
 #ifdef STEXT_DIFF
 		    IncCount(summaryPtr->tagPtr, summaryPtr->toggleCount,
@@ -4111,11 +5844,12 @@ TkTextIsElided(
 	    nodePtr = nodePtr->parentPtr) {
 	register Node *siblingPtr;
 	register Summary *summaryPtr;
+	int i;
 
 	for (siblingPtr = nodePtr->parentPtr->children.nodePtr;
 		siblingPtr != nodePtr; siblingPtr = siblingPtr->nextPtr) {
-	    for (summaryPtr = siblingPtr->summaryPtr; summaryPtr != NULL;
-		    summaryPtr = summaryPtr->nextPtr) {
+	    for (i = 0; i < siblingPtr->numSummaries; i++) {
+		summaryPtr = &siblingPtr->summaries[i];
 		if (summaryPtr->toggleCount & 1) {
 		    tagPtr = summaryPtr->tagPtr;
 		    if (tagPtr->elideString != NULL) {
@@ -4336,21 +6070,16 @@ TkBTreeCheck(
 	    Tcl_Panic("TkBTreeCheck found odd toggle count for \"%s\" (%d)",
 		    tagPtr->name, tagPtr->toggleCount);
 	}
-	for (summaryPtr = nodePtr->summaryPtr; summaryPtr != NULL;
-		summaryPtr = summaryPtr->nextPtr) {
-	    if (summaryPtr->tagPtr == tagPtr) {
-		Tcl_Panic("TkBTreeCheck found root node with summary info");
-	    }
+	if (FindSummary(nodePtr, tagPtr) != NULL) {
+	    Tcl_Panic("TkBTreeCheck found root node with summary info");
 	}
 	count = 0;
 	if (nodePtr->level > 0) {
 	    for (nodePtr = nodePtr->children.nodePtr ; nodePtr != NULL ;
 		    nodePtr = nodePtr->nextPtr) {
-		for (summaryPtr = nodePtr->summaryPtr; summaryPtr != NULL;
-			summaryPtr = summaryPtr->nextPtr) {
-		    if (summaryPtr->tagPtr == tagPtr) {
-			count += summaryPtr->toggleCount;
-		    }
+		summaryPtr = FindSummary(nodePtr, tagPtr);
+		if (summaryPtr != NULL) {
+		    count += summaryPtr->toggleCount;
 		}
 	    }
 	} else {
@@ -4453,7 +6182,8 @@ CheckNodeConsistency(
     register Summary *summaryPtr, *summaryPtr2;
     register TkTextLine *linePtr;
     register TkTextSegment *segPtr;
-    int numChildren, numLines, toggleCount, minChildren, i;
+    int numChildren, numLines, toggleCount, minChildren, i, j;
+    int numBytes, numChars, numEmbedded;
 #ifdef STEXT_LINE_VISIBLE
     int *numLinesVisible;
     int linesVisible[PIXEL_CLIENTS];
@@ -4476,6 +6206,9 @@ CheckNodeConsistency(
 
     numChildren = 0;
     numLines = 0;
+    numBytes = 0;
+    numChars = 0;
+    numEmbedded = 0;
     if (references > PIXEL_CLIENTS) {
 	numPixels = (int *) ckalloc(sizeof(int) * references);
 #ifdef STEXT_LINE_VISIBLE
@@ -4518,6 +6251,12 @@ CheckNodeConsistency(
 			&& (segPtr->typePtr != &tkTextCharType)) {
 		    Tcl_Panic("CheckNodeConsistency: line ended with wrong type");
 		}
+		numBytes += segPtr->size;
+		if (segPtr->typePtr == &tkTextCharType) {
+		    numChars += CountChars(segPtr->body.chars, segPtr->size);
+		} else {
+		    numEmbedded += segPtr->size;
+		}
 	    }
 	    numChildren++;
 	    numLines++;
@@ -4544,25 +6283,20 @@ CheckNodeConsistency(
 			nodePtr->level, childNodePtr->level);
 	    }
 	    CheckNodeConsistency(childNodePtr, references);
-	    for (summaryPtr = childNodePtr->summaryPtr; summaryPtr != NULL;
-			summaryPtr = summaryPtr->nextPtr) {
-		for (summaryPtr2 = nodePtr->summaryPtr; ;
-			summaryPtr2 = summaryPtr2->nextPtr) {
-		    if (summaryPtr2 == NULL) {
-			if (summaryPtr->tagPtr->tagRootPtr == nodePtr) {
-			    break;
-			}
-			Tcl_Panic("CheckNodeConsistency: node tag \"%s\" not %s",
-				summaryPtr->tagPtr->name,
-				"present in parent summaries");
-		    }
-		    if (summaryPtr->tagPtr == summaryPtr2->tagPtr) {
-			break;
-		    }
+	    for (j = 0; j < childNodePtr->numSummaries; j++) {
+		summaryPtr = &childNodePtr->summaries[j];
+		if (FindSummary(nodePtr, summaryPtr->tagPtr) == NULL
+			&& summaryPtr->tagPtr->tagRootPtr != nodePtr) {
+		    Tcl_Panic("CheckNodeConsistency: node tag \"%s\" not %s",
+			    summaryPtr->tagPtr->name,
+			    "present in parent summaries");
 		}
 	    }
 	    numChildren++;
 	    numLines += childNodePtr->numLines;
+	    numBytes += childNodePtr->numBytes;
+	    numChars += childNodePtr->numChars;
+	    numEmbedded += childNodePtr->numEmbedded;
 	    for (i = 0; i<references; i++) {
 		numPixels[i] += childNodePtr->numPixels[i];
 #ifdef STEXT_LINE_VISIBLE
@@ -4579,6 +6313,18 @@ CheckNodeConsistency(
 	Tcl_Panic("CheckNodeConsistency: mismatch in numLines (%d %d)",
 		numLines, nodePtr->numLines);
     }
+    if (numBytes != nodePtr->numBytes) {
+	Tcl_Panic("CheckNodeConsistency: mismatch in numBytes (%d %d)",
+		numBytes, nodePtr->numBytes);
+    }
+    if (numChars != nodePtr->numChars) {
+	Tcl_Panic("CheckNodeConsistency: mismatch in numChars (%d %d)",
+		numChars, nodePtr->numChars);
+    }
+    if (numEmbedded != nodePtr->numEmbedded) {
+	Tcl_Panic("CheckNodeConsistency: mismatch in numEmbedded (%d %d)",
+		numEmbedded, nodePtr->numEmbedded);
+    }
     for (i = 0; i<references; i++) {
 	if (numPixels[i] != nodePtr->numPixels[i]) {
 	    Tcl_Panic("CheckNodeConsistency: mismatch in numPixels (%d %d) for widget (%d)",
@@ -4598,8 +6344,12 @@ CheckNodeConsistency(
 #endif
     }
 
-    for (summaryPtr = nodePtr->summaryPtr; summaryPtr != NULL;
-	    summaryPtr = summaryPtr->nextPtr) {
+    if (nodePtr->numSummaries > nodePtr->summarySpace) {
+	Tcl_Panic("CheckNodeConsistency: too many summaries (%d %d)",
+		nodePtr->numSummaries, nodePtr->summarySpace);
+    }
+    for (j = 0; j < nodePtr->numSummaries; j++) {
+	summaryPtr = &nodePtr->summaries[j];
 	if (summaryPtr->tagPtr->toggleCount == summaryPtr->toggleCount) {
 	    Tcl_Panic("CheckNodeConsistency: found unpruned root for \"%s\"",
 		    summaryPtr->tagPtr->name);
@@ -4623,12 +6373,9 @@ CheckNodeConsistency(
 	    for (childNodePtr = nodePtr->children.nodePtr;
 		    childNodePtr != NULL;
 		    childNodePtr = childNodePtr->nextPtr) {
-		for (summaryPtr2 = childNodePtr->summaryPtr;
-			summaryPtr2 != NULL;
-			summaryPtr2 = summaryPtr2->nextPtr) {
-		    if (summaryPtr2->tagPtr == summaryPtr->tagPtr) {
-			toggleCount += summaryPtr2->toggleCount;
-		    }
+		summaryPtr2 = FindSummary(childNodePtr, summaryPtr->tagPtr);
+		if (summaryPtr2 != NULL) {
+		    toggleCount += summaryPtr2->toggleCount;
 		}
 	    }
 	}
@@ -4636,16 +6383,69 @@ CheckNodeConsistency(
 	    Tcl_Panic("CheckNodeConsistency: mismatch in toggleCount (%d %d)",
 		    toggleCount, summaryPtr->toggleCount);
 	}
-	for (summaryPtr2 = summaryPtr->nextPtr; summaryPtr2 != NULL;
-		summaryPtr2 = summaryPtr2->nextPtr) {
-	    if (summaryPtr2->tagPtr == summaryPtr->tagPtr) {
-		Tcl_Panic("CheckNodeConsistency: duplicated node tag: %s",
-			summaryPtr->tagPtr->name);
-	    }
+	if (j > 0 && summaryPtr[-1].tagPtr >= summaryPtr->tagPtr) {
+	    Tcl_Panic("CheckNodeConsistency: %s node tag: %s",
+		    summaryPtr[-1].tagPtr == summaryPtr->tagPtr ?
+		    "duplicated" : "unsorted", summaryPtr->tagPtr->name);
 	}
     }
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * GrowRoot --
+ *
+ *	This function makes a new root node above the root of a B-tree, with
+ *	the old root as its only child. It is called before the root is split.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The tree becomes one level deeper.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+GrowRoot(
+    BTree *treePtr)		/* Tree whose root is about to be split. */
+{
+    register Node *rootPtr = treePtr->rootPtr;
+    register Node *newPtr;
+    int i;
+
+    newPtr = (Node *) ckalloc(sizeof(Node));
+    newPtr->parentPtr = NULL;
+    newPtr->nextPtr = NULL;
+    newPtr->summaries = NULL;
+    newPtr->numSummaries = 0;
+    newPtr->summarySpace = 0;
+    newPtr->level = rootPtr->level + 1;
+    newPtr->poolPtr = rootPtr->poolPtr;
+    newPtr->children.nodePtr = rootPtr;
+    newPtr->numChildren = 1;
+    newPtr->numLines = rootPtr->numLines;
+    newPtr->numBytes = rootPtr->numBytes;
+    newPtr->numChars = rootPtr->numChars;
+    newPtr->numEmbedded = rootPtr->numEmbedded;
+    newPtr->numPixels = (int *)
+	    ckalloc(sizeof(int) * treePtr->pixelReferences);
+#ifdef STEXT_LINE_VISIBLE
+    newPtr->numLinesVisible = (int *)
+	    ckalloc(sizeof(int) * treePtr->pixelReferences);
+#endif
+    for (i=0; i<treePtr->pixelReferences; i++) {
+	newPtr->numPixels[i] = rootPtr->numPixels[i];
+#ifdef STEXT_LINE_VISIBLE
+	newPtr->numLinesVisible[i] = rootPtr->numLinesVisible[i];
+#endif
+    }
+    RecomputeNodeCounts(treePtr, newPtr);
+    treePtr->rootPtr = newPtr;
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -4694,28 +6494,7 @@ Rebalance(
 		 */
 
 		if (nodePtr->parentPtr == NULL) {
-		    newPtr = (Node *) ckalloc(sizeof(Node));
-		    newPtr->parentPtr = NULL;
-		    newPtr->nextPtr = NULL;
-		    newPtr->summaryPtr = NULL;
-		    newPtr->level = nodePtr->level + 1;
-		    newPtr->children.nodePtr = nodePtr;
-		    newPtr->numChildren = 1;
-		    newPtr->numLines = nodePtr->numLines;
-		    newPtr->numPixels = (int *)
-			    ckalloc(sizeof(int) * treePtr->pixelReferences);
-#ifdef STEXT_LINE_VISIBLE
-		    newPtr->numLinesVisible = (int *)
-			    ckalloc(sizeof(int) * treePtr->pixelReferences);
-#endif
-		    for (i=0; i<treePtr->pixelReferences; i++) {
-			newPtr->numPixels[i] = nodePtr->numPixels[i];
-#ifdef STEXT_LINE_VISIBLE
-			newPtr->numLinesVisible[i] = nodePtr->numLinesVisible[i];
-#endif
-		    }
-		    RecomputeNodeCounts(treePtr, newPtr);
-		    treePtr->rootPtr = newPtr;
+		    GrowRoot(treePtr);
 		}
 		newPtr = (Node *) ckalloc(sizeof(Node));
 		newPtr->numPixels = (int *)
@@ -4733,8 +6512,11 @@ Rebalance(
 		newPtr->parentPtr = nodePtr->parentPtr;
 		newPtr->nextPtr = nodePtr->nextPtr;
 		nodePtr->nextPtr = newPtr;
-		newPtr->summaryPtr = NULL;
+		newPtr->summaries = NULL;
+		newPtr->numSummaries = 0;
+		newPtr->summarySpace = 0;
 		newPtr->level = nodePtr->level;
+		newPtr->poolPtr = nodePtr->poolPtr;
 		newPtr->numChildren = nodePtr->numChildren - MIN_CHILDREN;
 		if (nodePtr->level == 0) {
 		    for (i = MIN_CHILDREN-1,
@@ -4781,7 +6563,7 @@ Rebalance(
 		if ((nodePtr->numChildren == 1) && (nodePtr->level > 0)) {
 		    treePtr->rootPtr = nodePtr->children.nodePtr;
 		    treePtr->rootPtr->parentPtr = NULL;
-		    DeleteSummaries(nodePtr->summaryPtr);
+		    DeleteSummaries(nodePtr);
 		    ckfree((char *) nodePtr);
 		}
 		return;
@@ -4870,7 +6652,7 @@ Rebalance(
 		RecomputeNodeCounts(treePtr, nodePtr);
 		nodePtr->nextPtr = otherPtr->nextPtr;
 		nodePtr->parentPtr->numChildren--;
-		DeleteSummaries(otherPtr->summaryPtr);
+		DeleteSummaries(otherPtr);
 		ckfree((char *) otherPtr);
 		continue;
 	    }
@@ -4893,6 +6675,116 @@ Rebalance(
     }
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * RebalanceBulk --
+ *
+ *	This function is called in place of Rebalance when an insert has
+ *	added many lines to one node. Rebalance would split off MIN_CHILDREN
+ *	children at a time, walking the remaining list again for every split
+ *	and leaving the nodes half full. Here the children of the node are
+ *	instead divided evenly among as few nodes as will hold them, in one
+ *	pass over the list, and the same is done for each ancestor that
+ *	overflows as a result. The tree above the insertion point is thus
+ *	built bottom-up out of nearly full nodes.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The internal structure of treePtr may change.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RebalanceBulk(
+    BTree *treePtr,		/* Tree that is being rebalanced. */
+    register Node *nodePtr)	/* Node that may have too many children. */
+{
+    for ( ; nodePtr != NULL && nodePtr->numChildren > MAX_CHILDREN;
+	    nodePtr = nodePtr->parentPtr) {
+	register Node *newPtr;
+	Node *childPtr = NULL;
+	TkTextLine *linePtr = NULL;
+	int numNodes, numChildren, numExtra, i;
+
+	if (nodePtr->parentPtr == NULL) {
+	    GrowRoot(treePtr);
+	}
+
+	/*
+	 * Every node gets numChildren children, and the first numExtra of
+	 * them one more. Since the node overflowed there are at least two
+	 * nodes, so none of them gets fewer than MIN_CHILDREN.
+	 */
+
+	numNodes = (nodePtr->numChildren + MAX_CHILDREN - 1) / MAX_CHILDREN;
+	numChildren = nodePtr->numChildren / numNodes;
+	numExtra = nodePtr->numChildren % numNodes;
+	if (nodePtr->level == 0) {
+	    linePtr = nodePtr->children.linePtr;
+	} else {
+	    childPtr = nodePtr->children.nodePtr;
+	}
+
+	for (newPtr = nodePtr; ; ) {
+	    for (i = numChildren - (numExtra-- > 0 ? 0 : 1); i > 0; i--) {
+		if (newPtr->level == 0) {
+		    linePtr = linePtr->nextPtr;
+		} else {
+		    childPtr = childPtr->nextPtr;
+		}
+	    }
+	    if (--numNodes == 0) {
+		RecomputeNodeCounts(treePtr, newPtr);
+		break;
+	    }
+
+	    /*
+	     * Cut the child list after the last child of this node and start
+	     * a new sibling with the rest.
+	     */
+
+	    nodePtr = newPtr;
+	    newPtr = (Node *) ckalloc(sizeof(Node));
+	    newPtr->numPixels = (int *)
+		    ckalloc(sizeof(int) * treePtr->pixelReferences);
+#ifdef STEXT_LINE_VISIBLE
+	    newPtr->numLinesVisible = (int *)
+		    ckalloc(sizeof(int) * treePtr->pixelReferences);
+#endif
+	    for (i=0; i<treePtr->pixelReferences; i++) {
+		newPtr->numPixels[i] = 0;
+#ifdef STEXT_LINE_VISIBLE
+		newPtr->numLinesVisible[i] = 0;
+#endif
+	    }
+	    newPtr->parentPtr = nodePtr->parentPtr;
+	    newPtr->nextPtr = nodePtr->nextPtr;
+	    nodePtr->nextPtr = newPtr;
+	    newPtr->summaries = NULL;
+	    newPtr->numSummaries = 0;
+	    newPtr->summarySpace = 0;
+	    newPtr->level = nodePtr->level;
+	    newPtr->poolPtr = nodePtr->poolPtr;
+	    if (nodePtr->level == 0) {
+		newPtr->children.linePtr = linePtr->nextPtr;
+		linePtr->nextPtr = NULL;
+		linePtr = newPtr->children.linePtr;
+	    } else {
+		newPtr->children.nodePtr = childPtr->nextPtr;
+		childPtr->nextPtr = NULL;
+		childPtr = newPtr->children.nodePtr;
+	    }
+	    RecomputeNodeCounts(treePtr, nodePtr);
+	    nodePtr->parentPtr->numChildren++;
+	}
+	nodePtr = newPtr;
+    }
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -4908,7 +6800,8 @@ Rebalance(
  *
  * Side effects:
  *	The tag counts for nodePtr are modified to reflect its current child
- *	structure, as are its numChildren and numLines fields. Also, all of
+ *	structure, as are its numChildren, numLines, numBytes, numChars and
+ *	numEmbedded fields. Also, all of
  *	the childrens' parentPtr fields are made to point to nodePtr.
  *
  *----------------------------------------------------------------------
@@ -4925,19 +6818,25 @@ RecomputeNodeCounts(
     register TkTextLine *linePtr;
     register TkTextSegment *segPtr;
     TkTextTag *tagPtr;
-    int ref;
+    int ref, i, j;
 
     /*
      * Zero out all the existing counts for the node, but don't delete the
      * existing Summary records (most of them will probably be reused).
      */
 
-    for (summaryPtr = nodePtr->summaryPtr; summaryPtr != NULL;
-	    summaryPtr = summaryPtr->nextPtr) {
-	summaryPtr->toggleCount = 0;
+    for (i = 0; i < nodePtr->numSummaries; i++) {
+	nodePtr->summaries[i].toggleCount = 0;
     }
     nodePtr->numChildren = 0;
     nodePtr->numLines = 0;
+    nodePtr->numBytes = 0;
+    nodePtr->numChars = 0;
+    nodePtr->numEmbedded = 0;
+#ifdef STEXT_FOLDING
+    nodePtr->foldStale = true;
+    FoldIndexStale(nodePtr->parentPtr);
+#endif
     for (ref = 0; ref<treePtr->pixelReferences; ref++) {
 	nodePtr->numPixels[ref] = 0;
 #if defined(STEXT_LINE_VISIBLE) && defined(STEXT_LINE_FLAGS)
@@ -4969,26 +6868,24 @@ RecomputeNodeCounts(
 	    linePtr->parentPtr = nodePtr;
 	    for (segPtr = linePtr->segPtr; segPtr != NULL;
 		    segPtr = segPtr->nextPtr) {
+		nodePtr->numBytes += segPtr->size;
+		if (segPtr->typePtr == &tkTextCharType) {
+		    nodePtr->numChars +=
+			    CountChars(segPtr->body.chars, segPtr->size);
+		} else {
+		    nodePtr->numEmbedded += segPtr->size;
+		}
 		if (((segPtr->typePtr != &tkTextToggleOnType)
 			&& (segPtr->typePtr != &tkTextToggleOffType))
 			|| !(segPtr->body.toggle.inNodeCounts)) {
 		    continue;
 		}
 		tagPtr = segPtr->body.toggle.tagPtr;
-		for (summaryPtr = nodePtr->summaryPtr; ;
-			summaryPtr = summaryPtr->nextPtr) {
-		    if (summaryPtr == NULL) {
-			summaryPtr = (Summary *) ckalloc(sizeof(Summary));
-			summaryPtr->tagPtr = tagPtr;
-			summaryPtr->toggleCount = 1;
-			summaryPtr->nextPtr = nodePtr->summaryPtr;
-			nodePtr->summaryPtr = summaryPtr;
-			break;
-		    }
-		    if (summaryPtr->tagPtr == tagPtr) {
-			summaryPtr->toggleCount++;
-			break;
-		    }
+		summaryPtr = FindSummary(nodePtr, tagPtr);
+		if (summaryPtr == NULL) {
+		    AddSummary(nodePtr, tagPtr, 1);
+		} else {
+		    summaryPtr->toggleCount++;
 		}
 	    }
 	}
@@ -4997,6 +6894,9 @@ RecomputeNodeCounts(
 		childPtr = childPtr->nextPtr) {
 	    nodePtr->numChildren++;
 	    nodePtr->numLines += childPtr->numLines;
+	    nodePtr->numBytes += childPtr->numBytes;
+	    nodePtr->numChars += childPtr->numChars;
+	    nodePtr->numEmbedded += childPtr->numEmbedded;
 	    for (ref = 0; ref<treePtr->pixelReferences; ref++) {
 		nodePtr->numPixels[ref] += childPtr->numPixels[ref];
 #ifdef STEXT_LINE_VISIBLE
@@ -5004,22 +6904,14 @@ RecomputeNodeCounts(
 #endif
 	    }
 	    childPtr->parentPtr = nodePtr;
-	    for (summaryPtr2 = childPtr->summaryPtr; summaryPtr2 != NULL;
-		    summaryPtr2 = summaryPtr2->nextPtr) {
-		for (summaryPtr = nodePtr->summaryPtr; ;
-			summaryPtr = summaryPtr->nextPtr) {
-		    if (summaryPtr == NULL) {
-			summaryPtr = (Summary *) ckalloc(sizeof(Summary));
-			summaryPtr->tagPtr = summaryPtr2->tagPtr;
-			summaryPtr->toggleCount = summaryPtr2->toggleCount;
-			summaryPtr->nextPtr = nodePtr->summaryPtr;
-			nodePtr->summaryPtr = summaryPtr;
-			break;
-		    }
-		    if (summaryPtr->tagPtr == summaryPtr2->tagPtr) {
-			summaryPtr->toggleCount += summaryPtr2->toggleCount;
-			break;
-		    }
+	    for (i = 0; i < childPtr->numSummaries; i++) {
+		summaryPtr2 = &childPtr->summaries[i];
+		summaryPtr = FindSummary(nodePtr, summaryPtr2->tagPtr);
+		if (summaryPtr == NULL) {
+		    AddSummary(nodePtr, summaryPtr2->tagPtr,
+			    summaryPtr2->toggleCount);
+		} else {
+		    summaryPtr->toggleCount += summaryPtr2->toggleCount;
 		}
 	    }
 	}
@@ -5032,8 +6924,8 @@ RecomputeNodeCounts(
      * no summary information, and they become the tagRootPtr for the tag.
      */
 
-    summaryPtr2 = NULL;
-    for (summaryPtr = nodePtr->summaryPtr; summaryPtr != NULL; ) {
+    for (i = j = 0; i < nodePtr->numSummaries; i++) {
+	summaryPtr = &nodePtr->summaries[i];
 	if (summaryPtr->toggleCount > 0 &&
 		summaryPtr->toggleCount < summaryPtr->tagPtr->toggleCount) {
 	    if (nodePtr->level == summaryPtr->tagPtr->tagRootPtr->level) {
@@ -5044,8 +6936,7 @@ RecomputeNodeCounts(
 
 		summaryPtr->tagPtr->tagRootPtr = nodePtr->parentPtr;
 	    }
-	    summaryPtr2 = summaryPtr;
-	    summaryPtr = summaryPtr->nextPtr;
+	    nodePtr->summaries[j++] = *summaryPtr;
 	    continue;
 	}
 	if (summaryPtr->toggleCount == summaryPtr->tagPtr->toggleCount) {
@@ -5056,15 +6947,89 @@ RecomputeNodeCounts(
 
 	    summaryPtr->tagPtr->tagRootPtr = nodePtr;
 	}
-	if (summaryPtr2 != NULL) {
-	    summaryPtr2->nextPtr = summaryPtr->nextPtr;
-	    ckfree((char *) summaryPtr);
-	    summaryPtr = summaryPtr2->nextPtr;
-	} else {
-	    nodePtr->summaryPtr = summaryPtr->nextPtr;
-	    ckfree((char *) summaryPtr);
-	    summaryPtr = nodePtr->summaryPtr;
-	}
+    }
+    nodePtr->numSummaries = j;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CountChars --
+ *
+ *	Count the characters in a string of UTF-8 bytes.
+ *
+ * Results:
+ *	The number of characters in the first numBytes bytes of string.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+CountChars(
+    const char *string,		/* Characters to count. */
+    int numBytes)		/* Number of bytes in string. */
+{
+    register const unsigned char *p = (const unsigned char *) string;
+    register int i = numBytes;
+
+    /*
+     * Run over the leading ascii characters before resorting to the
+     * Tcl_NumUtfChars call, as TkTextIndexCount does.
+     */
+
+    while (i && (*p < 0xC0)) {
+	i--;
+	p++;
+    }
+    if (i) {
+	return numBytes - i + Tcl_NumUtfChars((const char *) p, i);
+    }
+    return numBytes;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ChangeNodeSizes --
+ *
+ *	This function is called when a segment is added to or removed from a
+ *	line, to update the byte and character counts of the line's node and
+ *	of all its ancestors.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The numBytes, numChars and numEmbedded fields of nodePtr and its
+ *	ancestors are changed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+ChangeNodeSizes(
+    register Node *nodePtr,	/* Node that holds the line of segPtr. */
+    const TkTextSegment *segPtr,/* Segment that was added or removed. */
+    int sign)			/* 1 if the segment was added, -1 if it was
+				 * removed. */
+{
+    int numChars = 0, numEmbedded = 0;
+
+    if (segPtr->size == 0) {
+	return;
+    }
+    if (segPtr->typePtr == &tkTextCharType) {
+	numChars = sign * CountChars(segPtr->body.chars, segPtr->size);
+    } else {
+	numEmbedded = sign * segPtr->size;
+    }
+    for ( ; nodePtr != NULL; nodePtr = nodePtr->parentPtr) {
+	nodePtr->numBytes += sign * segPtr->size;
+	nodePtr->numChars += numChars;
+	nodePtr->numEmbedded += numEmbedded;
     }
 }
 
@@ -5179,39 +7144,73 @@ TkBTreeNumPixels(
 static TkTextSegment *
 CharSplitProc(
     TkTextSegment *segPtr,	/* Pointer to segment to split. */
-    int index)			/* Position within segment at which to
+    int index,			/* Position within segment at which to
 				 * split. */
+    TkTextLine *linePtr)	/* Line containing segment. */
 {
     TkTextSegment *newPtr1, *newPtr2;
 
-    newPtr1 = (TkTextSegment *) ckalloc(CSEG_SIZE(index));
-    newPtr2 = (TkTextSegment *) ckalloc(
+#ifdef STEXT_MAPPED_CHARS
+    /*
+     * Splitting a segment doesn't modify the text, so both halves of a
+     * mapped segment still point into the mapping.
+     */
+
+    if (CSEG_MAPPED(segPtr)) {
+	newPtr1 = (TkTextSegment *)
+		PoolAlloc(LINE_POOL(linePtr), CSEG_MAPPED_SIZE);
+	newPtr2 = (TkTextSegment *)
+		PoolAlloc(LINE_POOL(linePtr), CSEG_MAPPED_SIZE);
+	newPtr1->typePtr = &tkTextCharType;
+	newPtr1->nextPtr = newPtr2;
+	newPtr1->size = index;
+	newPtr1->body.ch = segPtr->body.ch;
+	newPtr2->typePtr = &tkTextCharType;
+	newPtr2->nextPtr = segPtr->nextPtr;
+	newPtr2->size = segPtr->size - index;
+	newPtr2->body.ch.chars = segPtr->body.ch.chars + index;
+	newPtr2->body.ch.u.mapPtr = segPtr->body.ch.u.mapPtr;
+	newPtr2->body.ch.u.mapPtr->refCount++;
+	PoolFree(LINE_POOL(linePtr), (char *) segPtr, CSEG_MAPPED_SIZE);
+	return newPtr1;
+    }
+#endif
+
+    newPtr1 = (TkTextSegment *)
+	    PoolAlloc(LINE_POOL(linePtr), CSEG_SIZE(index));
+    newPtr2 = (TkTextSegment *) PoolAlloc(LINE_POOL(linePtr),
 	    CSEG_SIZE(segPtr->size - index));
     newPtr1->typePtr = &tkTextCharType;
     newPtr1->nextPtr = newPtr2;
     newPtr1->size = index;
-#ifdef STEXT_STYLE_HACK
+#if defined(STEXT_STYLE_HACK) && !defined(STEXT_STYLE_RUNS)
     newPtr1->body.chst.chars = newPtr1->body.chst.data;
     newPtr1->body.chst.style = newPtr1->body.chst.data + newPtr1->size + 1;
     memcpy(newPtr1->body.chst.style, segPtr->body.chst.style, (size_t) index);
     newPtr1->body.chst.style[index] = -1;
+#endif
+#ifdef STEXT_MAPPED_CHARS
+    newPtr1->body.ch.chars = newPtr1->body.ch.u.data;
 #endif
     strncpy(newPtr1->body.chars, segPtr->body.chars, (size_t) index);
     newPtr1->body.chars[index] = 0;
     newPtr2->typePtr = &tkTextCharType;
     newPtr2->nextPtr = segPtr->nextPtr;
     newPtr2->size = segPtr->size - index;
-#ifdef STEXT_STYLE_HACK
+#if defined(STEXT_STYLE_HACK) && !defined(STEXT_STYLE_RUNS)
     newPtr2->body.chst.chars = newPtr2->body.chst.data;
     newPtr2->body.chst.style = newPtr2->body.chst.data + newPtr2->size + 1;
     memcpy(newPtr2->body.chst.style, segPtr->body.chst.style + index,
 	newPtr2->size);
+#endif
+#ifdef STEXT_MAPPED_CHARS
+    newPtr2->body.ch.chars = newPtr2->body.ch.u.data;
 #endif
     strcpy(newPtr2->body.chars, segPtr->body.chars + index);
-    ckfree((char *) segPtr);
+    PoolFree(LINE_POOL(linePtr), (char *) segPtr, CSEG_SIZE(segPtr->size));
     return newPtr1;
 }
-
+
 /*
  *--------------------------------------------------------------
  *
@@ -5220,6 +7219,10 @@ CharSplitProc(
  *	This function merges adjacent character segments into a single
  *	character segment, if possible.
  *
+ *	Two pieces of the same mapped segment are joined again without
+ *	copying them. Otherwise the merged segment is an ordinary one, so a
+ *	mapped segment is copied once the text next to it is modified.
+ *
  * Results:
  *	The return value is a pointer to the first segment in the (new) list
  *	of segments that used to start with segPtr.
@@ -5235,7 +7238,7 @@ static TkTextSegment *
 CharCleanupProc(
     TkTextSegment *segPtr,	/* Pointer to first of two adjacent segments
 				 * to join. */
-    TkTextLine *linePtr)	/* Line containing segments (not used). */
+    TkTextLine *linePtr)	/* Line containing segments. */
 {
     TkTextSegment *segPtr2, *newPtr;
 
@@ -5243,25 +7246,45 @@ CharCleanupProc(
     if ((segPtr2 == NULL) || (segPtr2->typePtr != &tkTextCharType)) {
 	return segPtr;
     }
-    newPtr = (TkTextSegment *) ckalloc(CSEG_SIZE(
-	    segPtr->size + segPtr2->size));
+#ifdef STEXT_MAPPED_CHARS
+    if (CSEG_MAPPED(segPtr) && CSEG_MAPPED(segPtr2)
+	    && (segPtr->body.chars + segPtr->size == segPtr2->body.chars)) {
+	newPtr = (TkTextSegment *)
+		PoolAlloc(LINE_POOL(linePtr), CSEG_MAPPED_SIZE);
+	newPtr->typePtr = &tkTextCharType;
+	newPtr->nextPtr = segPtr2->nextPtr;
+	newPtr->size = segPtr->size + segPtr2->size;
+	newPtr->body.ch = segPtr->body.ch;
+	newPtr->body.ch.u.mapPtr->refCount--;
+	PoolFree(LINE_POOL(linePtr), (char *) segPtr, CSEG_MAPPED_SIZE);
+	PoolFree(LINE_POOL(linePtr), (char *) segPtr2, CSEG_MAPPED_SIZE);
+	return newPtr;
+    }
+#endif
+    newPtr = (TkTextSegment *) PoolAlloc(LINE_POOL(linePtr),
+	    CSEG_SIZE(segPtr->size + segPtr2->size));
     newPtr->typePtr = &tkTextCharType;
     newPtr->nextPtr = segPtr2->nextPtr;
     newPtr->size = segPtr->size + segPtr2->size;
-#ifdef STEXT_STYLE_HACK
+#if defined(STEXT_STYLE_HACK) && !defined(STEXT_STYLE_RUNS)
     newPtr->body.chst.chars = newPtr->body.chst.data;
     newPtr->body.chst.style = newPtr->body.chst.data + newPtr->size + 1;
     memcpy(newPtr->body.chst.style, segPtr->body.chst.style, segPtr->size);
     memcpy(newPtr->body.chst.style + segPtr->size, segPtr2->body.chst.style,
 	segPtr2->size);
 #endif
-    strcpy(newPtr->body.chars, segPtr->body.chars);
-    strcpy(newPtr->body.chars + segPtr->size, segPtr2->body.chars);
-    ckfree((char *) segPtr);
-    ckfree((char *) segPtr2);
+#ifdef STEXT_MAPPED_CHARS
+    newPtr->body.ch.chars = newPtr->body.ch.u.data;
+#endif
+    memcpy(newPtr->body.chars, segPtr->body.chars, (size_t) segPtr->size);
+    memcpy(newPtr->body.chars + segPtr->size, segPtr2->body.chars,
+	    (size_t) segPtr2->size);
+    newPtr->body.chars[newPtr->size] = 0;
+    FreeChars(segPtr, linePtr);
+    FreeChars(segPtr2, linePtr);
     return newPtr;
 }
-
+
 /*
  *--------------------------------------------------------------
  *
@@ -5287,10 +7310,108 @@ CharDeleteProc(
 				 * deleted, so everything must get cleaned
 				 * up. */
 {
-    ckfree((char *) segPtr);
+    FreeChars(segPtr, linePtr);
     return 0;
 }
-
+
+/*
+ *--------------------------------------------------------------
+ *
+ * FreeChars --
+ *
+ *	Free the storage of a character segment that is no longer part of
+ *	any line.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	A mapped segment releases its reference to the mapping, which may
+ *	unmap the file.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+FreeChars(
+    TkTextSegment *segPtr,	/* Segment to free. */
+    TkTextLine *linePtr)	/* Line the segment was in. */
+{
+#ifdef STEXT_MAPPED_CHARS
+    if (CSEG_MAPPED(segPtr)) {
+	TkTextReleaseMapping(segPtr->body.ch.u.mapPtr);
+	PoolFree(LINE_POOL(linePtr), (char *) segPtr, CSEG_MAPPED_SIZE);
+	return;
+    }
+#endif
+    PoolFree(LINE_POOL(linePtr), (char *) segPtr, CSEG_SIZE(segPtr->size));
+}
+
+#ifdef STEXT_MAPPED_CHARS
+/*
+ *--------------------------------------------------------------
+ *
+ * MappedChars --
+ *
+ *	Make the segments for one line of a mapped file, which ends with
+ *	"\n" or "\r\n". For "\r\n" the mapped segment stops short of the
+ *	"\r", and an ordinary segment holds the "\n".
+ *
+ * Results:
+ *	The first of the new segments. *lastPtrPtr is set to the last.
+ *
+ * Side effects:
+ *	The mapped segment takes a reference to the mapping.
+ *
+ *--------------------------------------------------------------
+ */
+
+static TkTextSegment *
+MappedChars(
+    TkTextLine *linePtr,	/* Line the segments are for. */
+    TkTextMapping *mapPtr,	/* Mapping the line is in. */
+    const char *start,		/* First byte of the line. */
+    int numBytes,		/* Bytes in the line, with its end. */
+    TkTextSegment **lastPtrPtr)	/* Where to store the last segment. */
+{
+    TkTextSegment *segPtr = NULL, *newlinePtr;
+    int size = numBytes;
+
+    if (numBytes > 1 && start[numBytes - 2] == '\r') {
+	size -= 2;
+    }
+    if (size > 0) {
+	segPtr = (TkTextSegment *)
+		PoolAlloc(LINE_POOL(linePtr), CSEG_MAPPED_SIZE);
+	segPtr->typePtr = &tkTextCharType;
+	segPtr->nextPtr = NULL;
+	segPtr->size = size;
+	segPtr->body.ch.chars = (char *) start;
+	segPtr->body.ch.u.mapPtr = mapPtr;
+	mapPtr->refCount++;
+	*lastPtrPtr = segPtr;
+    }
+    if (size == numBytes) {
+	return segPtr;
+    }
+
+    newlinePtr = (TkTextSegment *)
+	    PoolAlloc(LINE_POOL(linePtr), CSEG_SIZE(1));
+    newlinePtr->typePtr = &tkTextCharType;
+    newlinePtr->nextPtr = NULL;
+    newlinePtr->size = 1;
+    newlinePtr->body.ch.chars = newlinePtr->body.ch.u.data;
+    newlinePtr->body.chars[0] = '\n';
+    newlinePtr->body.chars[1] = 0;
+    *lastPtrPtr = newlinePtr;
+    if (segPtr == NULL) {
+	return newlinePtr;
+    }
+    segPtr->nextPtr = newlinePtr;
+    return segPtr;
+}
+#endif /* STEXT_MAPPED_CHARS */
+
 /*
  *--------------------------------------------------------------
  *
@@ -5318,12 +7439,21 @@ CharCheckProc(
      * Make sure that the segment contains the number of characters indicated
      * by its header, and that the last segment in a line ends in a newline.
      * Also make sure that there aren't ever two character segments adjacent
-     * to each other: they should be merged together.
+     * to each other: they should be merged together. Mapped segments are
+     * the exception, as they are only merged when the text around them is
+     * modified.
      */
 
     if (segPtr->size <= 0) {
 	Tcl_Panic("CharCheckProc: segment has size <= 0");
     }
+#ifdef STEXT_MAPPED_CHARS
+    if (CSEG_MAPPED(segPtr)) {
+	if (memchr(segPtr->body.chars, 0, (size_t) segPtr->size) != NULL) {
+	    Tcl_Panic("CharCheckProc: mapped segment contains a null");
+	}
+    } else
+#endif
     if (strlen(segPtr->body.chars) != (size_t) segPtr->size) {
 	Tcl_Panic("CharCheckProc: segment has wrong size");
     }
@@ -5332,10 +7462,15 @@ CharCheckProc(
 	    Tcl_Panic("CharCheckProc: line doesn't end with newline");
 	}
     } else if (segPtr->nextPtr->typePtr == &tkTextCharType) {
+#ifdef STEXT_MAPPED_CHARS
+	if (CSEG_MAPPED(segPtr) || CSEG_MAPPED(segPtr->nextPtr)) {
+	    return;
+	}
+#endif
 	Tcl_Panic("CharCheckProc: adjacent character segments weren't merged");
     }
 }
-
+
 /*
  *--------------------------------------------------------------
  *
@@ -5363,7 +7498,7 @@ ToggleDeleteProc(
 				 * up. */
 {
     if (treeGone) {
-	ckfree((char *) segPtr);
+	PoolFree(LINE_POOL(linePtr), (char *) segPtr, TSEG_SIZE);
 	return 0;
     }
 
@@ -5437,9 +7572,9 @@ ToggleCleanupProc(
 			segPtr->body.toggle.tagPtr, -counts);
 	    }
 	    prevPtr->nextPtr = segPtr2->nextPtr;
-	    ckfree((char *) segPtr2);
+	    PoolFree(LINE_POOL(linePtr), (char *) segPtr2, TSEG_SIZE);
 	    segPtr2 = segPtr->nextPtr;
-	    ckfree((char *) segPtr);
+	    PoolFree(LINE_POOL(linePtr), (char *) segPtr, TSEG_SIZE);
 	    return segPtr2;
 	}
     }
@@ -5513,21 +7648,13 @@ ToggleCheckProc(
 	Tcl_Panic("ToggleCheckProc: toggle counts not updated in nodes");
     }
     needSummary = (segPtr->body.toggle.tagPtr->tagRootPtr!=linePtr->parentPtr);
-    for (summaryPtr = linePtr->parentPtr->summaryPtr; ;
-	    summaryPtr = summaryPtr->nextPtr) {
-	if (summaryPtr == NULL) {
-	    if (needSummary) {
-		Tcl_Panic("ToggleCheckProc: tag not present in node");
-	    } else {
-		break;
-	    }
-	}
-	if (summaryPtr->tagPtr == segPtr->body.toggle.tagPtr) {
-	    if (!needSummary) {
-		Tcl_Panic("ToggleCheckProc: tag present in root node summary");
-	    }
-	    break;
+    summaryPtr = FindSummary(linePtr->parentPtr, segPtr->body.toggle.tagPtr);
+    if (summaryPtr == NULL) {
+	if (needSummary) {
+	    Tcl_Panic("ToggleCheckProc: tag not present in node");
 	}
+    } else if (!needSummary) {
+	Tcl_Panic("ToggleCheckProc: tag present in root node summary");
     }
 }
 
@@ -326,6 +326,15 @@ typedef struct TextDInfo {
     DLine *dLineFreePtr;		/* Available records. */
     TkTextDispChunk *dChunkFreePtr;	/* Available records. */
     struct CharInfo *dCharInfoFreePtr;	/* Available records. */
+#endif
+#ifdef STEXT_STYLE_HACK
+    TextStyle **lexerStyles;	/* Styles of chunks that have no tags other
+				 * than a lexer style, indexed by lexer style
+				 * plus one (so unstyled text uses slot 0).
+				 * NULL entries haven't been looked up. */
+    int numLexerStyles;		/* Number of slots in lexerStyles. */
+    int lexerStyleEpoch;	/* Value of sharedTextPtr->tagEpoch when the
+				 * lexerStyles were looked up. */
 #endif
     int topPixelOffset;		/* Identifies first pixel in top display line
 				 * to display in window. */
@@ -601,6 +610,12 @@ static void		FreeDLines(TkText *textPtr, DLine *firstPtr,
 			    DLine *lastPtr, int action);
 static void		FreeStyle(TkText *textPtr, TextStyle *stylePtr);
 static TextStyle *	GetStyle(TkText *textPtr, CONST TkTextIndex *indexPtr);
+#ifdef STEXT_STYLE_HACK
+static void		FreeLexerStyles(TkText *textPtr);
+static TextStyle *	GetLexerStyle(TkText *textPtr,
+			    CONST TkTextIndex *indexPtr);
+static int		HasTags(TkText *textPtr, CONST TkTextIndex *indexPtr);
+#endif
 static void		GetXView(Tcl_Interp *interp, TkText *textPtr,
 			    int report);
 static void		GetYView(Tcl_Interp *interp, TkText *textPtr,
@@ -696,6 +711,11 @@ TkTextCreateDInfo(
     dInfoPtr->dLineFreePtr = NULL;
     dInfoPtr->dChunkFreePtr = NULL;
     dInfoPtr->dCharInfoFreePtr = NULL;
+#endif
+#ifdef STEXT_STYLE_HACK
+    dInfoPtr->lexerStyles = NULL;
+    dInfoPtr->numLexerStyles = 0;
+    dInfoPtr->lexerStyleEpoch = textPtr->sharedTextPtr->tagEpoch;
 #endif
     dInfoPtr->copyGC = None;
     gcValues.graphics_exposures = True;
@@ -805,6 +825,12 @@ count++;
 	}
 dbwin("TkTextFreeDInfo: freed %d CharInfo", count);
     }
+#endif
+#ifdef STEXT_STYLE_HACK
+    FreeLexerStyles(textPtr);
+    if (dInfoPtr->lexerStyles != NULL) {
+	ckfree((char *) dInfoPtr->lexerStyles);
+    }
 #endif
     Tcl_DeleteHashTable(&dInfoPtr->styleTable);
     if (dInfoPtr->copyGC != None) {
@@ -1127,6 +1153,143 @@ FreeStyle(
 	ckfree((char *) stylePtr);
     }
 }
+
+#ifdef STEXT_STYLE_HACK
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetLexerStyle --
+ *
+ *	This function is called in place of GetStyle for a character that has
+ *	no tags except the one for its lexer style. In syntax-highlighted text
+ *	nearly every chunk starts with a different lexer style, so the styles
+ *	are cached for each lexer style rather than computed and hashed again
+ *	for each chunk. The cache is thrown away whenever any tag changes (see
+ *	the tagEpoch field of TkSharedText) or the widget is reconfigured.
+ *
+ * Results:
+ *	The return value is a pointer to a TextStyle structure, as for
+ *	GetStyle.
+ *
+ * Side effects:
+ *	The cache may be emptied or grown, and a new style looked up.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static TextStyle *
+GetLexerStyle(
+    TkText *textPtr,		/* Overall information about text widget. */
+    CONST TkTextIndex *indexPtr)/* The character in the text for which display
+				 * information is wanted. */
+{
+    TextDInfo *dInfoPtr = textPtr->dInfoPtr;
+    TextStyle *stylePtr;
+    int slot, i;
+
+    if (dInfoPtr->lexerStyleEpoch != textPtr->sharedTextPtr->tagEpoch) {
+	FreeLexerStyles(textPtr);
+	dInfoPtr->lexerStyleEpoch = textPtr->sharedTextPtr->tagEpoch;
+    }
+
+    slot = Lexer_StyleAtIndex(textPtr->sharedTextPtr->lexer, indexPtr) + 1;
+    if (slot >= dInfoPtr->numLexerStyles) {
+	dInfoPtr->lexerStyles = (TextStyle **) ckrealloc(
+		(char *) dInfoPtr->lexerStyles,
+		(unsigned) (slot + 1) * sizeof(TextStyle *));
+	for (i = dInfoPtr->numLexerStyles; i <= slot; i++) {
+	    dInfoPtr->lexerStyles[i] = NULL;
+	}
+	dInfoPtr->numLexerStyles = slot + 1;
+    }
+
+    /*
+     * The cache keeps the reference returned by GetStyle, the caller gets
+     * another one.
+     */
+
+    stylePtr = dInfoPtr->lexerStyles[slot];
+    if (stylePtr == NULL) {
+	stylePtr = GetStyle(textPtr, indexPtr);
+	dInfoPtr->lexerStyles[slot] = stylePtr;
+    }
+    stylePtr->refCount++;
+    return stylePtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FreeLexerStyles --
+ *
+ *	Release the styles cached by GetLexerStyle.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Styles no longer used by any chunk are freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FreeLexerStyles(
+    TkText *textPtr)		/* Information about overall widget. */
+{
+    TextDInfo *dInfoPtr = textPtr->dInfoPtr;
+    int i;
+
+    for (i = 0; i < dInfoPtr->numLexerStyles; i++) {
+	if (dInfoPtr->lexerStyles[i] != NULL) {
+	    FreeStyle(textPtr, dInfoPtr->lexerStyles[i]);
+	    dInfoPtr->lexerStyles[i] = NULL;
+	}
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HasTags --
+ *
+ *	Find out whether a character has any tags for this widget, not
+ *	counting the tag for its lexer style.
+ *
+ * Results:
+ *	Non-zero if there are such tags, zero otherwise.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+HasTags(
+    TkText *textPtr,		/* Overall information about text widget. */
+    CONST TkTextIndex *indexPtr)/* The character to check. */
+{
+    TkTextTagInfo tagInfo;
+    TkTextTag **tagPtrs;
+    int i, result = 0;
+
+    /*
+     * Passing no widget leaves out the lexer tag, but also includes the tags
+     * of peers, which are left out here instead.
+     */
+
+    tagPtrs = TkBTreeGetTags(indexPtr, NULL, &tagInfo);
+    for (i = 0; i < tagInfo.numTags; i++) {
+	if (tagPtrs[i]->textPtr == NULL || tagPtrs[i]->textPtr == textPtr) {
+	    result = 1;
+	    break;
+	}
+    }
+    TkTextFreeTagInfo(&tagInfo);
+    return result;
+}
+#endif /* STEXT_STYLE_HACK */
 
 /*
  *----------------------------------------------------------------------
@@ -1229,10 +1392,19 @@ LayoutDLine(
 #endif
 #ifdef STEXT_STYLE_HACK
     int styleIndex = -1;
+    int hasTags = -1;		/* Whether curIndex has any tags other than
+				 * its lexer style: -1 means not known yet,
+				 * which is the case after passing a tag
+				 * toggle. */
 
     segPtr = TkTextIndexToSeg(indexPtr, &byteOffset);
     if (segPtr->typePtr == &tkTextCharType) {
+#ifdef STEXT_STYLE_RUNS
+	styleIndex = TkBTreeGetStyle(indexPtr->linePtr, indexPtr->byteIndex,
+		NULL);
+#else
 	styleIndex = segPtr->body.chst.style[byteOffset];
+#endif
     }
 #endif
 
@@ -1513,6 +1685,9 @@ dbwin("LayoutDLine (%s:%d): merged lines %d-%d", file, line, PEER_LINESTO(textPt
 		    elide = (segPtr->typePtr == &tkTextToggleOffType)
 			    ^ segPtr->body.toggle.tagPtr->elide;
 		}
+#ifdef STEXT_STYLE_HACK
+		hasTags = -1;
+#endif
 	    }
 
 	    byteOffset = 0;
@@ -1548,6 +1723,9 @@ dbwin("LayoutDLine (%s:%d): merged lines %d-%d", file, line, PEER_LINESTO(textPt
 	}
 
 	if (segPtr->typePtr->layoutProc == NULL) {
+#ifdef STEXT_STYLE_HACK
+	    hasTags = -1;	/* Only tag toggles have no layoutProc. */
+#endif
 	    segPtr = segPtr->nextPtr;
 	    byteOffset = 0;
 	    continue;
@@ -1563,7 +1741,15 @@ dbwin("LayoutDLine (%s:%d): merged lines %d-%d", file, line, PEER_LINESTO(textPt
 	    chunkPtr->nextPtr = NULL;
 	    chunkPtr->clientData = NULL;
 	}
+#ifdef STEXT_STYLE_HACK
+	if (hasTags < 0) {
+	    hasTags = HasTags(textPtr, &curIndex);
+	}
+	chunkPtr->stylePtr = hasTags ? GetStyle(textPtr, &curIndex)
+		: GetLexerStyle(textPtr, &curIndex);
+#else
 	chunkPtr->stylePtr = GetStyle(textPtr, &curIndex);
+#endif
 	elide = chunkPtr->stylePtr->sValuePtr->elide;
 
 	/*
@@ -1620,9 +1806,9 @@ dbwin("LayoutDLine (%s:%d): merged lines %d-%d", file, line, PEER_LINESTO(textPt
 	     */
 
 	    if (!elide && justify == TK_JUSTIFY_LEFT) {
-		char *p;
+		char *p, *end = segPtr->body.chars + segPtr->size;
 
-		for (p = segPtr->body.chars + byteOffset; *p != 0; p++) {
+		for (p = segPtr->body.chars + byteOffset; p < end; p++) {
 		    if (*p == '\t') {
 			maxBytes = (p + 1 - segPtr->body.chars) - byteOffset;
 			gotTab = 1;
@@ -1648,10 +1834,24 @@ dbwin("LayoutDLine (%s:%d): merged lines %d-%d", file, line, PEER_LINESTO(textPt
 	/* The loop above breaks on tabs. This loop breaks on
 	 * style changes also. */
 	if (!elide && (segPtr->typePtr == &tkTextCharType)) {
-	    char *p;
+	    char *p, *end = segPtr->body.chars + segPtr->size;
 	    int i = byteOffset;
-	    for (p = segPtr->body.chars + byteOffset; *p; p++, i++) {
+#ifdef STEXT_STYLE_RUNS
+	    int thisStyle = -1;
+	    int runEnd = -1;	/* Byte index in the line where thisStyle
+				 * ends. */
+#endif
+	    for (p = segPtr->body.chars + byteOffset; p < end; p++, i++) {
+#ifdef STEXT_STYLE_RUNS
+		int lineByte = curIndex.byteIndex + (i - byteOffset);
+
+		if (lineByte >= runEnd) {
+		    thisStyle = TkBTreeGetStyle(curIndex.linePtr, lineByte,
+			    &runEnd);
+		}
+#else
 		int thisStyle = segPtr->body.chst.style[i];
+#endif
 		if (thisStyle != styleIndex) {
 		    maxBytes = i - byteOffset;
 		    if (!maxBytes) {
@@ -2127,7 +2327,7 @@ dbwin("DINFO_RELAYOUT_WINDOW %s", Tk_PathName(textPtr->tkwin));
 
     /* This will call TkTextChanged on any affected lines, freeing
     * any DLines. */
-    LexerLexNeeded(textPtr->sharedTextPtr);
+    LexerLexNeeded(textPtr);
 #endif
 
     dInfoPtr->flags &= ~DINFO_OUT_OF_DATE;
@@ -5354,6 +5554,13 @@ TkTextRedrawTag(
     int withTag)		/* 1 means redraw characters that have the
 				 * tag, 0 means redraw those without. */
 {
+#ifdef STEXT_STYLE_HACK
+    if (sharedTextPtr == NULL) {
+	textPtr->sharedTextPtr->tagEpoch++;
+    } else {
+	sharedTextPtr->tagEpoch++;
+    }
+#endif
     if (sharedTextPtr == NULL) {
 	TextRedrawTag(textPtr, index1Ptr, index2Ptr, tagPtr, withTag);
     } else {
@@ -5634,6 +5841,9 @@ dbwin("***** TkTextRelayoutWindow");
 
     FreeDLines(textPtr, dInfoPtr->dLinePtr, NULL, DLINE_UNLINK);
     dInfoPtr->dLinePtr = NULL;
+#ifdef STEXT_STYLE_HACK
+    FreeLexerStyles(textPtr);
+#endif
 
     /*
      * Recompute some overall things for the layout. Even if the window gets
@@ -8033,10 +8243,12 @@ TkTextCharLayoutProc(
 	    nextX = maxX;
 	    bytesThatFit++;
 	}
-	if (p[bytesThatFit] == '\n') {
+	if ((byteOffset + bytesThatFit < segPtr->size)
+		&& (p[bytesThatFit] == '\n')) {
 	    /*
 	     * A newline character takes up no space, so if the previous
-	     * character fits then so does the newline.
+	     * character fits then so does the newline. The segment may not
+	     * be null-terminated, so don't look past its end.
 	     */
 
 	    bytesThatFit++;
@@ -9720,6 +9932,10 @@ SetLineFoldLevel(
     depth &= SC_FOLDLEVELNUMBERMASK;
     /* Prevent level flags being in the depth bits. */
     level &= ~SC_FOLDLEVELNUMBERMASK;
+    if ((linePtr->level ^ (depth | level)) &
+	    (SC_FOLDLEVELNUMBERMASK | SC_FOLDLEVELHEADERFLAG)) {
+	TkBTreeLineFoldChanged(linePtr);
+    }
     linePtr->level = depth | level;
 }
 
@@ -9731,6 +9947,137 @@ GetLineFoldDepth(
     return linePtr->level & SC_FOLDLEVELNUMBERMASK;
 }
 
+int
+GetLineFoldLevel(
+    TkSharedText *sharedPtr,
+    TkTextLine *linePtr)
+{
+    return linePtr->level;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FoldLines --
+ *
+ *	Folds every fold header between firstPtr and lastPtr whose depth is
+ *	at least "depth" and unfolds the others, then shows or hides lines to
+ *	match. This is done in one pass over the lines, with the B-tree
+ *	counts and the display brought up to date once at the end, rather
+ *	than once for each line as ToggleContraction would.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Lines after lastPtr that belong to a fold header in the range are
+ *	shown or hidden too.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+FoldLines(
+    TkText *textPtr,
+    TkTextLine *firstPtr,	/* First line whose header is changed. */
+    TkTextLine *lastPtr,	/* Last line whose header is changed. */
+    int depth)			/* Headers this deep or deeper are folded.
+				 * 0 folds all, more than
+				 * SC_FOLDLEVELNUMBERMASK unfolds all. */
+{
+    TkSharedText *sharedPtr = textPtr->sharedTextPtr;
+    int ref = textPtr->pixelReference;
+    TextDInfo *dInfoPtr = textPtr->dInfoPtr;
+    TkTextLine *linePtr, *parentPtr, *endPtr;
+    TkTextLine *firstChangedPtr = NULL, *lastChangedPtr = NULL;
+    int hideDepth = -1, minDepth, lineDepth;
+    bool pastLast = false, hidden;
+
+    /*
+     * A line is hidden when its outermost folded header is. Start with the
+     * folded headers that enclose the first line.
+     */
+
+    for (parentPtr = GetFoldParent(sharedPtr, firstPtr); parentPtr != NULL;
+	    parentPtr = GetFoldParent(sharedPtr, parentPtr)) {
+	if (GetLineFolded(textPtr, parentPtr))
+	    hideDepth = GetLineFoldDepth(sharedPtr, parentPtr);
+    }
+
+    /*
+     * Past lastPtr, keep going until a line is found that can't be inside
+     * any fold in the range. The fake last line is never hidden.
+     */
+
+    endPtr = PEER_FINDLINE(textPtr, PEER_NUMLINES(textPtr));
+    minDepth = GetLineFoldDepth(sharedPtr, firstPtr);
+    for (linePtr = firstPtr; linePtr != NULL && linePtr != endPtr;
+	    linePtr = PEER_NEXTLINE(textPtr, linePtr)) {
+	lineDepth = GetLineFoldDepth(sharedPtr, linePtr);
+	if (pastLast) {
+	    if (lineDepth <= minDepth)
+		break;
+	} else {
+	    if (lineDepth < minDepth)
+		minDepth = lineDepth;
+	    if (GetLineFoldable(sharedPtr, linePtr)) {
+		if (lineDepth >= depth)
+		    linePtr->peerData[ref].flags |= LINE_FLAG_FOLDED;
+		else
+		    linePtr->peerData[ref].flags &= ~LINE_FLAG_FOLDED;
+	    }
+	    pastLast = (linePtr == lastPtr);
+	}
+
+	hidden = (hideDepth >= 0 && lineDepth > hideDepth);
+	if (!hidden) {
+	    hideDepth = -1;
+	    if (GetLineFoldable(sharedPtr, linePtr) &&
+		    GetLineFolded(textPtr, linePtr))
+		hideDepth = lineDepth;
+	}
+
+	if (hidden != !GetLineVisible(textPtr, linePtr)) {
+	    if (hidden) {
+		linePtr->peerData[ref].flags |= LINE_FLAG_HIDDEN;
+		TkBTreeLinePixelCount(textPtr, linePtr) = 0;
+	    } else {
+		linePtr->peerData[ref].flags &= ~LINE_FLAG_HIDDEN;
+		TkBTreeLinePixelCount(textPtr, linePtr) = textPtr->charHeight;
+	    }
+	    if (firstChangedPtr == NULL)
+		firstChangedPtr = linePtr;
+	    lastChangedPtr = linePtr;
+	}
+    }
+
+    if (firstChangedPtr != NULL) {
+	TkTextIndex index1, index2;
+	int fromLine, numLines;
+
+	TkBTreeRecountLinesVisible(textPtr, firstChangedPtr, lastChangedPtr);
+
+	/*
+	 * Hidden lines are laid out with no height, so it is cheap to have
+	 * every line from the first to the last that changed measured again.
+	 */
+
+	fromLine = PEER_LINESTO(textPtr, firstChangedPtr);
+	numLines = PEER_LINESTO(textPtr, lastChangedPtr) - fromLine;
+	TkTextInvalidateLineMetrics(NULL, textPtr, firstChangedPtr,
+		numLines, TK_TEXT_INVALIDATE_ONLY);
+	PEER_BYTEINDEX(textPtr, fromLine, 0, &index1);
+	PEER_BYTEINDEX(textPtr, fromLine + numLines + 1, 0, &index2);
+	PEER_TEXTCHANGED(textPtr, &index1, &index2);
+    }
+
+    dInfoPtr->flags |= DINFO_OUT_OF_DATE|REPICK_NEEDED;
+    if (!(dInfoPtr->flags & REDRAW_PENDING)) {
+	dInfoPtr->flags |= REDRAW_PENDING;
+	Tcl_DoWhenIdle(DisplayText, (ClientData) textPtr);
+    }
+}
+
 #endif /* STEXT_FOLDING */
 
 #ifdef STEXT_DIFF
@@ -31,11 +31,8 @@
 #define NO_STYLE -1
 #define DEFAULT_STYLE 0 /* whitespace */
 
-/* FIXME: This LexVars struct should be per-thread or kept on the stack but
- * I don't want to dereference a pointer everywhere. So I use a mutex to only
- * allow one thread at a time to access it. */
-struct LexVars vars;
-TCL_DECLARE_MUTEX(varsMutex)
+/* The bit of TkTextLine.keywordBits for a word with the given hash. */
+#define KEYWORD_BIT(hash) (1U << ((hash) >> 27))
 
 int
 FindStyleAtIndex(
@@ -52,7 +49,11 @@ FindStyleAtIndex(
     BTREE_BYTEINDEX(sharedPtr->peers, lineIndex, byteIndex, &index);
     segPtr = TkTextIndexToSeg(&index, &offset);
     if (segPtr->typePtr == &tkTextCharType) {
+#ifdef STEXT_STYLE_RUNS
+	return TkBTreeGetStyle(index.linePtr, index.byteIndex, NULL);
+#else
 	return segPtr->body.chst.style[offset];
+#endif
     }
     return NO_STYLE;
 }
@@ -65,12 +66,54 @@ FindStyleAtSOL(
     return FindStyleAtIndex(sharedPtr, lineIndex, 0);
 }
 
+/*
+ * The style at the end of a line is recorded when the line is styled, so
+ * this doesn't need to look at the line's segments or style runs.
+ */
+
 int
 FindStyleAtEOL(
     TkSharedText *sharedPtr,
     int lineIndex)
 {
-    return FindStyleAtIndex(sharedPtr, lineIndex, -1);
+    return BTREE_FINDLINE(sharedPtr->peers, lineIndex)->styleEOL;
+}
+
+/*
+ * Lexers get at the B-tree and their Lexer through these rather than
+ * through the fields of TkSharedText, which plugins treat as opaque.
+ */
+
+TkTextLine *
+FindLineAt(
+    TkSharedText *sharedPtr,
+    int lineIndex)
+{
+    return BTREE_FINDLINE(sharedPtr->peers, lineIndex);
+}
+
+Lexer *
+GetLexer(
+    TkSharedText *sharedPtr)
+{
+    return sharedPtr->lexer;
+}
+
+/*
+ * The options of a plugin's lexer are kept in a record of their own after
+ * the Lexer, so that the Lexer can change without moving them. This is
+ * where that record starts; LexerModule_Load() adds it to the offsets in
+ * the plugin's option specs.
+ */
+
+#define LEXER_DATA_OFFSET \
+    ((int) ((sizeof(Lexer) + sizeof(double) - 1) & ~(sizeof(double) - 1)))
+
+ClientData
+GetLexerData(
+    Lexer *lexer)
+{
+    return (ClientData) ((char *) lexer + LEXER_DATA_OFFSET);
 }
 
 int
@@ -151,6 +194,9 @@ GetLineStyle(
     Tcl_DString *dStringPtr)
 {
     TkTextSegment *segPtr;
+#ifdef STEXT_STYLE_RUNS
+    int byteIndex = 0, len;
+#endif
 
     Tcl_DStringSetLength(dStringPtr, 0);
 
@@ -158,8 +204,18 @@ GetLineStyle(
 	    segPtr != NULL;
 	    segPtr = segPtr->nextPtr) {
 	if ((segPtr->typePtr == &tkTextCharType) && (segPtr->size > 0)) {
+#ifdef STEXT_STYLE_RUNS
+	    len = Tcl_DStringLength(dStringPtr);
+	    Tcl_DStringSetLength(dStringPtr, len + segPtr->size);
+	    TkBTreeGetStyles(linePtr, byteIndex, segPtr->size,
+		    Tcl_DStringValue(dStringPtr) + len);
+#else
 	    Tcl_DStringAppend(dStringPtr, segPtr->body.chst.style, segPtr->size);
+#endif
 	}
+#ifdef STEXT_STYLE_RUNS
+	byteIndex += segPtr->size;
+#endif
     }
 
     return Tcl_DStringLength(dStringPtr);
@@ -172,28 +228,261 @@ SetLineStyle(
     char *buf,
     int len)
 {
+#ifndef STEXT_STYLE_RUNS
     TkTextSegment *segPtr;
     int copied = 0;
+#endif
 #ifdef STEXT_DEBUG
     int i;
     for (i = 0; i < len; i++) ASSERT(buf[i] < lexer->numStyles);
 #endif
 
+    linePtr->styleEOL = (len > 0) ? buf[len - 1] : NO_STYLE;
+#ifdef STEXT_STYLE_RUNS
+    TkBTreeSetStyles(linePtr, buf, len);
+#else
     for (segPtr = linePtr->segPtr;
 	    segPtr != NULL;
 	    segPtr = segPtr->nextPtr) {
 	if ((segPtr->typePtr == &tkTextCharType) && (segPtr->size > 0)) {
 	    if (copied + segPtr->size > len) {
-		int copy = len - copied;
+		int copy = MAX(len - copied, 0);
+		/* Past -maxlinelength the line is left unstyled. */
 		(void) memcpy(segPtr->body.chst.style, buf + copied, copy);
-		break;
+		memset(segPtr->body.chst.style + copy, NO_STYLE,
+			segPtr->size - copy);
+		copied += copy;
+		continue;
 	    }
 	    (void) memcpy(segPtr->body.chst.style, buf + copied, segPtr->size);
 	    copied += segPtr->size;
-	    if (copied >= len)
+	}
+    }
+#endif
+}
+
+void
+LexVars_Init(
+    LexVars *vars)
+{
+    memset(vars, '\0', sizeof(LexVars));
+    Tcl_DStringInit(&vars->charDString);
+    Tcl_DStringInit(&vars->styleDString);
+    vars->budget.minLine = -1;
+}
+
+static void
+LexVars_SetBudget(
+    LexVars *vars,
+    int minLine,
+    int milliseconds)
+{
+    vars->budget.minLine = minLine;
+    vars->budget.expired = false;
+    if (minLine < 0)
+	return;
+    Tcl_GetTime(&vars->budget.deadline);
+    vars->budget.deadline.sec += milliseconds / 1000;
+    vars->budget.deadline.usec += (milliseconds % 1000) * 1000;
+    if (vars->budget.deadline.usec >= 1000000) {
+	vars->budget.deadline.sec++;
+	vars->budget.deadline.usec -= 1000000;
+    }
+}
+
+static bool
+LexVars_BudgetExpired(
+    LexVars *vars)
+{
+    Tcl_Time now;
+
+    if (vars->budget.minLine < 0 || vars->lineIndex < vars->budget.minLine)
+	return false;
+    Tcl_GetTime(&now);
+    return (now.sec > vars->budget.deadline.sec) ||
+	(now.sec == vars->budget.deadline.sec &&
+	now.usec >= vars->budget.deadline.usec);
+}
+
+void
+LexVars_Free(
+    LexVars *vars)
+{
+    Tcl_DStringFree(&vars->charDString);
+    Tcl_DStringFree(&vars->styleDString);
+}
+
+/*
+ * Point charBuf at the text of the current line. Usually the text of a line
+ * is a single character segment, and the lexer reads it in place. The
+ * segments are only copied when tag toggles, marks or embedded windows and
+ * images split up the text. Lexers must never write to charBuf.
+ *
+ * A line longer than -maxlinelength is cut short and given a newline, so
+ * the lexer's work on it is bounded however long the line is.
+ */
+
+static void
+LexVars_LoadLine(
+    LexVars *vars)
+{
+    TkTextSegment *segPtr, *charSegPtr = NULL;
+
+    vars->lineTail = 0;
+    vars->escapeRun.start = 0;
+    vars->escapeRun.end = -2;
+    vars->stateExtSet = false;
+    vars->changes.stateExt = false;
+    vars->keywordBits = 0;
+
+    for (segPtr = vars->linePtr->segPtr;
+	    segPtr != NULL;
+	    segPtr = segPtr->nextPtr) {
+	if ((segPtr->typePtr == &tkTextCharType) && (segPtr->size > 0)) {
+	    if (charSegPtr != NULL) {
+		vars->lineLength = GetLineText(vars->linePtr,
+			&vars->charDString);
+		vars->charBuf = Tcl_DStringValue(&vars->charDString);
 		break;
+	    }
+	    charSegPtr = segPtr;
+	}
+    }
+    if (segPtr == NULL) {
+	if (charSegPtr == NULL) {
+	    vars->lineLength = 0;
+	    vars->charBuf = "";
+	    return;
+	}
+	vars->lineLength = charSegPtr->size;
+	vars->charBuf = charSegPtr->body.chars;
+    }
+
+    if (vars->maxLineLength > 0 &&
+	    vars->lineLength > vars->maxLineLength + 1) {
+	vars->lineTail = vars->lineLength - vars->maxLineLength;
+	if (vars->charBuf == Tcl_DStringValue(&vars->charDString)) {
+	    Tcl_DStringSetLength(&vars->charDString, vars->maxLineLength);
+	} else {
+	    Tcl_DStringSetLength(&vars->charDString, 0);
+	    Tcl_DStringAppend(&vars->charDString, vars->charBuf,
+		    vars->maxLineLength);
+	}
+	Tcl_DStringAppend(&vars->charDString, "\n", 1);
+	vars->charBuf = Tcl_DStringValue(&vars->charDString);
+	vars->lineLength = vars->maxLineLength + 1;
+    }
+}
+
+/*
+ * Read the styles of the current line into styleBuf, for folding or for
+ * backing up. The newline the lexer saw at the end of a cut-short line
+ * has the style the line ended with.
+ */
+
+static void
+LexVars_LoadStyles(
+    LexVars *vars)
+{
+    GetLineStyle(vars->linePtr, &vars->styleDString);
+    vars->styleBuf = Tcl_DStringValue(&vars->styleDString);
+    if (vars->lineTail > 0)
+	vars->styleBuf[vars->lineLength - 1] = vars->linePtr->styleEOL;
+}
+
+/*
+ * Store the styles of the line just lexed, then let the lexer set its fold
+ * level if it folds while lexing.
+ */
+
+static void
+LexVars_FinishLine(
+    LexVars *vars)
+{
+    vars->charIndex++; /* past newline so it is styled */
+    Flush();
+    if (vars->lineTail > 0) {
+	SetLineStyle(vars->sharedPtr->lexer, vars->linePtr, vars->styleBuf,
+		vars->lineLength - 1);
+	vars->linePtr->styleEOL = vars->styleBuf[vars->lineLength - 1];
+    } else {
+	SetLineStyle(vars->sharedPtr->lexer, vars->linePtr, vars->styleBuf,
+		vars->lineLength);
+    }
+    vars->styled.lines++;
+    vars->styled.bytes += vars->lineLength;
+    vars->linePtr->keywordBits = vars->keywordBits;
+    if (!vars->stateExtSet && vars->linePtr->stateExt != NULL) {
+	TkBTreeFreeLineState(vars->linePtr);
+	vars->changes.stateExt = true;
+    }
+    if (vars->foldLineProc != NULL)
+	(*vars->foldLineProc)(vars);
+}
+
+/*
+ * Set the extended state of the current line, which the next line starts
+ * from. A line whose lexer doesn't set it during lexing is left with none.
+ * A size of 0 means none too.
+ */
+
+void
+LexVars_SetStateExt(
+    LexVars *vars,
+    const char *data,
+    int size)
+{
+    TkTextLine *linePtr = vars->linePtr;
+    TkTextLineState *statePtr = linePtr->stateExt;
+
+    vars->stateExtSet = true;
+    if (size <= 0) {
+	if (statePtr != NULL) {
+	    TkBTreeFreeLineState(linePtr);
+	    vars->changes.stateExt = true;
 	}
+	return;
+    }
+    if (statePtr != NULL && statePtr->size == size &&
+	    !memcmp(statePtr->data, data, size))
+	return;
+    if (statePtr == NULL || statePtr->size < size) {
+	TkBTreeFreeLineState(linePtr);
+	statePtr = (TkTextLineState *) ckalloc((unsigned)
+		(Tk_Offset(TkTextLineState, data) + size));
+	linePtr->stateExt = statePtr;
+    }
+    statePtr->size = size;
+    memcpy(statePtr->data, data, size);
+    vars->changes.stateExt = true;
+}
+
+/*
+ * The extended state of the previous line, or NULL if it has none. Like
+ * PrevLineState(), this is what a speculative pass was told to start from
+ * when on its first line. Otherwise it is read from the line itself, since
+ * a lexer that backs up may have lexed the previous line again.
+ */
+
+const char *
+LexVars_PrevStateExt(
+    LexVars *vars,
+    int *sizePtr)
+{
+    TkTextLineState *statePtr;
+
+    if (vars->speculative && vars->lineIndex == vars->firstLine)
+	statePtr = vars->startStateExt;
+    else if (vars->linePrevPtr != NULL)
+	statePtr = vars->linePrevPtr->stateExt;
+    else
+	statePtr = NULL;
+    if (statePtr == NULL) {
+	*sizePtr = 0;
+	return NULL;
     }
+    *sizePtr = statePtr->size;
+    return statePtr->data;
 }
 
 void
@@ -205,299 +494,370 @@ BeginStyling(
     TkSharedText *sharedPtr = args->sharedPtr;
     Lexer *lexer = sharedPtr->lexer;
     TkText *textPtr = sharedPtr->peers; /* only needed for macros */
+    LexVars *vars = args->vars;
 
-    vars.sharedPtr = sharedPtr;
+    vars->sharedPtr = sharedPtr;
+
+    /* Lexers that back up a line mustn't touch the previous block. */
+    if (args->speculative && firstLine < args->firstLine)
+	firstLine = args->firstLine;
 
     if (firstLine > 0) {
-	vars.linePrevPtr = BTREE_FINDLINE(textPtr, firstLine - 1);
-	ASSERT(vars.linePrevPtr != NULL);
-	vars.linePtr = BTREE_NEXTLINE(textPtr, vars.linePrevPtr);
+	vars->linePrevPtr = BTREE_FINDLINE(textPtr, firstLine - 1);
+	ASSERT(vars->linePrevPtr != NULL);
+	vars->linePtr = BTREE_NEXTLINE(textPtr, vars->linePrevPtr);
+    } else {
+	vars->linePrevPtr = NULL;
+	vars->linePtr = BTREE_FINDLINE(textPtr, firstLine);
+    }
+    ASSERT(vars->linePtr != NULL);
+    vars->lineNextPtr = BTREE_NEXTLINE(textPtr, vars->linePtr);
+
+    vars->linesInDocument = args->linesInDocument;
+    ASSERT(vars->linesInDocument > 0);
+    if (lastLine >= vars->linesInDocument)
+	lastLine = vars->linesInDocument - 1;
+    vars->lineLastPtr = BTREE_FINDLINE(textPtr, lastLine);
+    ASSERT(vars->lineLastPtr != NULL);
+
+    vars->lineIndex = firstLine;
+    vars->firstLine = firstLine;
+    vars->speculative = args->speculative;
+    vars->wordListPtrs = lexer->wordListPtrs;
+    vars->charClass = lexer->lm->charClass;
+    vars->charIndex = 0;
+    vars->maxLineLength = lexer->maxLineLength;
+    LexVars_LoadLine(vars);
+    if (vars->speculative) {
+	vars->style = args->startStyle;
+	vars->startStyle = args->startStyle;
+	vars->startState = args->startState;
+	vars->startStateExt = args->startStateExt;
     } else {
-	vars.linePrevPtr = NULL;
-	vars.linePtr = BTREE_FINDLINE(textPtr, firstLine);
-    }
-    ASSERT(vars.linePtr != NULL);
-    vars.lineNextPtr = BTREE_NEXTLINE(textPtr, vars.linePtr);
-
-    vars.linesInDocument = args->linesInDocument;
-    ASSERT(vars.linesInDocument > 0);
-    if (lastLine >= vars.linesInDocument)
-	lastLine = vars.linesInDocument - 1;
-    vars.lineLastPtr = BTREE_FINDLINE(textPtr, lastLine);
-    ASSERT(vars.lineLastPtr != NULL);
-
-    vars.lineIndex = firstLine;
-    vars.wordListPtrs = lexer->wordListPtrs;
-    vars.charIndex = 0;
-    vars.lineLength = GetLineText(vars.linePtr, &vars.charDString);
-    vars.charBuf = Tcl_DStringValue(&vars.charDString);
-    vars.style = (firstLine > 0) ? FindStyleAtEOL(sharedPtr, firstLine - 1) : DEFAULT_STYLE;
-    vars.stylePrev = vars.style;
-    vars.folding = args->folding;
-    if (vars.folding) {
-	GetLineStyle(vars.linePtr, &vars.styleDString);
-	vars.styleBuf = Tcl_DStringValue(&vars.styleDString);
-	vars.style = (vars.lineLength > 0) ? vars.styleBuf[0] : DEFAULT_STYLE;
-	vars.styleNext = (vars.lineLength > 1) ? vars.styleBuf[1] : NO_STYLE;
+	vars->style = (vars->linePrevPtr != NULL) ?
+	    vars->linePrevPtr->styleEOL : DEFAULT_STYLE;
+	vars->startStyle = vars->style;
+	vars->startState = (vars->linePrevPtr != NULL) ?
+	    vars->linePrevPtr->state : 0;
+	vars->startStateExt = NULL;
+    }
+    vars->stylePrev = vars->style;
+    vars->folding = args->folding;
+    vars->foldLineProc = NULL;
+    if (vars->folding) {
+	LexVars_LoadStyles(vars);
+	vars->style = (vars->lineLength > 0) ? vars->styleBuf[0] : DEFAULT_STYLE;
+	vars->styleNext = (vars->lineLength > 1) ? vars->styleBuf[1] : NO_STYLE;
     } else {
-	Tcl_DStringSetLength(&vars.styleDString, vars.lineLength);
-	vars.styleBuf = Tcl_DStringValue(&vars.styleDString);
+	Tcl_DStringSetLength(&vars->styleDString, vars->lineLength);
+	vars->styleBuf = Tcl_DStringValue(&vars->styleDString);
 #ifdef STEXT_DEBUG
-	memset(vars.styleBuf, 0x7f, vars.lineLength);
+	memset(vars->styleBuf, 0x7f, vars->lineLength);
 #endif
     }
-    vars.startIndex = 0;
-    vars.chPrev = (firstLine > 0) ? '\n' : ' ';
-    vars.chCur = (vars.lineLength > 0) ? vars.charBuf[0] : ' ';
-    vars.chNext = (vars.lineLength > 1) ? vars.charBuf[1] : ' ';
-    vars.atLineStart = true;
-    vars.atLineEnd = (vars.chCur == '\r' && vars.chNext != '\n') ||
-	(vars.chCur == '\n') || (vars.charIndex >= vars.lineLength);
-    vars.changes.checking = false;
+    vars->startIndex = 0;
+    vars->chPrev = (firstLine > 0) ? '\n' : ' ';
+    vars->chCur = (vars->lineLength > 0) ? vars->charBuf[0] : ' ';
+    vars->chNext = (vars->lineLength > 1) ? vars->charBuf[1] : ' ';
+    vars->atLineStart = true;
+    vars->atLineEnd = (vars->chCur == '\r' && vars->chNext != '\n') ||
+	(vars->chCur == '\n') || (vars->charIndex >= vars->lineLength);
+    vars->changes.checking = false;
 }
 
 static void
-ForwardOneChar(void)
-{
-    vars.chPrev = vars.chCur;
-    vars.chCur = vars.chNext;
-    vars.charIndex++;
-    if (vars.charIndex + 1 < vars.lineLength)
-	vars.chNext = vars.charBuf[vars.charIndex + 1];
+ForwardOneChar(
+    LexVars *vars)
+{
+    vars->chPrev = vars->chCur;
+    vars->chCur = vars->chNext;
+    vars->charIndex++;
+    if (vars->charIndex + 1 < vars->lineLength)
+	vars->chNext = vars->charBuf[vars->charIndex + 1];
     else
-	vars.chNext = ' ';
-    vars.stylePrev = vars.style; /* styling function may access stylePrev. */
-    if (vars.folding) {
-	vars.style = vars.styleNext;
-	if (vars.charIndex + 1 < vars.lineLength)
-	    vars.styleNext = vars.styleBuf[vars.charIndex + 1];
+	vars->chNext = ' ';
+    vars->stylePrev = vars->style; /* styling function may access stylePrev. */
+    if (vars->folding) {
+	vars->style = vars->styleNext;
+	if (vars->charIndex + 1 < vars->lineLength)
+	    vars->styleNext = vars->styleBuf[vars->charIndex + 1];
 	else
-	    vars.styleNext = NO_STYLE;
+	    vars->styleNext = NO_STYLE;
     }
 }
 
 static void
-ForwardOneLine(void)
-{
-    vars.linePrevPtr = vars.linePtr;
-    vars.linePtr = vars.lineNextPtr;
-    vars.lineNextPtr = BTREE_NEXTLINE(vars.textPtr, vars.linePtr);
-    vars.lineIndex++;
-    vars.lineLength = GetLineText(vars.linePtr, &vars.charDString);
-    vars.charBuf = Tcl_DStringValue(&vars.charDString);
-    vars.stylePrev = vars.style; /* styling function may access stylePrev. */
-    if (vars.folding) {
-	GetLineStyle(vars.linePtr, &vars.styleDString);
-	vars.styleBuf = Tcl_DStringValue(&vars.styleDString);
-	vars.style = (vars.lineLength > 0) ? vars.styleBuf[0] : NO_STYLE;
-	vars.styleNext = (vars.lineLength > 1) ? vars.styleBuf[1] : NO_STYLE;
+ForwardOneLine(
+    LexVars *vars)
+{
+    vars->linePrevPtr = vars->linePtr;
+    vars->linePtr = vars->lineNextPtr;
+    vars->lineNextPtr = BTREE_NEXTLINE(NULL, vars->linePtr);
+    vars->lineIndex++;
+    LexVars_LoadLine(vars);
+    vars->stylePrev = vars->style; /* styling function may access stylePrev. */
+    if (vars->folding) {
+	LexVars_LoadStyles(vars);
+	vars->style = (vars->lineLength > 0) ? vars->styleBuf[0] : NO_STYLE;
+	vars->styleNext = (vars->lineLength > 1) ? vars->styleBuf[1] : NO_STYLE;
     } else {
-	Tcl_DStringSetLength(&vars.styleDString, vars.lineLength);
-	vars.styleBuf = Tcl_DStringValue(&vars.styleDString);
+	Tcl_DStringSetLength(&vars->styleDString, vars->lineLength);
+	vars->styleBuf = Tcl_DStringValue(&vars->styleDString);
 #ifdef STEXT_DEBUG
-	memset(vars.styleBuf, 0x7f, vars.lineLength);
+	memset(vars->styleBuf, 0x7f, vars->lineLength);
 #endif
     }
-    vars.startIndex = 0;
-    vars.charIndex = 0;
-    vars.chPrev = '\n';
-    vars.chCur = (vars.lineLength > 0) ? vars.charBuf[0] : ' ';
+    vars->startIndex = 0;
+    vars->charIndex = 0;
+    vars->chPrev = '\n';
+    vars->chCur = (vars->lineLength > 0) ? vars->charBuf[0] : ' ';
     /* FIXME: first char on next line */
-    vars.chNext = (vars.lineLength > 1) ? vars.charBuf[1] : ' ';
+    vars->chNext = (vars->lineLength > 1) ? vars->charBuf[1] : ' ';
 }
 
 void
-Forward(void)
+LexVars_Forward(
+    LexVars *vars)
 {
-    if (vars.linePtr == NULL)
+    if (vars->linePtr == NULL)
 	return;
 
     /* Move forward 1 char in the current line. */
-    if (!vars.atLineEnd /*vars.charIndex < vars.lineLength*/) {
-	ForwardOneChar();
+    if (!vars->atLineEnd /*vars->charIndex < vars->lineLength*/) {
+	ForwardOneChar(vars);
 
     /* Advance to the next line unless we just finished the final line. */
-    } else if (vars.lineNextPtr != NULL) {
-	if (!vars.folding) {
-	    vars.charIndex++; /* past newline so it is styled */
-	    Flush();
-	    SetLineStyle(vars.sharedPtr->lexer, vars.linePtr, vars.styleBuf,
-		    vars.lineLength);
-	}
-	if (vars.lineIndex == vars.linesInDocument - 1) {
-	    vars.linePtr = NULL; /* stop */
+    } else if (vars->lineNextPtr != NULL) {
+	if (!vars->folding)
+	    LexVars_FinishLine(vars);
+	if (vars->lineIndex == vars->linesInDocument - 1) {
+	    vars->linePtr = NULL; /* stop */
 	    return;
 	}
 
 	/* The line we just finished is past the last requested line. */
-	if (vars.changes.checking) {
+	if (vars->changes.checking) {
 	    /* If the style/state/level is the same as before it was
 	     * lexed/folded, then we are done. */
-	    if (vars.changes.style == vars.style &&
-		    vars.changes.state == vars.linePtr->state &&
-		    vars.changes.level == vars.linePtr->level) {
-		vars.linePtr = NULL; /* stop */
+	    if (vars->changes.style == vars->style &&
+		    vars->changes.state == vars->linePtr->state &&
+		    vars->changes.level == vars->linePtr->level &&
+		    !vars->changes.stateExt) {
+		vars->linePtr = NULL; /* stop */
 		return;
 	    }
 
 	/* The line we just finished is the last requested line. Keep
 	 * checking lines until the style/state/level stops changing.
 	 * This is done to repair damage caused by edits. */
-	} else if (vars.linePtr == vars.lineLastPtr) {
-	    vars.changes.checking = true;
+	} else if (vars->linePtr == vars->lineLastPtr) {
+	    /* The following lines belong to another block. */
+	    if (vars->speculative) {
+		vars->linePtr = NULL; /* stop */
+		return;
+	    }
+	    vars->changes.checking = true;
+	}
+
+	/* The time budget for this pass is used up. The caller will
+	 * resume with the next line later. */
+	if (LexVars_BudgetExpired(vars)) {
+	    vars->budget.expired = true;
+	    vars->linePtr = NULL; /* stop */
+	    return;
 	}
 
-	ForwardOneLine();
+	ForwardOneLine(vars);
 
-	/* Remember the style/state/level before lexing/folding. */
-	if (vars.changes.checking) {
-	    if (vars.folding) {
-		vars.changes.style = (vars.lineLength > 0) ?
-		    vars.styleBuf[vars.lineLength - 1] : NO_STYLE;
-	    } else {
-		vars.changes.style = FindStyleAtEOL(vars.sharedPtr,
-		    vars.lineIndex);
-	    }
-	    vars.changes.state = vars.linePtr->state;
-	    vars.changes.level = vars.linePtr->level;
+	/* Remember the line's checkpoint before lexing/folding. */
+	if (vars->changes.checking) {
+	    vars->changes.style = vars->linePtr->styleEOL;
+	    vars->changes.state = vars->linePtr->state;
+	    vars->changes.level = vars->linePtr->level;
 	}
 
     /* Finished. */
     } else {
-	if (!vars.folding) {
-	    vars.charIndex++; /* past newline so it is styled */
-	    Flush();
-	    SetLineStyle(vars.sharedPtr->lexer, vars.linePtr, vars.styleBuf,
-		vars.lineLength);
-	}
-	vars.linePtr = NULL; /* stop */
+	if (!vars->folding)
+	    LexVars_FinishLine(vars);
+	vars->linePtr = NULL; /* stop */
 	return;
     }
-    vars.atLineStart = (vars.charIndex == 0);
-    vars.atLineEnd = (vars.chCur == '\r' && vars.chNext != '\n') ||
-	(vars.chCur == '\n') || (vars.charIndex >= vars.lineLength);
+    vars->atLineStart = (vars->charIndex == 0);
+    vars->atLineEnd = (vars->chCur == '\r' && vars->chNext != '\n') ||
+	(vars->chCur == '\n') || (vars->charIndex >= vars->lineLength);
+}
+
+/*
+ * The EOL style of the line before the current one, or NO_STYLE at the
+ * start of the document. On the first line of a speculative pass, this is
+ * the style the pass was told to start from, since the line itself belongs
+ * to a block being lexed by another thread.
+ */
+
+static int
+PrevLineStyleEOL(
+    LexVars *vars)
+{
+    if (vars->speculative && vars->lineIndex == vars->firstLine)
+	return vars->startStyle;
+    if (vars->linePrevPtr != NULL)
+	return vars->linePrevPtr->styleEOL;
+    return NO_STYLE;
 }
 
 void
-Back(void)
+LexVars_Back(
+    LexVars *vars)
 {
-    if (vars.linePtr == NULL)
+    if (vars->linePtr == NULL)
 	return;
 
     /* Move back 1 char in the current line. */
-    if (!vars.atLineStart) {
-	vars.chNext = vars.chCur;
-	vars.chCur = vars.chPrev;
-	vars.charIndex--;
-	vars.startIndex--;
-	if (vars.charIndex > 0)
-	    vars.chPrev = vars.charBuf[vars.charIndex - 1];
-	else if (vars.linePrevPtr != NULL)
-	    vars.chPrev = '\n';
+    if (!vars->atLineStart) {
+	vars->chNext = vars->chCur;
+	vars->chCur = vars->chPrev;
+	vars->charIndex--;
+	vars->startIndex--;
+	if (vars->charIndex > 0)
+	    vars->chPrev = vars->charBuf[vars->charIndex - 1];
+	else if (vars->linePrevPtr != NULL)
+	    vars->chPrev = '\n';
 	else
-	    vars.chPrev = ' ';
-
-	vars.styleNext = vars.style;
-	vars.style = vars.stylePrev;
-	if (vars.charIndex > 0)
-	    vars.stylePrev = vars.styleBuf[vars.charIndex - 1];
-	else if (vars.linePrevPtr != NULL)
-	    vars.stylePrev = FindStyleAtEOL(vars.sharedPtr, vars.lineIndex - 1);
+	    vars->chPrev = ' ';
+
+	vars->styleNext = vars->style;
+	vars->style = vars->stylePrev;
+	if (vars->charIndex > 0)
+	    vars->stylePrev = vars->styleBuf[vars->charIndex - 1];
 	else
-	    vars.stylePrev = NO_STYLE;
+	    vars->stylePrev = PrevLineStyleEOL(vars);
+
+    /* A speculative pass can't back up into the previous block. */
+    } else if (AtStartOfDoc() && vars->linePrevPtr != NULL) {
+	return;
 
     /* Move to the previous line if any. */
-    } else if (vars.linePrevPtr != NULL) {
-	vars.lineNextPtr = vars.linePtr;
-	vars.linePtr = vars.linePrevPtr;
-	vars.linePrevPtr = BTREE_PREVLINE(vars.textPtr, vars.linePtr);
-	vars.lineIndex--;
-
-	vars.lineLength = GetLineText(vars.linePtr, &vars.charDString);
-	vars.charBuf = Tcl_DStringValue(&vars.charDString);
-	vars.chNext = vars.chCur;
-	vars.chCur = vars.chPrev;
-	if (vars.lineLength > 1)
-	    vars.chPrev = vars.charBuf[vars.lineLength - 2];
-	else if (vars.linePrevPtr != NULL)
-	    vars.chPrev = '\n';
+    } else if (vars->linePrevPtr != NULL) {
+	vars->lineNextPtr = vars->linePtr;
+	vars->linePtr = vars->linePrevPtr;
+	vars->linePrevPtr = BTREE_PREVLINE(NULL, vars->linePtr);
+	vars->lineIndex--;
+
+	LexVars_LoadLine(vars);
+	vars->chNext = vars->chCur;
+	vars->chCur = vars->chPrev;
+	if (vars->lineLength > 1)
+	    vars->chPrev = vars->charBuf[vars->lineLength - 2];
+	else if (vars->linePrevPtr != NULL)
+	    vars->chPrev = '\n';
 	else
-	    vars.chPrev = ' ';
-
-	GetLineStyle(vars.linePtr, &vars.styleDString);
-	vars.styleBuf = Tcl_DStringValue(&vars.styleDString);
-	vars.styleNext = vars.style;
-	vars.style = vars.stylePrev;
-	if (vars.lineLength > 1)
-	    vars.stylePrev = vars.styleBuf[vars.lineLength - 2];
-	else if (vars.linePrevPtr != NULL)
-	    vars.stylePrev = FindStyleAtEOL(vars.sharedPtr, vars.lineIndex - 1);
+	    vars->chPrev = ' ';
+
+	LexVars_LoadStyles(vars);
+	vars->styleNext = vars->style;
+	vars->style = vars->stylePrev;
+	if (vars->lineLength > 1)
+	    vars->stylePrev = vars->styleBuf[vars->lineLength - 2];
 	else
-	    vars.stylePrev = NO_STYLE;
+	    vars->stylePrev = PrevLineStyleEOL(vars);
 
-	vars.charIndex = vars.lineLength - 1;
-	vars.startIndex = vars.lineLength - 1;
+	vars->charIndex = vars->lineLength - 1;
+	vars->startIndex = vars->lineLength - 1;
 
     /* Finished. */
     } else {
-	vars.linePtr = NULL; /* stop */
+	vars->linePtr = NULL; /* stop */
 	return;
     }
-    vars.atLineStart = (vars.charIndex == 0);
-    vars.atLineEnd = (vars.chCur == '\r' && vars.chNext != '\n') ||
-	(vars.chCur == '\n') || (vars.charIndex >= vars.lineLength);
+    vars->atLineStart = (vars->charIndex == 0);
+    vars->atLineEnd = (vars->chCur == '\r' && vars->chNext != '\n') ||
+	(vars->chCur == '\n') || (vars->charIndex >= vars->lineLength);
+}
+
+/*
+ * Move back to the start of the current line in one step, leaving the
+ * cursor as a Back() for each character would.
+ */
+
+void
+LexVars_ToLineStart(
+    LexVars *vars)
+{
+    int n;
+
+    if (vars->linePtr == NULL)
+	return;
+
+    n = vars->charIndex;
+    if (n > 0) {
+	vars->styleNext = (n > 1) ? vars->styleBuf[1] : vars->style;
+	vars->charIndex = 0;
+	vars->startIndex -= n;
+	vars->chCur = vars->charBuf[0];
+	vars->chNext = (vars->lineLength > 1) ? vars->charBuf[1] : ' ';
+	vars->chPrev = (vars->linePrevPtr != NULL) ? '\n' : ' ';
+	vars->stylePrev = PrevLineStyleEOL(vars);
+	vars->atLineStart = true;
+	vars->atLineEnd = (vars->chCur == '\r' && vars->chNext != '\n') ||
+	    (vars->chCur == '\n') || (vars->charIndex >= vars->lineLength);
+    }
+    vars->style = vars->stylePrev;
 }
 
 void
-ForwardN(
+LexVars_ForwardN(
+    LexVars *vars,
     int n)
 {
     while (n--) Forward();
 }
 
 void
-JumpToEOL(void)
+LexVars_JumpToEOL(
+    LexVars *vars)
 {
-    if (vars.linePtr == NULL || vars.atLineEnd)
+    if (vars->linePtr == NULL || vars->atLineEnd)
 	return;
 
     /* I'm pretty sure there is *always* a '\n' at the end. */
-    ASSERT(vars.lineLength > 0);
+    ASSERT(vars->lineLength > 0);
 
-    vars.charIndex = vars.lineLength - 1;
-    vars.chPrev = (vars.charIndex > 0) ?
-	vars.charBuf[vars.charIndex - 1] : (vars.linePrevPtr ? '\n' : '\0');
-    vars.chCur = '\n';
-    vars.chNext = '\0'; /* FIXME: first char on next line */
+    vars->charIndex = vars->lineLength - 1;
+    vars->chPrev = (vars->charIndex > 0) ?
+	vars->charBuf[vars->charIndex - 1] : (vars->linePrevPtr ? '\n' : '\0');
+    vars->chCur = '\n';
+    vars->chNext = '\0'; /* FIXME: first char on next line */
 
-    if (!vars.folding) Flush();
+    if (!vars->folding) Flush();
 
-    vars.stylePrev = (vars.charIndex > 0) ?
-	vars.styleBuf[vars.charIndex - 1] : NO_STYLE; /* FIXME: style at end of previous line */
-    if (vars.folding) {
-	vars.style = vars.styleBuf[vars.charIndex];
-	vars.styleNext = NO_STYLE; /* FIXME: style at start of next line */
+    vars->stylePrev = (vars->charIndex > 0) ?
+	vars->styleBuf[vars->charIndex - 1] : NO_STYLE; /* FIXME: style at end of previous line */
+    if (vars->folding) {
+	vars->style = vars->styleBuf[vars->charIndex];
+	vars->styleNext = NO_STYLE; /* FIXME: style at start of next line */
     }
-    vars.atLineStart = (vars.charIndex == 0);
-    vars.atLineEnd = (vars.chCur == '\r' && vars.chNext != '\n') ||
-	(vars.chCur == '\n') || (vars.charIndex >= vars.lineLength);
+    vars->atLineStart = (vars->charIndex == 0);
+    vars->atLineEnd = (vars->chCur == '\r' && vars->chNext != '\n') ||
+	(vars->chCur == '\n') || (vars->charIndex >= vars->lineLength);
 }
 
 bool
-MatchStr(
+LexVars_MatchStr(
+    LexVars *vars,
     const char *s)
 {
     int n;
-    if (vars.chCur != *s)
+    if (vars->chCur != *s)
 	return false;
     s++;
-    if (vars.chNext != *s)
+    if (vars->chNext != *s)
 	return false;
     s++;
     for (n = 2; *s; n++) {
-	if (vars.charIndex + n >= vars.lineLength)
+	if (vars->charIndex + n >= vars->lineLength)
 	    return false;
-	if (*s != vars.charBuf[vars.charIndex + n])
+	if (*s != vars->charBuf[vars->charIndex + n])
 	    return false;
 	s++;
     }
@@ -505,29 +865,32 @@ MatchStr(
 }
 
 bool
-MatchStrAt(
+LexVars_MatchStrAt(
+    LexVars *vars,
     int i,
     const char *s)
 {
-    if (i < 0 || i >= vars.lineLength)
+    if (i < 0 || i >= vars->lineLength)
 	return false;
-    for (/**/; *s && i < vars.lineLength; i++, s++) {
-	if (vars.charBuf[i] != *s)
+    for (/**/; *s && i < vars->lineLength; i++, s++) {
+	if (vars->charBuf[i] != *s)
 	    return false;
     }
     return !*s;
 }
 
 void
-Flush(void)
+LexVars_Flush(
+    LexVars *vars)
 {
-    while (vars.startIndex < vars.charIndex) {
-	vars.styleBuf[vars.startIndex++] = vars.style;
+    while (vars->startIndex < vars->charIndex) {
+	vars->styleBuf[vars->startIndex++] = vars->style;
     }
 }
 
 void
-StyleAhead(
+LexVars_StyleAhead(
+    LexVars *vars,
     int count,
     int style)
 {
@@ -535,32 +898,38 @@ StyleAhead(
 
     Flush();
     while (n-- > 0)
-	vars.styleBuf[vars.startIndex++] = style;
+	vars->styleBuf[vars->startIndex++] = style;
     ForwardN(count - 1);
 }
 
 int
-GetCurrent(
+LexVars_GetCurrent(
+    LexVars *vars,
     char *s,
     int len)
 {
     int i, n = 0;
-    for (i = vars.startIndex; i < vars.charIndex && n < len; i++)
-	s[n++] = vars.charBuf[i];
+    for (i = vars->startIndex; i < vars->charIndex && n < len; i++)
+	s[n++] = vars->charBuf[i];
     s[n] = '\0';
     return n;
 }
 
 bool
-MatchKeyword(
+LexVars_MatchKeyword(
+    LexVars *vars,
     char *s,
     int len,
     int *index)
 {
+    unsigned int hash = WordList_Hash(s, len);
     int i;
 
+    vars->keywordBits |= KEYWORD_BIT(hash);
     for (i = 0; i < NUM_WORD_LISTS; i++) {
-	if (WordList_InList(vars.wordListPtrs[i], s, len)) {
+	if (vars->wordListPtrs[i]->words == NULL)
+	    continue;
+	if (WordList_InListHash(vars->wordListPtrs[i], s, len, hash)) {
 	    *index = i;
 	    return true;
 	}
@@ -568,17 +937,167 @@ MatchKeyword(
     return false;
 }
 
-bool IsEscaped(int offset)
+bool
+LexVars_InList(
+    LexVars *vars,
+    WordList *wl,
+    const char *s,
+    int len)
 {
-    int i = vars.charIndex + offset - 1;
-    if ((i >= 0) && (vars.charBuf[i] == '\\')) {
-	return !IsEscaped(offset - 1);
+    unsigned int hash = WordList_Hash(s, len);
+
+    vars->keywordBits |= KEYWORD_BIT(hash);
+    if (wl->words == NULL)
+	return false;
+    return WordList_InListHash(wl, s, len, hash);
+}
+
+/*
+ * The character at "offset" from the current one is escaped when an odd
+ * number of backslashes come right before it.
+ */
+
+bool
+LexVars_IsEscaped(
+    LexVars *vars,
+    int offset)
+{
+    int i = vars->charIndex + offset - 1;
+    int start;
+
+    if (i < 0 || i >= vars->lineLength || vars->charBuf[i] != '\\')
+	return false;
+    if (i >= vars->escapeRun.start && i <= vars->escapeRun.end + 1) {
+	if (i > vars->escapeRun.end)
+	    vars->escapeRun.end = i;
+    } else {
+	for (start = i; start > 0 && vars->charBuf[start - 1] == '\\';
+		start--) {
+	    /* Empty loop body. */
+	}
+	vars->escapeRun.start = start;
+	vars->escapeRun.end = i;
     }
-    return false;
+    return ((i - vars->escapeRun.start) & 1) == 0;
+}
+
+/*
+ * Move forward to the character before index "stop" as Forward() would, for
+ * the Skip functions. The caller guarantees that none of the characters
+ * skipped ends the line, and nothing needs styling since the style doesn't
+ * change.
+ */
+
+static int
+LexVars_SkipToIndex(
+    LexVars *vars,
+    int stop)
+{
+    int n = stop - 1 - vars->charIndex;
+
+    if (n <= 0)
+	return 0;
+    vars->charIndex += n;
+    vars->chPrev = vars->charBuf[vars->charIndex - 1];
+    vars->chCur = vars->charBuf[vars->charIndex];
+    vars->chNext = (vars->charIndex + 1 < vars->lineLength) ?
+	vars->charBuf[vars->charIndex + 1] : ' ';
+    vars->stylePrev = vars->style;
+    vars->atLineStart = false;
+    vars->atLineEnd = (vars->charIndex >= vars->lineLength);
+    return n;
+}
+
+int
+LexVars_SkipClass(
+    LexVars *vars,
+    int mask)
+{
+    const char *p = vars->charBuf;
+    int i = vars->charIndex + 1;
+
+    if (vars->linePtr == NULL || vars->folding || vars->atLineEnd)
+	return 0;
+    while (i < vars->lineLength && (vars->charClass[(unsigned char) p[i]] & mask)
+	    && p[i] != '\r' && p[i] != '\n')
+	i++;
+    return LexVars_SkipToIndex(vars, i);
+}
+
+int
+LexVars_SkipTo(
+    LexVars *vars,
+    const char *stops)
+{
+    char reject[32];
+    int i = vars->charIndex + 1;
+    size_t len = strlen(stops);
+
+    if (vars->linePtr == NULL || vars->folding || vars->atLineEnd ||
+	    i >= vars->lineLength)
+	return 0;
+    ASSERT(len + 3 <= sizeof(reject));
+    memcpy(reject, stops, len);
+    strcpy(reject + len, "\r\n");
+
+    /* The line ends with a newline, which stops strcspn() even where the
+     * line is not nul-terminated, and strcspn() is vectorized in most C
+     * libraries. */
+    i += strcspn(vars->charBuf + i, reject);
+    if (i > vars->lineLength)
+	i = vars->lineLength;
+    return LexVars_SkipToIndex(vars, i);
 }
 
 /* ======================================== */
 
+/*
+ * Keyword lists are compiled into a minimal-probe perfect hash when they are
+ * set: every word gets a slot of its own, so a lookup hashes the candidate
+ * once and compares it against at most one word per list. The words are
+ * grouped into buckets by hash, and each bucket gets a displacement that
+ * scatters its words into free slots ("hash and displace"). Words starting
+ * with '^' are prefixes and are kept in a short list of their own, along
+ * with any word whose hash happens to equal that of another word.
+ *
+ * If no perfect hash is found before the table reaches
+ * WORDLIST_MAX_GROWTH slots per word, the words are put in an ordinary
+ * open-addressing table instead (displace is NULL) and lookups probe until
+ * they find an empty slot.
+ */
+
+#define WORDLIST_MAX_TRIES 0x10000
+#define WORDLIST_MAX_GROWTH 8
+
+static unsigned int
+WordList_Mix(
+    unsigned int h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+#define WordList_Slot(wl,h,d) \
+    (WordList_Mix((h) ^ ((unsigned int) (d) * 0x9e3779b9)) & (wl)->tableMask)
+
+unsigned int
+WordList_Hash(
+    const char *s,
+    int len)
+{
+    unsigned int h = 2166136261U;	/* FNV-1a */
+
+    while (len-- > 0) {
+	h ^= (unsigned char) *s++;
+	h *= 16777619U;
+    }
+    return h;
+}
+
 void
 WordList_Init(
     WordList *wl)
@@ -586,7 +1105,12 @@ WordList_Init(
     wl->words = NULL;
     wl->lengths = NULL;
     wl->numWords = 0;
-    wl->sorted = false;
+    wl->table = NULL;
+    wl->tableMask = 0;
+    wl->displace = NULL;
+    wl->numBuckets = 0;
+    wl->others = NULL;
+    wl->numOthers = 0;
 }
 
 void
@@ -597,9 +1121,16 @@ WordList_Clear(
 	ckfree((char *) wl->words);
 	ckfree((char *) wl->lengths);
     }
-    wl->words = NULL;
-    wl->numWords = 0;
-    wl->sorted = false;
+    if (wl->table) {
+	ckfree((char *) wl->table);
+    }
+    if (wl->displace) {
+	ckfree((char *) wl->displace);
+    }
+    if (wl->others) {
+	ckfree((char *) wl->others);
+    }
+    WordList_Init(wl);
 }
 
 void
@@ -609,34 +1140,215 @@ WordList_Free(
     WordList_Clear(wl);
 }
 
+/*
+ * Try to place all the words with hashes[] into a table of tableMask+1
+ * slots. Buckets are placed biggest first, since those are the hardest to
+ * fit. Returns false if some bucket found no displacement, in which case the
+ * caller tries again with a bigger table.
+ */
+
+static bool
+WordList_Build(
+    WordList *wl,
+    const int *exact,		/* Indices of non-prefix words. */
+    int numExact,
+    const unsigned int *hashes)	/* Hash of each word in exact[]. */
+{
+    int *order, *next, *first, *size;
+    int i, j, b, d, slot, numSlots = wl->tableMask + 1;
+    bool ok = true;
+
+    order = (int *) ckalloc(sizeof(int) * wl->numBuckets);
+    first = (int *) ckalloc(sizeof(int) * wl->numBuckets);
+    size = (int *) ckalloc(sizeof(int) * wl->numBuckets);
+    next = (int *) ckalloc(sizeof(int) * (numExact + 1));
+
+    for (b = 0; b < wl->numBuckets; b++) {
+	first[b] = -1;
+	size[b] = 0;
+	order[b] = b;
+	wl->displace[b] = 0;
+    }
+    for (i = 0; i < numExact; i++) {
+	b = hashes[i] % wl->numBuckets;
+	next[i] = first[b];
+	first[b] = i;
+	size[b]++;
+    }
+
+    /* Insertion sort, there are few buckets. */
+    for (i = 1; i < wl->numBuckets; i++) {
+	b = order[i];
+	for (j = i; j > 0 && size[order[j - 1]] < size[b]; j--)
+	    order[j] = order[j - 1];
+	order[j] = b;
+    }
+
+    for (slot = 0; slot < numSlots; slot++)
+	wl->table[slot] = -1;
+
+    for (i = 0; ok && i < wl->numBuckets && size[order[i]] > 0; i++) {
+	b = order[i];
+	for (d = 0; d < WORDLIST_MAX_TRIES; d++) {
+	    /* Claim slots, undoing the claims if any collide. */
+	    for (j = first[b]; j != -1; j = next[j]) {
+		slot = WordList_Slot(wl, hashes[j], d);
+		if (wl->table[slot] != -1)
+		    break;
+		wl->table[slot] = exact[j];
+	    }
+	    if (j == -1)
+		break;
+	    for (j = first[b]; j != -1; j = next[j]) {
+		slot = WordList_Slot(wl, hashes[j], d);
+		if (wl->table[slot] != exact[j])
+		    break;
+		wl->table[slot] = -1;
+	    }
+	}
+	if (d == WORDLIST_MAX_TRIES)
+	    ok = false;
+	wl->displace[b] = d;
+    }
+
+    ckfree((char *) order);
+    ckfree((char *) first);
+    ckfree((char *) size);
+    ckfree((char *) next);
+    return ok;
+}
+
+/*
+ * Put the words into an open-addressing table with linear probing, for
+ * lists that have no perfect hash.
+ */
+
+static void
+WordList_BuildProbed(
+    WordList *wl,
+    const int *exact,		/* Indices of non-prefix words. */
+    int numExact,
+    const unsigned int *hashes)	/* Hash of each word in exact[]. */
+{
+    int i, slot, numSlots = wl->tableMask + 1;
+
+    ckfree((char *) wl->displace);
+    wl->displace = NULL;
+    wl->numBuckets = 0;
+    for (slot = 0; slot < numSlots; slot++)
+	wl->table[slot] = -1;
+    for (i = 0; i < numExact; i++) {
+	for (slot = hashes[i] & wl->tableMask; wl->table[slot] != -1;
+		slot = (slot + 1) & wl->tableMask)
+	    ;
+	wl->table[slot] = exact[i];
+    }
+}
+
 void
 WordList_Set(
     WordList *wl,
     const char **words)
 {
-    int i;
-    for (i = 0; words[i]; i++)
+    int i, j, n, numExact = 0, numSlots, isNew;
+    int *exact;
+    unsigned int *hashes;
+    Tcl_HashTable seen;
+    Tcl_HashEntry *hPtr;
+
+    WordList_Clear(wl);
+
+    for (n = 0; words[n]; n++)
 	;
-    wl->numWords = i;
-    wl->lengths = (int *) ckalloc(i * sizeof(int));
     wl->words = words;
-    wl->sorted = false;
-}
+    wl->numWords = n;
+    wl->lengths = (int *) ckalloc(sizeof(int) * (n + 1));
+    exact = (int *) ckalloc(sizeof(int) * (n + 1));
+    hashes = (unsigned int *) ckalloc(sizeof(unsigned int) * (n + 1));
+    wl->others = (int *) ckalloc(sizeof(int) * (n + 1));
+
+    /*
+     * Words with the same hash would never fit in a perfect hash. Find them
+     * with a hash table keyed by hash value: a repeated word is dropped, a
+     * different word goes to the others list.
+     */
+
+    Tcl_InitHashTable(&seen, TCL_ONE_WORD_KEYS);
+    for (i = 0; i < n; i++) {
+	wl->lengths[i] = strlen(words[i]);
+	if (words[i][0] == '^') {
+	    wl->others[wl->numOthers++] = i;
+	    continue;
+	}
+	hashes[numExact] = WordList_Hash(words[i], wl->lengths[i]);
+	hPtr = Tcl_CreateHashEntry(&seen, INT2PTR(hashes[numExact]), &isNew);
+	if (!isNew) {
+	    j = PTR2INT(Tcl_GetHashValue(hPtr));
+	    if (strcmp(words[j], words[i]))
+		wl->others[wl->numOthers++] = i;
+	    continue;
+	}
+	Tcl_SetHashValue(hPtr, INT2PTR(i));
+	exact[numExact++] = i;
+    }
+    Tcl_DeleteHashTable(&seen);
 
-static int
-cmpString(
-    const void *a1,
-    const void *a2)
-{
-    return strcmp(*(char**)(a1), *(char**)(a2));
+    if (numExact > 0) {
+	wl->numBuckets = (numExact + 3) / 4;
+	wl->displace = (int *) ckalloc(sizeof(int) * wl->numBuckets);
+	for (numSlots = 8; numSlots < numExact * 2; numSlots *= 2)
+	    ;
+	while (1) {
+	    wl->table = (int *) ckalloc(sizeof(int) * numSlots);
+	    wl->tableMask = numSlots - 1;
+	    if (WordList_Build(wl, exact, numExact, hashes))
+		break;
+	    if (numSlots >= numExact * WORDLIST_MAX_GROWTH) {
+		WordList_BuildProbed(wl, exact, numExact, hashes);
+		break;
+	    }
+	    ckfree((char *) wl->table);
+	    numSlots *= 2;
+	}
+    }
+
+    ckfree((char *) exact);
+    ckfree((char *) hashes);
 }
 
-static void
-SortWordList(
-    const char **words,
-    unsigned int len)
+bool
+WordList_InListHash(
+    WordList *wl,
+    const char *s,
+    int len,
+    unsigned int hash)		/* WordList_Hash(s, len) */
 {
-    qsort(words, len, sizeof(*words), cmpString);
+    int i, j;
+
+    if (wl->displace != NULL) {
+	i = wl->table[WordList_Slot(wl, hash,
+		wl->displace[hash % wl->numBuckets])];
+	if (i != -1 && wl->lengths[i] == len &&
+		!memcmp(wl->words[i], s, len))
+	    return true;
+    } else if (wl->table != NULL) {
+	for (j = hash & wl->tableMask; (i = wl->table[j]) != -1;
+		j = (j + 1) & wl->tableMask) {
+	    if (wl->lengths[i] == len && !memcmp(wl->words[i], s, len))
+		return true;
+	}
+    }
+    for (j = 0; j < wl->numOthers; j++) {
+	i = wl->others[j];
+	if (wl->words[i][0] == '^') {
+	    if (wl->lengths[i] - 1 <= len &&
+		    !memcmp(wl->words[i] + 1, s, wl->lengths[i] - 1))
+		return true;
+	} else if (wl->lengths[i] == len && !memcmp(wl->words[i], s, len)) {
+	    return true;
+	}
+    }
+    return false;
 }
 
 bool
@@ -645,59 +1357,9 @@ WordList_InList(
     const char *s,
     int len)
 {
-    unsigned char firstChar;
-    int j;
-    const char **words = wl->words;
-    if (words == NULL)
+    if (wl->words == NULL)
 	return false;
-    if (!wl->sorted) {
-	unsigned int k;
-	int l;
-	SortWordList(words, wl->numWords);
-	for (k = 0; k < (sizeof(wl->starts) / sizeof(wl->starts[0])); k++)
-	    wl->starts[k] = -1;
-	for (l = wl->numWords - 1; l >= 0; l--) {
-	    unsigned char indexChar = words[l][0];
-	    wl->starts[indexChar] = l;
-	    wl->lengths[l] = strlen(words[l]);
-	}
-	wl->sorted = true;
-    }
-    firstChar = s[0];
-    j = wl->starts[firstChar];
-    if (j >= 0) {
-	while (words[j][0] == firstChar) {
-	    if ((s[1] == words[j][1]) && (len == wl->lengths[j])) {
-		const char *a = words[j] + 1;
-		const char *b = s + 1;
-		while (*a && *a == *b) {
-		    a++;
-		    b++;
-		}
-		if (!*a /* && !*b */)
-		    return true;
-if (*a > *b) break;
-	    }
-	    j++;
-if (!words[j]) break;
-	}
-    }
-    j = wl->starts['^'];
-    if (j >= 0) {
-	while (words[j][0] == '^') {
-	    const char *a = words[j] + 1;
-	    const char *b = s;
-	    while (*a && *a == *b) {
-		a++;
-		b++;
-	    }
-	    if (!*a)
-		return true;
-	    j++;
-if (!words[j]) break;
-	}
-    }
-    return false;
+    return WordList_InListHash(wl, s, len, WordList_Hash(s, len));
 }
 
 /* ======================================== */
@@ -713,15 +1375,74 @@ static Tk_OptionSpec lexerOptionSpecs[] = {
 	TK_CONFIG_NULL_OK, NULL, 0},
     {TK_OPTION_BOOLEAN, "-enable", (char *) NULL, (char *) NULL,
 	"1", -1, Tk_Offset(Lexer, enable), 0, NULL, 0},
+    {TK_OPTION_BOOLEAN, "-lazy", (char *) NULL, (char *) NULL,
+	"0", -1, Tk_Offset(Lexer, lazy), 0, NULL, 0},
+    {TK_OPTION_INT, "-maxlinelength", (char *) NULL, (char *) NULL,
+	"0", -1, Tk_Offset(Lexer, maxLineLength), 0, NULL, 0},
+    {TK_OPTION_INT, "-threads", (char *) NULL, (char *) NULL,
+	"0", -1, Tk_Offset(Lexer, numThreads), 0, NULL, 0},
+    {TK_OPTION_INT, "-timeslice", (char *) NULL, (char *) NULL,
+	"20", -1, Tk_Offset(Lexer, timeSlice), 0, NULL, 0},
     {TK_OPTION_END, (char *) NULL, (char *) NULL, (char *) NULL,
 	(char *) NULL, 0, 0, 0, 0}
 };
 
+unsigned char lexCharClass[256];
+
+static bool
+LexIsWordStart(
+    int ch)
+{
+    return isascii(ch) && (isalnum(ch) || ch == '_');
+}
+
+static bool
+LexIsWordChar(
+    int ch)
+{
+    return isascii(ch) && (isalnum(ch) || ch == '.' || ch == '_');
+}
+
+static void
+LexCharClass_Init(
+    unsigned char *charClass,
+    LexerCharProc isWordStart,
+    LexerCharProc isWordChar)
+{
+    int ch;
+
+    for (ch = 0; ch < 256; ch++) {
+	int bits = 0;
+	if (ch == ' ' || ch == '\t')
+	    bits |= CC_BLANK;
+	if (ch == ' ' || (ch >= 0x09 && ch <= 0x0d))
+	    bits |= CC_SPACE;
+	if (ch >= '0' && ch <= '9')
+	    bits |= CC_DIGIT;
+	if ((*isWordStart)(ch))
+	    bits |= CC_WORDSTART;
+	if ((*isWordChar)(ch))
+	    bits |= CC_WORD;
+	if (ch != '\0' && (!isascii(ch) || !isalnum(ch)) &&
+		strchr("%^&*()-+=|{}[]:;<>,/?!.~", ch) != NULL)
+	    bits |= CC_OPERATOR;
+	charClass[ch] = bits;
+    }
+}
+
 static void
 LexerModule_Init(
     Tcl_Interp *interp,
     LexerModule *lm)
 {
+    /* The shared table is the same for every interpreter. */
+    if (lexCharClass['a'] == 0) {
+	LexCharClass_Init(lexCharClass, LexIsWordStart, LexIsWordChar);
+    }
+    LexCharClass_Init(lm->charClass,
+	    lm->isWordStart ? lm->isWordStart : LexIsWordStart,
+	    lm->isWordChar ? lm->isWordChar : LexIsWordChar);
+
     if (lm->optionSpecs != NULL) {
 	Tk_OptionSpec *specPtr;
 
@@ -778,14 +1499,20 @@ FreeLexerInterpData(
 extern LexerModule lmBash;
 extern LexerModule lmTOL;
 extern LexerModule lmCPP;
+extern LexerModule lmGrammar;
 extern LexerModule lmLua;
 extern LexerModule lmMake;
 extern LexerModule lmPython;
 /* extern LexerModule lmRuby; */
 extern LexerModule lmTcl;
 
-static LexerModule *
-LexerModule_InitAll(
+/*
+ * Return the list of lexer modules, registering them with the interpreter
+ * the first time.
+ */
+
+LexerModule *
+LexerModule_Head(
     Tcl_Interp *interp)
 {
     LexerInterpData *interpData = Tcl_GetAssocData(interp, "STextLexer", NULL);
@@ -801,20 +1528,16 @@ LexerModule_InitAll(
     lmHead = LexerModule_Add(interp, lmHead, &lmBash);
     lmHead = LexerModule_Add(interp, lmHead, &lmCPP);
     lmHead = LexerModule_Add(interp, lmHead, &lmTOL);
+    lmHead = LexerModule_Add(interp, lmHead, &lmGrammar);
     lmHead = LexerModule_Add(interp, lmHead, &lmLua);
     lmHead = LexerModule_Add(interp, lmHead, &lmMake);
     lmHead = LexerModule_Add(interp, lmHead, &lmPython);
 /*    lmHead = LexerModule_Add(interp, lmHead, &lmRuby);*/
     lmHead = LexerModule_Add(interp, lmHead, &lmTcl);
 
-    Tcl_DStringInit(&vars.charDString); /* FIXME: never freed */
-    Tcl_DStringInit(&vars.styleDString); /* FIXME: never freed */
-
     return interpData->lmHead = lmHead;
 }
 
-#define LexerModule_Head(interp) LexerModule_InitAll(interp)
-
 static LexerModule *
 LexerModule_Find(
     Tcl_Interp *interp,
@@ -822,7 +1545,7 @@ LexerModule_Find(
 {
     LexerModule *walk;
 
-    walk = LexerModule_InitAll(interp);
+    walk = LexerModule_Head(interp);
 
     while (walk) {
 	if (!strcmp(walk->name, name))
@@ -832,6 +1555,146 @@ LexerModule_Find(
     return NULL;
 }
 
+/*
+ * The helpers a lexer plugin calls through its lexerStubsPtr.
+ */
+
+static const LexerStubs lexerStubs = {
+    LEXER_PLUGIN_VERSION,
+    lexCharClass,
+    LexVars_Forward,
+    LexVars_Back,
+    LexVars_ToLineStart,
+    LexVars_ForwardN,
+    LexVars_JumpToEOL,
+    LexVars_MatchStr,
+    LexVars_MatchStrAt,
+    LexVars_Flush,
+    LexVars_StyleAhead,
+    LexVars_GetCurrent,
+    LexVars_MatchKeyword,
+    LexVars_IsEscaped,
+    LexVars_SkipClass,
+    LexVars_SkipTo,
+    WordList_InList,
+    BeginStyling,
+    FindStyleAtSOL,
+    FindStyleAtEOL,
+    GetFirstNonWSChar,
+    IndentAmount,
+    SetLineState,
+    GetLineState,
+    SetLineFoldLevel,
+    TkBTreeFindLine,
+    TkBTreeNextLine,
+    TkBTreePreviousLine,
+    LexVars_SetStateExt,
+    LexVars_PrevStateExt,
+    LexVars_InList,
+    FindLineAt,
+    GetLexer,
+    GetLineFoldLevel,
+    GetLexerData
+};
+
+/*
+ * Load a lexer plugin from a shared library and register its lexer module
+ * with the interpreter. The library stays loaded for the life of the
+ * process, as with the "load" command.
+ */
+
+int
+LexerModule_Load(
+    Tcl_Interp *interp,
+    Tcl_Obj *pathPtr)
+{
+#if (TCL_MAJOR_VERSION > 8) || (TCL_MINOR_VERSION >= 6)
+    static CONST char *symbols[] = { LEXER_PLUGIN_SYMBOL, NULL };
+    LexerInterpData *interpData;
+    LexerPlugin *plugin;
+    LexerModule lmTemplate;
+    Tk_OptionSpec *specPtr;
+    Tcl_LoadHandle loadHandle;
+    char buf[64];
+    int i, numSpecs;
+
+    if (Tcl_LoadFile(interp, pathPtr, symbols, 0, &plugin,
+	    &loadHandle) != TCL_OK) {
+	return TCL_ERROR;
+    }
+    if (plugin->version < LEXER_PLUGIN_MIN_VERSION ||
+	    plugin->version > LEXER_PLUGIN_VERSION) {
+	sprintf(buf, "%d, expected %d to %d", plugin->version,
+		LEXER_PLUGIN_MIN_VERSION, LEXER_PLUGIN_VERSION);
+	Tcl_AppendResult(interp, "lexer plugin \"", Tcl_GetString(pathPtr),
+		"\" has version ", buf, NULL);
+	goto error;
+    }
+
+    /*
+     * A plugin built against an older header has smaller public views,
+     * never larger ones.
+     */
+
+    if (plugin->moduleSize > LEXER_MODULE_PUBLIC_SIZE ||
+	    plugin->argsSize > LEXER_ARGS_PUBLIC_SIZE ||
+	    plugin->varsSize > LEXVARS_PUBLIC_SIZE ||
+	    plugin->lm == NULL || plugin->lm->size < 0) {
+	Tcl_AppendResult(interp, "lexer plugin \"", Tcl_GetString(pathPtr),
+		"\" was built with different headers", NULL);
+	goto error;
+    }
+    if (plugin->initProc != NULL &&
+	    (*plugin->initProc)(interp, &lexerStubs) != TCL_OK) {
+	goto error;
+    }
+    if (LexerModule_Find(interp, plugin->lm->name) != NULL) {
+	Tcl_AppendResult(interp, "lexer \"", plugin->lm->name,
+		"\" already exists", NULL);
+	goto error;
+    }
+
+    /*
+     * Copy the public view of the module, and move the plugin's options
+     * after the Lexer. The copied specs live as long as the library.
+     */
+
+    memset(&lmTemplate, 0, sizeof(LexerModule));
+    memcpy(&lmTemplate, plugin->lm, (size_t) plugin->moduleSize);
+    lmTemplate.size = LEXER_DATA_OFFSET + plugin->lm->size;
+    if (plugin->lm->optionSpecs != NULL) {
+	for (numSpecs = 0;
+		plugin->lm->optionSpecs[numSpecs].type != TK_OPTION_END;
+		numSpecs++)
+	    ;
+	specPtr = (Tk_OptionSpec *) ckalloc((numSpecs + 1) *
+		sizeof(Tk_OptionSpec));
+	memcpy(specPtr, plugin->lm->optionSpecs,
+		(numSpecs + 1) * sizeof(Tk_OptionSpec));
+	for (i = 0; i < numSpecs; i++) {
+	    if (specPtr[i].objOffset >= 0)
+		specPtr[i].objOffset += LEXER_DATA_OFFSET;
+	    if (specPtr[i].internalOffset >= 0)
+		specPtr[i].internalOffset += LEXER_DATA_OFFSET;
+	}
+	lmTemplate.optionSpecs = specPtr;
+    }
+
+    interpData = Tcl_GetAssocData(interp, "STextLexer", NULL);
+    interpData->lmHead = LexerModule_Add(interp, interpData->lmHead,
+	    &lmTemplate);
+    Tcl_SetResult(interp, (char *) plugin->lm->name, TCL_VOLATILE);
+    return TCL_OK;
+
+error:
+    Tcl_FSUnloadFile(interp, loadHandle);
+    return TCL_ERROR;
+#else
+    Tcl_AppendResult(interp, "loading lexers requires Tcl 8.6", NULL);
+    return TCL_ERROR;
+#endif
+}
+
 static void
 DeleteTag(
     TkText *textPtr,
@@ -850,7 +1713,13 @@ DeleteTag(
     Tcl_DeleteHashEntry(hPtr);
 }
 
-/* Called from tkText.c as well */
+static void LexPool_Free(LexPool *pool);
+
+/*
+ * Called from tkText.c as well. textPtr is NULL for a lexer that was
+ * created without a widget.
+ */
+
 void
 Lexer_FreeInstance(
     TkText *textPtr,
@@ -858,19 +1727,32 @@ Lexer_FreeInstance(
 {
     int i;
 
+    if (lexer->lexTimer != NULL)
+	Tcl_DeleteTimerHandler(lexer->lexTimer);
     Tk_FreeConfigOptions((char *) lexer, lexer->lm->optionTable,
-	    textPtr->tkwin);
-    for (i = 0; i < lexer->numStyles; i++)
-	DeleteTag(textPtr, lexer->tags[i]);
+	    textPtr ? textPtr->tkwin : NULL);
+    if (textPtr != NULL) {
+	for (i = 0; i < lexer->numStyles; i++)
+	    DeleteTag(textPtr, lexer->tags[i]);
+	textPtr->sharedTextPtr->tagEpoch++;
+    }
     ckfree((char *) lexer->tags);
     lexer->tags = NULL;
     for (i = 0; i < NUM_WORD_LISTS; i++)
 	WordList_Free(lexer->wordListPtrs[i]);
+    if (lexer->pool != NULL)
+	LexPool_Free(lexer->pool);
     ckfree((char *) lexer);
 }
 
-static Lexer *
+/*
+ * Create a lexer for the given widget. If textPtr is NULL, as in the lexer
+ * benchmark, there is no widget and the styles get no tags.
+ */
+
+Lexer *
 Lexer_NewInstance(
+    Tcl_Interp *interp,
     TkText *textPtr,
     LexerModule *lm)
 {
@@ -894,11 +1776,13 @@ Lexer_NewInstance(
     lexer->tags = (TkTextTag **) ckalloc(lexer->numStyles *
 	    sizeof(TkTextTag *));
     for (i = 0; i < lexer->numStyles; i++) {
-	lexer->tags[i] = TkTextCreateTag(textPtr, lexer->lm->styleNames[i],
-		NULL);
+	lexer->tags[i] = (textPtr == NULL) ? NULL :
+		TkTextCreateTag(textPtr, lexer->lm->styleNames[i], NULL);
     }
-    if (Tk_InitOptions(textPtr->interp, (char *) lexer, lm->optionTable,
-	    textPtr->tkwin) != TCL_OK) {
+    if (textPtr != NULL)
+	textPtr->sharedTextPtr->tagEpoch++;
+    if (Tk_InitOptions(interp, (char *) lexer, lm->optionTable,
+	    textPtr ? textPtr->tkwin : NULL) != TCL_OK) {
 	Lexer_FreeInstance(textPtr, lexer);
 	return NULL;
     }
@@ -915,7 +1799,7 @@ IndentAmount(
     PFNIsCommentLeader pfnIsCommentLeader)
 {
     char buf[256];
-    int end = GetLineTextClipped(linePtr, buf, 512);
+    int end = GetLineTextClipped(linePtr, buf, sizeof(buf));
     int spaceFlags = 0;
 
     /* Determines the indentation level of the current line and also checks for consistent
@@ -949,70 +1833,353 @@ IndentAmount(
 		spaceFlags |= wsSpaceTab;
 	    indent = (indent / 8 + 1) * 8;
 	}
-	if (pos + 1 == end)
-	    break;
-	ch = buf[++pos];
+	if (pos + 1 == end)
+	    break;
+	ch = buf[++pos];
+    }
+
+    *flags = spaceFlags;
+    indent += SC_FOLDLEVELBASE;
+    /* if completely empty line or the start of a comment... */
+    if ((ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r') ||
+	(pfnIsCommentLeader && (*pfnIsCommentLeader)(buf, pos, end-pos)) )
+	return indent | SC_FOLDLEVELWHITEFLAG;
+    else
+	return indent;
+}
+
+#define DLINE(n) ((n) + 1) /* BTree line index -> display line index. */
+
+/*
+ * With -threads, a range of at least LEX_BLOCK_LINES lines per thread is
+ * split into blocks that are lexed at the same time. Each block but the
+ * first starts out assuming the previous line ends in the default style and
+ * state. Once all blocks are done, any block whose assumption was wrong is
+ * lexed again from its first line until the lines stop changing, which
+ * usually happens within a few lines.
+ *
+ * The blocks are lexed by a pool of threads that belongs to the lexer, so
+ * a shared text starts its threads once rather than on every pass. The
+ * calling thread lexes blocks too, so a pass still finishes if no thread
+ * could be started. Without TCL_THREADS the mutex calls do nothing, so no
+ * threads are started at all.
+ */
+
+#define LEX_BLOCK_LINES 2000
+#define LEX_MAX_THREADS 64
+
+typedef struct LexBlock {
+    LexerArgs args;
+    LexVars vars;
+} LexBlock;
+
+struct LexPool {
+    Tcl_Mutex mutex;
+    Tcl_Condition workCond;	/* Signalled when blocks are queued or the
+				 * pool is shutting down. */
+    Tcl_Condition doneCond;	/* Signalled when the last block is done. */
+    LexBlock *blocks;		/* Blocks of the current pass. */
+    int numBlocks;
+    int nextBlock;		/* Index of the first block no thread has
+				 * taken yet. */
+    int numPending;		/* Blocks not lexed yet. */
+    bool shutdown;
+    int numThreads;
+    Tcl_ThreadId threads[LEX_MAX_THREADS];
+};
+
+/*
+ * Take the next block of the current pass and lex it. Returns false if
+ * there was none. Called with the pool's mutex held.
+ */
+
+static bool
+LexPool_RunBlock(
+    LexPool *pool)
+{
+    LexBlock *blockPtr;
+
+    if (pool->nextBlock >= pool->numBlocks)
+	return false;
+    blockPtr = &pool->blocks[pool->nextBlock++];
+    Tcl_MutexUnlock(&pool->mutex);
+    (*blockPtr->args.lexer->lm->fnLexer)(&blockPtr->args);
+    Tcl_MutexLock(&pool->mutex);
+    if (--pool->numPending == 0)
+	Tcl_ConditionNotify(&pool->doneCond);
+    return true;
+}
+
+static Tcl_ThreadCreateType
+LexPoolThreadProc(
+    ClientData clientData)
+{
+    LexPool *pool = (LexPool *) clientData;
+
+    Tcl_MutexLock(&pool->mutex);
+    while (!pool->shutdown) {
+	if (!LexPool_RunBlock(pool))
+	    Tcl_ConditionWait(&pool->workCond, &pool->mutex, NULL);
+    }
+    Tcl_MutexUnlock(&pool->mutex);
+    Tcl_ExitThread(TCL_OK);
+    TCL_THREAD_CREATE_RETURN;
+}
+
+/*
+ * Make sure the lexer's pool has at least numThreads threads, as far as
+ * they can be started.
+ */
+
+static LexPool *
+LexPool_Get(
+    Lexer *lexer,
+    int numThreads)
+{
+    LexPool *pool = lexer->pool;
+
+    if (pool == NULL) {
+	pool = (LexPool *) ckalloc(sizeof(LexPool));
+	memset(pool, '\0', sizeof(LexPool));
+	lexer->pool = pool;
+
+	/* Tcl creates the mutex when first locked; do so before any thread
+	 * of the pool can. */
+	Tcl_MutexLock(&pool->mutex);
+	Tcl_MutexUnlock(&pool->mutex);
+    }
+#ifdef TCL_THREADS
+    while (pool->numThreads < numThreads) {
+	if (Tcl_CreateThread(&pool->threads[pool->numThreads],
+		LexPoolThreadProc, (ClientData) pool,
+		TCL_THREAD_STACK_DEFAULT, TCL_THREAD_JOINABLE) != TCL_OK)
+	    break;
+	pool->numThreads++;
+    }
+#endif
+    return pool;
+}
+
+static void
+LexPool_Free(
+    LexPool *pool)
+{
+    int i, result;
+
+    Tcl_MutexLock(&pool->mutex);
+    pool->shutdown = true;
+    Tcl_ConditionNotify(&pool->workCond);
+    Tcl_MutexUnlock(&pool->mutex);
+    for (i = 0; i < pool->numThreads; i++)
+	Tcl_JoinThread(pool->threads[i], &result);
+    Tcl_ConditionFinalize(&pool->workCond);
+    Tcl_ConditionFinalize(&pool->doneCond);
+    Tcl_MutexFinalize(&pool->mutex);
+    ckfree((char *) pool);
+}
+
+/*
+ * Lex args->firstLine..lastLine plus any following lines that changed as a
+ * result, using numBlocks threads. Returns the index of the last line that
+ * was lexed.
+ */
+
+static int
+LexParallel(
+    LexerArgs *args,
+    int numBlocks)
+{
+    TkSharedText *sharedPtr = args->sharedPtr;
+    LexerFunction fnLexer = args->lexer->lm->fnLexer;
+    LexPool *pool;
+    LexBlock *blocks;
+    TkTextLine *linePtr;
+    int i, firstLine, lastLine, blockLines, lastLexed;
+
+    firstLine = args->firstLine;
+    lastLine = args->lastLine;
+    blockLines = (lastLine - firstLine + 1) / numBlocks;
+
+    blocks = (LexBlock *) ckalloc(numBlocks * sizeof(LexBlock));
+    for (i = 0; i < numBlocks; i++) {
+	LexBlock *blockPtr = &blocks[i];
+
+	blockPtr->args = *args;
+	blockPtr->args.firstLine = firstLine + i * blockLines;
+	blockPtr->args.lastLine = (i == numBlocks - 1) ? lastLine :
+	    blockPtr->args.firstLine + blockLines - 1;
+	blockPtr->args.vars = &blockPtr->vars;
+	blockPtr->args.speculative = true;
+	if (i == 0 && firstLine > 0) {
+	    linePtr = BTREE_FINDLINE(sharedPtr->peers, firstLine - 1);
+	    blockPtr->args.startStyle = linePtr->styleEOL;
+	    blockPtr->args.startState = linePtr->state;
+	    blockPtr->args.startStateExt = linePtr->stateExt;
+	} else {
+	    blockPtr->args.startStyle = DEFAULT_STYLE;
+	    blockPtr->args.startState = 0;
+	    blockPtr->args.startStateExt = NULL;
+	}
+	LexVars_Init(&blockPtr->vars);
+    }
+
+    /* Queue the blocks and help lex them until the pool has done them
+     * all. Nothing reads the lines of another block before then. */
+    pool = LexPool_Get(args->lexer, numBlocks - 1);
+    Tcl_MutexLock(&pool->mutex);
+    pool->blocks = blocks;
+    pool->numBlocks = pool->numPending = numBlocks;
+    pool->nextBlock = 0;
+    Tcl_ConditionNotify(&pool->workCond);
+    while (LexPool_RunBlock(pool))
+	;
+    while (pool->numPending > 0)
+	Tcl_ConditionWait(&pool->doneCond, &pool->mutex, NULL);
+    pool->blocks = NULL;
+    pool->numBlocks = pool->nextBlock = 0;
+    Tcl_MutexUnlock(&pool->mutex);
+
+    /* Now check the seams: lex each block whose first line started with
+     * the wrong style or state again, the usual way. That keeps going
+     * while the lines differ from what was lexed speculatively, possibly
+     * into later blocks. */
+    args->speculative = false;
+    lastLexed = blocks[0].args.lastLine;
+    for (i = 1; i < numBlocks; i++) {
+	int blockFirst = blocks[i].args.firstLine;
+
+	if (blockFirst <= lastLexed)
+	    continue;
+	linePtr = BTREE_FINDLINE(sharedPtr->peers, blockFirst - 1);
+	if (linePtr->styleEOL == DEFAULT_STYLE &&
+		linePtr->state == 0 && linePtr->stateExt == NULL) {
+	    lastLexed = blocks[i].args.lastLine;
+	    continue;
+	}
+	args->firstLine = args->lastLine = blockFirst;
+	(*fnLexer)(args);
+	lastLexed = args->vars->lineIndex;
     }
 
-    *flags = spaceFlags;
-    indent += SC_FOLDLEVELBASE;
-    /* if completely empty line or the start of a comment... */
-    if ((ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r') ||
-	(pfnIsCommentLeader && (*pfnIsCommentLeader)(buf, pos, end-pos)) )
-	return indent | SC_FOLDLEVELWHITEFLAG;
-    else
-	return indent;
+    /* Lines after the range may have changed too, as when lexing
+     * serially. */
+    if (lastLexed <= lastLine) {
+	args->firstLine = args->lastLine = lastLine;
+	(*fnLexer)(args);
+	lastLexed = args->vars->lineIndex;
+    }
+
+    for (i = 0; i < numBlocks; i++) {
+	args->vars->styled.lines += blocks[i].vars.styled.lines;
+	args->vars->styled.bytes += blocks[i].vars.styled.bytes;
+	LexVars_Free(&blocks[i].vars);
+    }
+    ckfree((char *) blocks);
+
+    args->firstLine = firstLine;
+    args->lastLine = lastLine;
+    return lastLexed;
 }
 
-#define DLINE(n) ((n) + 1) /* BTree line index -> display line index. */
+/*
+ * Lex and fold the given range of lines plus any following lines whose
+ * style/state/level changed as a result. If minLine is >= 0 then the work
+ * is limited to roughly the given number of milliseconds once line minLine
+ * has been done. Returns the index of the first line that still needs to be
+ * lexed when the time budget ran out, or -1 when everything was done.
+ */
 
-static void
+static int
 LexAndFold(
     TkSharedText *sharedPtr,
     int startLine,
-    int numLines
+    int numLines,
+    int minLine,
+    int budget
     )
 {
     Lexer *lexer = sharedPtr->lexer;
     LexerArgs lexerArgs;
+    LexVars lexVars;
     TkTextIndex index1, index2;
     TkTextLine *linePtr;
     int lastLine, lastStyledLine;
+    int resumeLine = -1;
+    int numBlocks;
+    Tcl_Time start, end;
+    long usec;
 
     ASSERT(startLine >= 0);
     ASSERT(numLines > 0);
 
+    Tcl_GetTime(&start);
+
     lexerArgs.lexer = lexer;
     lexerArgs.sharedPtr = sharedPtr;
     lexerArgs.linesInDocument = BTREE_NUMLINES(sharedPtr->peers);
     lastLine = startLine + numLines - 1;
     if (lastLine >= lexerArgs.linesInDocument)
 	lastLine = lexerArgs.linesInDocument - 1;
+    lexer->stats.passes++;
+    lexer->stats.linesRequested += lastLine - startLine + 1;
     lexerArgs.firstLine = startLine;
     lexerArgs.lastLine = lastLine;
+    lexerArgs.vars = &lexVars;
+    lexerArgs.speculative = false;
+    lexerArgs.folded = false;
 
-    Tcl_MutexLock(&varsMutex);
+    numBlocks = lexer->numThreads;
+    if (numBlocks > LEX_MAX_THREADS)
+	numBlocks = LEX_MAX_THREADS;
+    if (numBlocks > (lastLine - startLine + 1) / LEX_BLOCK_LINES)
+	numBlocks = (lastLine - startLine + 1) / LEX_BLOCK_LINES;
+
+    /* A parallel pass can't stop right after minLine, as a -lazy lexer
+     * does, since it goes on until the lines stop changing. */
+    if (minLine >= 0 && budget == 0)
+	numBlocks = 1;
+
+    LexVars_Init(&lexVars);
+    LexVars_SetBudget(&lexVars, minLine, budget);
 
     lexerArgs.folding = false;
-    (*lexer->lm->fnLexer)(&lexerArgs);
-dbwin("LEX %s %d-%d", Tk_PathName(sharedPtr->peers->tkwin), DLINE(lexerArgs.firstLine), DLINE(lexerArgs.lastLine));
-dbwin("LEX %s following until %d", Tk_PathName(sharedPtr->peers->tkwin), DLINE(vars.lineIndex));
-    lastLine = vars.lineIndex;
-    lastStyledLine = vars.lineIndex;
+    if (numBlocks > 1) {
+	/* A parallel pass isn't time-sliced. The blocks can't fold while
+	 * lexing since a block doesn't know the fold level it starts at. */
+	lexerArgs.foldWhileLexing = false;
+	LexVars_SetBudget(&lexVars, -1, 0);
+	lexVars.lineIndex = LexParallel(&lexerArgs, numBlocks);
+    } else {
+	lexerArgs.foldWhileLexing = (lexer->lm->fnFolder != NULL);
+	(*lexer->lm->fnLexer)(&lexerArgs);
+    }
+    lastLine = lexVars.lineIndex;
+    lastStyledLine = lexVars.lineIndex;
+    lexer->stats.linesLexed += lexVars.styled.lines;
+    lexer->stats.bytesStyled += lexVars.styled.bytes;
+    if (lexerArgs.folded)
+	lexer->stats.linesFolded += lexVars.styled.lines;
+    if (lexVars.budget.expired) {
+	resumeLine = lastLine + 1;
+	lexVars.budget.expired = false;
+    }
 
     /* Fold the requested lines plus any following lines that were lexed
-     * because of EOL style changes. */
-    if (lexer->lm->fnFolder != NULL) {
+     * because of EOL style changes, unless the lexer did so already. */
+    if (lexer->lm->fnFolder != NULL && !lexerArgs.folded) {
 	lexerArgs.firstLine = startLine;
 	lexerArgs.lastLine = lastLine;
 	lexerArgs.folding = true;
 	(*lexer->lm->fnFolder)(&lexerArgs);
-dbwin("FOLD %s %d-%d", Tk_PathName(sharedPtr->peers->tkwin), DLINE(lexerArgs.firstLine), DLINE(lexerArgs.lastLine));
-dbwin("FOLD %s following until %d", Tk_PathName(sharedPtr->peers->tkwin), DLINE(vars.lineIndex));
-	lastLine = vars.lineIndex;
+	if (lexVars.budget.expired &&
+		(resumeLine == -1 || lexVars.lineIndex < resumeLine)) {
+	    resumeLine = lexVars.lineIndex + 1;
+	}
+	lastLine = lexVars.lineIndex;
+	lexer->stats.linesFolded += lastLine - startLine + 1;
     }
 
-    Tcl_MutexUnlock(&varsMutex);
+    LexVars_Free(&lexVars);
 
     {
 	/* Go through all the affected lines to fix problems caused by
@@ -1026,6 +2193,8 @@ dbwin("FOLD %s following until %d", Tk_PathName(sharedPtr->peers->tkwin), DLINE(
 		linePtr != NULL;
 		linePtr = BTREE_NEXTLINE(sharedPtr->peers, linePtr), lineIndex++) {
 	    TkText *peer;
+
+	    lexer->stats.linesRepaired++;
 	    for (peer = sharedPtr->peers;
 		    peer != NULL;
 		    peer = peer->next) {
@@ -1065,6 +2234,14 @@ dbwin("LexAndFold INVALIDATE WHOLE DOC");
      * changed. */
     TkTextInvalidateLineMetrics(sharedPtr, NULL,
 	    index1.linePtr, lastStyledLine - startLine, TK_TEXT_INVALIDATE_ONLY);
+
+    Tcl_GetTime(&end);
+    usec = (end.sec - start.sec) * 1000000 + (end.usec - start.usec);
+    lexer->stats.usecTotal += usec;
+    if (usec > lexer->stats.usecMax)
+	lexer->stats.usecMax = usec;
+
+    return resumeLine;
 }
 
 static void
@@ -1072,12 +2249,17 @@ RemoveStyle(
     TkText *textPtr)
 {
     TkTextLine *linePtr;
+#ifndef STEXT_STYLE_RUNS
     TkTextSegment *segPtr;
+#endif
 
 dbwin("RemoveStyle %s", Tk_PathName(textPtr->tkwin));
     for (linePtr = BTREE_FINDLINE(textPtr, 0);
 	    linePtr != NULL;
 	    linePtr = BTREE_NEXTLINE(textPtr, linePtr)){
+#ifdef STEXT_STYLE_RUNS
+	TkBTreeFreeStyles(linePtr);
+#else
 	for (segPtr = linePtr->segPtr;
 	    segPtr != NULL;
 	    segPtr = segPtr->nextPtr) {
@@ -1085,8 +2267,11 @@ dbwin("RemoveStyle %s", Tk_PathName(textPtr->tkwin));
 		memset(segPtr->body.chst.style, NO_STYLE, segPtr->size);
 	    }
 	}
+#endif
 	SetLineState(textPtr, linePtr, 0);
-	linePtr->level = 0;
+	TkBTreeFreeLineState(linePtr);
+	SetLineFoldLevel(textPtr->sharedTextPtr, linePtr, 0, 0);
+	linePtr->styleEOL = NO_STYLE;
     }
 
 {
@@ -1104,10 +2289,15 @@ RemoveStyleFromLine(
     TkText *textPtr,
     TkTextLine *linePtr)
 {
+#ifndef STEXT_STYLE_RUNS
     TkTextSegment *segPtr;
+#endif
 
     if (linePtr == NULL) return;
 dbwin("RemoveStyleFromLine line %d\n", BTREE_LINESTO(textPtr, linePtr) + 1);
+#ifdef STEXT_STYLE_RUNS
+    TkBTreeFreeStyles(linePtr);
+#else
     segPtr = linePtr->segPtr;
     while (segPtr != NULL) {
 	if (segPtr->typePtr == &tkTextCharType) {
@@ -1115,8 +2305,11 @@ dbwin("RemoveStyleFromLine line %d\n", BTREE_LINESTO(textPtr, linePtr) + 1);
 	}
 	segPtr = segPtr->nextPtr;
     }
+#endif
     SetLineState(textPtr, linePtr, 0);
-    linePtr->level = 0;
+    TkBTreeFreeLineState(linePtr);
+    SetLineFoldLevel(textPtr->sharedTextPtr, linePtr, 0, 0);
+    linePtr->styleEOL = NO_STYLE;
 }
 
 static void
@@ -1126,11 +2319,25 @@ EventuallyLexAndFold(
     int numLines)
 {
     Lexer *lexer = sharedPtr->lexer;
+    TkTextLine *linePtr;
     TkText *peer;
+    int i;
 
     if (lexer->startLine == -1) {
 	lexer->startLine = startLine;
 	lexer->endLine = startLine + numLines;
+    } else if (lexer->numRestyle > 0 && startLine > lexer->endLine + 1) {
+	/* Runs of lines are waiting to be restyled after the pending
+	 * range. Rather than stretch the range over the lines in between,
+	 * wait in line with them. */
+	linePtr = BTREE_FINDLINE(sharedPtr->peers, startLine);
+	for (i = 0; linePtr != NULL && i <= numLines; i++) {
+	    if (!(linePtr->flags & LINE_FLAG_RESTYLE)) {
+		linePtr->flags |= LINE_FLAG_RESTYLE;
+		lexer->numRestyle++;
+	    }
+	    linePtr = BTREE_NEXTLINE(sharedPtr->peers, linePtr);
+	}
     } else {
 	if (startLine < lexer->startLine)
 	    lexer->startLine = startLine;
@@ -1169,19 +2376,325 @@ LexerDeletion(
     EventuallyLexAndFold(sharedPtr, startLine, 0);
 }
 
+/*
+ * Make the next run of lines with LINE_FLAG_RESTYLE set, from fromLine on,
+ * the pending range. Returns false, with nothing pending, if there are
+ * none.
+ */
+
+static bool
+LexNextRun(
+    TkSharedText *sharedPtr,
+    int fromLine)
+{
+    Lexer *lexer = sharedPtr->lexer;
+    TkTextLine *linePtr;
+    int lineIndex = fromLine;
+
+    lexer->startLine = lexer->endLine = -1;
+    if (lexer->numRestyle <= 0 ||
+	    fromLine >= BTREE_NUMLINES(sharedPtr->peers)) {
+	lexer->numRestyle = 0;
+	return false;
+    }
+    for (linePtr = BTREE_FINDLINE(sharedPtr->peers, fromLine);
+	    linePtr != NULL;
+	    linePtr = BTREE_NEXTLINE(sharedPtr->peers, linePtr), lineIndex++) {
+	if (linePtr->flags & LINE_FLAG_RESTYLE) {
+	    linePtr->flags &= ~LINE_FLAG_RESTYLE;
+	    lexer->numRestyle--;
+	    if (lexer->startLine == -1)
+		lexer->startLine = lineIndex;
+	    lexer->endLine = lineIndex;
+	} else if (lexer->startLine != -1) {
+	    break;
+	}
+    }
+    if (lexer->startLine == -1) {
+	lexer->numRestyle = 0;
+	return false;
+    }
+    return true;
+}
+
+/*
+ * Lex part of the pending range lexer->startLine..endLine. The lines up to
+ * and including minLine are always done, after that lexing stops once the
+ * -timeslice budget is used up and the remainder is left for
+ * LexerAsyncProc. A -lazy lexer stops right after minLine and leaves the
+ * remainder until something needs it, unless folding was used. When the
+ * range is done the next run of lines to restyle becomes the pending range,
+ * and is lexed too if it starts by minLine.
+ */
+
+static void LexerAsyncProc(ClientData clientData);
+
+static void
+LexPending(
+    TkSharedText *sharedPtr,
+    int minLine)
+{
+    Lexer *lexer = sharedPtr->lexer;
+    int resumeLine, budget = lexer->timeSlice;
+    bool lazy = lexer->lazy && !lexer->foldsWanted;
+
+    if (lexer->startLine >= BTREE_NUMLINES(sharedPtr->peers)) {
+	lexer->startLine = lexer->endLine = -1;
+	lexer->numRestyle = 0;
+	return;
+    }
+    if (lazy)
+	budget = 0;
+    else if (lexer->timeSlice <= 0)
+	minLine = -1;
+
+    while (1) {
+	resumeLine = LexAndFold(sharedPtr, lexer->startLine,
+		lexer->endLine - lexer->startLine + 1,
+		(minLine != -1 && minLine < lexer->startLine) ?
+		lexer->startLine : minLine, budget);
+	if (resumeLine != -1) {
+	    lexer->startLine = resumeLine;
+	    if (lexer->endLine < resumeLine)
+		lexer->endLine = resumeLine;
+	    break;
+	}
+	if (!LexNextRun(sharedPtr, lexer->endLine + 1)) {
+	    if (lexer->lexTimer != NULL) {
+		Tcl_DeleteTimerHandler(lexer->lexTimer);
+		lexer->lexTimer = NULL;
+	    }
+	    return;
+	}
+	if (minLine != -1 && lexer->startLine > minLine)
+	    break;
+    }
+    if (lexer->lexTimer == NULL && !lazy) {
+	lexer->lexTimer = Tcl_CreateTimerHandler(1, LexerAsyncProc,
+		(ClientData) sharedPtr);
+    }
+}
+
+/*
+ * Timer handler that lexes the pending range one slice at a time. Like
+ * AsyncUpdateLineMetrics in tkTextDisp.c this uses a timer rather than an
+ * idle callback so that it can reschedule itself.
+ */
+
+static void
+LexerAsyncProc(
+    ClientData clientData)
+{
+    TkSharedText *sharedPtr = (TkSharedText *) clientData;
+    Lexer *lexer = sharedPtr->lexer;
+
+    lexer->lexTimer = NULL;
+    if (!lexer->enable || lexer->startLine == -1)
+	return;
+    LexPending(sharedPtr, lexer->startLine);
+}
+
+/*
+ * Return the index of the last B-tree line that may be displayed in the
+ * window without scrolling.
+ */
+
+static int
+LastLineInView(
+    TkText *textPtr)
+{
+    TkTextLine *linePtr = textPtr->topIndex.linePtr, *nextPtr;
+    int rows;
+
+    if (textPtr->tkwin != NULL && textPtr->charHeight > 0) {
+	rows = Tk_Height(textPtr->tkwin) / textPtr->charHeight + 1;
+	while (--rows > 0) {
+	    nextPtr = TkBTreeNextLineVisible(textPtr, linePtr);
+	    if (nextPtr == NULL)
+		break;
+	    linePtr = nextPtr;
+	}
+    }
+    return BTREE_LINESTO(textPtr, linePtr);
+}
+
+/*
+ * Called when the display is about to be updated. The lines in the window
+ * are styled right away, anything after them is lexed in the background,
+ * or left alone by a -lazy lexer.
+ */
+
 void
 LexerLexNeeded(
-    TkSharedText *sharedPtr)
+    TkText *textPtr)
 {
+    TkSharedText *sharedPtr = textPtr->sharedTextPtr;
     Lexer *lexer = sharedPtr->lexer;
+    int lastLine;
 
     if (lexer == NULL || !lexer->enable || lexer->startLine == -1)
 	return;
 
-    LexAndFold(sharedPtr, lexer->startLine,
-	lexer->endLine - lexer->startLine + 1);
+    if (lexer->timeSlice > 0 || lexer->lazy) {
+	lastLine = LastLineInView(textPtr);
 
-    lexer->startLine = lexer->endLine = -1;
+	/* Nothing in the window needs lexing. */
+	if (lastLine < lexer->startLine) {
+	    if (lexer->lexTimer == NULL &&
+		    !(lexer->lazy && !lexer->foldsWanted)) {
+		lexer->lexTimer = Tcl_CreateTimerHandler(1, LexerAsyncProc,
+			(ClientData) sharedPtr);
+	    }
+	    return;
+	}
+    } else {
+	lastLine = -1;
+    }
+
+    LexPending(sharedPtr, lastLine);
+}
+
+/*
+ * Make sure the style of the given line is up-to-date before it is
+ * queried.
+ */
+
+void
+LexerLexThrough(
+    TkSharedText *sharedPtr,
+    int lineIndex)
+{
+    Lexer *lexer = sharedPtr->lexer;
+
+    if (!lexer->enable || lexer->startLine == -1 ||
+	    lexer->startLine > lineIndex)
+	return;
+
+    LexPending(sharedPtr, lineIndex);
+}
+
+/*
+ * Called before a line is folded or its fold level is used. The lines
+ * through the next one are styled right away, since whether a line can be
+ * folded depends on the level of the line after it. From then on a -lazy
+ * lexer fills in the rest of the document in the background too, as the
+ * extent of a fold is only known once the lines after it have levels.
+ */
+
+void
+LexerFoldsWanted(
+    TkSharedText *sharedPtr,
+    int lineIndex)
+{
+    Lexer *lexer = sharedPtr->lexer;
+
+    if (lexer == NULL || !lexer->enable)
+	return;
+
+    lexer->foldsWanted = true;
+    LexerLexThrough(sharedPtr, lineIndex + 1);
+    if (lexer->startLine != -1 && lexer->lexTimer == NULL &&
+	    lexer->timeSlice > 0) {
+	lexer->lexTimer = Tcl_CreateTimerHandler(1, LexerAsyncProc,
+		(ClientData) sharedPtr);
+    }
+}
+
+/*
+ * Find the words that a new keyword list adds to or removes from the old
+ * one, and OR together their KEYWORD_BIT()s in *bitsPtr. Returns false
+ * when a prefix ("^word") changes, since the lines whose identifiers
+ * merely start with it can't be told from their keywordBits.
+ */
+
+static bool
+WordList_Changes(
+    WordList *wl,
+    const char **words,
+    unsigned int *bitsPtr)
+{
+    Tcl_HashTable table;
+    Tcl_HashEntry *hPtr;
+    Tcl_HashSearch search;
+    const char *word;
+    unsigned int bits = 0;
+    bool exact = true;
+    int i, isNew;
+
+    Tcl_InitHashTable(&table, TCL_STRING_KEYS);
+    for (i = 0; i < wl->numWords; i++) {
+	Tcl_CreateHashEntry(&table, wl->words[i], &isNew);
+    }
+    for (i = 0; words[i] != NULL; i++) {
+	hPtr = Tcl_FindHashEntry(&table, words[i]);
+	if (hPtr != NULL) {
+	    Tcl_SetHashValue(hPtr, (ClientData) 1); /* in both lists */
+	    continue;
+	}
+	if (words[i][0] == '^')
+	    exact = false;
+	bits |= KEYWORD_BIT(WordList_Hash(words[i], strlen(words[i])));
+    }
+    for (hPtr = Tcl_FirstHashEntry(&table, &search);
+	    hPtr != NULL;
+	    hPtr = Tcl_NextHashEntry(&search)) {
+	if (Tcl_GetHashValue(hPtr) != NULL)
+	    continue;
+	word = Tcl_GetHashKey(&table, hPtr);
+	if (word[0] == '^')
+	    exact = false;
+	bits |= KEYWORD_BIT(WordList_Hash(word, strlen(word)));
+    }
+    Tcl_DeleteHashTable(&table);
+
+    *bitsPtr = bits;
+    return exact;
+}
+
+/*
+ * Restyle the lines that looked up any of the words whose KEYWORD_BIT()s
+ * are in "bits", after a keyword list changed. The lines are marked with
+ * LINE_FLAG_RESTYLE, and so are those of the pending range, so that the
+ * lines in between aren't lexed again. LexPending() then takes one run of
+ * marked lines at a time as the pending range, so they are lexed like an
+ * edited range, within -timeslice and not before they are needed by a
+ * -lazy lexer.
+ */
+
+static void
+RestyleKeywords(
+    TkSharedText *sharedPtr,
+    unsigned int bits)
+{
+    Lexer *lexer = sharedPtr->lexer;
+    TkTextLine *linePtr;
+    TkText *peer;
+    int lineIndex, numLines;
+
+    if (bits == 0 || !lexer->enable)
+	return;
+
+    numLines = BTREE_NUMLINES(sharedPtr->peers);
+    for (linePtr = BTREE_FINDLINE(sharedPtr->peers, 0), lineIndex = 0;
+	    lineIndex < numLines;
+	    linePtr = BTREE_NEXTLINE(sharedPtr->peers, linePtr), lineIndex++) {
+	if ((linePtr->keywordBits & bits) || (lexer->startLine != -1 &&
+		lineIndex >= lexer->startLine &&
+		lineIndex <= lexer->endLine)) {
+	    if (!(linePtr->flags & LINE_FLAG_RESTYLE)) {
+		linePtr->flags |= LINE_FLAG_RESTYLE;
+		lexer->numRestyle++;
+	    }
+	}
+    }
+    if (!LexNextRun(sharedPtr, 0))
+	return;
+
+    for (peer = sharedPtr->peers;
+	    peer != NULL;
+	    peer = peer->next) {
+	TkTextEventuallyUpdateDInfo(peer);
+    }
 }
 
 bool
@@ -1198,8 +2711,14 @@ Lexer_OwnsTag(
     return false;
 }
 
-TkTextTag *
-Lexer_TagAtIndex(
+/*
+ * Return the lexer style of the character at the given index, or NO_STYLE
+ * if it has none or the lexer is disabled. Called by the display code to
+ * look up its cache of styles for chunks that have no other tags.
+ */
+
+int
+Lexer_StyleAtIndex(
     Lexer *lexer,
     CONST TkTextIndex *indexPtr)
 {
@@ -1207,14 +2726,28 @@ Lexer_TagAtIndex(
     TkTextSegment *segPtr;
 
     if (lexer == NULL || !lexer->enable || lexer->tags == NULL)
-	return NULL;
+	return NO_STYLE;
 
     segPtr = TkTextIndexToSeg(indexPtr, &offsetInSeg);
     if (segPtr->typePtr == &tkTextCharType) {
-	int styleIndex = segPtr->body.chst.style[offsetInSeg];
-	if (styleIndex != NO_STYLE) {
-	    return lexer->tags[styleIndex];
-	}
+#ifdef STEXT_STYLE_RUNS
+	return TkBTreeGetStyle(indexPtr->linePtr, indexPtr->byteIndex, NULL);
+#else
+	return segPtr->body.chst.style[offsetInSeg];
+#endif
+    }
+    return NO_STYLE;
+}
+
+TkTextTag *
+Lexer_TagAtIndex(
+    Lexer *lexer,
+    CONST TkTextIndex *indexPtr)
+{
+    int styleIndex = Lexer_StyleAtIndex(lexer, indexPtr);
+
+    if (styleIndex != NO_STYLE) {
+	return lexer->tags[styleIndex];
     }
     return NULL;
 }
@@ -1543,6 +3076,10 @@ LexerConfigureCmd(
 		    continue;
 		}
 	    }
+	    if (lexer->maxLineLength < 0) {
+		Tcl_AppendResult(interp, "-maxlinelength must be >= 0", NULL);
+		continue;
+	    }
 
 	    Tk_FreeSavedOptions(&savedOptions);
 	    break;
@@ -1587,11 +3124,11 @@ TkTextLexerCmd(
 {
     TkSharedText *sharedTextPtr = textPtr->sharedTextPtr;
     static CONST char *cmdNames[] = {
-	"bracematch", "cget", "configure", "invoke", "keywords", "names",
-	"set", "styleat", "stylenames", NULL };
+	"bracematch", "cget", "configure", "invoke", "keywords", "load",
+	"names", "set", "stats", "styleat", "stylenames", NULL };
     enum {
 	CMD_BRACEMATCH, CMD_CGET, CMD_CONFIGURE, CMD_INVOKE, CMD_KEYWORDS,
-	CMD_NAMES, CMD_SET, CMD_STYLEAT, CMD_STYLENAMES
+	CMD_LOAD, CMD_NAMES, CMD_SET, CMD_STATS, CMD_STYLEAT, CMD_STYLENAMES
     };
     int result = TCL_OK;
     int i;
@@ -1628,21 +3165,59 @@ TkTextLexerCmd(
 	    if (sharedTextPtr->lexer == NULL) {
 		goto nolexer;
 	    }
+	    LexerLexThrough(sharedTextPtr,
+		    BTREE_LINESTO(textPtr, indexPtr->linePtr));
 	    segPtr = TkTextIndexToSeg(indexPtr, &offset);
 	    if (segPtr->typePtr == &tkTextCharType) {
 		char chBrace = segPtr->body.chars[offset];
+#ifdef STEXT_STYLE_RUNS
+		int styBrace = TkBTreeGetStyle(indexPtr->linePtr,
+			indexPtr->byteIndex, NULL);
+#else
 		char styBrace = segPtr->body.chst.style[offset];
+#endif
 		int depth = 1;
 		int direction;
 		TkTextIndex index = *indexPtr;
+		TkTextLine *linePtr = indexPtr->linePtr;
 		char chSeek = BraceOpposite(chBrace, &direction);
+#ifdef STEXT_STYLE_RUNS
+		/* A forward scan looks up a style only when it leaves the
+		 * run the last one came from. */
+		TkTextLine *runLinePtr = NULL;
+		int runEnd = 0, styAtPos = NO_STYLE;
+#endif
 
 		if (chSeek == '\0')
 		    break;
-		styBrace = segPtr->body.chst.style[offset];
 		while (TkTextIndexForwCharsExt(textPtr, &index, &segPtr, &offset, direction)) {
-		    char chAtPos = segPtr->body.chars[offset];
-		    char styAtPos = segPtr->body.chst.style[offset];
+		    char chAtPos;
+#ifndef STEXT_STYLE_RUNS
+		    char styAtPos;
+#endif
+
+		    /* The lines before the brace are styled already, but a
+		     * forward scan may run past the lines lexed so far, as
+		     * a -lazy lexer leaves those below the window. */
+		    if (index.linePtr != linePtr) {
+			linePtr = index.linePtr;
+			if (direction > 0 &&
+				sharedTextPtr->lexer->startLine != -1) {
+			    LexerLexThrough(sharedTextPtr,
+				    BTREE_LINESTO(textPtr, linePtr));
+			}
+		    }
+		    chAtPos = segPtr->body.chars[offset];
+#ifdef STEXT_STYLE_RUNS
+		    if (direction < 0 || index.linePtr != runLinePtr ||
+			    index.byteIndex >= runEnd) {
+			styAtPos = TkBTreeGetStyle(index.linePtr,
+				index.byteIndex, &runEnd);
+			runLinePtr = index.linePtr;
+		    }
+#else
+		    styAtPos = segPtr->body.chst.style[offset];
+#endif
 		    if (styAtPos == styBrace) {
 			if (chAtPos == chBrace)
 			    depth++;
@@ -1716,13 +3291,14 @@ TkTextLexerCmd(
 	    if (sharedTextPtr->lexer == NULL) {
 		goto nolexer;
 	    }
-	    LexAndFold(sharedTextPtr, start, end - start + 1);
+	    LexAndFold(sharedTextPtr, start, end - start + 1, -1, 0);
 	    break;
 	}
 	case CMD_KEYWORDS: {
 	    int numWords;
 	    CONST char **words;
 	    int index;
+	    unsigned int keywordBits;
 
 	    if (objc < 4 || objc > 5) {
 		Tcl_WrongNumArgs(interp, 3, objv, "index ?list?");
@@ -1760,8 +3336,25 @@ TkTextLexerCmd(
 		result = TCL_ERROR;
 		break;
 	    }
-	    WordList_Set(sharedTextPtr->lexer->wordListPtrs[index - 1], words);
-	    EventuallyLexAndFold(sharedTextPtr, 0, BTREE_NUMLINES(textPtr));
+	    if (WordList_Changes(sharedTextPtr->lexer->wordListPtrs[index - 1],
+		    words, &keywordBits)) {
+		WordList_Set(sharedTextPtr->lexer->wordListPtrs[index - 1],
+			words);
+		RestyleKeywords(sharedTextPtr, keywordBits);
+	    } else {
+		WordList_Set(sharedTextPtr->lexer->wordListPtrs[index - 1],
+			words);
+		EventuallyLexAndFold(sharedTextPtr, 0, BTREE_NUMLINES(textPtr));
+	    }
+	    break;
+	}
+	case CMD_LOAD: {
+	    if (objc != 4) {
+		Tcl_WrongNumArgs(interp, 3, objv, "fileName");
+		result = TCL_ERROR;
+		break;
+	    }
+	    result = LexerModule_Load(interp, objv[3]);
 	    break;
 	}
 	case CMD_NAMES: {
@@ -1823,7 +3416,7 @@ TkTextLexerCmd(
 	    if (sharedTextPtr->lexer != NULL) {
 		Lexer_FreeInstance(textPtr, sharedTextPtr->lexer);
 	    }
-	    lexer = Lexer_NewInstance(textPtr, lm);
+	    lexer = Lexer_NewInstance(textPtr->interp, textPtr, lm);
 	    if (lexer == NULL) {
 		result = TCL_ERROR;
 	    }
@@ -1831,6 +3424,37 @@ TkTextLexerCmd(
 	    EventuallyLexAndFold(sharedTextPtr, 0, BTREE_NUMLINES(textPtr));
 	    break;
 	}
+	case CMD_STATS: {
+	    Lexer *lexer = sharedTextPtr->lexer;
+	    Tcl_Obj *listObj;
+
+	    if (objc > 4 || (objc == 4 &&
+		    strcmp(Tcl_GetString(objv[3]), "reset"))) {
+		Tcl_WrongNumArgs(interp, 3, objv, "?reset?");
+		result = TCL_ERROR;
+		break;
+	    }
+	    if (lexer == NULL) {
+		goto nolexer;
+	    }
+	    listObj = Tcl_NewListObj(0, NULL);
+#define STAT(n,o) \
+    Tcl_ListObjAppendElement(interp, listObj, Tcl_NewStringObj(n, -1)); \
+    Tcl_ListObjAppendElement(interp, listObj, o)
+	    STAT("passes", Tcl_NewLongObj(lexer->stats.passes));
+	    STAT("requested", Tcl_NewLongObj(lexer->stats.linesRequested));
+	    STAT("lexed", Tcl_NewLongObj(lexer->stats.linesLexed));
+	    STAT("bytes", Tcl_NewWideIntObj(lexer->stats.bytesStyled));
+	    STAT("folded", Tcl_NewLongObj(lexer->stats.linesFolded));
+	    STAT("repaired", Tcl_NewLongObj(lexer->stats.linesRepaired));
+	    STAT("usec", Tcl_NewWideIntObj(lexer->stats.usecTotal));
+	    STAT("maxusec", Tcl_NewLongObj(lexer->stats.usecMax));
+#undef STAT
+	    Tcl_SetObjResult(interp, listObj);
+	    if (objc == 4)
+		memset(&lexer->stats, '\0', sizeof(lexer->stats));
+	    break;
+	}
 	case CMD_STYLEAT: {
 	    CONST TkTextIndex *indexPtr;
 	    int offset;
@@ -1849,10 +3473,16 @@ TkTextLexerCmd(
 	    if (sharedTextPtr->lexer == NULL) {
 		goto nolexer;
 	    }
-	    /* FIXME: if LEX_NEEDED ... */
+	    LexerLexThrough(sharedTextPtr,
+		    BTREE_LINESTO(textPtr, indexPtr->linePtr));
 	    segPtr = TkTextIndexToSeg(indexPtr, &offset);
 	    if (segPtr->typePtr == &tkTextCharType) {
+#ifdef STEXT_STYLE_RUNS
+		int style = TkBTreeGetStyle(indexPtr->linePtr,
+			indexPtr->byteIndex, NULL);
+#else
 		int style = segPtr->body.chst.style[offset];
+#endif
 		if (style != NO_STYLE) {
 		    Tcl_SetStringObj(Tcl_GetObjResult(interp),
 			    sharedTextPtr->lexer->tags[style]->name, -1);
@@ -1886,6 +3516,11 @@ nolexer:
     return TCL_ERROR;
 }
 
+/*
+ * The fold queries below are answered by the B-tree, which keeps the
+ * smallest fold depth of each subtree so it can skip over whole nodes.
+ */
+
 TkTextLine *
 GetLastChild(
     TkSharedText *sharedPtr,
@@ -1894,15 +3529,12 @@ GetLastChild(
     int level = GetLineFoldDepth(sharedPtr, linePtr);
     TkTextLine *line2Ptr;
 
-    for (line2Ptr = BTREE_NEXTLINE(NULL, linePtr);
-	    line2Ptr != NULL;
-	    line2Ptr = BTREE_NEXTLINE(NULL, line2Ptr)) {
-	if (GetLineFoldDepth(sharedPtr, line2Ptr) <= level) {
-	    break;
-	}
-	linePtr = line2Ptr;
+    line2Ptr = TkBTreeNextLineFoldDepth(linePtr, level);
+    if (line2Ptr == NULL) {
+	return TkBTreeFindLine(sharedPtr->tree, NULL,
+		TkBTreeNumLines(sharedPtr->tree, NULL));
     }
-    return linePtr;
+    return BTREE_PREVLINE(NULL, line2Ptr);
 }
 
 TkTextLine *
@@ -1910,18 +3542,8 @@ GetFoldParent(
     TkSharedText *sharedPtr,
     TkTextLine *linePtr)
 {
-    int level = GetLineFoldDepth(sharedPtr, linePtr);
-    TkTextLine *line2Ptr;
-
-    for (line2Ptr = BTREE_PREVLINE(NULL, linePtr);
-	    line2Ptr != NULL;
-	    line2Ptr = BTREE_PREVLINE(NULL, line2Ptr)) {
-	if (GetLineFoldable(sharedPtr, line2Ptr) &&
-		GetLineFoldDepth(sharedPtr, line2Ptr) < level) {
-	    return line2Ptr;
-	}
-    }
-    return NULL;
+    return TkBTreePreviousFoldHeader(linePtr,
+	    GetLineFoldDepth(sharedPtr, linePtr));
 }
 
 static TkTextLine *
@@ -1932,30 +3554,22 @@ Expand(
 {
     TkSharedText *sharedPtr = textPtr->sharedTextPtr;
     TkTextLine *last = GetLastChild(sharedPtr, linePtr);
-    int lineMaxSubord = BTREE_LINESTO(textPtr, last);
-    TkTextLine *next = BTREE_NEXTLINE(textPtr,linePtr);
+    TkTextLine *stop = BTREE_NEXTLINE(textPtr, last);
 
-    if (linePtr == last)
-	return next; /* no children */
+    if (linePtr == last || !doExpand)
+	return stop; /* no children, or nothing to show */
 
-    linePtr = next;
-    while (BTREE_LINESTO(textPtr, linePtr) <= lineMaxSubord) {
-	if (doExpand) {
-	    SetLineVisible(textPtr, linePtr, true);
-	}
+    linePtr = BTREE_NEXTLINE(textPtr, linePtr);
+    while (linePtr != NULL && linePtr != stop) {
+	SetLineVisible(textPtr, linePtr, true);
 	if (GetLineFoldable(sharedPtr, linePtr)) {
-	    if (doExpand && !GetLineFolded(textPtr, linePtr)) {
-		linePtr = Expand(textPtr, linePtr, true);
-	    } else {
-		linePtr = Expand(textPtr, linePtr, false);
-	    }
+	    linePtr = Expand(textPtr, linePtr,
+		    !GetLineFolded(textPtr, linePtr));
 	} else {
 	    linePtr = BTREE_NEXTLINE(textPtr, linePtr);
 	}
-	if (linePtr == NULL)
-	    break;
     }
-    return BTREE_NEXTLINE(textPtr, last);
+    return stop;
 }
 
 static void
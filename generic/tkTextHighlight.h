@@ -14,21 +14,42 @@
 typedef struct WordList WordList;
 struct WordList
 {
-    const char **words;
-    int *lengths;
+    const char **words;		/* NULL-terminated, from Tcl_SplitList. */
+    int *lengths;		/* strlen() of each word. */
     int numWords;
-    bool sorted;
-    int starts[256];
+    int *table;			/* Perfect hash of the words that aren't
+				 * prefixes: index into words[] or -1. */
+    unsigned int tableMask;	/* Number of slots in table, minus 1. */
+    int *displace;		/* Displacement for each bucket, or NULL if
+				 * table is probed linearly instead. */
+    int numBuckets;
+    int *others;		/* Indices of the words not in table: those
+				 * starting with '^', which are prefixes, and
+				 * any whose hash collides with another. */
+    int numOthers;
 };
-extern void WordList_WordList(WordList *wl);
+extern void WordList_Init(WordList *wl);
 extern void WordList_Clear(WordList *wl);
 extern void WordList_Free(WordList *wl);
 extern void WordList_Set(WordList *wl, const char **words);
+extern unsigned int WordList_Hash(const char *s, int len);
 extern bool WordList_InList(WordList *wl, const char *s, int len);
+extern bool WordList_InListHash(WordList *wl, const char *s, int len,
+    unsigned int hash);
 
 typedef struct Lexer Lexer;
 typedef struct LexerModule LexerModule;
 typedef struct LexerArgs LexerArgs;
+typedef struct LexVars LexVars;
+typedef struct LexPool LexPool;
+
+/*
+ * LexerArgs, LexVars and LexerModule begin with the fields lexer plugins
+ * may use, the public view. New public fields go at the end of it, so a
+ * plugin built against an older header still finds its fields where it
+ * expects them. The fields after the view are private to the widget and
+ * may change at any time. See "Lexer plugins" below.
+ */
 
 struct LexerArgs
 {
@@ -38,24 +59,71 @@ struct LexerArgs
     int lastLine;
     int linesInDocument;
     bool folding;
+    LexVars *vars;		/* Cursor state for this invocation. Owned by
+				 * the caller so that lexers for different
+				 * documents may run at the same time. */
+    bool foldWhileLexing;	/* The lexing pass may set the fold levels
+				 * too, if the lexer knows how. */
+    bool folded;		/* Set by a lexer that did so, in which case
+				 * no folding pass follows. */
+
+    /* End of the public view. */
+
+    bool speculative;		/* Lex firstLine..lastLine only, starting
+				 * with startStyle and startState rather than
+				 * whatever the previous line ends with. This
+				 * is how blocks of lines are lexed in
+				 * parallel. */
+    int startStyle;
+    int startState;
+    TkTextLineState *startStateExt;
 };
 
+#define LEXER_ARGS_PUBLIC_SIZE Tk_Offset(LexerArgs, speculative)
+
 typedef int (*LexerFunction)(LexerArgs *args);
+typedef void (*LexerLineProc)(LexVars *vars);
+typedef bool (*LexerCharProc)(int ch);
+
+/*
+ * Character classes, as bits in the 256-entry tables below. CC_WORDSTART
+ * and CC_WORD are specific to each lexer module.
+ */
+
+#define CC_BLANK	0x01	/* Space or tab. */
+#define CC_SPACE	0x02	/* Space, tab, newline etc. */
+#define CC_DIGIT	0x04	/* 0-9 */
+#define CC_WORDSTART	0x08	/* First character of an identifier. */
+#define CC_WORD		0x10	/* Any character of an identifier. */
+#define CC_OPERATOR	0x20	/* See isoperator(). */
+
+extern unsigned char lexCharClass[256];
 
 struct LexerModule
 {
     CONST char *name;		/* Identifier ("cpp", "tcl" etc). */
-    int size;			/* sizeof(Lexer) plus extra options. */
+    int size;			/* sizeof(Lexer) plus extra options. For a
+				 * plugin, only the size of the record
+				 * holding its options: see GetLexerData(). */
     CONST char **styleNames;	/* NULL-terminated list of style names.
 				 * These become tag names. */
     LexerFunction fnLexer;	/* Lexing function. */
     LexerFunction fnFolder;	/* Folding function. */
     Tk_OptionSpec *optionSpecs;	/* Lexer-specific option specs. */
+    LexerCharProc isWordStart;	/* Identifier start characters, NULL for
+				 * iswordstart(). */
+    LexerCharProc isWordChar;	/* Identifier characters, NULL for
+				 * iswordchar(). */
+
+    /* End of the public view. */
 
     Tk_OptionTable optionTable;	/* Lexer-specific option table. */
+    unsigned char charClass[256]; /* CC_XXX bits for each character. */
     LexerModule *next;		/* Linked list of defined lexers. */
 };
 
+#define LEXER_MODULE_PUBLIC_SIZE Tk_Offset(LexerModule, optionTable)
+
 struct Lexer
 {
     LexerModule *lm;
@@ -69,6 +137,38 @@ struct Lexer
     int braceStyle;
     int startLine;
     int endLine;
+    int timeSlice;		/* -timeslice: milliseconds of lexing per
+				 * slice, 0 to lex synchronously. */
+    int numThreads;		/* -threads: lex large ranges in this many
+				 * blocks at once, 0 or 1 to lex serially. */
+    LexPool *pool;		/* Threads lexing those blocks, started by
+				 * the first parallel pass. */
+    int maxLineLength;		/* -maxlinelength: lex only this many bytes
+				 * of a line, 0 for no limit. */
+    int lazy;			/* -lazy: lex only as far as a window shows
+				 * or a command asks, not in the
+				 * background. */
+    bool foldsWanted;		/* Folding was used, so the lines after the
+				 * window are lexed in the background even
+				 * when -lazy. */
+    Tcl_TimerToken lexTimer;	/* Lexes the rest of startLine..endLine in
+				 * the background. */
+    int numRestyle;		/* Lines after endLine with
+				 * LINE_FLAG_RESTYLE set. Each run of them
+				 * becomes the pending range in turn. May be
+				 * too high if some were deleted. */
+    struct {
+	long passes;		/* Calls of LexAndFold(). */
+	long linesRequested;	/* Lines those calls were asked to lex. */
+	long linesLexed;	/* Lines styled, including those following
+				 * the requested ones that changed. */
+	Tcl_WideInt bytesStyled;
+	long linesFolded;	/* Lines whose fold level was computed. */
+	long linesRepaired;	/* Lines visited fixing fold state after
+				 * lexing. */
+	Tcl_WideInt usecTotal;	/* Time spent in all passes. */
+	long usecMax;		/* Time spent in the longest pass. */
+    } stats;			/* Reported by "lexer stats". */
 };
 
 struct LexVars
@@ -81,15 +181,21 @@ struct LexVars
     TkTextLine *lineLastPtr;
 
     WordList **wordListPtrs;
+    const unsigned char *charClass; /* The module's character classes. */
 
     char chPrev;
     char chCur;
     char chNext;
-    Tcl_DString charDString;
-    char *charBuf;
+    const char *charBuf;	/* Text of the current line. Points into the
+				 * line's segment when possible, otherwise
+				 * into charDString. */
 
     int lineIndex;
     int linesInDocument;
+    int firstLine;		/* Line BeginStyling() started at. */
+    int startState;		/* State of the line before firstLine. */
+    bool speculative;		/* Stop after lineLastPtr instead of going
+				 * on while lines change. */
 
     int lineLength;
     int charIndex;
@@ -100,63 +206,169 @@ struct LexVars
 
     bool folding;
 
+    int stylePrev;
+    int style;
+    int styleNext;
+    char *styleBuf;
+
+    LexerLineProc foldLineProc;	/* If not NULL, called when lexing for each
+				 * line once it is styled, to set its fold
+				 * level in the same pass. */
+
+    /* End of the public view. */
+
+    Tcl_DString charDString;
+    Tcl_DString styleDString;
+
+    int startStyle;		/* EOL style of the line before firstLine. */
+    TkTextLineState *startStateExt;
+				/* Extended state of that line. */
+
+    int maxLineLength;		/* Lexer's -maxlinelength. */
+    int lineTail;		/* Bytes of the line past maxLineLength. The
+				 * lexer sees the line cut short, followed by
+				 * a newline, and the tail is left unstyled. */
+    struct {
+	int start;
+	int end;
+    } escapeRun;		/* charBuf[start..end] are backslashes and
+				 * the byte before start isn't. Saves
+				 * IsEscaped() from scanning a long run of
+				 * backslashes again for each one. */
+
+    bool stateExtSet;		/* SetStateExt() was called for this line. */
+    unsigned int keywordBits;	/* Words looked up on this line, see
+				 * TkTextLine. */
+
     struct {
 	bool checking;
 	int style;
 	int level;
 	int state;
+	bool stateExt;		/* The line's extended state changed when it
+				 * was lexed. */
     } changes;
 
-    int stylePrev;
-    int style;
-    int styleNext;
-    Tcl_DString styleDString;
-    char *styleBuf;
+    struct {
+	int lines;		/* Lines styled by this invocation. */
+	Tcl_WideInt bytes;	/* Bytes styled by this invocation. */
+    } styled;
+
+    struct {
+	int minLine;		/* Never stop before finishing this line. */
+	Tcl_Time deadline;	/* Stop at the next line after this time. */
+	bool expired;		/* Stopped because the deadline passed. */
+    } budget;
 };
-extern struct LexVars vars;
+
+#define LEXVARS_PUBLIC_SIZE Tk_Offset(LexVars, charDString)
+
+extern void LexVars_Init(LexVars *vars);
+extern void LexVars_Free(LexVars *vars);
+
+/*
+ * The helper macros and functions below operate on the LexVars of the
+ * current invocation. Every function that uses them must have a variable
+ * named "vars" in scope, usually "LexVars *vars = args->vars;".
+ */
 
 #define More() \
-    ((vars.linePtr != NULL) /*&& (vars.charIndex < vars.lineLength)*/)
+    ((vars->linePtr != NULL) /*&& (vars->charIndex < vars->lineLength)*/)
+
+/*
+ * A speculative pass treats the start of its first line as the start of
+ * the document, so a lexer that backs up stays out of the previous block.
+ */
 
 #define AtStartOfDoc() \
-    (vars.linePrevPtr == NULL && vars.atLineStart)
+    (vars->atLineStart && (vars->linePrevPtr == NULL || \
+    (vars->speculative && vars->lineIndex == vars->firstLine)))
 
-#define ToLineStart() \
-    while (vars.charIndex > 0) \
-	Back(); \
-    vars.style = vars.stylePrev;
+/*
+ * The state of the previous line. Lexers must use this rather than reading
+ * linePrevPtr->state, because the line before the first one of a
+ * speculative pass belongs to a block being lexed by another thread.
+ */
+
+#define PrevLineState() \
+    ((vars->lineIndex == vars->firstLine) ? vars->startState : \
+    GetLineState(NULL, vars->linePrevPtr))
+
+extern void LexVars_Forward(LexVars *vars);
+extern void LexVars_Back(LexVars *vars);
+extern void LexVars_ToLineStart(LexVars *vars);
+extern void LexVars_ForwardN(LexVars *vars, int n);
+extern void LexVars_JumpToEOL(LexVars *vars);
 
-extern void Forward(void);
-extern void Back(void);
-extern void ForwardN(int n);
-extern void JumpToEOL(void);
+#define Forward() LexVars_Forward(vars)
+#define Back() LexVars_Back(vars)
+#define ToLineStart() LexVars_ToLineStart(vars)
+#define ForwardN(n) LexVars_ForwardN(vars, n)
+#define JumpToEOL() LexVars_JumpToEOL(vars)
 
 #define MatchCh(c) \
-    (vars.chCur == c)
+    (vars->chCur == c)
 
 #define MatchChCh(c1,c2) \
-    ((vars.chCur == c1) && (vars.chNext == c2))
+    ((vars->chCur == c1) && (vars->chNext == c2))
+
+extern bool LexVars_MatchStr(LexVars *vars, const char *s);
+extern bool LexVars_MatchStrAt(LexVars *vars, int i, const char *s);
+extern void LexVars_Flush(LexVars *vars);
+extern void LexVars_StyleAhead(LexVars *vars, int count, int style);
+extern int LexVars_GetCurrent(LexVars *vars, char *s, int len);
+extern bool LexVars_MatchKeyword(LexVars *vars, char *s, int len,
+    int *index);
+extern bool LexVars_IsEscaped(LexVars *vars, int offset);
+extern int LexVars_SkipClass(LexVars *vars, int mask);
+extern int LexVars_SkipTo(LexVars *vars, const char *stops);
+
+#define MatchStr(s) LexVars_MatchStr(vars, s)
+#define MatchStrAt(i,s) LexVars_MatchStrAt(vars, i, s)
+#define Flush() LexVars_Flush(vars)
+#define StyleAhead(c,s) LexVars_StyleAhead(vars, c, s)
+#define GetCurrent(s,n) LexVars_GetCurrent(vars, s, n)
+#define MatchKeyword(s,n,i) LexVars_MatchKeyword(vars, s, n, i)
+#define IsEscaped(o) LexVars_IsEscaped(vars, o)
 
-extern bool MatchStr(const char *s);
-extern bool MatchStrAt(int i, const char *s);
-extern void Flush(void);
-extern void StyleAhead(int count, int style);
-extern int GetCurrent(char *s, int len);
-extern bool MatchKeyword(char *s, int len, int *index);
-extern bool IsEscaped(int offset);
+/*
+ * Skip over a run of characters in one call rather than going around the
+ * lexer loop for each. Both stop on the last character of the run, so the
+ * loop's Forward() lands on the character that ends it, and neither moves
+ * past the end of the line. SkipClass() skips characters having any of the
+ * CC_XXX bits in "mask"; SkipTo() skips characters not in "stops", such as
+ * the body of a string or comment.
+ */
+
+#define SkipClass(m) LexVars_SkipClass(vars, m)
+#define SkipTo(s) LexVars_SkipTo(vars, s)
 
 extern void SetLineState(TkText *textPtr, TkTextLine *linePtr, int state);
 extern int GetLineState(TkText *textPtr, TkTextLine *linePtr);
 
+/*
+ * State that doesn't fit in the int of SetLineState(), such as the
+ * delimiter of a here document, can be kept with a line as a blob of
+ * bytes. SetStateExt() is called while lexing the line, PrevLineStateExt()
+ * returns what the previous line kept, or NULL. Lexing after an edit goes
+ * on until the blobs stop changing as well as the states.
+ */
+
+extern void LexVars_SetStateExt(LexVars *vars, const char *data, int size);
+extern const char *LexVars_PrevStateExt(LexVars *vars, int *sizePtr);
+
+#define SetStateExt(d,n) LexVars_SetStateExt(vars, (const char *) (d), n)
+#define PrevLineStateExt(n) LexVars_PrevStateExt(vars, n)
+
 #define GetRelative(n) \
-    SafeGetCharAt(vars.charIndex + n)
+    SafeGetCharAt(vars->charIndex + n)
 
 #define ChangeState(s) \
-    vars.style = (s)
+    vars->style = (s)
 
 #define SetStyle(s) \
     Flush(); \
-    vars.style = (s)
+    vars->style = (s)
 
 #define ForwardSetStyle(s) \
     Forward(); \
@@ -166,22 +378,25 @@ extern int GetLineState(TkText *textPtr, TkTextLine *linePtr);
     Flush();
 
 #define GetCharAt(i) \
-    vars.charBuf[i]
+    vars->charBuf[i]
 
 #define SafeGetCharAt(i) \
-    (((i) >= 0 && (i) < vars.lineLength) ? vars.charBuf[i] : ' ')
+    (((i) >= 0 && (i) < vars->lineLength) ? vars->charBuf[i] : ' ')
 
 #define ColourTo(i,s) \
-    vars.charIndex = (i) + 1; \
-    vars.style = (s); \
+    vars->charIndex = (i) + 1; \
+    vars->style = (s); \
     Flush(); \
-    vars.startIndex = (i) + 1
+    vars->startIndex = (i) + 1
+
+#define CharClass(ch) \
+    lexCharClass[(unsigned char) (ch)]
 
 #define IsASpace(ch) \
-    ((ch == ' ') || ((ch >= 0x09) && (ch <= 0x0d)))
+    (CharClass(ch) & CC_SPACE)
 
 #define IsASpaceOrTab(ch) \
-    ((ch == ' ') || (ch == '\t'))
+    (CharClass(ch) & CC_BLANK)
 
 #define IsADigit(ch) \
     ((ch >= '0') && (ch <= '9'))
@@ -191,27 +406,40 @@ extern int GetLineState(TkText *textPtr, TkTextLine *linePtr);
 #endif
 
 #define isoperator(ch) \
-    ((!isascii(ch) || !isalnum(ch)) && (strchr("%^&*()-+=|{}[]:;<>,/?!.~", ch) != NULL))
+    (CharClass(ch) & CC_OPERATOR)
 
 /**
  * Check if a character is a space.
  * This is ASCII specific but is safe with chars >= 0x80.
  */
 #define isspacechar(ch) \
-    ((ch == ' ') || ((ch >= 0x09) && (ch <= 0x0d)))
+    (CharClass(ch) & CC_SPACE)
 
 #define iswordchar(ch) \
-    (isascii(ch) && (isalnum(ch) || ch == '.' || ch == '_'))
+    (CharClass(ch) & CC_WORD)
 
 #define iswordstart(ch) \
-    (isascii(ch) && (isalnum(ch) || ch == '_'))
+    (CharClass(ch) & CC_WORDSTART)
+
+/* Identifier characters as defined by the current lexer module. */
+#define IsWordChar(ch) \
+    (vars->charClass[(unsigned char) (ch)] & CC_WORD)
+
+#define IsWordStart(ch) \
+    (vars->charClass[(unsigned char) (ch)] & CC_WORDSTART)
 
 #define InList(w,s,n) \
-    WordList_InList(w, s, n)
+    LexVars_InList(vars, w, s, n)
+
+extern bool LexVars_InList(LexVars *vars, WordList *wl, const char *s,
+    int len);
 
 extern void BeginStyling(LexerArgs *args, int firstLine, int lastLine);
 extern int FindStyleAtSOL(TkSharedText *sharedPtr, int lineIndex);
 extern int FindStyleAtEOL(TkSharedText *sharedPtr, int lineIndex);
+extern TkTextLine *FindLineAt(TkSharedText *sharedPtr, int lineIndex);
+extern Lexer *GetLexer(TkSharedText *sharedPtr);
+extern ClientData GetLexerData(Lexer *lexer);
 extern int GetFirstNonWSChar(TkTextLine *linePtr);
 
 enum { wsSpace = 1, wsTab = 2, wsSpaceTab = 4, wsInconsistent=8};
@@ -219,3 +447,162 @@ typedef bool (*PFNIsCommentLeader)(char *buf, int pos, int len);
 extern int IndentAmount(TkTextLine *linePtr, TkTextLine *linePrevPtr,
     int *flags, PFNIsCommentLeader pfnIsCommentLeader);
 
+/*
+ * Lexer plugins. A shared library loaded with "pathName lexer load" exports
+ * a LexerPlugin named "Textplus_LexerPlugin" describing one lexer module.
+ * Plugins don't link against the widget; they are compiled with
+ * USE_LEXER_STUBS defined and call the helpers above through the LexerStubs
+ * table that initProc receives, usually by storing it in lexerStubsPtr.
+ *
+ * A plugin depends only on what its LEXER_PLUGIN_VERSION promises, so it
+ * keeps working with later versions of the widget:
+ *
+ * - New entries are only ever added at the end of the stubs table, and each
+ *   addition bumps LEXER_PLUGIN_VERSION. A plugin uses the entries of its
+ *   own version, which a later table still has in the same places.
+ * - It reads LexerArgs, LexVars and LexerModule through their public views
+ *   only, which grow at the end too. LEXER_PLUGIN_SIZES records the views
+ *   it was built with, and the widget refuses one larger than its own.
+ * - Lexer, TkTextLine, TkText and TkSharedText are opaque. A plugin passes
+ *   the pointers it is given on to the helpers, reads a line with
+ *   GetLineState() and GetLineFoldLevel() and finds lines with
+ *   FindLineAt(). The BTREE_XXX macros that read those structs aren't
+ *   defined for it.
+ * - Its options live in a record of its own, of lm->size bytes, which the
+ *   widget allocates after the Lexer. The offsets in lm->optionSpecs are
+ *   into that record, and GetLexerData() returns it.
+ *
+ * plugin/LexSample.c is built this way.
+ *
+ *	typedef struct { int foo; } FooData;
+ *	static Tk_OptionSpec fooOptionSpecs[] = {
+ *	    {TK_OPTION_BOOLEAN, "-foo", NULL, NULL, "1", -1,
+ *		Tk_Offset(FooData, foo), 0, NULL, 0},
+ *	    ...
+ *	};
+ *	const LexerStubs *lexerStubsPtr;
+ *	LexerModule lmFoo = { "foo", sizeof(FooData), ..., fooOptionSpecs };
+ *	static int FooInit(Tcl_Interp *interp, const LexerStubs *stubsPtr)
+ *	{
+ *	    lexerStubsPtr = stubsPtr;
+ *	    return TCL_OK;
+ *	}
+ *	DLLEXPORT LexerPlugin Textplus_LexerPlugin = {
+ *	    LEXER_PLUGIN_VERSION, LEXER_PLUGIN_SIZES, FooInit, &lmFoo
+ *	};
+ *
+ * Plugins built before version 5 compiled in the whole of these structs,
+ * so they can't be loaded.
+ */
+
+#define LEXER_PLUGIN_VERSION 5
+#define LEXER_PLUGIN_MIN_VERSION 5
+#define LEXER_PLUGIN_SYMBOL "Textplus_LexerPlugin"
+#define LEXER_PLUGIN_SIZES \
+    LEXER_MODULE_PUBLIC_SIZE, LEXER_ARGS_PUBLIC_SIZE, LEXVARS_PUBLIC_SIZE
+
+typedef struct LexerStubs {
+    int version;		/* LEXER_PLUGIN_VERSION. */
+    const unsigned char *charClass; /* lexCharClass */
+    void (*forward)(LexVars *vars);
+    void (*back)(LexVars *vars);
+    void (*toLineStart)(LexVars *vars);
+    void (*forwardN)(LexVars *vars, int n);
+    void (*jumpToEOL)(LexVars *vars);
+    bool (*matchStr)(LexVars *vars, const char *s);
+    bool (*matchStrAt)(LexVars *vars, int i, const char *s);
+    void (*flush)(LexVars *vars);
+    void (*styleAhead)(LexVars *vars, int count, int style);
+    int (*getCurrent)(LexVars *vars, char *s, int len);
+    bool (*matchKeyword)(LexVars *vars, char *s, int len, int *index);
+    bool (*isEscaped)(LexVars *vars, int offset);
+    int (*skipClass)(LexVars *vars, int mask);
+    int (*skipTo)(LexVars *vars, const char *stops);
+    bool (*inList)(WordList *wl, const char *s, int len);
+    void (*beginStyling)(LexerArgs *args, int firstLine, int lastLine);
+    int (*findStyleAtSOL)(TkSharedText *sharedPtr, int lineIndex);
+    int (*findStyleAtEOL)(TkSharedText *sharedPtr, int lineIndex);
+    int (*getFirstNonWSChar)(TkTextLine *linePtr);
+    int (*indentAmount)(TkTextLine *linePtr, TkTextLine *linePrevPtr,
+	int *flags, PFNIsCommentLeader pfnIsCommentLeader);
+    void (*setLineState)(TkText *textPtr, TkTextLine *linePtr, int state);
+    int (*getLineState)(TkText *textPtr, TkTextLine *linePtr);
+    void (*setLineFoldLevel)(TkSharedText *sharedPtr, TkTextLine *linePtr,
+	int depth, int level);
+    TkTextLine *(*findLine)(TkTextBTree tree, const TkText *textPtr,
+	int line);
+    TkTextLine *(*nextLine)(const TkText *textPtr, TkTextLine *linePtr);
+    TkTextLine *(*previousLine)(TkText *textPtr, TkTextLine *linePtr);
+    /* Version 2. */
+    void (*setStateExt)(LexVars *vars, const char *data, int size);
+    const char *(*prevStateExt)(LexVars *vars, int *sizePtr);
+    /* Version 3. */
+    bool (*lexInList)(LexVars *vars, WordList *wl, const char *s, int len);
+    /* Version 4. */
+    TkTextLine *(*findLineAt)(TkSharedText *sharedPtr, int lineIndex);
+    Lexer *(*getLexer)(TkSharedText *sharedPtr);
+    /* Version 5. */
+    int (*getLineFoldLevel)(TkSharedText *sharedPtr, TkTextLine *linePtr);
+    ClientData (*getLexerData)(Lexer *lexer);
+} LexerStubs;
+
+typedef struct LexerPlugin {
+    int version;		/* LEXER_PLUGIN_VERSION. */
+    int moduleSize;		/* The LEXER_PLUGIN_SIZES the plugin was */
+    int argsSize;		/* compiled with. */
+    int varsSize;
+    int (*initProc)(Tcl_Interp *interp, const LexerStubs *stubsPtr);
+				/* Called each time the library is loaded,
+				 * before the module is registered. */
+    LexerModule *lm;		/* The lexer module. Its public view is
+				 * copied when it is registered, like the
+				 * built-in ones. */
+} LexerPlugin;
+
+#ifdef USE_LEXER_STUBS
+extern const LexerStubs *lexerStubsPtr;
+
+#define lexCharClass (lexerStubsPtr->charClass)
+#define LexVars_Forward (lexerStubsPtr->forward)
+#define LexVars_Back (lexerStubsPtr->back)
+#define LexVars_ToLineStart (lexerStubsPtr->toLineStart)
+#define LexVars_ForwardN (lexerStubsPtr->forwardN)
+#define LexVars_JumpToEOL (lexerStubsPtr->jumpToEOL)
+#define LexVars_MatchStr (lexerStubsPtr->matchStr)
+#define LexVars_MatchStrAt (lexerStubsPtr->matchStrAt)
+#define LexVars_Flush (lexerStubsPtr->flush)
+#define LexVars_StyleAhead (lexerStubsPtr->styleAhead)
+#define LexVars_GetCurrent (lexerStubsPtr->getCurrent)
+#define LexVars_MatchKeyword (lexerStubsPtr->matchKeyword)
+#define LexVars_IsEscaped (lexerStubsPtr->isEscaped)
+#define LexVars_SkipClass (lexerStubsPtr->skipClass)
+#define LexVars_SkipTo (lexerStubsPtr->skipTo)
+#define WordList_InList (lexerStubsPtr->inList)
+#define BeginStyling (lexerStubsPtr->beginStyling)
+#define FindStyleAtSOL (lexerStubsPtr->findStyleAtSOL)
+#define FindStyleAtEOL (lexerStubsPtr->findStyleAtEOL)
+#define GetFirstNonWSChar (lexerStubsPtr->getFirstNonWSChar)
+#define IndentAmount (lexerStubsPtr->indentAmount)
+#define SetLineState (lexerStubsPtr->setLineState)
+#define GetLineState (lexerStubsPtr->getLineState)
+#define SetLineFoldLevel (lexerStubsPtr->setLineFoldLevel)
+#undef TkBTreeFindLine
+#undef TkBTreeNextLine
+#undef TkBTreePreviousLine
+#define TkBTreeFindLine (lexerStubsPtr->findLine)
+#define TkBTreeNextLine (lexerStubsPtr->nextLine)
+#define TkBTreePreviousLine (lexerStubsPtr->previousLine)
+#define LexVars_SetStateExt (lexerStubsPtr->setStateExt)
+#define LexVars_PrevStateExt (lexerStubsPtr->prevStateExt)
+#define LexVars_InList (lexerStubsPtr->lexInList)
+#define FindLineAt (lexerStubsPtr->findLineAt)
+#define GetLexer (lexerStubsPtr->getLexer)
+#define GetLineFoldLevel (lexerStubsPtr->getLineFoldLevel)
+#define GetLexerData (lexerStubsPtr->getLexerData)
+#undef BTREE_BYTEINDEX
+#undef BTREE_NUMLINES
+#undef BTREE_LINESTO
+#undef BTREE_FINDLINE
+#undef BTREE_TEXTCHANGED
+#endif /* USE_LEXER_STUBS */
+
@@ -31,6 +31,15 @@
 #define TKINDEX_DISPLAY	1
 #define TKINDEX_ANY	2
 
+/*
+ * Moves over more than this many bytes or characters, and counts over more
+ * than this many lines, use the byte and character counts kept in the nodes
+ * of the B-tree instead of walking all the segments in between.
+ */
+
+#define SKIP_MIN_CHARS	4096
+#define SKIP_MIN_LINES	32
+
 /*
  * Forward declarations for functions defined later in this file:
  */
@@ -42,6 +51,11 @@ static CONST char *	StartEnd(TkText *textPtr, CONST char *string,
 static int		GetIndex(Tcl_Interp *interp, TkSharedText *sharedPtr,
 			    TkText *textPtr, CONST char *string,
 			    TkTextIndex *indexPtr, int *canCachePtr);
+static int		IndexCharOffset(CONST TkTextIndex *indexPtr,
+			    TkTextCountType type);
+static int		SkipLines(CONST TkText *textPtr,
+			    TkTextIndex *indexPtr, int count, int bytes,
+			    TkTextCountType type);
 
 /*
  * The "textindex" Tcl_Obj definition:
@@ -1416,6 +1430,9 @@ TkTextIndexForwBytes(
     }
 
     *dstPtr = *srcPtr;
+    if (byteCount > SKIP_MIN_CHARS) {
+	byteCount = SkipLines(textPtr, dstPtr, byteCount, 1, COUNT_INDICES);
+    }
     dstPtr->byteIndex += byteCount;
     while (1) {
 	/*
@@ -1499,6 +1516,9 @@ TkTextIndexForwChars(
     }
 
     *dstPtr = *srcPtr;
+    if (!checkElided && charCount > SKIP_MIN_CHARS) {
+	charCount = SkipLines(textPtr, dstPtr, charCount, 0, type);
+    }
 
     /*
      * Find seg that contains src byteIndex. Move forward specified number of
@@ -1672,6 +1692,18 @@ TkTextIndexCount(
     int byteOffset, maxBytes, count = 0, elide = 0;
     int checkElided = (type & COUNT_DISPLAY);
 
+    /*
+     * Far apart indices are counted from their offsets in the text, which
+     * the B-tree computes in logarithmic time.
+     */
+
+    if (!checkElided && (indexPtr1->linePtr != indexPtr2->linePtr)
+	    && (TkBTreeLinesTo(NULL, indexPtr2->linePtr)
+	    - TkBTreeLinesTo(NULL, indexPtr1->linePtr) > SKIP_MIN_LINES)) {
+	return IndexCharOffset(indexPtr2, type)
+		- IndexCharOffset(indexPtr1, type);
+    }
+
     /*
      * Find seg that contains src index, and remember how many bytes not to
      * count in the given segment.
@@ -1834,6 +1866,113 @@ TkTextIndexCount(
     return count;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * IndexCharOffset --
+ *
+ *	Compute the offset of an index from the start of the text, counting
+ *	items of the type given by "type".
+ *
+ * Results:
+ *	The number of characters (or indices, if "type" includes
+ *	COUNT_INDICES) before indexPtr in the whole text.
+ *
+ * Side effects:
+ *	None.
+ *
+ *---------------------------------------------------------------------------
+ */
+
+static int
+IndexCharOffset(
+    CONST TkTextIndex *indexPtr,/* Index whose offset is wanted. */
+    TkTextCountType type)	/* COUNT_CHARS or COUNT_INDICES. */
+{
+    TkTextIndex lineStart;
+
+    lineStart = *indexPtr;
+    lineStart.byteIndex = 0;
+    return TkBTreeCharsTo(NULL, indexPtr->linePtr, type)
+	    + TkTextIndexCount(NULL, &lineStart, indexPtr, type);
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * SkipLines --
+ *
+ *	Used by TkTextIndexForwBytes and TkTextIndexForwChars to skip the
+ *	lines before the one that holds the destination of a long move, using
+ *	the byte and character counts of the B-tree. If the destination is
+ *	past the end of the text, the index is moved to the last line so that
+ *	the caller runs into the end just as it would have without skipping.
+ *
+ * Results:
+ *	The number of bytes or characters still to move from the new index.
+ *
+ * Side effects:
+ *	*indexPtr is moved to the start of a later line, unless the index is
+ *	beyond the end of the text widget.
+ *
+ *---------------------------------------------------------------------------
+ */
+
+static int
+SkipLines(
+    CONST TkText *textPtr,	/* Overall information about text widget. */
+    TkTextIndex *indexPtr,	/* Index to move: gets modified. */
+    int count,			/* How many bytes or characters forward to
+				 * move. */
+    int bytes,			/* Non-zero means count bytes, otherwise
+				 * count items of the type given by type. */
+    TkTextCountType type)	/* COUNT_CHARS or COUNT_INDICES. */
+{
+    TkTextLine *linePtr = NULL, *lastPtr;
+    int start, offset, last;
+
+    if (bytes) {
+	start = TkBTreeBytesTo(NULL, indexPtr->linePtr) + indexPtr->byteIndex;
+    } else {
+	start = IndexCharOffset(indexPtr, type);
+    }
+    if (count < INT_MAX - start) {
+	if (bytes) {
+	    linePtr = TkBTreeFindByteLine(indexPtr->tree, NULL,
+		    start + count, &offset);
+	} else {
+	    linePtr = TkBTreeFindCharLine(indexPtr->tree, NULL,
+		    start + count, type, &offset);
+	}
+    }
+
+    if (textPtr != NULL && textPtr->end != NULL) {
+	lastPtr = textPtr->end;
+	if (linePtr != NULL && TkBTreeLinesTo(NULL, linePtr)
+		> TkBTreeLinesTo(NULL, lastPtr)) {
+	    linePtr = NULL;
+	}
+    } else {
+	lastPtr = TkBTreeFindLine(indexPtr->tree, NULL,
+		TkBTreeNumLines(indexPtr->tree, NULL));
+    }
+    if (linePtr == NULL) {
+	if (bytes) {
+	    last = TkBTreeBytesTo(NULL, lastPtr);
+	} else {
+	    last = TkBTreeCharsTo(NULL, lastPtr, type);
+	}
+	if (last < start) {
+	    return count;
+	}
+	linePtr = lastPtr;
+	offset = count - (last - start);
+    }
+    indexPtr->linePtr = linePtr;
+    indexPtr->byteIndex = 0;
+    return offset;
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -1872,6 +2011,27 @@ TkTextIndexBackBytes(
     }
 
     *dstPtr = *srcPtr;
+    if (byteCount > SKIP_MIN_CHARS) {
+	int offset, start = 0;
+
+	/*
+	 * Find the line with the B-tree.
+	 */
+
+	if (textPtr != NULL && textPtr->start != NULL) {
+	    start = TkBTreeBytesTo(NULL, textPtr->start);
+	}
+	offset = TkBTreeBytesTo(NULL, srcPtr->linePtr) + srcPtr->byteIndex
+		- byteCount;
+	if (offset < start) {
+	    dstPtr->linePtr = TkBTreeFindLine(dstPtr->tree, textPtr, 0);
+	    dstPtr->byteIndex = 0;
+	    return 1;
+	}
+	dstPtr->linePtr = TkBTreeFindByteLine(dstPtr->tree, NULL, offset,
+		&dstPtr->byteIndex);
+	return 0;
+    }
     dstPtr->byteIndex -= byteCount;
     lineIndex = -1;
     while (dstPtr->byteIndex < 0) {
@@ -1946,6 +2106,29 @@ TkTextIndexBackChars(
 	TkTextIndexForwChars(textPtr, srcPtr, -charCount, dstPtr, type);
 	return;
     }
+    if (!checkElided && charCount > SKIP_MIN_CHARS) {
+	int offset, start = 0;
+
+	/*
+	 * Find the line with the B-tree, then move forward to the character
+	 * within it.
+	 */
+
+	if (textPtr != NULL && textPtr->start != NULL) {
+	    start = TkBTreeCharsTo(NULL, textPtr->start, type);
+	}
+	offset = IndexCharOffset(srcPtr, type) - charCount;
+	*dstPtr = *srcPtr;
+	dstPtr->byteIndex = 0;
+	if (offset < start) {
+	    dstPtr->linePtr = TkBTreeFindLine(dstPtr->tree, textPtr, 0);
+	    return;
+	}
+	dstPtr->linePtr = TkBTreeFindCharLine(dstPtr->tree, NULL, offset,
+		type, &offset);
+	TkTextIndexForwChars(textPtr, dstPtr, offset, dstPtr, type);
+	return;
+    }
     if (checkElided) {
 	infoPtr = (TkTextElideInfo *) ckalloc(sizeof(TkTextElideInfo));
 	elide = TkTextIsElided(textPtr, srcPtr, infoPtr);
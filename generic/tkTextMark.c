@@ -16,13 +16,6 @@
 #include "tkInt.h"
 #include "tkText.h"
 
-/*
- * Macro that determines the size of a mark segment:
- */
-
-#define MSEG_SIZE ((unsigned) (Tk_Offset(TkTextSegment, body) \
-	+ sizeof(TkTextMark)))
-
 /*
  * Forward references for functions defined in this file:
  */
@@ -227,7 +220,8 @@ TkTextMarkCmd(
 		}
 		TkBTreeUnlinkSegment(markPtr, markPtr->body.mark.linePtr);
 		Tcl_DeleteHashEntry(hPtr);
-		ckfree((char *) markPtr);
+		TkBTreeFreeSegment(textPtr->sharedTextPtr->tree, markPtr,
+			MSEG_SIZE);
 	    }
 	}
 	break;
@@ -306,7 +300,8 @@ TkTextSetMark(
 	}
 	TkBTreeUnlinkSegment(markPtr, markPtr->body.mark.linePtr);
     } else {
-	markPtr = (TkTextSegment *) ckalloc(MSEG_SIZE);
+	markPtr = TkBTreeAllocSegment(textPtr->sharedTextPtr->tree,
+		MSEG_SIZE);
 	markPtr->typePtr = &tkTextRightMarkType;
 	markPtr->size = 0;
 	markPtr->body.mark.textPtr = textPtr;
@@ -163,13 +163,8 @@ snit::widget Editor {
     $self setFileName $fileName
     $self configure -undo no
     $self configure -startline {} -endline {}
-    $self delete 1.0 end
+    $self load -file $fileName
     $self edit reset
-    set chan [ open $fileName ]
-    while { ![ eof $chan ] } {
-      $self insert end [read $chan 100000]
-    }
-    close $chan
 
     $self configure -undo yes
 
@@ -0,0 +1,134 @@
+/*
+ * LexSample.c --
+ *
+ * Lexer for unified diffs, built as a lexer plugin. It is an example of
+ * the recipe at the end of tkTextHighlight.h: it is compiled with
+ * USE_LEXER_STUBS, doesn't link against the widget, and reaches the
+ * helpers only through the LexerStubs table. Load it with
+ *
+ *	.t lexer load /path/to/libLexSample.so
+ *	.t lexer set diff
+ *
+ * RCS: @(#) $Id$
+ */
+
+#include "tkText.h"
+#include "tkTextHighlight.h"
+
+#define SCE_DIFF_DEFAULT 0
+#define SCE_DIFF_HEADER 1
+#define SCE_DIFF_POSITION 2
+#define SCE_DIFF_DELETED 3
+#define SCE_DIFF_ADDED 4
+
+static CONST char *styleNames[] = {
+    "default", "header", "position", "deleted", "added", NULL
+};
+
+/* Line state: the line is inside a hunk. */
+#define LS_HUNK 0x1
+
+/*
+ * The options of the lexer. The widget keeps this record with the lexer,
+ * and GetLexerData() returns it.
+ */
+
+typedef struct DiffData {
+    int foldHunks;		/* -foldhunks: whether hunks fold. */
+} DiffData;
+
+static Tk_OptionSpec diffOptionSpecs[] = {
+    {TK_OPTION_BOOLEAN, "-foldhunks", (char *) NULL, (char *) NULL,
+	"1", -1, Tk_Offset(DiffData, foldHunks), 0, NULL, 0},
+    {TK_OPTION_END, (char *) NULL, (char *) NULL, (char *) NULL,
+	(char *) NULL, 0, 0, 0, 0}
+};
+
+const LexerStubs *lexerStubsPtr;
+
+static int ColouriseDiffDoc(LexerArgs *args)
+{
+    LexVars *vars = args->vars;
+    int state;
+
+    BeginStyling(args, args->firstLine, args->lastLine);
+
+    for (; More(); Forward()) {
+	if (!vars->atLineStart)
+	    continue;
+
+	state = PrevLineState() & LS_HUNK;
+	if (MatchStr("diff ") || MatchStr("--- ") || MatchStr("+++ ")) {
+	    if (MatchStr("diff "))
+		state = 0;
+	    SetStyle(SCE_DIFF_HEADER);
+	} else if (MatchStr("@@")) {
+	    state = LS_HUNK;
+	    SetStyle(SCE_DIFF_POSITION);
+	} else if (state && MatchCh('-')) {
+	    SetStyle(SCE_DIFF_DELETED);
+	} else if (state && MatchCh('+')) {
+	    SetStyle(SCE_DIFF_ADDED);
+	} else {
+	    SetStyle(SCE_DIFF_DEFAULT);
+	}
+	SetLineState(NULL, vars->linePtr, state);
+	JumpToEOL();
+    }
+    return 0;
+}
+
+/*
+ * Each hunk folds up under its "@@" line.
+ */
+
+static int FoldDiffDoc(LexerArgs *args)
+{
+    LexVars *vars = args->vars;
+    DiffData *data = (DiffData *) GetLexerData(args->lexer);
+
+    BeginStyling(args, args->firstLine, args->lastLine);
+
+    for (; More(); Forward()) {
+	if (!vars->atLineStart)
+	    continue;
+
+	if (!data->foldHunks) {
+	    SetLineFoldLevel(vars->sharedPtr, vars->linePtr,
+		    SC_FOLDLEVELBASE, 0);
+	} else if (MatchStr("@@")) {
+	    SetLineFoldLevel(vars->sharedPtr, vars->linePtr,
+		    SC_FOLDLEVELBASE, SC_FOLDLEVELHEADERFLAG);
+	} else if (GetLineState(NULL, vars->linePtr) & LS_HUNK) {
+	    SetLineFoldLevel(vars->sharedPtr, vars->linePtr,
+		    SC_FOLDLEVELBASE + 1, 0);
+	} else {
+	    SetLineFoldLevel(vars->sharedPtr, vars->linePtr,
+		    SC_FOLDLEVELBASE, 0);
+	}
+	JumpToEOL();
+    }
+    return 0;
+}
+
+static LexerModule lmDiff = {
+    "diff",
+    sizeof(DiffData),
+    styleNames,
+    ColouriseDiffDoc,
+    FoldDiffDoc,
+    diffOptionSpecs
+};
+
+static int
+DiffInit(
+    Tcl_Interp *interp,
+    const LexerStubs *stubsPtr)
+{
+    lexerStubsPtr = stubsPtr;
+    return TCL_OK;
+}
+
+DLLEXPORT LexerPlugin Textplus_LexerPlugin = {
+    LEXER_PLUGIN_VERSION, LEXER_PLUGIN_SIZES, DiffInit, &lmDiff
+};